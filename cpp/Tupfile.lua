@@ -102,6 +102,10 @@ pkg = get_fibre_package({
     enable_client=true,
     enable_tcp_server_backend=get_bool_config("ENABLE_TCP_SERVER_BACKEND", enable_tcp),
     enable_tcp_client_backend=get_bool_config("ENABLE_TCP_CLIENT_BACKEND", enable_tcp),
+    enable_unix_server_backend=get_bool_config("ENABLE_UNIX_SERVER_BACKEND", enable_tcp),
+    enable_unix_client_backend=get_bool_config("ENABLE_UNIX_CLIENT_BACKEND", enable_tcp),
+    enable_udp_server_backend=get_bool_config("ENABLE_UDP_SERVER_BACKEND", enable_tcp),
+    enable_udp_client_backend=get_bool_config("ENABLE_UDP_CLIENT_BACKEND", enable_tcp),
     enable_libusb_backend=get_bool_config("ENABLE_LIBUSB_BACKEND", true),
     enable_socket_can_backend=get_bool_config("ENABLE_SOCKETCAN_BACKEND", true),
     allow_heap=true,
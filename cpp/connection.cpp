@@ -436,6 +436,16 @@ void Connection::close_tx_slot(FrameStreamSink* sink) {
     }
 }
 
+bool Connection::reopen_tx_slot(FrameStreamSink* sink, Node* node) {
+    if (output_slots_.find(sink) == output_slots_.end()) {
+        return true;
+    }
+    close_tx_slot(sink);
+    // The acks that went out through the old slot may be lost as well
+    send_ack_ = true;
+    return open_tx_slot(sink, node);
+}
+
 void Connection::handle_rx_not_empty() {
     if (rx_busy_) {
         // The connection handler is already busy handling data and will
@@ -558,3 +568,80 @@ WriteArgs Connection::rx_done(WriteResult result) {
     // handle_rx_not_full(); TODO: unblock reception after buffer was full
     return args;
 }
+
+void CallContext::reset_at(Domain* domain, uint8_t layer) {
+    if (layer <= 1) {
+        routing_info_offset = 0;
+    }
+    if (layer <= 0) {
+        domain->close_call(handler);
+        handler = nullptr;
+    }
+}
+
+bool CallContext::process_packet(Domain* domain, FrameStreamSink* return_path, Node* node, cbufptr_t packet) {
+    Chunk chunks[32];
+    BufChainBuilder builder{chunks};
+    write_iterator write_it{builder};
+
+    uint8_t reset_layer = 0;
+    if (!LowLevelProtocol::unpack(state, packet, &reset_layer, write_it)) {
+        return false;
+    }
+
+    BufChain chain = builder;
+
+    if (reset_layer != 0xff) {
+        reset_at(domain, reset_layer);
+    }
+
+    while (chain.n_chunks()) {
+        Chunk chunk = chain.front();
+
+        if (chunk.layer() <= 1 && chunk.is_frame_boundary()) {
+            reset_at(domain, chunk.layer());
+            chain = chain.skip_chunks(1);
+        } else if (chunk.layer() == 0) {
+            // ignore data on layer0
+            chain = chain.skip_chunks(1);
+        } else if (chunk.layer() == 1) {
+            // data on layer 1
+            size_t n_copy =
+                std::min(chunk.buf().size(), sizeof(routing_info) -
+                                                 routing_info_offset);
+            std::copy_n(chunk.buf().begin(), n_copy,
+                        routing_info + routing_info_offset);
+            routing_info_offset += n_copy;
+
+            if (routing_info_offset >= 1) {
+                if (routing_info[0] == 0x00 ||
+                    routing_info[0] == 0x01) {  // call ID for local call stream
+                    if (routing_info_offset >= 17) {
+                        std::array<uint8_t, 16> call_id;
+                        std::copy_n(routing_info + 1, 16, call_id.begin());
+                        domain->open_call(call_id, routing_info[0],
+                                          return_path, node,
+                                          &handler);  // TODO: log error
+                    }
+                }
+            }
+            chain = chain.skip_chunks(1);
+
+        } else {
+            // Handle data addressed to top level protocol
+            auto payload_end = chain.find_chunk_on_layer(1);
+
+            if (handler) {
+                handler->process_sync(chain.until(payload_end.chunk).elevate(-2));
+            } else {
+                // discard data because we don't know what handler to
+                // send it to
+                // TODO: log
+            }
+
+            chain = chain.from(payload_end);
+        }
+    }
+
+    return true;
+}
@@ -1,17 +1,26 @@
 #ifndef __CRC_HPP
 #define __CRC_HPP
 
+#include <fibre/config.hpp>
 #include <stdint.h>
 #include <stdlib.h>
 #include <limits.h>
 
+#if FIBRE_CRC_TABLE_SLICES
+#include <fibre/cpp_utils.hpp>
+#endif
+
+#if FIBRE_CRC_TABLE_SLICES != 0 && FIBRE_CRC_TABLE_SLICES != 1 && FIBRE_CRC_TABLE_SLICES != 4 && FIBRE_CRC_TABLE_SLICES != 8
+#error "FIBRE_CRC_TABLE_SLICES must be 0, 1, 4 or 8"
+#endif
+
 // Calculates an arbitrary CRC for one byte.
 // Adapted from https://barrgroup.com/Embedded-Systems/How-To/CRC-Calculation-C-Code
 template<typename T, unsigned POLYNOMIAL>
-static T calc_crc(T remainder, uint8_t value) {
+static T calc_crc_bitwise(T remainder, uint8_t value) {
     constexpr T BIT_WIDTH = (CHAR_BIT * sizeof(T));
     constexpr T TOPBIT = ((T)1 << (BIT_WIDTH - 1));
-    
+
     // Bring the next byte into the remainder.
     remainder ^= (value << (BIT_WIDTH - 8));
 
@@ -27,13 +36,109 @@ static T calc_crc(T remainder, uint8_t value) {
     return remainder;
 }
 
+#if FIBRE_CRC_TABLE_SLICES
+
+// Same as calc_crc_bitwise() but evaluated at compile time. Shifts `n_bits`
+// zero bits through the remainder.
+template<typename T, unsigned POLYNOMIAL>
+constexpr T crc_shift_zero_bits(T remainder, unsigned n_bits) {
+    return !n_bits ? remainder : crc_shift_zero_bits<T, POLYNOMIAL>(
+        (remainder & ((T)1 << (CHAR_BIT * sizeof(T) - 1)))
+            ? (T)((remainder << 1) ^ POLYNOMIAL)
+            : (T)(remainder << 1),
+        n_bits - 1);
+}
+
+/**
+ * @brief Compile-time generated CRC lookup tables.
+ *
+ * Table k (k = 0 ... N_SLICES-1) holds the CRC (with zero initial remainder)
+ * of each possible byte value followed by k zero bytes. Table 0 is the classic
+ * byte-wise lookup table. The others are used to process N_SLICES bytes per
+ * step ("slice-by-N").
+ */
+template<typename T, unsigned POLYNOMIAL, size_t N_SLICES>
+struct CrcTable {
+    static constexpr T entry(size_t i) {
+        return crc_shift_zero_bits<T, POLYNOMIAL>((T)((i % 256) << (CHAR_BIT * sizeof(T) - 8)), 8 * (i / 256 + 1));
+    }
+
+    template<size_t ... Is>
+    struct Values {
+        static constexpr T values[sizeof...(Is)] = {entry(Is)...};
+    };
+
+    template<size_t ... Is>
+    static constexpr const T* get(std::index_sequence<Is...>) {
+        return Values<Is...>::values;
+    }
+
+    static const T* table() {
+        return get(std::make_index_sequence<256 * N_SLICES>());
+    }
+};
+
+template<typename T, unsigned POLYNOMIAL, size_t N_SLICES>
+template<size_t ... Is>
+constexpr T CrcTable<T, POLYNOMIAL, N_SLICES>::Values<Is...>::values[sizeof...(Is)];
+
+template<typename T, unsigned POLYNOMIAL>
+static T calc_crc_table(const T* table, T remainder, uint8_t value) {
+    constexpr T BIT_WIDTH = (CHAR_BIT * sizeof(T));
+    return (T)((remainder << 8) ^ table[((remainder >> (BIT_WIDTH - 8)) ^ value) & 0xff]);
+}
+
+#endif
+
+template<typename T, unsigned POLYNOMIAL>
+static T calc_crc(T remainder, uint8_t value) {
+#if FIBRE_CRC_TABLE_SLICES
+    return calc_crc_table<T, POLYNOMIAL>(CrcTable<T, POLYNOMIAL, 1>::table(), remainder, value);
+#else
+    return calc_crc_bitwise<T, POLYNOMIAL>(remainder, value);
+#endif
+}
+
 template<typename T, unsigned POLYNOMIAL>
 static T calc_crc(T remainder, const uint8_t* buffer, size_t length) {
+#if FIBRE_CRC_TABLE_SLICES
+    const T* table = CrcTable<T, POLYNOMIAL, 1>::table();
+    while (length--)
+        remainder = calc_crc_table<T, POLYNOMIAL>(table, remainder, *(buffer++));
+#else
+    while (length--)
+        remainder = calc_crc_bitwise<T, POLYNOMIAL>(remainder, *(buffer++));
+#endif
+    return remainder;
+}
+
+#if FIBRE_CRC_TABLE_SLICES > 1
+
+// Slice-by-N for 16-bit CRCs: The remainder is XORed into the first two
+// bytes of each N-byte block and the block is then reduced with one table
+// lookup per byte.
+template<unsigned POLYNOMIAL, size_t N_SLICES>
+static uint16_t calc_crc16_sliced(uint16_t remainder, const uint8_t* buffer, size_t length) {
+    const uint16_t* table = CrcTable<uint16_t, POLYNOMIAL, N_SLICES>::table();
+
+    while (length >= N_SLICES) {
+        uint16_t result = table[256 * (N_SLICES - 1) + (((remainder >> 8) ^ buffer[0]) & 0xff)]
+                        ^ table[256 * (N_SLICES - 2) + ((remainder ^ buffer[1]) & 0xff)];
+        for (size_t i = 2; i < N_SLICES; ++i) {
+            result ^= table[256 * (N_SLICES - 1 - i) + buffer[i]];
+        }
+        remainder = result;
+        buffer += N_SLICES;
+        length -= N_SLICES;
+    }
+
     while (length--)
-        remainder = calc_crc<T, POLYNOMIAL>(remainder, *(buffer++));
+        remainder = calc_crc_table<uint16_t, POLYNOMIAL>(table, remainder, *(buffer++));
     return remainder;
 }
 
+#endif
+
 template<unsigned POLYNOMIAL>
 static uint8_t calc_crc8(uint8_t remainder, uint8_t value) {
     return calc_crc<uint8_t, POLYNOMIAL>(remainder, value);
@@ -51,7 +156,11 @@ static uint8_t calc_crc8(uint8_t remainder, const uint8_t* buffer, size_t length
 
 template<unsigned POLYNOMIAL>
 static uint16_t calc_crc16(uint16_t remainder, const uint8_t* buffer, size_t length) {
+#if FIBRE_CRC_TABLE_SLICES > 1
+    return calc_crc16_sliced<POLYNOMIAL, FIBRE_CRC_TABLE_SLICES>(remainder, buffer, length);
+#else
     return calc_crc<uint16_t, POLYNOMIAL>(remainder, buffer, length);
+#endif
 }
 
 #endif /* __CRC_HPP */
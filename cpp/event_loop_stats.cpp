@@ -0,0 +1,193 @@
+#include <fibre/event_loop_stats.hpp>
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+
+#include "print_utils.hpp"
+#include <algorithm>
+#include <vector>
+#include <errno.h>
+#include <link.h>
+#include <time.h>
+
+using namespace fibre;
+
+void Histogram::merge(const Histogram& other) {
+    for (unsigned i = 0; i < kBuckets; ++i) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+uint64_t Histogram::percentile(double fraction) const {
+    uint64_t target = (uint64_t)(fraction * (double)count_ + 0.999999);
+    target = std::max(target, (uint64_t)1);
+
+    uint64_t total = 0;
+    for (unsigned i = 0; i < kBuckets; ++i) {
+        total += counts_[i];
+        if (total >= target) {
+            return std::min(highest_value(i), max_);
+        }
+    }
+    return max_;
+}
+
+uint64_t Histogram::highest_value(unsigned index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+    unsigned msb = index / kSubBuckets + kSubBucketBits - 1;
+    uint64_t width = 1ULL << (msb - kSubBucketBits);
+    return (uint64_t)(kSubBuckets + index % kSubBuckets) * width + width - 1;
+}
+
+uint64_t EventLoopStats::now_ns() {
+    // Same clock as the event loops use for their timers
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void EventLoopStats::reset(uint64_t now_ns) {
+    *this = {};
+    since_ns = now_ns;
+}
+
+void EventLoopStats::merge(const EventLoopStats& other) {
+    wait_ns += other.wait_ns;
+    n_wakeups += other.n_wakeups;
+    callback_time.merge(other.callback_time);
+    dispatch_lag.merge(other.dispatch_lag);
+    post_lag.merge(other.post_lag);
+    timer_lateness.merge(other.timer_lateness);
+    events_per_wakeup.merge(other.events_per_wakeup);
+    for (auto& it: other.callback_time_by_site) {
+        callback_time_by_site[it.first].merge(it.second);
+    }
+}
+
+struct PhdrSearch {
+    uintptr_t site;
+    const char* module;
+    uintptr_t offset;
+};
+
+static int find_module(struct dl_phdr_info* info, size_t, void* ctx) {
+    PhdrSearch* search = (PhdrSearch*)ctx;
+    for (size_t i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        if (phdr->p_type == PT_LOAD && search->site >= start && search->site < start + phdr->p_memsz) {
+            // The main program has an empty name
+            search->module = info->dlpi_name[0] ? info->dlpi_name : program_invocation_name;
+            search->offset = search->site - info->dlpi_addr;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool EventLoopStats::resolve_site(uintptr_t site, const char** module, uintptr_t* offset) {
+    PhdrSearch search = {site, nullptr, 0};
+    if (!dl_iterate_phdr(find_module, &search)) {
+        return false;
+    }
+    if (module) {
+        *module = search.module;
+    }
+    if (offset) {
+        *offset = search.offset;
+    }
+    return true;
+}
+
+#if FIBRE_ENABLE_TEXT_LOGGING
+
+namespace {
+
+struct Duration {
+    uint64_t ns;
+};
+
+struct HistogramSummary {
+    const Histogram* histogram;
+    bool is_duration;
+};
+
+HistogramSummary durations(const Histogram& histogram) { return {&histogram, true}; }
+HistogramSummary values(const Histogram& histogram) { return {&histogram, false}; }
+
+std::ostream& operator<<(std::ostream& stream, Duration d) {
+    if (d.ns < 10000ULL) {
+        return stream << d.ns << "ns";
+    } else if (d.ns < 10000000ULL) {
+        return stream << (d.ns / 1000ULL) << "us";
+    } else if (d.ns < 10000000000ULL) {
+        return stream << (d.ns / 1000000ULL) << "ms";
+    } else {
+        return stream << (d.ns / 1000000000ULL) << "s";
+    }
+}
+
+std::ostream& operator<<(std::ostream& stream, HistogramSummary s) {
+    const Histogram& h = *s.histogram;
+    uint64_t values[] = {h.mean(), h.percentile(0.5), h.percentile(0.99), h.percentile(0.999), h.max()};
+    const char* names[] = {"mean", "p50", "p99", "p99.9", "max"};
+
+    stream << "n=" << h.count();
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        stream << " " << names[i] << "=";
+        if (s.is_duration) {
+            stream << Duration{values[i]};
+        } else {
+            stream << values[i];
+        }
+    }
+    return stream;
+}
+
+}
+
+#endif
+
+void EventLoopStats::dump(Logger logger, uint64_t now_ns) const {
+    static const size_t kMaxSites = 10;
+
+    uint64_t period_ns = now_ns - since_ns;
+    unsigned busy_permille = period_ns ? (unsigned)(1000 - std::min(wait_ns, period_ns) * 1000 / period_ns) : 0;
+
+    F_LOG_D(logger, "event loop stats over " << Duration{period_ns} << ": "
+            << busy_permille / 10 << "." << busy_permille % 10 << "% busy, "
+            << n_wakeups << " wakeups");
+    F_LOG_D(logger, "  callback time:     " << durations(callback_time));
+    F_LOG_D(logger, "  dispatch lag:      " << durations(dispatch_lag));
+    F_LOG_D(logger, "  post lag:          " << durations(post_lag));
+    F_LOG_D(logger, "  timer lateness:    " << durations(timer_lateness));
+    F_LOG_D(logger, "  events per wakeup: " << values(events_per_wakeup));
+
+    // Sites that took the most time in total first
+    std::vector<std::pair<uintptr_t, const Histogram*>> sites;
+    for (auto& it: callback_time_by_site) {
+        sites.push_back({it.first, &it.second});
+    }
+    std::sort(sites.begin(), sites.end(), [](const std::pair<uintptr_t, const Histogram*>& a, const std::pair<uintptr_t, const Histogram*>& b) {
+        return a.second->sum() > b.second->sum();
+    });
+
+    for (size_t i = 0; i < std::min(sites.size(), kMaxSites); ++i) {
+        const char* module = nullptr;
+        uintptr_t offset = 0;
+        if (resolve_site(sites[i].first, &module, &offset)) {
+            F_LOG_D(logger, "  callback " << module << "+" << as_hex(offset) << ": total="
+                    << Duration{sites[i].second->sum()} << " " << durations(*sites[i].second));
+        } else {
+            F_LOG_D(logger, "  callback " << as_hex(sites[i].first) << ": total="
+                    << Duration{sites[i].second->sum()} << " " << durations(*sites[i].second));
+        }
+    }
+}
+
+#endif
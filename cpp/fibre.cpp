@@ -3,6 +3,7 @@
 #include <fibre/channel_discoverer.hpp>
 #include <fibre/cpp_utils.hpp>
 #include "legacy_protocol.hpp"
+#include "stream_adapter.hpp"
 #include "print_utils.hpp"
 #include <memory>
 #include <algorithm>
@@ -22,6 +23,9 @@
 #  ifdef __linux__
 #    include "platform_support/epoll_event_loop.hpp"
 using EventLoopImpl = fibre::EpollEventLoop;
+#    if FIBRE_ENABLE_IO_URING
+#      include "platform_support/io_uring_event_loop.hpp"
+#    endif
 #  else
 #    error "No event loop implementation available for this operating system."
 #  endif
@@ -39,6 +43,14 @@ using EventLoopImpl = fibre::EpollEventLoop;
 #include "platform_support/posix_tcp_backend.hpp"
 #endif
 
+#if FIBRE_ENABLE_UNIX_CLIENT_BACKEND || FIBRE_ENABLE_UNIX_SERVER_BACKEND
+#include "platform_support/posix_unix_backend.hpp"
+#endif
+
+#if FIBRE_ENABLE_UDP_CLIENT_BACKEND || FIBRE_ENABLE_UDP_SERVER_BACKEND
+#include "platform_support/posix_udp_backend.hpp"
+#endif
+
 #if FIBRE_ENABLE_SOCKET_CAN_BACKEND
 #include "platform_support/socket_can.hpp"
 #endif
@@ -92,9 +104,29 @@ RichStatus my_free(T* ctx) {
 #endif
 
 RichStatus fibre::launch_event_loop(Logger logger, Callback<void, EventLoop*> on_started) {
+    return launch_event_loop(logger, on_started, BusyPollConfig{});
+}
+
+RichStatus fibre::launch_event_loop(Logger logger, Callback<void, EventLoop*> on_started, const BusyPollConfig& busy_poll) {
 #if FIBRE_ENABLE_EVENT_LOOP
-    EventLoopImpl* event_loop = my_alloc<EventLoopImpl>(); // TODO: free
-    return event_loop->start(logger, [&](){ on_started.invoke(event_loop); });
+#if FIBRE_ENABLE_IO_URING
+    if (!busy_poll.is_enabled() && IoUringEventLoop::is_supported()) {
+        IoUringEventLoop* event_loop = my_alloc<IoUringEventLoop>();
+        F_RET_IF(!event_loop, "already have an event loop");
+        RichStatus status = event_loop->start(logger, [&](){ on_started.invoke(event_loop); });
+        F_LOG_IF_ERR(logger, my_free(event_loop), "failed to free event loop");
+        return status;
+    }
+    F_LOG_D(logger, "io_uring not available or busy polling requested, using epoll");
+#endif
+    EventLoopImpl* event_loop = my_alloc<EventLoopImpl>();
+    F_RET_IF(!event_loop, "already have an event loop");
+    RichStatus status = event_loop->set_busy_poll(busy_poll);
+    if (status.is_success()) {
+        status = event_loop->start(logger, [&](){ on_started.invoke(event_loop); });
+    }
+    F_LOG_IF_ERR(logger, my_free(event_loop), "failed to free event loop");
+    return status;
 #else
     return F_MAKE_ERR("event loop support not enabled");
 #endif
@@ -128,6 +160,36 @@ RichStatus fibre::open(EventLoop* event_loop, Logger logger, Fibre** p_ctx) {
         status = ctx->init_backend("tcp-server", new PosixTcpServerBackend{});
     }
 #endif
+#if FIBRE_ENABLE_UNIX_CLIENT_BACKEND
+    if (status.is_success()) {
+        status = ctx->init_backend("unix-client", new PosixUnixClientBackend{});
+    }
+#endif
+#if FIBRE_ENABLE_UNIX_SERVER_BACKEND
+    if (status.is_success()) {
+        status = ctx->init_backend("unix-server", new PosixUnixServerBackend{});
+    }
+#endif
+#if FIBRE_ENABLE_UNIX_CLIENT_BACKEND && FIBRE_ENABLE_SHM_TRANSPORT
+    if (status.is_success()) {
+        status = ctx->init_backend("shm-client", new PosixUnixClientBackend{true});
+    }
+#endif
+#if FIBRE_ENABLE_UNIX_SERVER_BACKEND && FIBRE_ENABLE_SHM_TRANSPORT
+    if (status.is_success()) {
+        status = ctx->init_backend("shm-server", new PosixUnixServerBackend{true});
+    }
+#endif
+#if FIBRE_ENABLE_UDP_CLIENT_BACKEND
+    if (status.is_success()) {
+        status = ctx->init_backend("udp-client", new PosixUdpClientBackend{});
+    }
+#endif
+#if FIBRE_ENABLE_UDP_SERVER_BACKEND
+    if (status.is_success()) {
+        status = ctx->init_backend("udp-server", new PosixUdpServerBackend{});
+    }
+#endif
 #if FIBRE_ENABLE_SOCKET_CAN_BACKEND
     if (status.is_success()) {
         status = ctx->init_backend("can", new SocketCanBackend{});
@@ -342,6 +404,29 @@ void Domain::add_legacy_channels(ChannelDiscoveryResult result, const char* name
 #endif
 }
 
+#if FIBRE_ENABLE_STREAM_ADAPTER
+void Domain::add_channels(ChannelDiscoveryResult result, const char* name, Callback<void, StreamStatus> on_closed) {
+    if (result.status != kFibreOk) {
+        F_LOG_E(ctx->logger, "discoverer stopped");
+        return;
+    }
+
+    if (!result.rx_channel || !result.tx_channel) {
+        F_LOG_E(ctx->logger, "unidirectional operation not supported yet");
+        return;
+    }
+
+    if (result.mtu < 64) {
+        F_LOG_E(ctx->logger, "MTU too small");
+        return;
+    }
+
+    // Deleted during on_stopped_native()
+    auto adapter = new StreamAdapter(this, result.rx_channel, result.tx_channel, result.packetized, result.mtu, name);
+    adapter->on_closed = on_closed;
+    adapter->start(MEMBER_CB(this, on_stopped_native));
+}
+#endif
 
 void Domain::on_found_node(const NodeId& node_id, FrameStreamSink* sink, const char* intf_name, Node** p_node) {
     Node* node;
@@ -374,7 +459,17 @@ void Domain::on_found_node(const NodeId& node_id, FrameStreamSink* sink, const c
 #if FIBRE_ENABLE_CLIENT != F_RUNTIME_CONFIG
     bool enable_client = true;
 #endif
-    if (enable_client) {
+    if (enable_client && node->client_connection) {
+        // The node was connected before (possibly through another sink).
+        // Resume the existing connection rather than starting a new one. The
+        // position header of the new output slot lets the node skip what it
+        // already received and everything that the node didn't acknowledge
+        // yet is sent again.
+        F_LOG_D(ctx->logger, "resuming connection to node");
+        if (!node->client_connection->open_tx_slot(sink, node)) {
+            F_LOG_W(ctx->logger, "cannot connect connection with sink (either of the two out of memory)");
+        }
+    } else if (enable_client) {
         *p_node = node;
 
         F_LOG_D(ctx->logger, "connecting to node");
@@ -384,9 +479,10 @@ void Domain::on_found_node(const NodeId& node_id, FrameStreamSink* sink, const c
         std::array<uint8_t, 16> tx_call_id = call_id;
         tx_call_id[15] ^= 1;
         EndpointClientConnection* conn = client_connections.alloc(call_id, this, tx_call_id); // TODO: free
+        node->client_connection = conn;
 
         auto client = new LegacyObjectClient{}; // TODO: free
-        client->start(node, this, MEMBER_CB(conn, start_call), intf_name);
+        client->start(node, this, nullptr, MEMBER_CB(conn, start_call), intf_name);
         if (!conn->open_tx_slot(sink, node)) {
             F_LOG_W(ctx->logger, "cannot connect connection with sink (either of the two out of memory)");
         }
@@ -398,6 +494,17 @@ void Domain::on_found_node(const NodeId& node_id, FrameStreamSink* sink, const c
 }
 
 void Domain::on_lost_node(Node* node, FrameStreamSink* sink) {
+    auto it = std::find(node->sinks.begin(), node->sinks.end(), sink);
+    if (it != node->sinks.end()) {
+        node->sinks.free(&*it);
+    }
+
+#if FIBRE_ENABLE_SERVER
+    for (auto& conn: server_connections) {
+        conn.second.close_tx_slot(sink);
+    }
+#endif
+
 #if FIBRE_ENABLE_CLIENT
 #if FIBRE_ENABLE_CLIENT != F_RUNTIME_CONFIG
     bool enable_client = true;
@@ -411,6 +518,25 @@ void Domain::on_lost_node(Node* node, FrameStreamSink* sink) {
 #endif
 }
 
+void Domain::resync_node(Node* node, FrameStreamSink* sink) {
+#if FIBRE_ENABLE_SERVER
+    for (auto& conn: server_connections) {
+        F_LOG_IF(ctx->logger, !conn.second.reopen_tx_slot(sink, node), "failed to reopen output slot");
+    }
+#endif
+
+#if FIBRE_ENABLE_CLIENT
+#if FIBRE_ENABLE_CLIENT != F_RUNTIME_CONFIG
+    bool enable_client = true;
+#endif
+    if (enable_client) {
+        for (auto& conn: client_connections) {
+            F_LOG_IF(ctx->logger, !conn.second.reopen_tx_slot(sink, node), "failed to reopen output slot");
+        }
+    }
+#endif
+}
+
 #if FIBRE_ENABLE_CLIENT
 void Domain::on_found_root_object(Object* obj, Interface* intf, std::string path) {
     root_objects_[obj] = {intf, path};
@@ -433,6 +559,14 @@ void Domain::on_stopped_s(LegacyProtocolPacketBased* protocol, StreamStatus stat
     delete (LegacyProtocolStreamBased*)((uintptr_t)protocol - offset);
 }
 
+#if FIBRE_ENABLE_STREAM_ADAPTER
+void Domain::on_stopped_native(StreamAdapter* adapter, StreamStatus status) {
+    Callback<void, StreamStatus> on_closed = adapter->on_closed;
+    delete adapter;
+    on_closed.invoke(status);
+}
+#endif
+
 #if FIBRE_ENABLE_SERVER
 const Function* Domain::get_server_function(ServerFunctionId id) {
     if (id < n_static_server_functions) {
@@ -492,6 +626,10 @@ void Domain::open_call(const std::array<uint8_t, 16>& call_id, uint8_t protocol,
 }
 
 void Domain::close_call(ConnectionInputSlot* slot) {
-    // TODO
+    // The connection itself stays open so that the call can be resumed on
+    // another input slot (e.g. after a reconnect).
+    if (slot) {
+        slot->conn_.close_rx_slot(slot);
+    }
 }
 
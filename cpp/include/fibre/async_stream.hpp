@@ -29,6 +29,18 @@ struct ReadResult {
     unsigned char* end;
 };
 
+struct ReadvResult {
+    StreamStatus status;
+
+    /**
+     * @brief The total number of bytes that were transferred, counted across
+     * all buffers of the transfer.
+     * If the status is kStreamError or kStreamCancelled then the accuracy
+     * of this field is not guaranteed.
+     */
+    size_t n_bytes;
+};
+
 struct WriteResult0 {
     StreamStatus status;
 
@@ -43,6 +55,18 @@ struct WriteResult0 {
     const unsigned char* end;
 };
 
+struct WritevResult {
+    StreamStatus status;
+
+    /**
+     * @brief The total number of bytes that were transferred, counted across
+     * all buffers of the transfer.
+     * If the status is kStreamError or kStreamCancelled then the accuracy
+     * of this field is not guaranteed.
+     */
+    size_t n_bytes;
+};
+
 
 using TransferHandle = uintptr_t;
 
@@ -74,7 +98,33 @@ public:
     virtual void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) = 0;
 
     /**
-     * @brief Cancels an operation that was previously started with start_read().
+     * @brief Returns true if this source implements start_readv().
+     *
+     * If false, users must fall back to start_read().
+     */
+    virtual bool supports_readv() const { return false; }
+
+    /**
+     * @brief Starts a scattered read operation. The buffers are filled
+     * back-to-back as if they were a single contiguous buffer.
+     *
+     * Like start_read(), this can complete after filling only part of the
+     * buffers. The transfer can be cancelled with cancel_read().
+     *
+     * Only supported if supports_readv() returns true. The default
+     * implementation fails immediately.
+     *
+     * @param buffers: Array of buffers to read into. The array and the buffers
+     *        must remain valid until `completer` is satisfied.
+     * @param n_buffers: Number of elements in `buffers`.
+     */
+    virtual void start_readv(const bufptr_t* buffers, size_t n_buffers, TransferHandle* handle, Callback<void, ReadvResult> completer) {
+        completer.invoke({kStreamError, 0});
+    }
+
+    /**
+     * @brief Cancels an operation that was previously started with start_read()
+     * or start_readv().
      *
      * The transfer is cancelled asynchronously and the associated completer
      * will eventually be completed with kStreamCancelled. Until then the
@@ -123,7 +173,33 @@ public:
     virtual void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult0> completer) = 0;
 
     /**
-     * @brief Cancels an operation that was previously started with start_write().
+     * @brief Returns true if this sink implements start_writev().
+     *
+     * If false, users must fall back to start_write().
+     */
+    virtual bool supports_writev() const { return false; }
+
+    /**
+     * @brief Starts a gathered write operation. The buffers are transferred
+     * back-to-back as if they were a single contiguous buffer.
+     *
+     * Like start_write(), this can complete after transferring only part of
+     * the data. The transfer can be cancelled with cancel_write().
+     *
+     * Only supported if supports_writev() returns true. The default
+     * implementation fails immediately.
+     *
+     * @param buffers: Array of buffers to write. The array and the buffers
+     *        must remain valid until `completer` is satisfied.
+     * @param n_buffers: Number of elements in `buffers`.
+     */
+    virtual void start_writev(const cbufptr_t* buffers, size_t n_buffers, TransferHandle* handle, Callback<void, WritevResult> completer) {
+        completer.invoke({kStreamError, 0});
+    }
+
+    /**
+     * @brief Cancels an operation that was previously started with start_write()
+     * or start_writev().
      *
      * The transfer is cancelled asynchronously and the associated completer
      * will eventually be completed with kStreamCancelled. Until then the
@@ -168,6 +168,44 @@ struct BufChain {
         return BufChain{bbegin_, begin_, end, elevation_};
     }
 
+    /**
+     * @brief Lists the data chunks up to the first frame boundary in
+     * `buffers`, for instance to pass them to AsyncStreamSink::start_writev().
+     * Empty chunks are left out.
+     *
+     * @returns The number of buffers that were filled in. If `max_buffers` is
+     * too small, the remaining chunks are not listed.
+     */
+    size_t gather(cbufptr_t* buffers, size_t max_buffers) {
+        BufChain chain = *this;
+        size_t n_buffers = 0;
+        while (n_buffers < max_buffers && chain.n_chunks() &&
+               chain.front().is_buf()) {
+            if (chain.front().buf().size()) {
+                buffers[n_buffers++] = chain.front().buf();
+            }
+            chain = chain.skip_chunks(1);
+        }
+        return n_buffers;
+    }
+
+    /**
+     * @brief Skips n bytes of data, which can span several chunks. This is
+     * where a gathered write continues if it only completed partially.
+     */
+    BufChain skip_data_bytes(size_t n) {
+        BufChain chain = *this;
+        while (chain.n_chunks() && chain.front().is_buf() &&
+               n >= chain.front().buf().size()) {
+            n -= chain.front().buf().size();
+            chain = chain.skip_chunks(1);
+        }
+        if (n && chain.n_chunks() && chain.front().is_buf()) {
+            chain = chain.skip_bytes(n);
+        }
+        return chain;
+    }
+
 private:
     const unsigned char* bbegin_;
     const Chunk* begin_;
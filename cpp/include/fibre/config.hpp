@@ -19,10 +19,22 @@
 #define FIBRE_ENABLE_EVENT_LOOP 0
 #endif
 
+#ifndef FIBRE_ENABLE_IO_URING
+#define FIBRE_ENABLE_IO_URING 0
+#endif
+
 #ifndef FIBRE_ALLOW_HEAP
 #define FIBRE_ALLOW_HEAP 1
 #endif
 
+#ifndef FIBRE_ENABLE_SHARDING
+#define FIBRE_ENABLE_SHARDING 0
+#endif
+
+#ifndef FIBRE_ENABLE_EVENT_LOOP_STATS
+#define FIBRE_ENABLE_EVENT_LOOP_STATS 0
+#endif
+
 #ifndef FIBRE_MAX_LOG_VERBOSITY
 #define FIBRE_MAX_LOG_VERBOSITY 5
 #endif
@@ -35,6 +47,10 @@
 #define FIBRE_ENABLE_CAN_ADAPTER 0
 #endif
 
+#ifndef FIBRE_ENABLE_STREAM_ADAPTER
+#define FIBRE_ENABLE_STREAM_ADAPTER 0
+#endif
+
 #ifndef FIBRE_ENABLE_LIBUSB_BACKEND
 #define FIBRE_ENABLE_LIBUSB_BACKEND 0
 #endif
@@ -47,10 +63,42 @@
 #define FIBRE_ENABLE_TCP_SERVER_BACKEND 0
 #endif
 
+#ifndef FIBRE_ENABLE_UNIX_CLIENT_BACKEND
+#define FIBRE_ENABLE_UNIX_CLIENT_BACKEND 0
+#endif
+
+#ifndef FIBRE_ENABLE_UNIX_SERVER_BACKEND
+#define FIBRE_ENABLE_UNIX_SERVER_BACKEND 0
+#endif
+
+#ifndef FIBRE_ENABLE_SHM_TRANSPORT
+#define FIBRE_ENABLE_SHM_TRANSPORT 0
+#endif
+
+#ifndef FIBRE_ENABLE_UDP_CLIENT_BACKEND
+#define FIBRE_ENABLE_UDP_CLIENT_BACKEND 0
+#endif
+
+#ifndef FIBRE_ENABLE_UDP_SERVER_BACKEND
+#define FIBRE_ENABLE_UDP_SERVER_BACKEND 0
+#endif
+
 #ifndef FIBRE_ENABLE_SOCKET_CAN_BACKEND
 #define FIBRE_ENABLE_SOCKET_CAN_BACKEND 0
 #endif
 
+#ifndef FIBRE_CRC_TABLE_SLICES
+#define FIBRE_CRC_TABLE_SLICES 0
+#endif
+
+#ifndef FIBRE_LEGACY_PROTOCOL_BUF_SIZE
+#define FIBRE_LEGACY_PROTOCOL_BUF_SIZE 128
+#endif
+
+#ifndef FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE
+#define FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE 8
+#endif
+
 #define F_RUNTIME_CONFIG 2
 
 #if FIBRE_ENABLE_CLIENT == 0
@@ -7,6 +7,7 @@ struct ConnectionInputSlot;
 }  // namespace fibre
 
 #include <fibre/bufchain.hpp>
+#include <fibre/low_level_protocol.hpp>
 #include <fibre/pool.hpp>
 #include <fibre/socket.hpp>
 #include <fibre/tx_pipe.hpp>
@@ -112,6 +113,10 @@ public:
 
     bool open_tx_slot(FrameStreamSink* sink, Node* node);
     void close_tx_slot(FrameStreamSink* sink);
+    // Replaces the output slot on the sink (if any) by a new one, which
+    // starts over from the last acknowledged position and repeats the current
+    // ack.
+    bool reopen_tx_slot(FrameStreamSink* sink, Node* node);
 
 protected:
     void handle_rx_not_empty();
@@ -151,6 +156,41 @@ protected:
     Chunk* upcall_chunks_end_;
 };
 
+/**
+ * @brief Receive state of one input slot of a packet based link (see
+ * CanAdapter and StreamAdapter).
+ *
+ * The packets carry LowLevelProtocol data. Layer 1 holds the routing info
+ * (protocol and call ID) of the call that the data on layers 2 and above
+ * belongs to.
+ */
+struct CallContext {
+    uint8_t protocol;
+    bool protocol_known = true;
+    ReceiverState state;
+
+    uint8_t routing_info[17];
+    size_t routing_info_offset;
+
+    uint16_t frame_ids[kMaxLayers];
+    size_t n_layers = 0;
+
+    ConnectionInputSlot* handler = nullptr;
+
+    void reset_at(Domain* domain, uint8_t layer);
+
+    /**
+     * @brief Unpacks one LowLevelProtocol packet and dispatches its content to
+     * the call it belongs to, opening the call if necessary.
+     *
+     * @param return_path: The sink on which the packet was received. Used as
+     *        return path for inbound calls.
+     * @param node: The node which sent the packet.
+     * @returns false if the packet is malformed.
+     */
+    bool process_packet(Domain* domain, FrameStreamSink* return_path, Node* node, cbufptr_t packet);
+};
+
 }  // namespace fibre
 
 #endif  // __FIBRE_SERVER_STREAM_HPP
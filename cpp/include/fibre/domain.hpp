@@ -19,6 +19,7 @@ class Function; // defined in function.hpp
 class Interface; // defined in interface.hpp
 struct ChannelDiscoveryResult;
 struct Object;
+class StreamAdapter;
 
 // TODO: legacy stuff - remove
 struct ChannelDiscoveryContext;
@@ -39,6 +40,12 @@ public:
 #endif
 
     void add_legacy_channels(ChannelDiscoveryResult result, const char* name); // TODO: deprecate
+#if FIBRE_ENABLE_STREAM_ADAPTER
+    // Runs the native Fibre protocol on the channels (see StreamAdapter).
+    // on_closed is invoked once the channels are no longer used, for instance
+    // because the underlying connection dropped.
+    void add_channels(ChannelDiscoveryResult result, const char* name, Callback<void, StreamStatus> on_closed = {});
+#endif
 
 #if FIBRE_ENABLE_SERVER
     const Function* get_server_function(ServerFunctionId id);
@@ -46,6 +53,9 @@ public:
 #endif
     void on_found_node(const NodeId& node_id, FrameStreamSink* sink, const char* intf_name, Node** p_node);
     void on_lost_node(Node* node, FrameStreamSink* sink);
+    // Makes all connections that send through the sink resend everything that
+    // the node didn't acknowledge yet. For sinks that can lose packets.
+    void resync_node(Node* node, FrameStreamSink* sink);
 
     void open_call(const std::array<uint8_t, 16>& call_id, uint8_t protocol, FrameStreamSink* return_path, Node* return_node, ConnectionInputSlot** slot);
     void close_call(ConnectionInputSlot* slot);
@@ -70,6 +80,9 @@ private:
 
     void on_stopped_p(LegacyProtocolPacketBased* protocol, StreamStatus status);
     void on_stopped_s(LegacyProtocolPacketBased* protocol, StreamStatus status);
+#if FIBRE_ENABLE_STREAM_ADAPTER
+    void on_stopped_native(StreamAdapter* adapter, StreamStatus status);
+#endif
 
 #if FIBRE_ALLOW_HEAP
     std::unordered_map<std::string, fibre::ChannelDiscoveryContext*> channel_discovery_handles;
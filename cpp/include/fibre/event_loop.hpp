@@ -1,12 +1,47 @@
 #ifndef __FIBRE_EVENT_LOOP_HPP
 #define __FIBRE_EVENT_LOOP_HPP
 
+#include <fibre/bufptr.hpp>
 #include <fibre/callback.hpp>
+#include <fibre/event_loop_stats.hpp>
+#include <fibre/rich_status.hpp>
 #include <fibre/timer.hpp>
 #include <stdint.h>
 
+struct msghdr;
+
 namespace fibre {
 
+/**
+ * @brief Handle for a completion-based I/O operation (see
+ * EventLoop::supports_async_io()).
+ */
+class IoOperation {};
+
+/**
+ * @brief Options that trade CPU time for lower wakeup latency.
+ *
+ * Only supported by EpollEventLoop (see EpollEventLoop::set_busy_poll()).
+ */
+struct BusyPollConfig {
+    // Time in microseconds for which the event loop keeps polling for new
+    // events without blocking before it goes to sleep. 0 to never spin.
+    uint32_t spin_us = 0;
+
+    // SO_BUSY_POLL value in microseconds for sockets that are registered on
+    // the event loop. This makes the kernel poll the network device on
+    // receive calls on these sockets. Setting it requires CAP_NET_ADMIN.
+    // 0 to keep the system default.
+    uint32_t socket_busy_poll_us = 0;
+
+    // CPU to pin the event loop thread to or -1 to keep the thread's CPU
+    // affinity. Spinning is only worthwhile if the thread doesn't compete
+    // with other threads for its CPU.
+    int cpu = -1;
+
+    bool is_enabled() const { return spin_us || socket_busy_poll_us || cpu >= 0; }
+};
+
 /**
  * @brief Base class for event loops.
  * 
@@ -22,6 +57,9 @@ public:
      * thread.
      * 
      * This function must be thread-safe.
+     *
+     * Implementations may have a bounded queue, in which case this function
+     * fails if the event loop is too far behind.
      */
     virtual RichStatus post(Callback<void> callback) = 0;
 
@@ -32,7 +70,14 @@ public:
      * 
      * @param fd: A waitable Unix file descriptor on which to listen for events.
      * @param events: A bitfield that specifies the events to listen for.
-     *        For instance EPOLLIN or EPOLLOUT.
+     *        For instance EPOLLIN or EPOLLOUT. Errors and hangups (EPOLLERR,
+     *        EPOLLHUP) are always reported.
+     *        By default the events are level-triggered. If EPOLLET is set they
+     *        are edge-triggered, that means the callback is only invoked when
+     *        the file descriptor becomes ready and the owner must read or write
+     *        until it gets EAGAIN before it can expect the next invokation.
+     *        A file descriptor with no events other than EPOLLERR and EPOLLHUP
+     *        does not keep the event loop running.
      * @param callback: The callback to invoke every time the event triggers.
      *        A bitfield is passed to the callback to indicate which events were
      *        triggered. This callback must remain valid until
@@ -40,6 +85,18 @@ public:
      */
     virtual RichStatus register_event(int fd, uint32_t events, Callback<void, uint32_t> callback) = 0;
 
+    /**
+     * @brief Changes the events that a registered file descriptor listens for.
+     *
+     * This is cheaper than deregistering and registering the file descriptor
+     * again. The callback stays the same. Events that were already triggered
+     * with the old mask may still be passed to the callback.
+     *
+     * @param events: The new set of events. Can be 0 to temporarily stop
+     *        listening for anything but errors and hangups.
+     */
+    virtual RichStatus modify_event(int fd, uint32_t events) = 0;
+
     /**
      * @brief Deregisters the given event.
      * 
@@ -47,6 +104,106 @@ public:
      * invoked and its resources can be freed.
      */
     virtual RichStatus deregister_event(int fd) = 0;
+
+    /**
+     * @brief Returns true if this event loop implements the completion-based
+     * I/O functions start_sendmsg(), start_recv_multishot(), release_buffer()
+     * and cancel_io().
+     * 
+     * If false, these functions fail and the caller must use readiness-based
+     * I/O through register_event() instead.
+     */
+    virtual bool supports_async_io() { return false; }
+
+    /**
+     * @brief Starts sending a message on the given socket.
+     * 
+     * @param msg: The message to send, as for sendmsg(2). The message header,
+     *        its I/O vectors and the buffers they point to must remain valid
+     *        until the operation completes or is cancelled.
+     * @param op: Set to a handle that can be passed to cancel_io(). The handle
+     *        becomes invalid when `on_done` is invoked.
+     * @param on_done: Invoked once with the result of the operation (number of
+     *        bytes sent or a negative errno).
+     */
+    virtual RichStatus start_sendmsg(int fd, const struct msghdr* msg, IoOperation** op, Callback<void, int> on_done) {
+        return F_MAKE_ERR("not supported");
+    }
+
+    /**
+     * @brief Starts receiving on the given socket into buffers that are owned
+     * by the event loop.
+     * 
+     * The operation stays active until it is cancelled or the socket reaches
+     * EOF or fails. For every received message `on_received` is invoked with
+     * the message length, the message data and the msg_flags as returned by
+     * recvmsg(2). The data remains valid until it is handed back through
+     * release_buffer().
+     * 
+     * The last invocation has a result <= 0 (0 for EOF or a negative errno)
+     * and empty data. After that the handle becomes invalid.
+     */
+    virtual RichStatus start_recv_multishot(int fd, IoOperation** op, Callback<void, int, cbufptr_t, int> on_received) {
+        return F_MAKE_ERR("not supported");
+    }
+
+    /**
+     * @brief Hands a buffer that was passed to a start_recv_multishot()
+     * callback back to the event loop.
+     */
+    virtual void release_buffer(cbufptr_t buffer) {}
+
+    /**
+     * @brief Cancels an operation that was started with start_sendmsg() or
+     * start_recv_multishot().
+     * 
+     * Once this function returns, the associated callback will no longer be
+     * invoked and the kernel no longer accesses the buffers of the operation.
+     */
+    virtual RichStatus cancel_io(IoOperation* op) {
+        return F_MAKE_ERR("not supported");
+    }
+
+    /**
+     * @brief Returns the SO_BUSY_POLL value in microseconds that sockets on
+     * this event loop should use or 0 to keep the system default.
+     */
+    virtual uint32_t socket_busy_poll_us() { return 0; }
+
+    /**
+     * @brief Makes the event loop return once no more callbacks are posted,
+     * even if file descriptors, timers or I/O operations are still open.
+     *
+     * Must be called on the event loop's thread. Whatever is still open at
+     * that point is leaked. This is for owners of an event loop that must
+     * shut it down even if some user of the loop didn't clean up after itself.
+     */
+    virtual RichStatus stop() {
+        return F_MAKE_ERR("not supported");
+    }
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    /**
+     * @brief Returns the instrumentation data of this event loop or null if
+     * this event loop doesn't collect any.
+     *
+     * The data is updated by the event loop thread so it must only be accessed
+     * (and reset) on that thread.
+     */
+    virtual EventLoopStats* get_stats() { return nullptr; }
+
+    /**
+     * @brief Logs a summary of the instrumentation data at debug level in the
+     * specified interval.
+     *
+     * The dump timer does not keep the event loop running.
+     *
+     * @param interval: Interval in seconds or 0 to stop logging.
+     */
+    virtual RichStatus set_stats_dump_interval(float interval) {
+        return F_MAKE_ERR("not supported");
+    }
+#endif
 };
 
 }
@@ -0,0 +1,149 @@
+#ifndef __FIBRE_EVENT_LOOP_STATS_HPP
+#define __FIBRE_EVENT_LOOP_STATS_HPP
+
+#include <fibre/config.hpp>
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+
+#include <fibre/logging.hpp>
+#include <stdint.h>
+#include <stddef.h>
+#include <unordered_map>
+
+namespace fibre {
+
+/**
+ * @brief Histogram with logarithmic buckets in the style of HdrHistogram.
+ *
+ * Each power of two is split into kSubBuckets linear sub-buckets, so values
+ * are recorded with a relative error of at most 1/kSubBuckets while the whole
+ * range fits into a fixed number of buckets. Values below kSubBuckets are
+ * recorded exactly. Recording is O(1) and never allocates.
+ */
+class Histogram {
+public:
+    void record(uint64_t value) {
+        counts_[index(value)]++;
+        count_++;
+        sum_ += value;
+        if (value < min_) {
+            min_ = value;
+        }
+        if (value > max_) {
+            max_ = value;
+        }
+    }
+
+    void merge(const Histogram& other);
+
+    uint64_t count() const { return count_; }
+    uint64_t sum() const { return sum_; }
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    uint64_t mean() const { return count_ ? sum_ / count_ : 0; }
+
+    /**
+     * @brief Returns the smallest value that is greater than or equal to the
+     * specified fraction of all recorded values (up to the bucket resolution).
+     *
+     * @param fraction: A value between 0 and 1, e.g. 0.99 for the 99th
+     *        percentile.
+     */
+    uint64_t percentile(double fraction) const;
+
+private:
+    static const unsigned kSubBucketBits = 4;
+    static const unsigned kSubBuckets = 1 << kSubBucketBits;
+    static const unsigned kMaxBits = 40; // values of 2^40 (18 minutes in ns) and above share the last bucket
+    static const unsigned kBuckets = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+    static unsigned index(uint64_t value) {
+        if (value < kSubBuckets) {
+            return (unsigned)value;
+        } else if (value >> kMaxBits) {
+            return kBuckets - 1;
+        }
+        unsigned msb = 63 - __builtin_clzll(value);
+        return (msb - kSubBucketBits + 1) * kSubBuckets
+             + (unsigned)((value >> (msb - kSubBucketBits)) & (kSubBuckets - 1));
+    }
+
+    static uint64_t highest_value(unsigned index);
+
+    uint64_t counts_[kBuckets] = {};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+/**
+ * @brief Instrumentation data of an event loop.
+ *
+ * All durations are in nanoseconds. The data is written by the event loop
+ * thread and must only be accessed on that thread (see EventLoop::get_stats()).
+ */
+struct EventLoopStats {
+    /**
+     * @brief Returns the current time on the clock that is used for all
+     * timestamps in this struct.
+     */
+    static uint64_t now_ns();
+
+    void reset(uint64_t now_ns);
+    void merge(const EventLoopStats& other);
+
+    /**
+     * @brief Logs a summary of the data at debug level.
+     */
+    void dump(Logger logger, uint64_t now_ns) const;
+
+    void record_wakeup(uint64_t wait_start_ns, uint64_t wakeup_ns, size_t n_events) {
+        wait_ns += wakeup_ns - wait_start_ns;
+        n_wakeups++;
+        events_per_wakeup.record(n_events);
+    }
+
+    void record_callback(uintptr_t site, uint64_t start_ns, uint64_t end_ns) {
+        callback_time.record(end_ns - start_ns);
+        // Consecutive callbacks often go to the same site
+        if (site != last_site_ || !last_site_histogram_) {
+            last_site_ = site;
+            last_site_histogram_ = &callback_time_by_site[site];
+        }
+        last_site_histogram_->record(end_ns - start_ns);
+    }
+
+    /**
+     * @brief Resolves a callback site to the file name of the binary that
+     * contains it and the offset within that binary (as accepted by
+     * addr2line).
+     *
+     * @returns false if the site is not part of any loaded binary.
+     */
+    static bool resolve_site(uintptr_t site, const char** module, uintptr_t* offset);
+
+    uint64_t since_ns = 0; // start of the period covered by this data
+    uint64_t wait_ns = 0; // time spent blocked waiting for events
+    uint64_t n_wakeups = 0;
+    Histogram callback_time; // run time of all callbacks
+    Histogram dispatch_lag; // time from a wakeup to the start of an event's callback
+    Histogram post_lag; // time from post() to the start of the posted callback
+    Histogram timer_lateness; // time from a timer's deadline (rounded up to the timer tick) to the start of its callback
+    Histogram events_per_wakeup; // number of events (not a duration)
+
+    // Run time of callbacks by callback function. The key is the address of
+    // the function that the Callback object points to, which for MEMBER_CB()
+    // callbacks is unique per member function.
+    std::unordered_map<uintptr_t, Histogram> callback_time_by_site;
+
+private:
+    uintptr_t last_site_ = 0;
+    Histogram* last_site_histogram_ = nullptr; // points into callback_time_by_site
+};
+
+}
+
+#endif
+
+#endif // __FIBRE_EVENT_LOOP_STATS_HPP
@@ -14,21 +14,46 @@ struct Fibre;
 #include <fibre/logging.hpp>
 #include <string>
 #include <memory>
+#include <vector>
 
 namespace fibre {
 
 struct Backend; // defined in channel_discoverer.hpp
 class ChannelDiscoverer; // defined in channel_discoverer.hpp
+class ShardedRuntime; // defined in sharded_runtime.hpp
 
 struct Fibre {
     size_t n_domains = 0;
     EventLoop* event_loop;
     Logger logger = Logger::none();
 
+#if FIBRE_ENABLE_SHARDING
+    /**
+     * @brief The runtime that owns this context, if any. All operations on
+     * this context and its domains must run on the shard `shard_id`.
+     */
+    ShardedRuntime* runtime = nullptr;
+    size_t shard_id = 0;
+#endif
+
 #if FIBRE_ALLOW_HEAP
     std::unordered_map<std::string, ChannelDiscoverer*> discoverers;
 #endif
 
+#if FIBRE_ENABLE_CLIENT && FIBRE_ALLOW_HEAP
+    /**
+     * @brief Interface descriptors (JSON) of legacy devices that were seen
+     * before, keyed by their JSON version ID.
+     */
+    std::unordered_map<uint32_t, std::vector<uint8_t>> legacy_descriptor_cache;
+
+    /**
+     * @brief Directory where legacy interface descriptors are persisted across
+     * sessions. If empty, descriptors are only cached in memory.
+     */
+    std::string legacy_descriptor_cache_dir;
+#endif
+
     /**
      * @brief Creates a domain on which objects can subsequently be published
      * and discovered.
@@ -92,6 +117,15 @@ void log_to_stderr(void* ctx, const char* file, unsigned line, int level, uintpt
  */
 RichStatus launch_event_loop(Logger logger, Callback<void, EventLoop*> on_started);
 
+/**
+ * @brief Like launch_event_loop() but with busy polling for lower wakeup
+ * latency (see BusyPollConfig).
+ *
+ * If busy polling is enabled this always uses the epoll-based event loop, even
+ * where io_uring is available.
+ */
+RichStatus launch_event_loop(Logger logger, Callback<void, EventLoop*> on_started, const BusyPollConfig& busy_poll);
+
 }
 
 #endif // __FIBRE_HPP
\ No newline at end of file
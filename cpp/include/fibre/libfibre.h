@@ -16,6 +16,8 @@
  *  - All of the library's functions can be expected reentry-safe. That means
  *    you can call into any libfibre function from any callback handler that
  *    libfibre invokes.
+ *  - Contexts that were opened with libfibre_open_sharded() are an exception
+ *    to the above: see libfibre_open_sharded() for details.
  * 
  * 
  * 
@@ -205,6 +207,55 @@ struct LibFibreLogger {
     void* ctx;
 };
 
+/**
+ * @brief Summary of a histogram of event loop measurements.
+ *
+ * Percentiles are accurate to within 1/16 of their value.
+ */
+struct LibFibreHistogram {
+    uint64_t count; //!< Number of recorded values
+    uint64_t min;
+    uint64_t max;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+};
+
+/**
+ * @brief Instrumentation data of libfibre's internal event loops.
+ *
+ * All durations are in nanoseconds.
+ */
+struct LibFibreEventLoopStats {
+    uint64_t period_ns; //!< Time covered by this data, summed over all event loops
+    uint64_t wait_ns; //!< Time the event loops spent blocked waiting for
+                      //!< events. The utilisation is `1 - wait_ns / period_ns`.
+    uint64_t n_wakeups; //!< Number of times the event loops woke up
+    struct LibFibreHistogram callback_time; //!< Run time of all callbacks
+    struct LibFibreHistogram dispatch_lag; //!< Time from a wakeup of the event
+                                           //!< loop to the start of an event's callback
+    struct LibFibreHistogram post_lag; //!< Time from posting a callback onto
+                                       //!< an event loop to its start
+    struct LibFibreHistogram timer_lateness; //!< Time from a timer's deadline
+                                             //!< (rounded up to 1ms) to the
+                                             //!< start of its callback
+    struct LibFibreHistogram events_per_wakeup; //!< Number of events per wakeup (not a duration)
+};
+
+/**
+ * @brief Run time of the callbacks that go to one callback function.
+ */
+struct LibFibreCallbackStats {
+    uintptr_t site; //!< Address of the callback function
+    const char* module; //!< Path of the binary that contains `site` or NULL
+                        //!< if unknown. Remains valid while the binary is loaded.
+    uintptr_t offset; //!< Offset of `site` in `module`, as accepted by
+                      //!< `addr2line -f -C -e <module> <offset>`
+    struct LibFibreHistogram run_time;
+};
+
 typedef uintptr_t LibFibreCallHandle;
 
 enum LibFibreTaskType {
@@ -305,6 +356,12 @@ typedef void (*on_lost_object_cb_t)(void*, LibFibreObject* obj);
 
 typedef void (*on_stopped_cb_t)(void*, LibFibreStatus);
 
+/**
+ * @brief Callback type for libfibre_start_bulk_read().
+ * @param rx_end: End of the data that was written to the output buffer.
+ */
+typedef void (*on_bulk_read_done_cb_t)(void*, LibFibreStatus status, unsigned char* rx_end);
+
 /**
  * @brief Callback type for libfibre_call().
  * 
@@ -383,6 +440,67 @@ FIBRE_PUBLIC struct LibFibreCtx* libfibre_open(LibFibreEventLoop event_loop, run
  */
 FIBRE_PUBLIC void libfibre_close(struct LibFibreCtx* ctx);
 
+/**
+ * @brief Opens a Fibre context that runs on internal threads.
+ *
+ * libfibre starts `n_shards` threads ("shards"), each with its own event loop
+ * and its own set of backends. Domains that are opened on the returned context
+ * are distributed round-robin over the shards. A domain and everything found
+ * on it (objects, calls) is owned by one shard.
+ *
+ * Unlike with libfibre_open(), the library's functions can be called from any
+ * thread. Each call is forwarded to the shard that owns the domain, object or
+ * call that it refers to. Functions that return a result wait for the shard
+ * to process the call.
+ *
+ * A shard never waits for another shard. If a function is called on a shard's
+ * thread (that is from a callback) and refers to something that another shard
+ * owns:
+ *  - Functions without a result (libfibre_close_domain(),
+ *    libfibre_start_discovery(), libfibre_stop_discovery(), ...) return
+ *    immediately and the owning shard processes the call later. Such calls
+ *    are processed in the order in which they were made.
+ *  - Functions with a result fail: libfibre_start_bulk_read() and the event
+ *    loop statistics functions return kFibreInvalidArgument.
+ *  - libfibre_open_domain() opens the domain on the calling shard.
+ * libfibre_close() must not be called on a shard's thread.
+ *
+ * Callbacks (including `run_tasks_cb`) are invoked on the thread of the
+ * shard that owns the respective domain, object or call. Different shards can
+ * invoke callbacks concurrently. The `ctx` argument of `run_tasks_cb` is a
+ * shard's context which can be passed to libfibre_run_tasks() just like the
+ * context returned by this function.
+ *
+ * libfibre_run_tasks() must not be called concurrently from multiple threads.
+ *
+ * @param n_shards: Number of shards or 0 to start one shard per CPU core.
+ * @param run_tasks_cb: See libfibre_open().
+ * @param logger: See libfibre_open(). Used concurrently by all shards.
+ * @returns The new context or NULL if the context could not be opened or if
+ *          libfibre was compiled without FIBRE_ENABLE_SHARDING.
+ *          The context must be closed with libfibre_close().
+ */
+FIBRE_PUBLIC struct LibFibreCtx* libfibre_open_sharded(size_t n_shards, run_tasks_cb_t run_tasks_cb, LibFibreLogger logger);
+
+/**
+ * @brief Sets the directory in which interface descriptors of known devices
+ * are cached across sessions.
+ *
+ * When a device is connected whose descriptor is already cached, discovery
+ * completes after a single request instead of downloading the descriptor.
+ * Cache entries are identified by the descriptor's version ID, so changes on
+ * the device side invalidate the cache automatically.
+ *
+ * Descriptors are always cached in memory for the lifetime of the context.
+ * The on-disk cache is disabled until this function is called. The Python
+ * bindings call it if the FIBRE_CACHE_DIR environment variable is set.
+ *
+ * @param ctx: The libfibre context that was obtained from libfibre_open().
+ * @param path: Path to an existing directory or NULL to disable the on-disk
+ *        cache.
+ */
+FIBRE_PUBLIC void libfibre_set_cache_dir(LibFibreCtx* ctx, const char* path);
+
 /**
  * @brief Creates a communication domain from the specified spec string.
  * 
@@ -516,6 +634,29 @@ FIBRE_PUBLIC void libfibre_free_interface_info(LibFibreInterfaceInfo* info);
  */
 FIBRE_PUBLIC LibFibreStatus libfibre_get_attribute(LibFibreInterface* intf, LibFibreObject* parent_obj, size_t attr_id, LibFibreObject** child_obj_ptr);
 
+/**
+ * @brief Reads the values of several property objects at once.
+ * 
+ * This uses as few round trips as the remote device supports. Devices that
+ * support multi-endpoint operations return up to one packet worth of values
+ * per request.
+ * 
+ * @param objs: The property objects to read. All objects must belong to the
+ *        same device. Property objects are the ones whose interface name starts
+ *        with "fibre.Property<". Properties of type object_ref are returned in
+ *        their raw wire format.
+ * @param n_objs: Number of objects in `objs`.
+ * @param rx_buf: The buffer into which the values are written in the order of
+ *        `objs`. Each value is prefixed with a byte that indicates its length.
+ *        The buffer must remain valid until on_done is invoked.
+ * @param rx_len: Length of rx_buf. 9 bytes per object are always sufficient.
+ * @param on_done: Invoked when the operation completes, unless this function
+ *        fails.
+ * @param cb_ctx: Arbitrary user data passed to the callback.
+ * @returns: kFibreOk or kFibreInvalidArgument
+ */
+FIBRE_PUBLIC LibFibreStatus libfibre_start_bulk_read(LibFibreObject** objs, size_t n_objs, unsigned char* rx_buf, size_t rx_len, on_bulk_read_done_cb_t on_done, void* cb_ctx);
+
 /**
  * @brief Posts a batch of tasks to libfibre and receives a batch of return
  * tasks for the application.
@@ -534,6 +675,55 @@ FIBRE_PUBLIC LibFibreStatus libfibre_get_attribute(LibFibreInterface* intf, LibF
  */
 FIBRE_PUBLIC void libfibre_run_tasks(LibFibreCtx* ctx, LibFibreTask* tasks, size_t n_tasks, LibFibreTask** out_tasks, size_t* n_out_tasks);
 
+/**
+ * @brief Reads the instrumentation data of the event loops that run the
+ * specified context.
+ *
+ * Only contexts with internal event loops (see libfibre_open_sharded()) are
+ * instrumented. For the root context the data of all shards is combined.
+ * For a shard's context (as passed to `run_tasks_cb`) only that shard's data
+ * is returned.
+ *
+ * The data covers the time since the context was opened or since the last
+ * call to libfibre_reset_event_loop_stats().
+ *
+ * @returns kFibreOk or kFibreInvalidArgument if the context has no
+ *          instrumented event loop, if it is called on a shard's thread for
+ *          another shard's data (see libfibre_open_sharded()) or if libfibre
+ *          was compiled without FIBRE_ENABLE_EVENT_LOOP_STATS.
+ */
+FIBRE_PUBLIC LibFibreStatus libfibre_get_event_loop_stats(LibFibreCtx* ctx, struct LibFibreEventLoopStats* stats);
+
+/**
+ * @brief Reads the run time of the event loops' callbacks, grouped by
+ * callback function.
+ *
+ * The callback functions are sorted by their total run time, most expensive
+ * first.
+ *
+ * @param sites: Array that receives the data.
+ * @param n_sites: Must be set to the length of `sites`. Set to the number of
+ *        entries that were written.
+ * @returns See libfibre_get_event_loop_stats().
+ */
+FIBRE_PUBLIC LibFibreStatus libfibre_get_callback_stats(LibFibreCtx* ctx, struct LibFibreCallbackStats* sites, size_t* n_sites);
+
+/**
+ * @brief Clears the instrumentation data of the context's event loops.
+ *
+ * @returns See libfibre_get_event_loop_stats().
+ */
+FIBRE_PUBLIC LibFibreStatus libfibre_reset_event_loop_stats(LibFibreCtx* ctx);
+
+/**
+ * @brief Makes each of the context's event loops log a summary of its
+ * instrumentation data at debug level in the specified interval.
+ *
+ * @param interval: Interval in seconds or 0 to stop logging.
+ * @returns See libfibre_get_event_loop_stats().
+ */
+FIBRE_PUBLIC LibFibreStatus libfibre_set_event_loop_stats_dump_interval(LibFibreCtx* ctx, float interval);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,12 +8,17 @@
 namespace fibre {
 
 struct FrameStreamSink;
+class Connection;
 
 struct Node {
     NodeId id;
 
     // TODO: configurable capacity
     Pool<FrameStreamSink*, 3> sinks;
+
+    // Connection to the node's object server. Outlives the sinks so that it
+    // can be resumed when the node is found again.
+    Connection* client_connection = nullptr;
 };
 
 }
@@ -0,0 +1,125 @@
+#ifndef __FIBRE_SHARDED_RUNTIME_HPP
+#define __FIBRE_SHARDED_RUNTIME_HPP
+
+#include <fibre/config.hpp>
+
+#if FIBRE_ENABLE_SHARDING
+
+#include <fibre/callback.hpp>
+#include <fibre/logging.hpp>
+#include <fibre/rich_status.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fibre {
+
+struct Fibre;
+class EventLoop;
+class Timer;
+
+/**
+ * @brief Runs several independent Fibre contexts ("shards"), each on its own
+ * event loop and thread.
+ *
+ * Every shard has its own set of backends. A domain that is created on a
+ * shard's Fibre context stays on that shard, along with all of its channels,
+ * connections and objects. Shards share no state so they need no locking.
+ * Work is passed between shards (or from application threads to a shard)
+ * through EventLoop::post().
+ *
+ * Thread safety: All functions are thread-safe unless noted otherwise.
+ */
+class ShardedRuntime {
+public:
+    /**
+     * @brief Starts the specified number of shards and returns once all of them
+     * are running.
+     *
+     * @param n_shards: Number of shards. If 0, one shard per CPU core is
+     *        started.
+     */
+    RichStatus start(size_t n_shards, Logger logger);
+
+    /**
+     * @brief Stops all shards and waits for their threads to exit.
+     *
+     * All domains must be closed before. Connections that are still open
+     * then are leaked (see EventLoop::stop()). Must not be called from a
+     * shard thread.
+     */
+    RichStatus stop();
+
+    size_t n_shards() { return shards_.size(); }
+    Fibre* get_fibre(size_t shard) { return shards_[shard]->fibre; }
+    EventLoop* get_event_loop(size_t shard) { return shards_[shard]->event_loop; }
+
+    /**
+     * @brief Returns the shard on whose thread the caller runs or n_shards()
+     * if the caller doesn't run on a shard thread.
+     */
+    size_t current_shard();
+
+    /**
+     * @brief Returns a shard for a new domain. Domains are distributed
+     * round-robin.
+     */
+    size_t next_shard();
+
+    /**
+     * @brief Runs the callback on the specified shard's thread.
+     */
+    RichStatus post(size_t shard, Callback<void> callback);
+
+    /**
+     * @brief Runs the callback on the specified shard's thread and waits for it
+     * to complete.
+     *
+     * If the caller already runs on that shard the callback runs immediately.
+     * Calling this from a different shard fails because two shards waiting
+     * for each other would deadlock. Use post() for calls between shards.
+     */
+    RichStatus run_sync(size_t shard, Callback<void> callback);
+
+private:
+    struct Shard {
+        void thread_main();
+        void on_started(EventLoop* event_loop);
+        void on_keepalive() {}
+        void shutdown();
+
+        ShardedRuntime* runtime;
+        size_t id;
+        Logger logger = Logger::none();
+        std::thread thread;
+        std::thread::id thread_id;
+        EventLoop* event_loop = nullptr;
+        Fibre* fibre = nullptr;
+        Timer* keepalive = nullptr; // keeps the event loop running while no domain is open
+        bool ready = false; // set once the shard is running or failed to start
+        RichStatus status;
+    };
+
+    struct SyncCall {
+        void run();
+        Callback<void> callback;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+    };
+
+    std::vector<Shard*> shards_;
+    std::atomic<size_t> next_shard_{0};
+
+    // Protects Shard::ready and Shard::status during start()
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+}
+
+#endif
+
+#endif // __FIBRE_SHARDED_RUNTIME_HPP
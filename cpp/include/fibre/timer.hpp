@@ -2,6 +2,7 @@
 #define __FIBRE_TIMER_HPP
 
 #include <fibre/callback.hpp>
+#include <stdint.h>
 
 namespace fibre {
 
@@ -34,6 +35,33 @@ public:
      *        repeatedly in intervals specified by `interval`.
      */
     virtual RichStatus set(float interval, TimerMode mode) = 0;
+
+    /**
+     * @brief Starts the timer with nanosecond resolution.
+     *
+     * Unlike set() this doesn't lose precision on long intervals. The
+     * triggers of a periodic timer are due at exactly `deadline + k * interval`
+     * so they don't drift, no matter how late individual triggers are served.
+     * Triggers that are already overdue when the previous one is served are
+     * skipped and reported through get_missed_periods().
+     *
+     * @param deadline_ns: Time of the first trigger. If `absolute` is false,
+     *        this is a delay from now. Otherwise it is a point in time on the
+     *        clock of TimerProvider::get_time_ns(). Deadlines in the past fire
+     *        as soon as possible.
+     * @param interval_ns: Interval of a periodic timer or 0 for a timer that
+     *        fires only once.
+     * @param absolute: Selects how `deadline_ns` is interpreted.
+     */
+    virtual RichStatus set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) = 0;
+
+    /**
+     * @brief Returns the number of triggers that were skipped right before the
+     * current trigger of a periodic timer.
+     *
+     * Only valid during the timer's callback.
+     */
+    virtual uint64_t get_missed_periods() = 0;
 };
 
 class TimerProvider {
@@ -56,6 +84,14 @@ public:
      * function.
      */
     virtual RichStatus close_timer(Timer* timer) = 0;
+
+    /**
+     * @brief Returns the current time on the clock that absolute timer
+     * deadlines refer to (see Timer::set_ns()).
+     *
+     * For the builtin event loops this is CLOCK_MONOTONIC.
+     */
+    virtual uint64_t get_time_ns() = 0;
 };
 
 }
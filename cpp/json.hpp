@@ -2,47 +2,64 @@
 #define __FIBRE_JSON_HPP
 
 #include <string>
-#include <vector>
-#include <memory>
-#include <algorithm>
-#include <fibre/logging.hpp>
-#include <fibre/backport/variant.hpp>
+#include <deque>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+
+// Minimal single-pass JSON parser.
+//
+// All nodes of a document are allocated from a json_arena which owns them.
+// Strings are not copied: they point into the input buffer, so the input buffer
+// must outlive the parsed document.
+
+enum json_type {
+    kJsonStr,
+    kJsonInt,
+    kJsonList,
+    kJsonDict,
+};
 
 struct json_error {
     const char* ptr;
-    std::string str;
+    const char* str;
 };
 
-struct json_value;
-using json_list = std::vector<std::shared_ptr<json_value>>;
-using json_dict = std::vector<std::pair<std::shared_ptr<json_value>, std::shared_ptr<json_value>>>;
-using json_value_variant = std::variant<std::string, int, json_list, json_dict, json_error>;
-
-struct json_value : json_value_variant {
-    //json_value(const json_value_variant& v) : json_value_variant{v} {}
-    template<typename T> json_value(T&& arg) : json_value_variant{std::forward<T>(arg)} {}
-    //json_value_variant v;
+struct json_value {
+    json_type type;
+    const char* str_begin; // valid for strings
+    const char* str_end; // valid for strings
+    int int_val; // valid for ints
+    json_value* first_child = nullptr; // list items or dict keys
+    json_value* next = nullptr; // next item in the parent list or dict
+    json_value* dict_val = nullptr; // value associated with a dict key
 };
 
-// helper functions
-inline bool json_is_str(json_value val) { return val.index() == 0; }
-inline bool json_is_int(json_value val) { return val.index() == 1; }
-inline bool json_is_list(json_value val) { return val.index() == 2; }
-inline bool json_is_dict(json_value val) { return val.index() == 3; }
-inline bool json_is_err(json_value val) { return val.index() == 4; }
-inline std::string json_as_str(json_value val) { return std::get<0>(val); }
-inline int json_as_int(json_value val) { return std::get<1>(val); }
-inline json_list json_as_list(json_value val) { return std::get<2>(val); }
-inline json_dict json_as_dict(json_value val) { return std::get<3>(val); }
-inline json_error json_as_err(json_value val) { return std::get<4>(val); }
-
-inline json_value json_make_error(const char* ptr, std::string str) {
-    return {json_error{ptr, str}};
+// std::deque never moves its elements so nodes can point to each other.
+using json_arena = std::deque<json_value>;
+
+// helper functions (all of them accept null)
+inline bool json_is_str(const json_value* val) { return val && val->type == kJsonStr; }
+inline bool json_is_int(const json_value* val) { return val && val->type == kJsonInt; }
+inline bool json_is_list(const json_value* val) { return val && val->type == kJsonList; }
+inline bool json_is_dict(const json_value* val) { return val && val->type == kJsonDict; }
+inline std::string json_as_str(const json_value* val) { return json_is_str(val) ? std::string{val->str_begin, val->str_end} : std::string{}; }
+inline int json_as_int(const json_value* val) { return json_is_int(val) ? val->int_val : 0; }
+
+// Returns the first item of a list or the first key of a dict. Use `next` to
+// iterate over the rest.
+inline const json_value* json_first(const json_value* val) {
+    return (json_is_list(val) || json_is_dict(val)) ? val->first_child : nullptr;
 }
 
+inline bool json_str_equals(const json_value* val, const char* str) {
+    size_t len = strlen(str);
+    return json_is_str(val) && (size_t)(val->str_end - val->str_begin) == len
+        && !memcmp(val->str_begin, str, len);
+}
 
 inline void json_skip_whitespace(const char** begin, const char* end) {
-    while (*begin < end && std::isspace(**begin)) {
+    while (*begin < end && isspace((unsigned char)**begin)) {
         (*begin)++;
     }
 }
@@ -51,117 +68,123 @@ inline bool json_comp(const char* begin, const char* end, char c) {
     return begin < end && *begin == c;
 }
 
-inline json_value json_parse(const char** begin, const char* end, fibre::Logger logger) {
-    // skip whitespace
-
+/**
+ * @brief Parses a JSON value starting at *begin and advances *begin to the end
+ * of the value.
+ *
+ * @returns The parsed value or null if a parsing error occurred, in which case
+ *          `error` is set.
+ */
+inline json_value* json_parse(const char** begin, const char* end, json_arena* arena, json_error* error) {
     if (*begin >= end) {
-        return json_make_error(*begin, "expected value but got EOF");
+        *error = {*begin, "expected value but got EOF"};
+        return nullptr;
     }
 
-    if (json_comp(*begin, end, '{')) {
-        // parse dict
-        (*begin)++; // consume leading '{'
-        json_dict dict;
-        bool expect_comma = false;
+    if (json_comp(*begin, end, '{') || json_comp(*begin, end, '[')) {
+        // parse dict or list
+        bool is_dict = **begin == '{';
+        char terminator = is_dict ? '}' : ']';
+        (*begin)++; // consume leading '{' or '['
+
+        arena->emplace_back();
+        json_value* container = &arena->back();
+        container->type = is_dict ? kJsonDict : kJsonList;
+        json_value** tail = &container->first_child;
 
         json_skip_whitespace(begin, end);
-        while (!json_comp(*begin, end, '}')) {
-            if (expect_comma) {
+        while (!json_comp(*begin, end, terminator)) {
+            if (*tail) {
                 if (!json_comp(*begin, end, ',')) {
-                    return json_make_error(*begin, "expected ',' or '}'");
+                    *error = {*begin, is_dict ? "expected ',' or '}'" : "expected ',' or ']'"};
+                    return nullptr;
                 }
                 (*begin)++; // consume comma
                 json_skip_whitespace(begin, end);
+                tail = &(*tail)->next;
             }
-            expect_comma = true;
-
-            // Parse key-value pair
-            json_value key = json_parse(begin, end, logger);
-            if (json_is_err(key)) return key;
-            json_skip_whitespace(begin, end);
-            if (!json_comp(*begin, end, ':')) {
-                return json_make_error(*begin, "expected :");
-            }
-            (*begin)++;
-            json_value val = json_parse(begin, end, logger);
-            if (json_is_err(val)) return val;
-            dict.push_back({std::make_shared<json_value>(key), std::make_shared<json_value>(val)});
-
-            json_skip_whitespace(begin, end);
-        }
-
-        (*begin)++;
-        return {dict};
 
-    } else if (json_comp(*begin, end, '[')) {
-        // parse list
-        (*begin)++; // consume leading '['
-        json_list list;
-        bool expect_comma = false;
+            // Parse item or key-value pair
+            json_value* item = json_parse(begin, end, arena, error);
+            if (!item) return nullptr;
 
-        json_skip_whitespace(begin, end);
-        while (!json_comp(*begin, end, ']')) {
-            if (expect_comma) {
-                if (!json_comp(*begin, end, ',')) {
-                    return json_make_error(*begin, "expected ',' or ']'");
+            if (is_dict) {
+                json_skip_whitespace(begin, end);
+                if (!json_comp(*begin, end, ':')) {
+                    *error = {*begin, "expected :"};
+                    return nullptr;
                 }
-                (*begin)++; // consume comma
+                (*begin)++;
                 json_skip_whitespace(begin, end);
+                item->dict_val = json_parse(begin, end, arena, error);
+                if (!item->dict_val) return nullptr;
             }
-            expect_comma = true;
-
-            // Parse item
-            json_value val = json_parse(begin, end, logger);
-            if (json_is_err(val)) return val;
-            list.push_back(std::make_shared<json_value>(val));
 
+            *tail = item;
             json_skip_whitespace(begin, end);
         }
 
-        (*begin)++; // consume trailing ']'
-        return {list};
+        (*begin)++; // consume trailing '}' or ']'
+        return container;
 
     } else if (json_comp(*begin, end, '"')) {
         // parse string
         (*begin)++; // consume leading '"'
-        std::string str;
+        const char* str_begin = *begin;
+        const char* str_end = static_cast<const char*>(memchr(*begin, '"', end - *begin));
 
-        while (!json_comp(*begin, end, '"')) {
-            if (*begin >= end) {
-                return json_make_error(*begin, "expected '\"' but got EOF");
-            }
-            if (json_comp(*begin, end, '\\')) {
-                return json_make_error(*begin, "escaped strings not supported");
-            }
-            str.push_back(**begin);
-            (*begin)++;
+        if (!str_end) {
+            *error = {end, "expected '\"' but got EOF"};
+            return nullptr;
+        }
+        if (const char* escape = static_cast<const char*>(memchr(str_begin, '\\', str_end - str_begin))) {
+            *error = {escape, "escaped strings not supported"};
+            return nullptr;
         }
 
-        (*begin)++; // consume trailing '"'
-        return {str};
+        *begin = str_end + 1; // consume string and trailing '"'
+        arena->emplace_back();
+        json_value* val = &arena->back();
+        val->type = kJsonStr;
+        val->str_begin = str_begin;
+        val->str_end = str_end;
+        return val;
 
-    } else if (std::isdigit(**begin)) {
+    } else if (isdigit((unsigned char)**begin)) {
         // parse int
-
-        std::string str;
-        while (*begin < end && std::isdigit(**begin)) {
-            str.push_back(**begin);
+        const char* int_begin = *begin;
+        long long int_val = 0;
+        while (*begin < end && isdigit((unsigned char)**begin)) {
+            int_val = int_val * 10 + (**begin - '0');
+            if (int_val > INT_MAX) {
+                *error = {int_begin, "integer too large"};
+                return nullptr;
+            }
             (*begin)++;
         }
 
-        return {std::stoi(str)}; // note: this can throw an exception if the int is too long
+        arena->emplace_back();
+        json_value* val = &arena->back();
+        val->type = kJsonInt;
+        val->int_val = (int)int_val;
+        return val;
 
     } else {
-        return json_make_error(*begin, "unexpected character '" + std::string(*begin, *begin + 1) + "'");
+        *error = {*begin, "unexpected character"};
+        return nullptr;
     }
 }
 
-inline json_value json_dict_find(json_dict dict, std::string key) {
-    auto it = std::find_if(dict.begin(), dict.end(),
-        [&](std::pair<std::shared_ptr<json_value>, std::shared_ptr<json_value>>& kv){
-            return json_is_str(*kv.first) && json_as_str(*kv.first) == key;
-        });
-    return (it == dict.end()) ? json_make_error(nullptr, "key not found") : *it->second;
+inline const json_value* json_dict_find(const json_value* dict, const char* key) {
+    if (!json_is_dict(dict)) {
+        return nullptr;
+    }
+    for (const json_value* item = dict->first_child; item; item = item->next) {
+        if (json_str_equals(item, key)) {
+            return item->dict_val;
+        }
+    }
+    return nullptr;
 }
 
 #endif // __FIBRE_JSON_HPP
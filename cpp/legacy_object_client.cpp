@@ -5,6 +5,7 @@
 #include "legacy_protocol.hpp"
 #include "print_utils.hpp"
 #include <fibre/simple_serdes.hpp>
+#include <stdio.h>
 
 using namespace fibre;
 
@@ -59,34 +60,32 @@ std::unordered_map<std::string, Transcoder*> encoders = {
     {"endpoint_ref", &endpoint_ref_encoder}};
 
 std::vector<LegacyFibreArg> parse_arglist(
-    const json_value& list_val,
+    const json_value* list_val,
     const std::unordered_map<std::string, Transcoder*>& transcoders,
     Logger logger) {
     std::vector<LegacyFibreArg> arglist;
 
-    for (auto& arg :
-         json_is_list(list_val) ? json_as_list(list_val) : json_list()) {
-        if (!json_is_dict(*arg)) {
+    for (const json_value* arg = json_first(list_val); arg; arg = arg->next) {
+        if (!json_is_dict(arg)) {
             F_LOG_E(logger, "arglist is invalid");
             continue;
         }
-        auto dict = json_as_dict(*arg);
 
-        json_value name_val = json_dict_find(dict, "name");
-        json_value id_val = json_dict_find(dict, "id");
-        json_value type_val = json_dict_find(dict, "type");
+        const json_value* name_val = json_dict_find(arg, "name");
+        const json_value* id_val = json_dict_find(arg, "id");
+        const json_value* type_val = json_dict_find(arg, "type");
 
         if (!json_is_str(name_val) || !json_is_int(id_val) ||
-            ((int)(size_t)json_as_int(id_val) != json_as_int(id_val)) ||
             !json_is_str(type_val)) {
             F_LOG_E(logger, "arglist is invalid");
             continue;
         }
 
-        auto it = transcoders.find(json_as_str(type_val));
+        std::string type = json_as_str(type_val);
+        auto it = transcoders.find(type);
 
         arglist.push_back({json_as_str(name_val),
-                           it == transcoders.end() ? json_as_str(type_val)
+                           it == transcoders.end() ? type
                                                    : it->second->app_codec,
                            it == transcoders.end() ? nullptr : it->second,
                            (size_t)json_as_int(id_val)});
@@ -96,16 +95,27 @@ std::vector<LegacyFibreArg> parse_arglist(
 }
 
 void LegacyObjectClient::start(Node* node, Domain* domain,
+                                LegacyProtocolPacketBased* protocol,
                                 EndpointClientCallback default_endpoint_client,
                                 std::string path) {
     node_ = node;
     domain_ = domain;
+    protocol_ = protocol;
     default_endpoint_client_ = default_endpoint_client;
     path_ = path;
 
     chunks_[0] = Chunk(0, data0);
     chunks_[1] = Chunk::frame_boundary(0);
 
+    // Ask for the JSON version ID first. If the descriptor is already known
+    // we can skip reading it.
+    loading_version_id_ = true;
+    start_endpoint0_read(0xffffffff);
+}
+
+void LegacyObjectClient::start_endpoint0_read(uint32_t offset) {
+    write_le<uint32_t>(offset, data0);
+
     Socket* call = default_endpoint_client_.invoke(0, 1, {0}, {0}, this);
 
     tx_pos_ = BufChain{chunks_}.begin();
@@ -123,21 +133,151 @@ WriteResult LegacyObjectClient::write(WriteArgs args) {
     while (args.buf.n_chunks()) {
         auto front = args.buf.front();
         if (front.is_buf()) {
-            for (uint8_t b : front.buf()) {
-                json_.push_back(b);
-            }
+            json_.insert(json_.end(), front.buf().begin(), front.buf().end());
         } else {
             // end of JSON
         }
         args.buf = args.buf.skip_chunks(1);
     }
     if (args.status == kFibreClosed) {
-        load_json(json_);
-        json_ = {};  // free memory (but really who cares)
+        if (loading_version_id_) {
+            loading_version_id_ = false;
+            std::vector<uint8_t> response;
+            std::swap(response, json_);
+            on_version_id(response);
+        } else {
+            if (version_id_.has_value()) {
+                store_cached_json(*version_id_);
+            }
+            load_json(json_);
+            json_ = {};  // free memory (but really who cares)
+        }
     }
     return {args.status, args.buf.begin()};
 }
 
+static uint32_t calc_json_version_id(const std::vector<uint8_t>& json) {
+    // Must match the calculation in legacy_endpoints_template.j2
+    uint16_t json_crc = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(
+        PROTOCOL_VERSION, json.data(), json.size());
+    return ((uint32_t)json_crc << 16) |
+           calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(json_crc, json.data(),
+                                                  json.size());
+}
+
+static std::string get_cache_path(Fibre* ctx, uint32_t version_id) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%08x.json", (unsigned)version_id);
+    return ctx->legacy_descriptor_cache_dir + name;
+}
+
+void LegacyObjectClient::on_version_id(cbufptr_t response) {
+    if (response.size() != 4) {
+        F_LOG_D(domain_->ctx->logger,
+                "device did not report a JSON version ID");
+        start_endpoint0_read(0);
+        return;
+    }
+
+    version_id_ = read_le<uint32_t>(response.begin());
+    F_LOG_D(domain_->ctx->logger, "JSON version ID: " << as_hex(*version_id_));
+
+    if (load_cached_json(*version_id_)) {
+        F_LOG_D(domain_->ctx->logger, "using cached JSON");
+        load_json(json_);
+        json_ = {};
+    } else {
+        start_endpoint0_read(0);
+    }
+}
+
+/**
+ * @brief Looks up the JSON for the given version ID in the in-memory cache and
+ * then in the on-disk cache and loads it into json_ if found.
+ *
+ * Cache entries that don't match their version ID (e.g. because the file was
+ * corrupted) are removed.
+ */
+bool LegacyObjectClient::load_cached_json(uint32_t version_id) {
+#if FIBRE_ALLOW_HEAP
+    Fibre* ctx = domain_->ctx;
+
+    auto it = ctx->legacy_descriptor_cache.find(version_id);
+    if (it != ctx->legacy_descriptor_cache.end()) {
+        json_ = it->second;
+        return true;
+    }
+
+    if (ctx->legacy_descriptor_cache_dir.empty()) {
+        return false;
+    }
+
+    std::string path = get_cache_path(ctx, version_id);
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    std::vector<uint8_t> json;
+    uint8_t buf[4096];
+    size_t n_read;
+    while ((n_read = fread(buf, 1, sizeof(buf), file)) > 0) {
+        json.insert(json.end(), buf, buf + n_read);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+
+    if (!ok || calc_json_version_id(json) != version_id) {
+        F_LOG_W(ctx->logger, "discarding invalid cache file " << path);
+        remove(path.c_str());
+        return false;
+    }
+
+    json_ = json;
+    ctx->legacy_descriptor_cache[version_id] = json;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Stores json_ in the in-memory and on-disk cache if it matches the
+ * given version ID.
+ */
+void LegacyObjectClient::store_cached_json(uint32_t version_id) {
+#if FIBRE_ALLOW_HEAP
+    Fibre* ctx = domain_->ctx;
+
+    if (calc_json_version_id(json_) != version_id) {
+        F_LOG_W(ctx->logger, "JSON does not match version ID. Not caching it.");
+        return;
+    }
+
+    ctx->legacy_descriptor_cache[version_id] = json_;
+
+    if (ctx->legacy_descriptor_cache_dir.empty()) {
+        return;
+    }
+
+    // Write to a temporary file first so that concurrent readers never see a
+    // partially written file.
+    std::string path = get_cache_path(ctx, version_id);
+    std::string tmp_path = path + ".tmp";
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        F_LOG_D(ctx->logger, "cannot write cache file " << tmp_path);
+        return;
+    }
+    bool ok = fwrite(json_.data(), 1, json_.size(), file) == json_.size();
+    ok = !fclose(file) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+        F_LOG_D(ctx->logger, "cannot write cache file " << path);
+        remove(tmp_path.c_str());
+    }
+#endif
+}
+
 WriteArgs LegacyObjectClient::on_write_done(WriteResult result) {
     tx_pos_ = result.end;
     return {{tx_pos_, BufChain{chunks_}.c_end()}, kFibreClosed};
@@ -188,7 +328,7 @@ std::shared_ptr<LegacyInterface> LegacyObjectClient::get_property_interfaces(
 }
 
 std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(
-    json_value list_val) {
+    const json_value* list_val) {
     if (!json_is_list(list_val)) {
         F_LOG_E(domain_->ctx->logger, "interface members must be a list");
         return nullptr;
@@ -199,31 +339,30 @@ std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(
         .ep_num = 0,
         .json_crc = json_crc_,
         .intf = std::make_shared<LegacyInterface>(),
+        .client = this,
     };
     auto obj_ptr = std::make_shared<LegacyObject>(obj);
     LegacyInterface& intf = *obj_ptr->intf;
 
-    for (auto& item : json_as_list(list_val)) {
-        if (!json_is_dict(*item)) {
+    for (const json_value* item = json_first(list_val); item; item = item->next) {
+        if (!json_is_dict(item)) {
             F_LOG_E(domain_->ctx->logger, "expected dict");
             continue;
         }
-        auto dict = json_as_dict(*item);
 
-        json_value type = json_dict_find(dict, "type");
-        json_value name_val = json_dict_find(dict, "name");
+        const json_value* type = json_dict_find(item, "type");
+        const json_value* name_val = json_dict_find(item, "name");
         std::string name =
             json_is_str(name_val) ? json_as_str(name_val) : "[anonymous]";
 
-        if (json_is_str(type) && json_as_str(type) == "object") {
+        if (json_str_equals(type, "object")) {
             std::shared_ptr<LegacyObject> subobj =
-                load_object(json_dict_find(dict, "members"));
+                load_object(json_dict_find(item, "members"));
             intf.attributes.push_back({name, subobj});
 
-        } else if (json_is_str(type) && json_as_str(type) == "function") {
-            json_value id = json_dict_find(dict, "id");
-            if (!json_is_int(id) ||
-                ((int)(size_t)json_as_int(id) != json_as_int(id))) {
+        } else if (json_str_equals(type, "function")) {
+            const json_value* id = json_dict_find(item, "id");
+            if (!json_is_int(id)) {
                 continue;
             }
             intf.functions.push_back(
@@ -232,25 +371,24 @@ std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(
                     name,
                     (size_t)json_as_int(id),
                     obj_ptr.get(),
-                    parse_arglist(json_dict_find(dict, "inputs"), encoders,
+                    parse_arglist(json_dict_find(item, "inputs"), encoders,
                                   domain_->ctx->logger),
-                    parse_arglist(json_dict_find(dict, "outputs"), decoders,
+                    parse_arglist(json_dict_find(item, "outputs"), decoders,
                                   domain_->ctx->logger),
                 }));
 
-        } else if (json_is_str(type) && json_as_str(type) == "json") {
+        } else if (json_str_equals(type, "json")) {
             // Ignore
 
         } else if (json_is_str(type)) {
             std::string type_str = json_as_str(type);
-            json_value access = json_dict_find(dict, "access");
+            const json_value* access = json_dict_find(item, "access");
             std::string access_str =
                 json_is_str(access) ? json_as_str(access) : "r";
             bool can_write = access_str.find('w') != std::string::npos;
 
-            json_value id = json_dict_find(dict, "id");
-            if (!json_is_int(id) ||
-                ((int)(size_t)json_as_int(id) != json_as_int(id))) {
+            const json_value* id = json_dict_find(item, "id");
+            if (!json_is_int(id)) {
                 continue;
             }
 
@@ -259,6 +397,7 @@ std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(
                 .ep_num = (size_t)json_as_int(id),
                 .json_crc = json_crc_,
                 .intf = get_property_interfaces(type_str, can_write),
+                .client = this,
             };
             auto subobj_ptr = std::make_shared<LegacyObject>(subobj);
             objects_.push_back(subobj_ptr);
@@ -277,13 +416,15 @@ void LegacyObjectClient::load_json(cbufptr_t json) {
     F_LOG_D(domain_->ctx->logger, "received JSON of length " << json.size());
 
     const char* begin = reinterpret_cast<const char*>(json.begin());
-    auto val = json_parse(&begin, begin + json.size(), domain_->ctx->logger);
+    json_arena arena;
+    json_error err;
+    const json_value* val = json_parse(&begin, begin + json.size(), &arena, &err);
 
-    if (json_is_err(val)) {
+    if (!val) {
         size_t pos =
-            json_as_err(val).ptr - reinterpret_cast<const char*>(json.begin());
+            err.ptr - reinterpret_cast<const char*>(json.begin());
         F_LOG_E(domain_->ctx->logger,
-                "JSON parsing error: " << json_as_err(val).str
+                "JSON parsing error: " << err.str
                                        << " at position " << pos);
         return;
     } else if (!json_is_list(val)) {
@@ -302,6 +443,126 @@ void LegacyObjectClient::load_json(cbufptr_t json) {
     }
 }
 
+bool LegacyObjectClient::start_bulk_read(
+    std::vector<LegacyObject*> objs, bufptr_t rx_buf,
+    Callback<void, StreamStatus, uint8_t*> on_done) {
+    if (!protocol_) {
+        return false; // only supported on the legacy protocol
+    }
+
+    for (auto obj : objs) {
+        if (!obj || obj->client != this || !obj->ep_num) {
+            return false;
+        }
+    }
+
+    LegacyBulkRead* op = new LegacyBulkRead{};
+    op->client_ = this;
+    op->objs_ = objs;
+    op->rx_buf_ = rx_buf;
+    op->on_done_ = on_done;
+    op->send_next();
+    return true;
+}
+
+// Largest value of any legacy property codec
+static constexpr size_t kMaxLegacyValueSize = 8;
+
+void LegacyBulkRead::send_next() {
+    if (n_done_ == objs_.size()) {
+        complete(kStreamOk);
+        return;
+    }
+
+    LegacyProtocolPacketBased* protocol = client_->protocol_;
+
+    if (!(protocol->peer_capabilities_ & LEGACY_CAP_MULTI_ENDPOINT)) {
+        if (rx_buf_.size() < 1 + kMaxLegacyValueSize) {
+            complete(kStreamError);
+            return;
+        }
+        n_requested_ = 1;
+        protocol->start_endpoint_operation(
+            objs_[n_done_]->ep_num, client_->json_crc_, {},
+            {rx_buf_.begin() + 1, kMaxLegacyValueSize},
+            MEMBER_CB(this, on_endpoint_done));
+        return;
+    }
+
+    // Pack as many operations into the request as fit into one packet in
+    // each direction (8 bytes request overhead, 2 bytes response overhead).
+    size_t max_tx_size = protocol->tx_mtu_ - 8;
+    size_t max_rx_size = std::min(protocol->tx_mtu_ - 2, rx_buf_.size());
+    size_t rx_size = 0;
+    tx_buf_.clear();
+
+    while (n_done_ + n_requested_ < objs_.size() &&
+           tx_buf_.size() + 4 <= max_tx_size &&
+           rx_size + 1 + kMaxLegacyValueSize <= max_rx_size) {
+        uint8_t op[4];
+        write_le<uint16_t>(objs_[n_done_ + n_requested_]->ep_num, op);
+        op[2] = 0; // no input
+        op[3] = kMaxLegacyValueSize;
+        tx_buf_.insert(tx_buf_.end(), op, op + 4);
+        rx_size += 1 + kMaxLegacyValueSize;
+        n_requested_++;
+    }
+
+    if (!n_requested_) {
+        complete(kStreamError);
+        return;
+    }
+
+    protocol->start_endpoint_operation(
+        LEGACY_MULTI_ENDPOINT_ID, client_->json_crc_,
+        {tx_buf_.data(), tx_buf_.size()}, {rx_buf_.begin(), rx_size},
+        MEMBER_CB(this, on_multi_endpoint_done));
+}
+
+void LegacyBulkRead::on_multi_endpoint_done(EndpointOperationResult result) {
+    if (result.status != kStreamOk) {
+        complete(result.status);
+        return;
+    }
+
+    // Check that the response contains all requested values
+    cbufptr_t response{rx_buf_.begin(), result.rx_end};
+    for (size_t i = 0; i < n_requested_; ++i) {
+        if (!response.size() || response.size() < (size_t)1 + response.begin()[0]) {
+            F_LOG_E(client_->domain_->ctx->logger, "incomplete multi-endpoint response");
+            complete(kStreamError);
+            return;
+        }
+        response = response.skip(1 + response.begin()[0]);
+    }
+
+    rx_buf_ = rx_buf_.skip(response.begin() - rx_buf_.begin());
+    n_done_ += n_requested_;
+    n_requested_ = 0;
+    send_next();
+}
+
+void LegacyBulkRead::on_endpoint_done(EndpointOperationResult result) {
+    if (result.status != kStreamOk) {
+        complete(result.status);
+        return;
+    }
+
+    size_t length = result.rx_end - (rx_buf_.begin() + 1);
+    rx_buf_.begin()[0] = (uint8_t)length;
+    rx_buf_ = rx_buf_.skip(1 + length);
+    n_done_ += n_requested_;
+    n_requested_ = 0;
+    send_next();
+}
+
+void LegacyBulkRead::complete(StreamStatus status) {
+    uint8_t* rx_end = rx_buf_.begin();
+    Callback<void, StreamStatus, uint8_t*> on_done = on_done_;
+    delete this;
+    on_done.invoke(status, rx_end);
+}
+
 FunctionInfo* LegacyFunction::get_info() const {
     FunctionInfo* info = new FunctionInfo{
         .name = name, .inputs = {{"obj", "object_ref"}}, .outputs = {}};
@@ -1,6 +1,7 @@
 #ifndef __FIBRE_LEGACY_OBJECT_MODEL_HPP
 #define __FIBRE_LEGACY_OBJECT_MODEL_HPP
 
+#include <fibre/backport/optional.hpp>
 #include <fibre/backport/variant.hpp>
 #include <fibre/callback.hpp>
 #include <fibre/fibre.hpp>
@@ -90,19 +91,67 @@ struct LegacyObject {
     size_t ep_num;
     uint16_t json_crc;
     std::shared_ptr<LegacyInterface> intf;
+    LegacyObjectClient* client;
 };
 
 using EndpointClientCallback = Callback<Socket*, uint16_t, uint16_t, std::vector<uint16_t>, std::vector<uint16_t>, Socket*>;
 
+/**
+ * @brief Reads the values of several properties with as few endpoint
+ * operations as possible.
+ *
+ * If the peer supports multi-endpoint operations, as many properties as fit
+ * into one packet are read with a single request. Otherwise the properties are
+ * read one by one.
+ *
+ * The values are written to the output buffer in the same format as the
+ * response of a multi-endpoint operation, that is each value is prefixed with
+ * its length in bytes.
+ */
+struct LegacyBulkRead {
+    LegacyObjectClient* client_ = nullptr;
+    std::vector<LegacyObject*> objs_;
+    size_t n_done_ = 0; // number of values that were received
+    size_t n_requested_ = 0; // number of values in the request that is in progress
+    bufptr_t rx_buf_ = {nullptr, nullptr}; // remaining output buffer
+    std::vector<uint8_t> tx_buf_;
+    Callback<void, StreamStatus, uint8_t*> on_done_;
+
+    void send_next();
+    void on_multi_endpoint_done(EndpointOperationResult result);
+    void on_endpoint_done(EndpointOperationResult result);
+    void complete(StreamStatus status);
+};
+
 class LegacyObjectClient : public Socket {
 public:
-    void start(Node* node, Domain* domain_, EndpointClientCallback default_endpoint_client, std::string path);
+    void start(Node* node, Domain* domain_, LegacyProtocolPacketBased* protocol, EndpointClientCallback default_endpoint_client, std::string path);
+
+    /**
+     * @brief Starts reading the values of the specified property objects.
+     *
+     * @param objs: The property objects to read. They must all belong to
+     *        this client.
+     * @param rx_buf: The buffer for the values. Each value is prefixed with
+     *        a length byte, so 9 bytes per property are always sufficient.
+     * @param on_done: Invoked with the status and the end of the valid data
+     *        in rx_buf. Not invoked if this function returns false.
+     * @returns false if any of the objects is not a property of this client
+     *          or if this client does not run on the legacy protocol.
+     */
+    bool start_bulk_read(std::vector<LegacyObject*> objs, bufptr_t rx_buf,
+                         Callback<void, StreamStatus, uint8_t*> on_done);
 
     std::shared_ptr<LegacyInterface> get_property_interfaces(std::string codec,
                                                               bool write);
-    std::shared_ptr<LegacyObject> load_object(json_value list_val);
+    std::shared_ptr<LegacyObject> load_object(const json_value* list_val);
     void load_json(cbufptr_t json);
 
+    void start_endpoint0_read(uint32_t offset);
+    void on_version_id(cbufptr_t response);
+    bool load_cached_json(uint32_t version_id);
+    void store_cached_json(uint32_t version_id);
+
     WriteResult write(WriteArgs args) final;
     WriteArgs on_write_done(WriteResult result) final;
 
@@ -111,11 +160,14 @@ public:
 
     Node* node_;
     Domain* domain_;
+    LegacyProtocolPacketBased* protocol_;
     EndpointClientCallback default_endpoint_client_;
     std::string path_; // TODO: get dynamically from node
     CBufIt tx_pos_;
     std::vector<uint8_t> json_;
     uint16_t json_crc_;
+    bool loading_version_id_ = false; // true while the JSON version ID is being fetched
+    std::optional<uint32_t> version_id_; // JSON version ID as reported by the device
     std::vector<std::shared_ptr<LegacyObject>> objects_;
     std::shared_ptr<LegacyObject> root_obj_ = nullptr;
     Chunk chunks_[2];
@@ -1,5 +1,6 @@
 
 #include "legacy_object_server.hpp"
+#include "legacy_protocol.hpp"
 #include "codecs.hpp"
 #include <fibre/fibre.hpp>
 #include <algorithm>
@@ -19,6 +20,8 @@ RichStatus endpoint0_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer) {
     } else if (*offset == 0xffffffff) {
         // If the offset is special value 0xFFFFFFFF, send back the JSON version ID instead
         return write_le<uint32_t>(json_version_id_, output_buffer) ? RichStatus::success() : F_MAKE_ERR("decoding failed");
+    } else if (*offset == LEGACY_CAPABILITIES_OFFSET) {
+        return write_le<uint32_t>(LEGACY_CAP_MULTI_ENDPOINT, output_buffer) ? RichStatus::success() : F_MAKE_ERR("decoding failed");
     } else if (*offset >= embedded_json_length) {
         // Attempt to read beyond the buffer end - return empty response
         return RichStatus::success();
@@ -85,39 +88,31 @@ RichStatus LegacyObjectServer::endpoint_handler(Domain* domain, int idx, cbufptr
 
     } else {
         // This endpoint access is part of a function call
+        size_t trigger_ep = ep.type == EndpointType::kFunctionTrigger ? idx :
+                            ep.type == EndpointType::kFunctionInput ? idx - ep.function_input.trigger_offset :
+                            idx - ep.function_output.trigger_offset;
+        auto& trigger = endpoint_table[trigger_ep].function_trigger;
+        size_t last_ep = trigger_ep + trigger.n_inputs + trigger.n_outputs;
 
         if (idx != expected_ep_) {
             reset(); // reset function call state
 
-            // Find the end of the function and determine its arg sizes
-            for (size_t i = idx + 1; i < n_endpoints; ++i) {
-                if (endpoint_table[i].type == EndpointType::kFunctionInput) {
-                    n_inputs_++;
-                } else if (endpoint_table[i].type == EndpointType::kFunctionOutput) {
-                    output_size_ += endpoint_table[i].function_output.size;
-                    n_outputs_++;
-                } else {
-                    break;
-                }
-            }
-
             bool correct_first_ep_access = 
-                    (ep.type == EndpointType::kFunctionTrigger && n_inputs_ == 0) // functions with no in args
-                 || (ep.type == EndpointType::kFunctionInput && endpoint_table[idx - 1].type == EndpointType::kFunctionTrigger); // functions with some in args
+                    (ep.type == EndpointType::kFunctionTrigger && trigger.n_inputs == 0) // functions with no in args
+                 || (ep.type == EndpointType::kFunctionInput && (size_t)idx == trigger_ep + 1); // functions with some in args
 
             F_RET_IF(!correct_first_ep_access, "incorrect endpoint access");
 
-            trigger_ep_ = ep.type == EndpointType::kFunctionTrigger ? idx : (idx - 1);
-
-            if (ep.type != EndpointType::kFunctionTrigger) {
-                n_inputs_++;
-            }
+            trigger_ep_ = trigger_ep;
             
             // Wrate object ID into RX buf as first argument
             bufptr_t outbuf{rx_buf_};
             // TODO: this codec doesn't work like that
-            fibre::Codec<ServerObjectId>::encode(endpoint_table[trigger_ep_].function_trigger.object_id, &outbuf);
+            fibre::Codec<ServerObjectId>::encode(trigger.object_id, &outbuf);
             rx_pos_ = outbuf.begin() - rx_buf_;
+
+            F_RET_IF(rx_pos_ + trigger.input_size > sizeof(rx_buf_) || trigger.output_size > sizeof(tx_buf_),
+                     "function arguments too large");
         }
 
 
@@ -126,19 +121,18 @@ RichStatus LegacyObjectServer::endpoint_handler(Domain* domain, int idx, cbufptr
                      "size mismatch");
 
             // Copy input buffer into scratch buffer
-            std::copy_n(input_buffer->begin(), input_buffer->size(), rx_buf_ + rx_pos_);
-            rx_pos_ += input_buffer->size();
+            std::copy_n(input_buffer->begin(), input_buffer->size(), rx_buf_ + rx_pos_ + ep.function_input.offset);
             *input_buffer = input_buffer->skip(input_buffer->size());
 
             // advance progress (to next input or trigger ep)
-            expected_ep_ = (idx + 1 - trigger_ep_) % (n_inputs_ + 1) + trigger_ep_;
+            expected_ep_ = (size_t)idx == trigger_ep + trigger.n_inputs ? trigger_ep : idx + 1;
 
         } else if (ep.type == EndpointType::kFunctionTrigger) {
             F_RET_IF(input_buffer->size() != 0 || output_buffer->size() != 0,
                      "size mismatch");
 
             // invoke function
-            auto* func = domain->get_server_function(ep.function_trigger.function_id);
+            auto* func = domain->get_server_function(trigger.function_id);
             F_RET_IF(!func, "invalid function");
 
             uint8_t call_frame[256];
@@ -146,7 +140,7 @@ RichStatus LegacyObjectServer::endpoint_handler(Domain* domain, int idx, cbufptr
                 domain,
                 true, // start
                 call_frame,
-                {kFibreClosed, {rx_buf_, rx_pos_}, {tx_buf_, output_size_}}, // call buffers
+                {kFibreClosed, {rx_buf_, rx_pos_ + trigger.input_size}, {tx_buf_, trigger.output_size}}, // call buffers
                 {} // continuation
             )*/;
 
@@ -157,7 +151,7 @@ RichStatus LegacyObjectServer::endpoint_handler(Domain* domain, int idx, cbufptr
                      "legacy protocol return error " << call_buffer_release->status << " but legacy protocol does not support error reporting");
 
             // advance progress (to first output ep or to 0 if there are no outputs)
-            expected_ep_ = (trigger_ep_ + n_inputs_ + 1) % (trigger_ep_ + n_inputs_ + 1 + n_outputs_);
+            expected_ep_ = trigger.n_outputs ? trigger_ep + trigger.n_inputs + 1 : 0;
 
         } else if (ep.type == EndpointType::kFunctionOutput) {
             // copy to output buffer
@@ -165,14 +159,41 @@ RichStatus LegacyObjectServer::endpoint_handler(Domain* domain, int idx, cbufptr
                      "size mismatch");
 
             // Copy scratch buffer into output buffer
-            std::copy_n(tx_buf_ + tx_pos_, output_buffer->size(), output_buffer->begin());
-            tx_pos_ += output_buffer->size();
+            std::copy_n(tx_buf_ + ep.function_output.offset, output_buffer->size(), output_buffer->begin());
             *output_buffer = output_buffer->skip(output_buffer->size());
 
             // advance progress (to next output or 0)
-            expected_ep_ = (idx + 1) % (trigger_ep_ + n_inputs_ + 1 + n_outputs_);
+            expected_ep_ = (size_t)idx == last_ep ? 0 : idx + 1;
         }
 
         return RichStatus::success();
     }
 }
+
+
+RichStatus LegacyObjectServer::multi_endpoint_handler(Domain* domain, cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    while (input_buffer->size()) {
+        std::optional<uint16_t> endpoint_id = read_le<uint16_t>(input_buffer);
+        std::optional<uint8_t> n_input = read_le<uint8_t>(input_buffer);
+        F_RET_IF(!endpoint_id.has_value() || !n_input.has_value() || input_buffer->size() < (size_t)*n_input + 1,
+                 "malformed multi-endpoint request");
+        F_RET_IF(!output_buffer->size(), "multi-endpoint response too large");
+
+        cbufptr_t op_input_buffer{input_buffer->begin(), *n_input};
+        size_t n_output = std::min((size_t)input_buffer->begin()[*n_input], output_buffer->size() - 1);
+        *input_buffer = input_buffer->skip(*n_input + 1);
+
+        // The output of each operation is prefixed with its actual length.
+        // Operations that fail yield an empty output but don't affect the
+        // other operations.
+        bufptr_t op_output_buffer{output_buffer->begin() + 1, n_output};
+        F_LOG_IF_ERR(domain->ctx->logger,
+                     endpoint_handler(domain, *endpoint_id, &op_input_buffer, &op_output_buffer),
+                     "endpoint handler failed for endpoint " << *endpoint_id);
+        size_t length = op_output_buffer.begin() - (output_buffer->begin() + 1);
+        output_buffer->begin()[0] = (uint8_t)length;
+        *output_buffer = output_buffer->skip(1 + length);
+    }
+
+    return RichStatus::success();
+}
@@ -14,32 +14,34 @@ namespace fibre {
 
 class Domain;
 
+/**
+ * @brief Serves endpoint operations of the legacy protocol.
+ *
+ * Each transport (LegacyProtocolPacketBased instance) owns its own server so
+ * that function calls in progress on different transports don't interfere
+ * with each other.
+ */
 struct LegacyObjectServer {
     uint8_t rx_buf_[128];
-    size_t rx_pos_;
+    size_t rx_pos_; // start of the function's input arguments in rx_buf_
     uint8_t tx_buf_[128];
-    size_t tx_pos_;
     size_t expected_ep_ = 0;  // 0 while no call in progress
     size_t trigger_ep_;
-    size_t n_inputs_;
-    size_t n_outputs_;
-    size_t output_size_;
-
-    uint8_t call_state_[256];
 
     void reset() {
         rx_pos_ = 0;
-        tx_pos_ = 0;
         expected_ep_ = 0;
         trigger_ep_ = 0;
-        n_inputs_ = 0;
-        n_outputs_ = 0;
-        output_size_ = 0;
     }
 
     RichStatus endpoint_handler(Domain* domain, int idx,
                                 cbufptr_t* input_buffer,
                                 bufptr_t* output_buffer);
+
+    // Handles a request on LEGACY_MULTI_ENDPOINT_ID.
+    RichStatus multi_endpoint_handler(Domain* domain,
+                                      cbufptr_t* input_buffer,
+                                      bufptr_t* output_buffer);
 };
 
 enum class EndpointType {
@@ -53,15 +55,26 @@ enum class EndpointType {
 struct EndpointDefinition {
     EndpointType type;
     union {
+        // The input endpoints of a function immediately follow its trigger
+        // endpoint and are followed by the output endpoints. The span of the
+        // function is precomputed by the interface generator.
         struct {
             ServerFunctionId function_id;
             ServerObjectId object_id;
+            uint16_t n_inputs;
+            uint16_t n_outputs;
+            uint16_t input_size; // sum of all input sizes
+            uint16_t output_size; // sum of all output sizes
         } function_trigger;
         struct {
             unsigned size;
+            uint16_t trigger_offset; // distance to the trigger endpoint
+            uint16_t offset; // byte offset among the input arguments
         } function_input;
         struct {
             unsigned size;
+            uint16_t trigger_offset; // distance to the trigger endpoint
+            uint16_t offset; // byte offset among the output arguments
         } function_output;
         struct {
             ServerFunctionId read_function_id;
@@ -22,18 +22,29 @@ void PacketWrapper::start_write(cbufptr_t buffer, TransferHandle* handle, Callba
 
     if (state_ != kStateIdle) {
         completer.invoke({kStreamError, buffer.begin()});
+        return;
     }
 
-    // TODO: support buffer size >= 128
-    if (buffer.size() >= 128) {
+    if (buffer.size() > MAX_PACKET_PAYLOAD_SIZE) {
         completer.invoke({kStreamError, buffer.begin()});
+        return;
     }
 
     completer_ = completer;
 
-    header_buf_[0] = CANONICAL_PREFIX;
-    header_buf_[1] = static_cast<uint8_t>(buffer.size());
-    header_buf_[2] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header_buf_, 2);
+    // The length is encoded as base-128 varint so that packets shorter than
+    // 128 bytes keep the original 3-byte header.
+    size_t length = buffer.size();
+    header_length_ = 0;
+    header_buf_[header_length_++] = CANONICAL_PREFIX;
+    if (length < 0x80) {
+        header_buf_[header_length_++] = static_cast<uint8_t>(length);
+    } else {
+        header_buf_[header_length_++] = static_cast<uint8_t>(length & 0x7f) | 0x80;
+        header_buf_[header_length_++] = static_cast<uint8_t>(length >> 7);
+    }
+    header_buf_[header_length_] = calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, header_buf_, header_length_);
+    header_length_++;
     
     payload_buf_ = buffer;
 
@@ -41,9 +52,30 @@ void PacketWrapper::start_write(cbufptr_t buffer, TransferHandle* handle, Callba
     trailer_buf_[0] = (uint8_t)((crc16 >> 8) & 0xff),
     trailer_buf_[1] = (uint8_t)((crc16 >> 0) & 0xff);
 
-    state_ = kStateSendingHeader;
-    expected_tx_end_ = header_buf_ + 3;
-    tx_channel_->start_write(header_buf_, &inner_transfer_handle_, MEMBER_CB(this, complete));
+    size_t total_length = header_length_ + payload_buf_.size() + sizeof(trailer_buf_);
+
+    if (tx_channel_->supports_writev()) {
+        // Send the whole packet with a single call to the underlying sink
+        tx_chunks_[0] = Chunk{0, {header_buf_, header_length_}};
+        tx_chunks_[1] = Chunk{0, payload_buf_};
+        tx_chunks_[2] = Chunk{0, trailer_buf_};
+        tx_chain_ = tx_chunks_;
+        state_ = kStateSendingVectored;
+        tx_channel_->start_writev(tx_bufs_, tx_chain_.gather(tx_bufs_, 3), &inner_transfer_handle_, MEMBER_CB(this, complete_vectored));
+
+    } else if (total_length <= sizeof(coalescing_buf_)) {
+        memcpy(coalescing_buf_, header_buf_, header_length_);
+        memcpy(coalescing_buf_ + header_length_, payload_buf_.begin(), payload_buf_.size());
+        memcpy(coalescing_buf_ + header_length_ + payload_buf_.size(), trailer_buf_, sizeof(trailer_buf_));
+        state_ = kStateSendingCoalesced;
+        expected_tx_end_ = coalescing_buf_ + total_length;
+        tx_channel_->start_write({coalescing_buf_, expected_tx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+
+    } else {
+        state_ = kStateSendingHeader;
+        expected_tx_end_ = header_buf_ + header_length_;
+        tx_channel_->start_write({header_buf_, expected_tx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+    }
 }
 
 void PacketWrapper::cancel_write(TransferHandle transfer_handle) {
@@ -69,7 +101,11 @@ void PacketWrapper::complete(WriteResult0 result) {
         return;
     }
 
-    if (state_ == kStateSendingHeader) {
+    if (state_ == kStateSendingCoalesced) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({kStreamOk, payload_buf_.end()});
+
+    } else if (state_ == kStateSendingHeader) {
         state_ = kStateSendingPayload;
         expected_tx_end_ = payload_buf_.end();
         tx_channel_->start_write(payload_buf_, &inner_transfer_handle_, MEMBER_CB(this, complete));
@@ -85,6 +121,30 @@ void PacketWrapper::complete(WriteResult0 result) {
     }
 }
 
+void PacketWrapper::complete_vectored(WritevResult result) {
+    if (state_ == kStateCancelling) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({kStreamCancelled, payload_buf_.begin()});
+        return;
+    }
+
+    if (result.status != kStreamOk) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({result.status, payload_buf_.begin()});
+        return;
+    }
+
+    // Continue with the buffers (or parts thereof) that were not sent yet
+    tx_chain_ = tx_chain_.skip_data_bytes(result.n_bytes);
+    if (tx_chain_.n_chunks()) {
+        tx_channel_->start_writev(tx_bufs_, tx_chain_.gather(tx_bufs_, 3), &inner_transfer_handle_, MEMBER_CB(this, complete_vectored));
+        return;
+    }
+
+    state_ = kStateIdle;
+    completer_.invoke_and_clear({kStreamOk, payload_buf_.end()});
+}
+
 
 /* PacketUnwrapper -----------------------------------------------------------*/
 
@@ -95,25 +155,30 @@ void PacketUnwrapper::start_read(bufptr_t buffer, TransferHandle* handle, Callba
 
     if (state_ != kStateIdle) {
         completer.invoke({kStreamError, buffer.begin()});
+        return;
     }
 
     completer_ = completer;
     payload_buf_ = buffer;
-
     state_ = kStateReceivingHeader;
-    expected_rx_end_ = rx_buf_ + 3;
-    rx_channel_->start_read({rx_buf_, expected_rx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+
+    // If this is called from within the completer, the loop in process()
+    // takes care of it once the completer returns.
+    process();
 }
 
 void PacketUnwrapper::cancel_read(TransferHandle transfer_handle) {
-    state_ = kStateCancelling;
-    rx_channel_->cancel_read(inner_transfer_handle_);
+    if (inner_read_pending_) {
+        state_ = kStateCancelling;
+        rx_channel_->cancel_read(inner_transfer_handle_);
+    } else if (state_ != kStateIdle) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({kStreamCancelled, payload_buf_.begin()});
+    }
 }
 
 void PacketUnwrapper::complete(ReadResult result) {
-    // All code paths in this function must end with either of these two:
-    //   - rx_channel_->start_read() to bounce back control to the underlying stream
-    //   - safe_complete() to return control to the client
+    inner_read_pending_ = false;
 
     if (state_ == kStateCancelling) {
         state_ = kStateIdle;
@@ -127,81 +192,255 @@ void PacketUnwrapper::complete(ReadResult result) {
         return;
     }
 
-    if (result.end < expected_rx_end_) {
-        rx_channel_->start_read({result.end, expected_rx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
-        return;
+    if (direct_read_) {
+        n_payload_received_ = result.end - payload_buf_.begin();
+    } else {
+        rx_end_ = result.end - rx_buf_;
     }
 
-    if (state_ == kStateReceivingHeader) {
-        size_t n_discard;
+    process();
+}
 
-        // Process header
-        if (rx_buf_[0] != CANONICAL_PREFIX) {
-            n_discard = 1;
-        } else if ((rx_buf_[1] & 0x80)) {
-            n_discard = 2; // TODO: support packets larger than 128 bytes
-        } else if (calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, rx_buf_, 3)) {
-            n_discard = 3;
-        } else {
-            state_ = kStateReceivingPayload;
-            payload_length_ = std::min(payload_buf_.size(), (size_t)rx_buf_[1]);
-            expected_rx_end_ = payload_buf_.begin() + payload_length_;
-            rx_channel_->start_read(payload_buf_.take(payload_length_), &inner_transfer_handle_, MEMBER_CB(this, complete));
-            return;
-        }
+void PacketUnwrapper::complete_vectored(ReadvResult result) {
+    inner_read_pending_ = false;
 
-        // Header was bad: discard the bad header bytes and receive more
-        memmove(rx_buf_, rx_buf_ + n_discard, sizeof(rx_buf_) - n_discard);
-        rx_channel_->start_read(bufptr_t{rx_buf_}.skip(3 - n_discard), &inner_transfer_handle_, MEMBER_CB(this, complete));
+    if (state_ == kStateCancelling) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({kStreamCancelled, payload_buf_.begin()});
+        return;
+    }
+
+    if (result.status != kStreamOk) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({result.status, payload_buf_.begin()});
+        return;
+    }
+
+    // Whatever goes beyond the payload is the start of the trailer
+    size_t n_payload = std::min(result.n_bytes, rx_bufs_[0].size());
+    n_payload_received_ += n_payload;
+    rx_end_ = result.n_bytes - n_payload;
 
-    } else if (state_ == kStateReceivingPayload) {
-        expected_rx_end_ = rx_buf_ + 2;
-        state_ = kStateReceivingTrailer;
-        rx_channel_->start_read({rx_buf_, expected_rx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+    process();
+}
 
-    } else if (state_ == kStateReceivingTrailer) {
-        uint16_t crc = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, payload_buf_.begin(), payload_length_);
-        crc = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(crc, rx_buf_, 2);
+/**
+ * @brief Delivers packets from the read-ahead buffer for as long as the client
+ * keeps requesting them and reads more data from the underlying stream when
+ * needed.
+ *
+ * This runs as a loop rather than through recursion so that any number of
+ * back-to-back packets and synchronously completing reads can be handled
+ * without growing the stack.
+ */
+void PacketUnwrapper::process() {
+    if (processing_) {
+        return;
+    }
+    processing_ = true;
 
-        if (!crc) {
+    while (!inner_read_pending_ && (state_ == kStateReceivingHeader
+            || state_ == kStateReceivingPayload || state_ == kStateReceivingTrailer)) {
+        if (parse()) {
             state_ = kStateIdle;
             completer_.invoke_and_clear({kStreamOk, payload_buf_.begin() + payload_length_});
         } else {
+            start_inner_read();
+        }
+    }
+
+    processing_ = false;
+}
+
+/**
+ * @brief Consumes data from the read-ahead buffer until either a complete
+ * packet was copied to payload_buf_ (returns true) or more data is needed
+ * (returns false).
+ */
+bool PacketUnwrapper::parse() {
+    for (;;) {
+        uint8_t* begin = rx_buf_ + rx_begin_;
+        size_t n_available = rx_end_ - rx_begin_;
+
+        if (state_ == kStateReceivingHeader) {
+            if (!n_available) {
+                return false;
+            }
+
+            if (begin[0] != CANONICAL_PREFIX) {
+                // Skip garbage up to the next potential packet start
+                uint8_t* prefix = static_cast<uint8_t*>(memchr(begin, CANONICAL_PREFIX, n_available));
+                rx_begin_ = prefix ? prefix - rx_buf_ : rx_end_;
+                continue;
+            }
+
+            size_t header_length = (n_available >= 2 && (begin[1] & 0x80)) ? 4 : 3;
+            if (n_available < header_length) {
+                return false;
+            }
+
+            size_t length = (header_length == 4)
+                ? ((begin[1] & 0x7f) | ((size_t)begin[2] << 7))
+                : begin[1];
+
+            // Discard the prefix if the header is invalid or if the packet
+            // doesn't fit into the client's buffer.
+            if ((header_length == 4 && (begin[2] & 0x80))
+                    || calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, begin, header_length)
+                    || length > payload_buf_.size()) {
+                rx_begin_++;
+                continue;
+            }
+
+            if (n_available >= header_length + length + 2) {
+                // The entire packet is buffered. Validate it in place so that
+                // the buffered bytes can be rescanned if the trailer is bad.
+                if (calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, begin + header_length, length + 2)) {
+                    rx_begin_++;
+                    continue;
+                }
+                memcpy(payload_buf_.begin(), begin + header_length, length);
+                rx_begin_ += header_length + length + 2;
+                payload_length_ = length;
+                return true;
+            }
+
+            rx_begin_ += header_length;
+            payload_length_ = length;
+            n_payload_received_ = 0;
+            state_ = kStateReceivingPayload;
+
+        } else if (state_ == kStateReceivingPayload) {
+            size_t n_copy = std::min(n_available, payload_length_ - n_payload_received_);
+            memcpy(payload_buf_.begin() + n_payload_received_, begin, n_copy);
+            rx_begin_ += n_copy;
+            n_payload_received_ += n_copy;
+            if (n_payload_received_ < payload_length_) {
+                return false;
+            }
+            state_ = kStateReceivingTrailer;
+
+        } else if (state_ == kStateReceivingTrailer) {
+            if (n_available < 2) {
+                return false;
+            }
+            uint16_t crc = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, payload_buf_.begin(), payload_length_);
+            crc = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(crc, begin, 2);
+            rx_begin_ += 2;
             state_ = kStateReceivingHeader;
-            expected_rx_end_ = rx_buf_ + 3;
-            rx_channel_->start_read({rx_buf_, expected_rx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+            if (!crc) {
+                return true;
+            }
+            // Bad trailer: drop the packet and continue with the next one
+
+        } else {
+            return false;
         }
     }
 }
 
+void PacketUnwrapper::start_inner_read() {
+    inner_read_pending_ = true;
+
+    if (state_ == kStateReceivingPayload) {
+        // The read-ahead buffer is exhausted (otherwise parse() would have
+        // consumed it). Read the rest of the payload directly.
+        bufptr_t rest = {payload_buf_.begin() + n_payload_received_, payload_buf_.begin() + payload_length_};
+
+        if (rx_channel_->supports_readv()) {
+            // The trailer and whatever follows it go to the read-ahead buffer
+            // within the same read.
+            rx_begin_ = rx_end_ = 0;
+            rx_bufs_[0] = rest;
+            rx_bufs_[1] = rx_buf_;
+            rx_channel_->start_readv(rx_bufs_, 2, &inner_transfer_handle_, MEMBER_CB(this, complete_vectored));
+        } else {
+            direct_read_ = true;
+            rx_channel_->start_read(rest, &inner_transfer_handle_, MEMBER_CB(this, complete));
+        }
+        return;
+    }
+
+    // Move the unparsed bytes (at most one incomplete header or trailer) to
+    // the front and fill up the rest of the buffer.
+    memmove(rx_buf_, rx_buf_ + rx_begin_, rx_end_ - rx_begin_);
+    rx_end_ -= rx_begin_;
+    rx_begin_ = 0;
+
+    direct_read_ = false;
+    rx_channel_->start_read({rx_buf_ + rx_end_, rx_buf_ + sizeof(rx_buf_)}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+}
+
 
 /* LegacyProtocolPacketBased -------------------------------------------------*/
 
 #if FIBRE_ENABLE_CLIENT
 
+LegacyProtocolPacketBased::~LegacyProtocolPacketBased() {
+    for (Call* call: calls_) {
+        if (call->in_use_) {
+            call->parent_ = nullptr; // the call deletes itself once it's finished
+        } else {
+            delete call;
+        }
+    }
+}
+
 Socket* LegacyProtocolPacketBased::start_call(uint16_t ep_num, uint16_t json_crc, std::vector<uint16_t> in_arg_ep_nums, std::vector<uint16_t> out_arg_ep_nums, Socket* caller) {
-    Call* call = new Call{}; // deleted in write() or on_write_done()
+    // Calls are recycled rather than deleted so that their argument buffers
+    // are only allocated once.
+    Call* call;
+    if (free_calls_.size()) {
+        call = free_calls_.back();
+        free_calls_.pop_back();
+    } else {
+        call = new Call{}; // deleted in the destructor of this protocol instance
+        calls_.push_back(call);
+    }
+
+    call->in_use_ = true;
     call->parent_ = this;
     call->ep_num_ = ep_num;
     call->json_crc_ = json_crc;
     call->caller_ = caller;
-    call->in_arg_ep_nums_ = in_arg_ep_nums;
-    call->out_arg_ep_nums_ = out_arg_ep_nums;
+    call->in_arg_ep_nums_.assign(in_arg_ep_nums.begin(), in_arg_ep_nums.end());
+    call->out_arg_ep_nums_.assign(out_arg_ep_nums.begin(), out_arg_ep_nums.end());
     return call;
 }
 
+void LegacyProtocolPacketBased::Call::release() {
+    if (!parent_) {
+        delete this; // protocol instance is already gone
+        return;
+    }
+
+    // Clear all buffers but keep their capacity for the next call
+    for (size_t i = 0; i <= n_in_args_ && i < in_args_.size(); ++i) {
+        in_args_[i].clear();
+    }
+    n_in_args_ = 0;
+    n_out_args = 0;
+    ops_.clear();
+    chunks_.clear();
+    error_ = false;
+    in_use_ = false;
+    parent_->free_calls_.push_back(this);
+}
+
 WriteResult LegacyProtocolPacketBased::Call::write(WriteArgs args) {
     while (args.buf.n_chunks()) {
         Chunk chunk = args.buf.front();
         args.buf = args.buf.skip_chunks(1);
 
-        if (chunk.is_buf() && chunk.layer() == 0) {
-            for (auto b : chunk.buf()) {
-                last_arg_.push_back(b);
+        if (chunk.layer() == 0 && (chunk.is_buf() || chunk.is_frame_boundary())) {
+            if (in_args_.size() <= n_in_args_) {
+                in_args_.emplace_back();
+            }
+            if (chunk.is_buf()) {
+                in_args_[n_in_args_].insert(in_args_[n_in_args_].end(), chunk.buf().begin(), chunk.buf().end());
+            } else {
+                n_in_args_++;
             }
-        } else if (chunk.is_frame_boundary() && chunk.layer() == 0) {
-            in_args_.push_back(last_arg_);
-            last_arg_ = {};
         } else {
             error_ = true;
         }
@@ -209,8 +448,11 @@ WriteResult LegacyProtocolPacketBased::Call::write(WriteArgs args) {
 
     // Dispatch legacy-style endpoint operations for each argument
     if (args.status == kFibreClosed && !error_) {
-        if (in_args_.size() != in_arg_ep_nums_.size()) {
+        if (n_in_args_ != in_arg_ep_nums_.size()) {
             error_ = true;
+            if (in_args_.size() < in_arg_ep_nums_.size()) {
+                in_args_.resize(in_arg_ep_nums_.size());
+            }
         }
 
         for (size_t i = 0; i < in_arg_ep_nums_.size(); ++i) {
@@ -219,9 +461,10 @@ WriteResult LegacyProtocolPacketBased::Call::write(WriteArgs args) {
             }
         }
 
-        std::vector<uint8_t> buf;
-        buf.resize(512);
-        out_args_ = std::vector<std::vector<uint8_t>>{out_arg_ep_nums_.size(), buf};
+        out_args_.resize(out_arg_ep_nums_.size());
+        for (auto& arg: out_args_) {
+            arg.resize(512);
+        }
 
         ops_.push_back(parent_->start_endpoint_operation(ep_num_, json_crc_,
             in_arg_ep_nums_.size() == 1 && in_arg_ep_nums_[0] == ep_num_ ? cbufptr_t{in_args_[0]} : cbufptr_t{},
@@ -246,7 +489,8 @@ void LegacyProtocolPacketBased::Call::on_ep_operation_done(EndpointOperationResu
     
     if (ops_.size() <= out_arg_ep_nums_.size()) {
         // special handling for endpoint 0
-        bool restart = ep_num_ == 0 && (result.rx_end != &*out_args_[n_out_args].end() - 512) && in_args_.size() == 1 && in_args_[0].size() == 4;
+        bool restart = ep_num_ == 0 && parent_ && (result.rx_end != &*out_args_[n_out_args].end() - 512) && n_in_args_ == 1 && in_args_[0].size() == 4
+                    && read_le<uint32_t>(in_args_[0].data()) != 0xffffffff; // the version ID is not part of the JSON
 
         out_args_[n_out_args].erase(out_args_[n_out_args].begin() + (result.rx_end - out_args_[n_out_args].data()), out_args_[n_out_args].end());
 
@@ -277,7 +521,7 @@ void LegacyProtocolPacketBased::Call::on_ep_operation_done(EndpointOperationResu
             }
             chunk_pos = result.end;
             if (chunk_pos == CBufIt{&*chunks_.end()} && result.status != kFibreOk) {
-                delete this; // close call
+                release(); // close call
                 return;
             }
         }
@@ -288,7 +532,7 @@ WriteArgs LegacyProtocolPacketBased::Call::on_write_done(WriteResult result) {
     chunk_pos = result.end;
     BufChain next = {chunk_pos, &*chunks_.end()};
     if (result.status != kFibreOk) {
-        delete this; // close call
+        release(); // close call
         return {{}, result.status};
     } else {
         return {next, kFibreClosed};
@@ -325,36 +569,107 @@ EndpointOperationHandle LegacyProtocolPacketBased::start_endpoint_operation(uint
         .callback = callback
     };
 
-    if (tx_handle_) {
-        F_LOG_D(domain_->ctx->logger, "Endpoint operation already in progress. Enqueuing this one.");
+    pending_operations_.push_back(op);
+    dispatch_endpoint_operations();
 
-        // A TX operation is already in progress. Enqueue this one.
-        pending_operations_.push_back(op);
-    } else {
-        start_endpoint_operation(op);
+    return op.seqno | 0xffff0000;
+}
+
+/**
+ * @brief Moves pending operations into the send window for as long as their
+ * window slot is free and starts transmitting if the TX channel is idle.
+ *
+ * Operations enter the window strictly in order of their sequence number so
+ * at most FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE operations are outstanding at any
+ * time.
+ */
+void LegacyProtocolPacketBased::dispatch_endpoint_operations() {
+    while (pending_operations_.size()) {
+        EndpointOperation& op = pending_operations_.front();
+        WindowSlot& slot = get_slot(op.seqno);
+        if (slot.in_use) {
+            F_LOG_D(domain_->ctx->logger, "Send window full. Enqueuing endpoint operation.");
+            break;
+        }
+
+        write_le<uint16_t>(op.seqno, slot.tx_buf);
+        write_le<uint16_t>(op.endpoint_id | 0x8000, slot.tx_buf + 2);
+        write_le<uint16_t>(op.rx_buf.size(), slot.tx_buf + 4);
+
+        size_t mtu = std::min(sizeof(slot.tx_buf), tx_mtu_);
+        size_t n_payload = std::min(std::max(mtu, (size_t)8) - 8, op.tx_buf.size());
+
+        memcpy(slot.tx_buf + 6, op.tx_buf.begin(), n_payload);
+
+        uint16_t trailer = (op.endpoint_id & 0x7fff) == 0 ?
+                           PROTOCOL_VERSION : client_.json_crc_;
+
+        write_le<uint16_t>(trailer, slot.tx_buf + 6 + n_payload);
+
+        slot.in_use = true;
+        slot.tx_started = false;
+        slot.op = op;
+        slot.tx_length = 8 + n_payload;
+        pending_operations_.pop_front();
     }
 
-    return op.seqno | 0xffff0000;
+    if (!tx_handle_) {
+        start_next_transmission();
+    }
+}
+
+/**
+ * @brief Starts transmitting the next operation in the send window, if any.
+ *
+ * Must only be called while the TX channel is idle. Returns true if a
+ * transmission was started.
+ */
+bool LegacyProtocolPacketBased::start_next_transmission() {
+    WindowSlot& slot = get_slot(next_tx_seq_no_);
+    if (!slot.in_use || slot.tx_started) {
+        return false;
+    }
+
+    next_tx_seq_no_ = (next_tx_seq_no_ + 1) & 0x7fff;
+    slot.tx_started = true;
+    transmitting_op_ = slot.op.handle();
+    tx_channel_->start_write({slot.tx_buf, slot.tx_length}, &tx_handle_, MEMBER_CB(this, on_write_finished));
+    return true;
+}
+
+void LegacyProtocolPacketBased::complete_endpoint_operation(WindowSlot& slot, StreamStatus status, const uint8_t* tx_end) {
+    EndpointOperation op = slot.op;
+    slot.in_use = false;
+    op.callback.invoke_and_clear({op.handle(), status, tx_end, op.rx_buf.begin()});
 }
 
-void LegacyProtocolPacketBased::start_endpoint_operation(EndpointOperation op) {
-    write_le<uint16_t>(op.seqno, tx_buf_);
-    write_le<uint16_t>(op.endpoint_id | 0x8000, tx_buf_ + 2);
-    write_le<uint16_t>(op.rx_buf.size(), tx_buf_ + 4);
+void LegacyProtocolPacketBased::on_mtu_probe_done(EndpointOperationResult result) {
+    if (result.status != kStreamOk) {
+        return;
+    }
 
-    size_t mtu = std::min(sizeof(tx_buf_), tx_mtu_);
-    size_t n_payload = std::min(std::max(mtu, (size_t)8) - 8, op.tx_buf.size());
+    if (result.rx_end != mtu_probe_rx_ + sizeof(mtu_probe_rx_)) {
+        F_LOG_D(domain_->ctx->logger, "peer does not support MTU negotiation, keeping MTU at " << tx_mtu_);
+        return;
+    }
 
-    memcpy(tx_buf_ + 6, op.tx_buf.begin(), n_payload);
+    size_t peer_mru = read_le<uint16_t>(mtu_probe_rx_);
+    tx_mtu_ = std::max(tx_mtu_, std::min(sizeof(tx_buf_), peer_mru));
+    F_LOG_D(domain_->ctx->logger, "negotiated MTU: " << tx_mtu_);
+}
 
-    uint16_t trailer = (op.endpoint_id & 0x7fff) == 0 ?
-                       PROTOCOL_VERSION : client_.json_crc_;
+void LegacyProtocolPacketBased::on_capabilities_done(EndpointOperationResult result) {
+    if (result.status != kStreamOk) {
+        return;
+    }
 
-    write_le<uint16_t>(trailer, tx_buf_ + 6 + n_payload);
+    if (result.rx_end != capabilities_rx_ + sizeof(capabilities_rx_)) {
+        F_LOG_D(domain_->ctx->logger, "peer does not report capabilities");
+        return;
+    }
 
-    expected_acks_[op.seqno] = op;
-    transmitting_op_ = op.seqno | 0xffff0000;
-    tx_channel_->start_write(cbufptr_t{tx_buf_}.take(8 + n_payload), &tx_handle_, MEMBER_CB(this, on_write_finished));
+    peer_capabilities_ = read_le<uint32_t>(capabilities_rx_);
+    F_LOG_D(domain_->ctx->logger, "peer capabilities: " << as_hex(peer_capabilities_));
 }
 
 /*
@@ -402,6 +717,30 @@ void LegacyProtocolPacketBased::cancel_endpoint_operation(EndpointOperationHandl
 
 #endif
 
+#if FIBRE_ENABLE_SERVER
+
+/**
+ * @brief Handles an MTU probe that was sent by the peer via endpoint 0.
+ *
+ * Returns false if the request is not an MTU probe, in which case it should be
+ * handled as a normal endpoint 0 request.
+ */
+bool LegacyProtocolPacketBased::handle_mtu_probe(cbufptr_t input_buffer, bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(&input_buffer);
+    std::optional<uint16_t> peer_mru = read_le<uint16_t>(&input_buffer);
+
+    if (!offset.has_value() || *offset != LEGACY_MTU_PROBE_OFFSET || !peer_mru.has_value()) {
+        return false;
+    }
+
+    tx_mtu_ = std::max(tx_mtu_, std::min(sizeof(tx_buf_), (size_t)*peer_mru));
+    write_le<uint16_t>((uint16_t)sizeof(rx_buf_), output_buffer);
+    F_LOG_D(domain_->ctx->logger, "peer requested MTU negotiation, new MTU: " << tx_mtu_);
+    return true;
+}
+
+#endif
+
 void LegacyProtocolPacketBased::on_write_finished(WriteResult0 result) {
     tx_handle_ = 0;
 
@@ -413,29 +752,24 @@ void LegacyProtocolPacketBased::on_write_finished(WriteResult0 result) {
 #if FIBRE_ENABLE_CLIENT
     if (transmitting_op_) {
         uint16_t seqno = transmitting_op_ & 0xffff;
-        EndpointOperationHandle handle = transmitting_op_;
         transmitting_op_ = 0;
 
-        auto it = expected_acks_.find(seqno);
+        WindowSlot& slot = get_slot(seqno);
 
-        size_t n_sent = std::max((size_t)(result.end - tx_buf_), (size_t)8) - 8;
-        it->second.tx_buf = it->second.tx_buf.skip(n_sent);
-        it->second.tx_done = true;
+        size_t n_sent = std::max((size_t)(result.end - slot.tx_buf), (size_t)8) - 8;
+        slot.op.tx_buf = slot.op.tx_buf.skip(n_sent);
+        slot.op.tx_done = true;
 
-        if (it->second.rx_done) {
+        if (slot.op.rx_done) {
             // It's possible that the RX operation completes before the TX operation
-            auto op = it->second;
-            expected_acks_.erase(it);
-            op.callback.invoke_and_clear({handle, kStreamOk, op.tx_buf.begin(), op.rx_buf.begin()});
+            complete_endpoint_operation(slot, kStreamOk, slot.op.tx_buf.begin());
         } else if (result.status != kStreamOk) {
             // If the TX task was a remote endpoint operation but didn't succeed
             // we terminate that operation
-            auto op = it->second;
-            expected_acks_.erase(it);
-            op.callback.invoke_and_clear({handle, result.status, result.end, op.rx_buf.begin()});
+            complete_endpoint_operation(slot, result.status, result.end);
         }
 
-        if (transmitting_op_) {
+        if (tx_handle_) {
             return;
         }
     }
@@ -459,16 +793,9 @@ void LegacyProtocolPacketBased::on_write_finished(WriteResult0 result) {
 #endif
 
 #if FIBRE_ENABLE_CLIENT
-    if (pending_operations_.size() > 0) {
-        // There is a write operation pending from the client side (i.e. an
-        // outgoing remote endpoint operation).
-        EndpointOperation op = pending_operations_[0];
-        pending_operations_.erase(pending_operations_.begin());
-        start_endpoint_operation(op);
-        if (transmitting_op_) {
-            return;
-        }
-    }
+    // Move operations into the window slots that were freed up and send the
+    // next outgoing remote endpoint operation.
+    dispatch_endpoint_operations();
 #endif
 }
 
@@ -506,22 +833,21 @@ void LegacyProtocolPacketBased::on_read_finished(ReadResult result) {
 
 #if FIBRE_ENABLE_CLIENT
         
-        auto it = expected_acks_.find(*seq_no & 0x7fff);
+        WindowSlot& slot = get_slot(*seq_no & 0x7fff);
 
-        if (it == expected_acks_.end()) {
+        if (!slot.in_use || slot.op.seqno != (*seq_no & 0x7fff) || slot.op.rx_done) {
             F_LOG_E(domain_->ctx->logger, "received unexpected ACK: " << (*seq_no & 0x7fff));
         } else {
-            size_t n_copy = std::min((size_t)(result.end - rx_buf.begin()), it->second.rx_buf.size());
-            memcpy(it->second.rx_buf.begin(), rx_buf.begin(), n_copy);
-            it->second.rx_buf = it->second.rx_buf.skip(n_copy);
-            it->second.rx_done = true;
+            size_t n_copy = std::min((size_t)(result.end - rx_buf.begin()), slot.op.rx_buf.size());
+            memcpy(slot.op.rx_buf.begin(), rx_buf.begin(), n_copy);
+            slot.op.rx_buf = slot.op.rx_buf.skip(n_copy);
+            slot.op.rx_done = true;
             F_LOG_T(domain_->ctx->logger, "received ACK: " << (*seq_no & 0x7fff));
 
             // It's possible that the RX operation completes before the TX operation
-            if (it->second.tx_done) {
-                auto op = it->second;
-                expected_acks_.erase(it);
-                op.callback.invoke_and_clear({op.handle(), kStreamOk, op.tx_buf.begin(), op.rx_buf.begin()});
+            if (slot.op.tx_done) {
+                complete_endpoint_operation(slot, kStreamOk, slot.op.tx_buf.begin());
+                dispatch_endpoint_operations();
             }
         }
 
@@ -575,9 +901,17 @@ void LegacyProtocolPacketBased::on_read_finished(ReadResult result) {
 
         cbufptr_t input_buffer{rx_buf.begin(), rx_buf.end() - 2};
         bufptr_t output_buffer{tx_buf_ + 2, expected_response_length};
-        F_LOG_IF_ERR(domain_->ctx->logger,
-                     server_.endpoint_handler(domain_, endpoint_id, &input_buffer, &output_buffer),
-                     "endpoint handler failed");
+        if (endpoint_id == 0 && negotiate_mtu_ && handle_mtu_probe(input_buffer, &output_buffer)) {
+            // handled locally
+        } else if (endpoint_id == LEGACY_MULTI_ENDPOINT_ID) {
+            F_LOG_IF_ERR(domain_->ctx->logger,
+                         server_.multi_endpoint_handler(domain_, &input_buffer, &output_buffer),
+                         "multi-endpoint handler failed");
+        } else {
+            F_LOG_IF_ERR(domain_->ctx->logger,
+                         server_.endpoint_handler(domain_, endpoint_id, &input_buffer, &output_buffer),
+                         "endpoint handler failed");
+        }
         
 
         // Send response
@@ -616,18 +950,18 @@ void LegacyProtocolPacketBased::on_rx_tx_closed(StreamStatus status) {
 
 #if FIBRE_ENABLE_CLIENT
     // Cancel pending endpoint operation
-    for (auto& op: pending_operations_) {
+    std::deque<EndpointOperation> pending_operations;
+    std::swap(pending_operations, pending_operations_);
+    for (auto& op: pending_operations) {
         op.callback.invoke_and_clear({op.handle(), status, op.tx_buf.begin(), op.rx_buf.begin()});
     }
-    pending_operations_.clear();
 
     // Cancel all ongoing endpoint operations
-    for (auto& item: expected_acks_) {
-        if (item.second.callback.has_value()) {
-            item.second.callback.invoke_and_clear({item.second.handle(), status, item.second.tx_buf.begin(), item.second.rx_buf.begin()});
+    for (auto& slot: window_) {
+        if (slot.in_use) {
+            complete_endpoint_operation(slot, status, slot.op.tx_buf.begin());
         }
     }
-    expected_acks_.clear();
 
     // Report that the root object was lost
     if (client_.root_obj_) {
@@ -646,7 +980,16 @@ void LegacyProtocolPacketBased::start(Callback<void, LegacyProtocolPacketBased*,
 
 #if FIBRE_ENABLE_CLIENT
     if (on_stopped_.has_value()) {
-        client_.start(nullptr, domain_, MEMBER_CB(this, start_call), std::string{intf_name_} + " (legacy protocol)");
+        if (negotiate_mtu_) {
+            // Announce our receive capacity before the object tree is loaded so
+            // that the JSON descriptor can already be fetched in large packets.
+            write_le<uint32_t>(LEGACY_MTU_PROBE_OFFSET, mtu_probe_tx_);
+            write_le<uint16_t>((uint16_t)sizeof(rx_buf_), mtu_probe_tx_ + 4);
+            start_endpoint_operation(0, PROTOCOL_VERSION, mtu_probe_tx_, mtu_probe_rx_, MEMBER_CB(this, on_mtu_probe_done));
+        }
+        write_le<uint32_t>(LEGACY_CAPABILITIES_OFFSET, capabilities_tx_);
+        start_endpoint_operation(0, PROTOCOL_VERSION, capabilities_tx_, capabilities_rx_, MEMBER_CB(this, on_capabilities_done));
+        client_.start(nullptr, domain_, this, MEMBER_CB(this, start_call), std::string{intf_name_} + " (legacy protocol)");
     }
 #endif
 }
@@ -2,13 +2,13 @@
 #define __FIBRE_LEGACY_PROTOCOL_HPP
 
 #include <fibre/async_stream.hpp>
+#include <fibre/bufchain.hpp>
 #include <fibre/config.hpp>
 
 #if FIBRE_ENABLE_CLIENT
 #include "legacy_object_client.hpp"
-#include <unordered_map>
+#include <deque>
 #include <optional>
-#include <queue>
 #endif
 
 #if FIBRE_ENABLE_SERVER
@@ -34,6 +34,44 @@ constexpr uint8_t CANONICAL_PREFIX = 0xAA;
 
 constexpr uint16_t PROTOCOL_VERSION = 1;
 
+// The length field of a stream packet header is a little endian base-128
+// varint of at most two bytes. Lengths below 128 therefore produce the original
+// 3-byte header [prefix, length, crc8]. Longer packets are only sent after the
+// peer announced that it can receive them (see LEGACY_MTU_PROBE_OFFSET).
+constexpr size_t MAX_PACKET_HEADER_SIZE = 4;
+constexpr size_t MAX_PACKET_PAYLOAD_SIZE = 0x3fff;
+
+// If an endpoint 0 request carries this offset followed by a 16-bit integer,
+// the integer is interpreted as the largest packet that the requester can
+// receive. The response contains the corresponding value for the responder.
+// Peers that don't support this return an empty response (offset beyond the
+// JSON length) in which case both sides keep the legacy 127 byte MTU.
+constexpr uint32_t LEGACY_MTU_PROBE_OFFSET = 0xfffffffe;
+
+// If an endpoint 0 request carries this offset, the response is a 32-bit
+// bitmask of LEGACY_CAP_* flags. Peers that don't know this return an empty
+// response, meaning no capabilities.
+constexpr uint32_t LEGACY_CAPABILITIES_OFFSET = 0xfffffffd;
+
+// The peer accepts requests on LEGACY_MULTI_ENDPOINT_ID.
+constexpr uint32_t LEGACY_CAP_MULTI_ENDPOINT = 0x00000001;
+
+// Endpoint ID of the multi-endpoint operation. The request payload is a list
+// of endpoint operations, each encoded as
+//   [endpoint_id: u16, n_input: u8, input: n_input bytes, n_output: u8]
+// and the response is the concatenation of their results, each encoded as
+//   [length: u8, output: length bytes]
+// where length is at most n_output. The trailer is the JSON CRC, as for all
+// endpoints except endpoint 0.
+constexpr uint16_t LEGACY_MULTI_ENDPOINT_ID = 0x7fff;
+
+static_assert(FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE >= 1 && FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE <= 128
+              && !(FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE & (FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE - 1)),
+              "FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE must be a power of two no larger than 128");
+
+static_assert(FIBRE_LEGACY_PROTOCOL_BUF_SIZE >= 128 && FIBRE_LEGACY_PROTOCOL_BUF_SIZE <= MAX_PACKET_PAYLOAD_SIZE,
+              "FIBRE_LEGACY_PROTOCOL_BUF_SIZE out of range");
+
 
 class PacketWrapper : public AsyncStreamSink {
 public:
@@ -45,18 +83,26 @@ public:
 
 private:
     void complete(WriteResult0 result);
+    void complete_vectored(WritevResult result);
 
     AsyncStreamSink* tx_channel_;
     TransferHandle inner_transfer_handle_;
-    uint8_t header_buf_[3];
+    uint8_t header_buf_[MAX_PACKET_HEADER_SIZE];
+    size_t header_length_ = 0;
     uint8_t trailer_buf_[2];
     const uint8_t* expected_tx_end_;
     cbufptr_t payload_buf_ = {nullptr, nullptr};
+    Chunk tx_chunks_[3]; // header, payload and trailer if the sink supports start_writev()
+    BufChain tx_chain_; // the part of tx_chunks_ that is not sent yet
+    cbufptr_t tx_bufs_[3]; // tx_chain_ as passed to start_writev()
+    uint8_t coalescing_buf_[64]; // used to send small packets in one piece if the sink doesn't support start_writev()
     Callback<void, WriteResult0> completer_;
 
     enum {
         kStateIdle,
         kStateCancelling,
+        kStateSendingVectored,
+        kStateSendingCoalesced,
         kStateSendingHeader,
         kStateSendingPayload,
         kStateSendingTrailer
@@ -74,14 +120,30 @@ public:
 
 private:
     void complete(ReadResult result);
+    void complete_vectored(ReadvResult result);
+    void process();
+    bool parse();
+    void start_inner_read();
 
     AsyncStreamSource* rx_channel_;
     TransferHandle inner_transfer_handle_;
-    uint8_t rx_buf_[3];
-    uint8_t* expected_rx_end_;
+
+    // Read-ahead buffer. Each read on the underlying stream fetches as much as
+    // fits in here. Packets that are entirely contained in this buffer are
+    // validated and delivered without further reads. For larger packets the
+    // rest of the payload is read directly into the client's buffer.
+    uint8_t rx_buf_[MAX_PACKET_HEADER_SIZE + 128 + 2];
+    size_t rx_begin_ = 0; // start of unparsed data in rx_buf_
+    size_t rx_end_ = 0; // end of unparsed data in rx_buf_
+
     size_t payload_length_ = 0;
+    size_t n_payload_received_ = 0;
     bufptr_t payload_buf_ = {nullptr, nullptr};
+    bufptr_t rx_bufs_[2]; // rest of the payload and read-ahead buffer if the source supports start_readv()
     Callback<void, ReadResult> completer_;
+    bool inner_read_pending_ = false;
+    bool direct_read_ = false; // true if the pending inner read goes to payload_buf_ rather than rx_buf_
+    bool processing_ = false;
 
     enum {
         kStateIdle,
@@ -95,16 +157,26 @@ private:
 
 struct LegacyProtocolPacketBased {
 public:
-    LegacyProtocolPacketBased(Domain* domain, AsyncStreamSource* rx_channel, AsyncStreamSink* tx_channel, size_t tx_mtu, const char* intf_name)
-        : domain_(domain), rx_channel_(rx_channel), tx_channel_(tx_channel), tx_mtu_(std::min(tx_mtu, sizeof(tx_buf_))), intf_name_(intf_name) {}
+    /**
+     * @param tx_mtu: The initial MTU. The protocol never sends packets larger
+     *        than this unless `negotiate_mtu` is true.
+     * @param negotiate_mtu: If true, the client side probes the peer for a
+     *        larger MTU (up to FIBRE_LEGACY_PROTOCOL_BUF_SIZE) and the server
+     *        side accepts such probes. This should only be enabled if the
+     *        underlying channel can carry packets of any size (i.e. on stream
+     *        based channels).
+     */
+    LegacyProtocolPacketBased(Domain* domain, AsyncStreamSource* rx_channel, AsyncStreamSink* tx_channel, size_t tx_mtu, const char* intf_name, bool negotiate_mtu = false)
+        : domain_(domain), rx_channel_(rx_channel), tx_channel_(tx_channel), tx_mtu_(std::min(tx_mtu, sizeof(tx_buf_))), intf_name_(intf_name), negotiate_mtu_(negotiate_mtu) {}
 
     Domain* domain_;
     AsyncStreamSource* rx_channel_;
     AsyncStreamSink* tx_channel_;
     size_t tx_mtu_;
     const char* intf_name_;
-    uint8_t tx_buf_[128];
-    uint8_t rx_buf_[128];
+    bool negotiate_mtu_;
+    uint8_t tx_buf_[FIBRE_LEGACY_PROTOCOL_BUF_SIZE];
+    uint8_t rx_buf_[FIBRE_LEGACY_PROTOCOL_BUF_SIZE];
 
     TransferHandle tx_handle_ = 0; // non-zero while a TX operation is in progress
     uint8_t* rx_end_ = nullptr; // non-zero if an RX operation has finished but wasn't handled yet because the TX channel was busy
@@ -125,22 +197,32 @@ public:
         std::vector<uint16_t> out_arg_ep_nums_;
         Socket* caller_;
 
-        std::vector<std::vector<uint8_t>> in_args_;
+        void release();
+
+        // The buffers of a call are kept when the call is released so
+        // that the next call on the same protocol instance can reuse them.
+        std::vector<std::vector<uint8_t>> in_args_; // the first n_in_args_ are complete, the next one is being received
+        size_t n_in_args_ = 0;
         std::vector<std::vector<uint8_t>> out_args_;
         size_t n_out_args = 0;
-        std::vector<uint8_t> last_arg_;
         std::vector<EndpointOperationHandle> ops_;
         std::vector<Chunk> chunks_;
         CBufIt chunk_pos;
         bool error_ = false;
+        bool in_use_ = false;
     };
 
 #if FIBRE_ENABLE_CLIENT
+    ~LegacyProtocolPacketBased();
+
     Socket* start_call(uint16_t ep_num, uint16_t json_crc, std::vector<uint16_t> in_arg_ep_nums, std::vector<uint16_t> out_arg_ep_nums, Socket* caller);
     EndpointOperationHandle start_endpoint_operation(uint16_t endpoint_id, uint16_t json_crc, cbufptr_t tx_buf, bufptr_t rx_buf, Callback<void, EndpointOperationResult> callback);
     //void cancel_endpoint_operation(EndpointOperationHandle handle);
 
     LegacyObjectClient client_;
+    uint32_t peer_capabilities_ = 0; // LEGACY_CAP_* flags reported by the peer
+    std::vector<Call*> calls_; // all calls that were ever allocated by this instance
+    std::vector<Call*> free_calls_; // calls that can be reused
 #endif
 
 #if FIBRE_ENABLE_SERVER
@@ -165,12 +247,37 @@ private:
         }
     };
 
-    void start_endpoint_operation(EndpointOperation op);
+    // One entry of the send window. Each outstanding operation owns a slot
+    // with its own TX buffer so that it can be queued for transmission without
+    // waiting for the previous operation's TX to finish.
+    struct WindowSlot {
+        bool in_use = false;
+        bool tx_started = false;
+        EndpointOperation op;
+        size_t tx_length = 0;
+        uint8_t tx_buf[FIBRE_LEGACY_PROTOCOL_BUF_SIZE];
+    };
 
+    WindowSlot& get_slot(uint16_t seqno) { return window_[seqno % FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE]; }
+    void dispatch_endpoint_operations();
+    bool start_next_transmission();
+    void complete_endpoint_operation(WindowSlot& slot, StreamStatus status, const uint8_t* tx_end);
+    void on_mtu_probe_done(EndpointOperationResult result);
+    void on_capabilities_done(EndpointOperationResult result);
+
+    uint8_t mtu_probe_tx_[6];
+    uint8_t mtu_probe_rx_[2];
+    uint8_t capabilities_tx_[4];
+    uint8_t capabilities_rx_[4];
     uint16_t outbound_seq_no_ = 0;
-    std::vector<EndpointOperation> pending_operations_; // operations that are waiting for TX
+    std::deque<EndpointOperation> pending_operations_; // operations that are waiting for a free window slot
+    WindowSlot window_[FIBRE_LEGACY_PROTOCOL_WINDOW_SIZE]; // operations that are waiting for TX and/or RX, indexed by seqno
+    uint16_t next_tx_seq_no_ = 1; // value of outbound_seq_no_ of the operation that is next in line for TX
     EndpointOperationHandle transmitting_op_ = 0; // operation that is in TX
-    std::unordered_map<uint16_t, EndpointOperation> expected_acks_; // operations that are waiting for RX
+#endif
+
+#if FIBRE_ENABLE_SERVER
+    bool handle_mtu_probe(cbufptr_t input_buffer, bufptr_t* output_buffer);
 #endif
 
     void on_write_finished(WriteResult0 result);
@@ -183,7 +290,7 @@ private:
 struct LegacyProtocolStreamBased {
 public:
     LegacyProtocolStreamBased(Domain* domain, AsyncStreamSource* rx_channel, AsyncStreamSink* tx_channel, const char* intf_name)
-        : unwrapper_(rx_channel), wrapper_(tx_channel), inner_protocol_{domain, &unwrapper_, &wrapper_, 127, intf_name} {}
+        : unwrapper_(rx_channel), wrapper_(tx_channel), inner_protocol_{domain, &unwrapper_, &wrapper_, 127, intf_name, true} {}
 
     void start(Callback<void, LegacyProtocolPacketBased*, StreamStatus> on_stopped) { inner_protocol_.start(on_stopped); }
 
@@ -3,13 +3,19 @@
 #include <fibre/libfibre.h>
 #include <fibre/channel_discoverer.hpp>
 #include <fibre/fibre.hpp>
+#include <fibre/sharded_runtime.hpp>
 #include "print_utils.hpp"
 #include "legacy_protocol.hpp" // TODO: remove this include
 #include "legacy_object_client.hpp" // TODO: remove this include
 #include <algorithm>
+#include <chrono>
 #include <random>
 #include <string.h>
 
+#if FIBRE_ENABLE_SHARDING
+#include <mutex>
+#endif
+
 using namespace fibre;
 
 struct LibFibreChannelDiscoveryCtx {
@@ -67,7 +73,7 @@ static const struct LibFibreVersion libfibre_version = { 0, 3, 3 };
 
 class FIBRE_PRIVATE ExternalEventLoop final : public fibre::EventLoop {
 public:
-    ExternalEventLoop(LibFibreEventLoop impl) : impl_(impl) {}
+    ExternalEventLoop(LibFibreEventLoop impl, Logger logger) : impl_(impl), logger_(logger) {}
 
     RichStatus post(fibre::Callback<void> callback) final {
         F_RET_IF(!impl_.post, "not implemented");
@@ -80,33 +86,91 @@ public:
         F_RET_IF(!impl_.register_event, "not implemented");
         F_RET_IF((*impl_.register_event)(event_fd, events, callback.get_ptr(), callback.get_ctx()) != 0,
                  "user provided register_event() failed");
+        callbacks_[event_fd] = callback;
         return RichStatus::success();
     }
 
+    RichStatus modify_event(int event_fd, uint32_t events) final {
+        // The application's event loop has no modify operation
+        auto it = callbacks_.find(event_fd);
+        F_RET_IF(it == callbacks_.end(), "event not registered");
+        fibre::Callback<void, uint32_t> callback = it->second;
+        F_RET_IF_ERR(deregister_event(event_fd), "failed to deregister event");
+        return register_event(event_fd, events, callback);
+    }
+
     RichStatus deregister_event(int event_fd) final {
         F_RET_IF(!impl_.deregister_event, "not implemented");
         F_RET_IF((*impl_.deregister_event)(event_fd) != 0,
                  "user provided deregister_event() failed");
+        callbacks_.erase(event_fd);
         return RichStatus::success();
     }
 
     struct ExternalTimer final : Timer {
-        RichStatus set(float interval, TimerMode mode) {
-            F_RET_IF(!parent->impl_.open_timer, "not implemented");
+        RichStatus set(float interval, TimerMode mode) final {
+            F_RET_IF(!parent->impl_.set_timer, "not implemented");
+            precise = false;
+            missed = 0;
             F_RET_IF((*parent->impl_.set_timer)(timer, interval, (int)mode) != 0, "user provided set_timer() failed");
             return RichStatus::success();
         }
+
+        RichStatus set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) final {
+            uint64_t now = parent->get_time_ns();
+            deadline = absolute ? deadline_ns : now + deadline_ns;
+            interval = interval_ns;
+            missed = 0;
+            precise = true;
+            return schedule(now);
+        }
+
+        uint64_t get_missed_periods() final { return missed; }
+
+        // The application's timers only take a float delay. To keep periodic
+        // timers from drifting, every trigger is scheduled as a one-shot
+        // timer for the time that remains until its exact deadline.
+        RichStatus schedule(uint64_t now) {
+            F_RET_IF(!parent->impl_.set_timer, "not implemented");
+            float delay = deadline > now ? (float)((double)(deadline - now) * 1e-9) : 0.0f;
+            F_RET_IF((*parent->impl_.set_timer)(timer, delay, (int)TimerMode::kOnce) != 0, "user provided set_timer() failed");
+            return RichStatus::success();
+        }
+
+        void on_trigger() {
+            if (precise && interval) {
+                uint64_t now = parent->get_time_ns();
+                deadline += interval;
+                missed = 0;
+                if (deadline <= now) {
+                    missed = (now - deadline) / interval + 1;
+                    deadline += missed * interval;
+                }
+                F_LOG_IF_ERR(parent->logger_, schedule(now), "failed to reschedule timer");
+            }
+            // The callback may close the timer
+            callback.invoke();
+        }
+
         ExternalEventLoop* parent;
         LibFibreEventLoopTimer* timer;
+        Callback<void> callback;
+        bool precise; // set through set_ns()
+        uint64_t deadline; // deadline of the next trigger if precise is true
+        uint64_t interval;
+        uint64_t missed;
     };
 
     RichStatus open_timer(Timer** p_timer, Callback<void> on_trigger) final {
         F_RET_IF(!impl_.open_timer, "not implemented");
-        LibFibreEventLoopTimer* id;
-        F_RET_IF((*impl_.open_timer)(&id, on_trigger.get_ptr(), on_trigger.get_ctx()) != 0, "user provided open_timer() failed");
-        ExternalTimer* t = new ExternalTimer{};
+        ExternalTimer* t = new ExternalTimer{}; // deleted in close_timer()
         t->parent = this;
-        t->timer = id;
+        t->callback = on_trigger;
+        Callback<void> cb = MEMBER_CB(t, on_trigger);
+        if ((*impl_.open_timer)(&t->timer, cb.get_ptr(), cb.get_ctx()) != 0) {
+            delete t;
+            return F_MAKE_ERR("user provided open_timer() failed");
+        }
         if (p_timer) {
             *p_timer = t;
         }
@@ -121,8 +185,17 @@ public:
         return RichStatus::success();
     }
 
+    uint64_t get_time_ns() final {
+        // Same clock as the application's event loop most likely uses
+        // (CLOCK_MONOTONIC on Linux)
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
 private:
     LibFibreEventLoop impl_;
+    Logger logger_;
+    std::unordered_map<int, fibre::Callback<void, uint32_t>> callbacks_; // required by modify_event()
 };
 
 namespace fibre {
@@ -221,7 +294,8 @@ struct FIBRE_PRIVATE LibFibreCtx {
     void dispatch_tasks_to_app();
     void handle_tasks(LibFibreTask* tasks, size_t n_tasks);
 
-    ExternalEventLoop* event_loop;
+    EventLoop* event_loop;
+    ExternalEventLoop* external_event_loop = nullptr; // owned by this context (if any)
     run_tasks_cb_t run_tasks_cb;
     //size_t n_discoveries = 0;
     fibre::Fibre* fibre_ctx;
@@ -234,7 +308,98 @@ struct FIBRE_PRIVATE LibFibreCtx {
 
     std::vector<LibFibreTask> task_queue;
     std::vector<LibFibreTask> shadow_task_queue;
+
+#if FIBRE_ENABLE_SHARDING
+    void route_tasks(LibFibreTask* tasks, size_t n_tasks, std::vector<LibFibreTask>* out_tasks);
+    void forget_call(LibFibreCallHandle handle);
+
+    // Only used by contexts that were opened with libfibre_open_sharded().
+    // The application receives the root context. It has no Fibre context of
+    // its own but one child context per shard. A child context and everything
+    // on it is only ever touched by its shard's thread.
+    fibre::ShardedRuntime* runtime = nullptr;
+    LibFibreCtx* root = nullptr; // null for the root context itself
+    std::vector<LibFibreCtx*> shards; // empty for child contexts
+    Logger logger = Logger::none();
+
+    // Owning shard of each call (root context only)
+    std::mutex call_shards_mutex;
+    std::unordered_map<LibFibreCallHandle, size_t> call_shards;
+#endif
+};
+
+#if FIBRE_ENABLE_SHARDING
+struct FIBRE_PRIVATE LibFibreTaskBatch {
+    void run() {
+        ctx->handle_tasks(tasks.data(), tasks.size());
+        delete this;
+    }
+
+    LibFibreCtx* ctx;
+    std::vector<LibFibreTask> tasks;
 };
+#endif
+
+/**
+ * @brief Runs `func` on the thread of the shard that owns `fibre_ctx` and
+ * waits for it to complete.
+ *
+ * This makes the libfibre functions thread-safe on sharded contexts. On
+ * contexts that were opened with libfibre_open() `func` is invoked directly.
+ *
+ * @returns false if `func` was not run. This is the case if the caller runs on
+ *          a different shard because two shards that wait for each other
+ *          could deadlock.
+ */
+template<typename TFunc>
+static bool run_on_owner(fibre::Fibre* fibre_ctx, const TFunc& func) {
+#if FIBRE_ENABLE_SHARDING
+    if (fibre_ctx->runtime) {
+        return !F_LOG_IF_ERR(fibre_ctx->logger, fibre_ctx->runtime->run_sync(fibre_ctx->shard_id, Callback<void>{func}),
+                             "failed to run on shard " << fibre_ctx->shard_id);
+    }
+#endif
+    func();
+    return true;
+}
+
+#if FIBRE_ENABLE_SHARDING
+template<typename TFunc>
+struct FIBRE_PRIVATE LibFibrePostedCall {
+    void run() {
+        func();
+        delete this;
+    }
+
+    TFunc func;
+};
+#endif
+
+/**
+ * @brief Same as run_on_owner() except that if the caller runs on a different
+ * shard, `func` is posted to the owning shard and runs later.
+ *
+ * For functions that don't return a result. `func` must not capture anything
+ * by reference. Calls that one shard posts to another shard run in order.
+ */
+template<typename TFunc>
+static void run_or_post_on_owner(fibre::Fibre* fibre_ctx, TFunc func) {
+#if FIBRE_ENABLE_SHARDING
+    fibre::ShardedRuntime* runtime = fibre_ctx->runtime;
+    if (runtime) {
+        size_t current = runtime->current_shard();
+        if (current != runtime->n_shards() && current != fibre_ctx->shard_id) {
+            auto call = new LibFibrePostedCall<TFunc>{func}; // deleted in run()
+            if (F_LOG_IF_ERR(fibre_ctx->logger, runtime->post(fibre_ctx->shard_id, MEMBER_CB(call, run)),
+                             "failed to post to shard " << fibre_ctx->shard_id)) {
+                delete call;
+            }
+            return;
+        }
+    }
+#endif
+    run_on_owner(fibre_ctx, func);
+}
 
 struct FIBRE_PRIVATE LibFibreDiscoveryCtx {
     void on_found_object(fibre::Object* obj, fibre::Interface* intf, std::string path);
@@ -306,6 +471,13 @@ void LibFibreCtx::dispatch_tasks_to_app() {
         size_t n_out_tasks = 123;
         (*run_tasks_cb)(this, task_queue.data(), task_queue.size(), &out_tasks, &n_out_tasks);
         task_queue = {};
+#if FIBRE_ENABLE_SHARDING
+        if (root) {
+            // The application may return tasks for calls on other shards
+            root->route_tasks(out_tasks, n_out_tasks, nullptr);
+            continue;
+        }
+#endif
         handle_tasks(out_tasks, n_out_tasks);
     }
 
@@ -400,21 +572,97 @@ WriteArgs LibFibreCall::on_write_done(WriteResult result) {
 void LibFibreCall::close_half(int side) {
     closed[side] = true;
     if (closed[0] && closed[1]) {
+#if FIBRE_ENABLE_SHARDING
+        if (ctx->root) {
+            ctx->root->forget_call(handle);
+        }
+#endif
         delete this;
     }
 }
 
+#if FIBRE_ENABLE_SHARDING
+/**
+ * @brief Hands each task to the shard that owns the corresponding call.
+ *
+ * Must only be called on the root context.
+ *
+ * @param out_tasks: If not null, tasks that the shards generate immediately
+ *        in response are appended to this list. Otherwise they are posted to
+ *        the application through run_tasks_cb on the respective shard.
+ */
+void LibFibreCtx::route_tasks(LibFibreTask* tasks, size_t n_tasks, std::vector<LibFibreTask>* out_tasks) {
+    std::vector<std::vector<LibFibreTask>> per_shard(shards.size());
+
+    {
+        std::unique_lock<std::mutex> lock(call_shards_mutex);
+        for (size_t i = 0; i < n_tasks; ++i) {
+            if (tasks[i].type == kStartCall) {
+                size_t shard = from_c(tasks[i].start_call.domain)->ctx->shard_id;
+                call_shards[tasks[i].handle] = shard;
+                per_shard[shard].push_back(tasks[i]);
+            } else {
+                auto it = call_shards.find(tasks[i].handle);
+                if (it == call_shards.end()) {
+                    F_LOG_E(logger, "unknown call");
+                    continue;
+                }
+                per_shard[it->second].push_back(tasks[i]);
+            }
+        }
+    }
+
+    size_t current = runtime->current_shard();
+
+    for (size_t i = 0; i < shards.size(); ++i) {
+        std::vector<LibFibreTask>& batch = per_shard[i];
+        LibFibreCtx* shard = shards[i];
+        if (!batch.size()) {
+            continue;
+        }
+
+        if (current != shards.size() && current != i) {
+            // Never wait for another shard while running on a shard
+            LibFibreTaskBatch* async_batch = new LibFibreTaskBatch{shard, batch}; // deleted in run()
+            F_LOG_IF_ERR(logger, runtime->post(i, MEMBER_CB(async_batch, run)),
+                         "failed to post tasks to shard " << i);
+            continue;
+        }
+
+        auto handle_batch = [&]() {
+            if (shard->in_dispatcher || !out_tasks) {
+                // The shard's dispatcher passes the resulting tasks on
+                shard->handle_tasks(batch.data(), batch.size());
+                return;
+            }
+            shard->autostart_dispatcher = false;
+            shard->handle_tasks(batch.data(), batch.size());
+            shard->autostart_dispatcher = true;
+            out_tasks->insert(out_tasks->end(), shard->task_queue.begin(), shard->task_queue.end());
+            shard->task_queue = {};
+        };
+        F_LOG_IF_ERR(logger, runtime->run_sync(i, handle_batch), "failed to run tasks on shard " << i);
+    }
+}
+
+void LibFibreCtx::forget_call(LibFibreCallHandle handle) {
+    std::unique_lock<std::mutex> lock(call_shards_mutex);
+    call_shards.erase(handle);
+}
+#endif
+
 const struct LibFibreVersion* libfibre_get_version() {
     return &libfibre_version;
 }
 
 LibFibreCtx* libfibre_open(LibFibreEventLoop event_loop, run_tasks_cb_t run_tasks_cb, LibFibreLogger logger) {
+    Logger fibre_logger = logger.log ? Logger{{logger.log, logger.ctx}, (LogLevel)logger.verbosity} : Logger::none();
+
     LibFibreCtx* ctx = new LibFibreCtx();
-    ctx->event_loop = new ExternalEventLoop(event_loop);
+    ctx->external_event_loop = new ExternalEventLoop(event_loop, fibre_logger);
+    ctx->event_loop = ctx->external_event_loop;
     ctx->run_tasks_cb = run_tasks_cb;
 
-    Logger fibre_logger = logger.log ? Logger{{logger.log, logger.ctx}, (LogLevel)logger.verbosity} : Logger::none();
-
     F_LOG_D(fibre_logger, "test log call");
 
     //return (LibFibreCtx*)((uintptr_t)logger.log);
@@ -422,12 +670,46 @@ LibFibreCtx* libfibre_open(LibFibreEventLoop event_loop, run_tasks_cb_t run_task
     
 
     if (F_LOG_IF_ERR(fibre_logger, fibre::open(ctx->event_loop, fibre_logger, &ctx->fibre_ctx), "failed to open fibre")) {
-        delete ctx->event_loop;
+        delete ctx->external_event_loop;
+        delete ctx;
+        return nullptr;
+    }
+
+    return ctx;
+}
+
+LibFibreCtx* libfibre_open_sharded(size_t n_shards, run_tasks_cb_t run_tasks_cb, LibFibreLogger logger) {
+    Logger fibre_logger = logger.log ? Logger{{logger.log, logger.ctx}, (LogLevel)logger.verbosity} : Logger::none();
+
+#if FIBRE_ENABLE_SHARDING
+    LibFibreCtx* ctx = new LibFibreCtx();
+    ctx->run_tasks_cb = run_tasks_cb;
+    ctx->logger = fibre_logger;
+    ctx->fibre_ctx = nullptr;
+    ctx->runtime = new fibre::ShardedRuntime{};
+
+    if (F_LOG_IF_ERR(fibre_logger, ctx->runtime->start(n_shards, fibre_logger), "failed to start shards")) {
+        delete ctx->runtime;
         delete ctx;
         return nullptr;
     }
 
+    for (size_t i = 0; i < ctx->runtime->n_shards(); ++i) {
+        LibFibreCtx* shard = new LibFibreCtx(); // deleted in libfibre_close()
+        shard->event_loop = ctx->runtime->get_event_loop(i);
+        shard->fibre_ctx = ctx->runtime->get_fibre(i);
+        shard->run_tasks_cb = run_tasks_cb;
+        shard->runtime = ctx->runtime;
+        shard->root = ctx;
+        shard->logger = fibre_logger;
+        ctx->shards.push_back(shard);
+    }
+
     return ctx;
+#else
+    F_LOG_E(fibre_logger, "sharding not enabled");
+    return nullptr;
+#endif
 }
 
 void libfibre_close(LibFibreCtx* ctx) {
@@ -435,17 +717,57 @@ void libfibre_close(LibFibreCtx* ctx) {
         return;
     }
 
+#if FIBRE_ENABLE_SHARDING
+    if (ctx->root) {
+        ctx = ctx->root;
+    }
+    if (ctx->runtime) {
+        Logger logger = ctx->logger;
+        if (ctx->runtime->current_shard() != ctx->runtime->n_shards()) {
+            F_LOG_E(logger, "libfibre_close() must not be called on a shard's thread");
+            return;
+        }
+        F_LOG_IF_ERR(logger, ctx->runtime->stop(), "failed to stop shards");
+        delete ctx->runtime;
+        for (LibFibreCtx* shard: ctx->shards) {
+            delete shard;
+        }
+        F_LOG_D(logger, "closed (" << fibre::as_hex((uintptr_t)ctx) << ")");
+        delete ctx;
+        return;
+    }
+#endif
+
     Logger logger = ctx->fibre_ctx->logger;
 
     fibre::close(ctx->fibre_ctx);
     ctx->fibre_ctx = nullptr;
 
-    delete ctx->event_loop;
+    delete ctx->external_event_loop;
     delete ctx;
 
     F_LOG_D(logger, "closed (" << fibre::as_hex((uintptr_t)ctx) << ")");
 }
 
+void libfibre_set_cache_dir(LibFibreCtx* ctx, const char* path) {
+    if (!ctx) {
+        return; // invalid argument
+    }
+#if FIBRE_ENABLE_SHARDING
+    if (ctx->shards.size()) {
+        for (LibFibreCtx* shard: ctx->shards) {
+            libfibre_set_cache_dir(shard, path);
+        }
+        return;
+    }
+#endif
+    fibre::Fibre* fibre_ctx = ctx->fibre_ctx;
+    std::string dir = path ? path : "";
+    run_or_post_on_owner(fibre_ctx, [=]() {
+        fibre_ctx->legacy_descriptor_cache_dir = dir;
+    });
+}
+
 FIBRE_PUBLIC LibFibreDomain* libfibre_open_domain(LibFibreCtx* ctx,
     const char* specs, size_t specs_len) {
     if (!ctx) {
@@ -457,8 +779,25 @@ FIBRE_PUBLIC LibFibreDomain* libfibre_open_domain(LibFibreCtx* ctx,
             node_id[i] = engine();
         }
 
-        F_LOG_D(ctx->fibre_ctx->logger, "opening domain with node ID " << as_hex(node_id));
-        return to_c(ctx->fibre_ctx->create_domain({specs, specs_len}, (uint8_t*)node_id, {}));
+#if FIBRE_ENABLE_SHARDING
+        if (ctx->shards.size()) {
+            // A shard can't wait for another shard so a domain that is opened
+            // from a shard's thread goes to that shard.
+            size_t shard = ctx->runtime->current_shard();
+            if (shard == ctx->shards.size()) {
+                shard = ctx->runtime->next_shard();
+            }
+            ctx = ctx->shards[shard];
+        }
+#endif
+
+        fibre::Fibre* fibre_ctx = ctx->fibre_ctx;
+        fibre::Domain* domain = nullptr;
+        F_LOG_D(fibre_ctx->logger, "opening domain with node ID " << as_hex(node_id));
+        run_on_owner(fibre_ctx, [&]() {
+            domain = fibre_ctx->create_domain({specs, specs_len}, (uint8_t*)node_id, {});
+        });
+        return to_c(domain);
     }
 }
 
@@ -466,13 +805,19 @@ void libfibre_close_domain(LibFibreDomain* domain) {
     if (!domain) {
         return; // invalid argument
     }
-    F_LOG_D(from_c(domain)->ctx->logger, "closing domain");
+    fibre::Fibre* fibre_ctx = from_c(domain)->ctx;
+    F_LOG_D(fibre_ctx->logger, "closing domain");
 
-    from_c(domain)->ctx->close_domain(from_c(domain));
+    run_or_post_on_owner(fibre_ctx, [=]() {
+        fibre_ctx->close_domain(from_c(domain));
+    });
 }
 
 void libfibre_show_device_dialog(LibFibreDomain* domain, const char* backend) {
-    from_c(domain)->show_device_dialog(backend);
+    std::string backend_name = backend;
+    run_or_post_on_owner(from_c(domain)->ctx, [=]() {
+        from_c(domain)->show_device_dialog(backend_name);
+    });
 }
 
 void libfibre_start_discovery(LibFibreDomain* domain, LibFibreDiscoveryCtx** handle,
@@ -496,8 +841,10 @@ void libfibre_start_discovery(LibFibreDomain* domain, LibFibreDiscoveryCtx** han
         *handle = discovery_ctx;
     }
 
-    from_c(domain)->start_discovery(MEMBER_CB(discovery_ctx, on_found_object),
-        MEMBER_CB(discovery_ctx, on_lost_object));
+    run_or_post_on_owner(from_c(domain)->ctx, [=]() {
+        from_c(domain)->start_discovery(MEMBER_CB(discovery_ctx, on_found_object),
+            MEMBER_CB(discovery_ctx, on_lost_object));
+    });
 }
 
 void libfibre_stop_discovery(LibFibreDiscoveryCtx* handle) {
@@ -505,8 +852,12 @@ void libfibre_stop_discovery(LibFibreDiscoveryCtx* handle) {
         return; // invalid argument
     }
 
-    handle->domain_->stop_discovery();
-    delete handle;
+    // The handle is deleted on the owning shard because until the discovery
+    // stopped, the shard can still invoke the callbacks on it.
+    run_or_post_on_owner(handle->domain_->ctx, [=]() {
+        handle->domain_->stop_discovery();
+        delete handle;
+    });
 }
 
 struct FunctionInfoContainer {
@@ -621,7 +972,61 @@ LibFibreStatus libfibre_get_attribute(LibFibreInterface* intf, LibFibreObject* p
     return LibFibreStatus::kFibreOk;
 }
 
+struct LibFibreBulkReadCtx {
+    on_bulk_read_done_cb_t on_done;
+    void* cb_ctx;
+
+    void complete(StreamStatus status, uint8_t* rx_end) {
+        (*on_done)(cb_ctx, convert_status(status), rx_end);
+        delete this;
+    }
+};
+
+LibFibreStatus libfibre_start_bulk_read(LibFibreObject** objs, size_t n_objs, unsigned char* rx_buf, size_t rx_len, on_bulk_read_done_cb_t on_done, void* cb_ctx) {
+    if (!objs || !n_objs || !on_done) {
+        return LibFibreStatus::kFibreInvalidArgument;
+    }
+
+    std::vector<LegacyObject*> legacy_objs;
+    for (size_t i = 0; i < n_objs; ++i) {
+        legacy_objs.push_back(reinterpret_cast<LegacyObject*>(from_c(objs[i])));
+    }
+
+    LegacyObjectClient* client = legacy_objs[0] ? legacy_objs[0]->client : nullptr;
+    if (!client) {
+        return LibFibreStatus::kFibreInvalidArgument;
+    }
+
+    LibFibreBulkReadCtx* ctx = new LibFibreBulkReadCtx{on_done, cb_ctx};
+    bool started = false;
+    bool ran = run_on_owner(client->domain_->ctx, [&]() {
+        started = client->start_bulk_read(legacy_objs, {rx_buf, rx_len}, MEMBER_CB(ctx, complete));
+    });
+    if (!ran || !started) {
+        delete ctx;
+        return LibFibreStatus::kFibreInvalidArgument;
+    }
+
+    return LibFibreStatus::kFibreOk;
+}
+
 void libfibre_run_tasks(LibFibreCtx* ctx, LibFibreTask* tasks, size_t n_tasks, LibFibreTask** out_tasks, size_t* n_out_tasks) {
+#if FIBRE_ENABLE_SHARDING
+    if (ctx->runtime) {
+        LibFibreCtx* root = ctx->root ? ctx->root : ctx;
+        if (ctx->in_dispatcher) {
+            F_LOG_E(root->logger, "libfibre_run_tasks must not be called from inside the libfibre_run_tasks_callback");
+        }
+
+        std::vector<LibFibreTask> new_tasks;
+        root->route_tasks(tasks, n_tasks, &new_tasks);
+        std::swap(root->shadow_task_queue, new_tasks);
+        *out_tasks = root->shadow_task_queue.data();
+        *n_out_tasks = root->shadow_task_queue.size();
+        return;
+    }
+#endif
+
     if (ctx->in_dispatcher) {
         F_LOG_E(ctx->fibre_ctx->logger, "libfibre_run_tasks must not be called from inside the libfibre_run_tasks_callback");
     }
@@ -638,6 +1043,155 @@ void libfibre_run_tasks(LibFibreCtx* ctx, LibFibreTask* tasks, size_t n_tasks, L
     *n_out_tasks = ctx->shadow_task_queue.size();
 }
 
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+static LibFibreHistogram to_c(const fibre::Histogram& histogram) {
+    return {
+        .count = histogram.count(),
+        .min = histogram.min(),
+        .max = histogram.max(),
+        .mean = histogram.mean(),
+        .p50 = histogram.percentile(0.5),
+        .p90 = histogram.percentile(0.9),
+        .p99 = histogram.percentile(0.99),
+        .p999 = histogram.percentile(0.999),
+    };
+}
+
+/**
+ * @brief Runs `func` for each event loop of the context on the event loop's
+ * own thread.
+ *
+ * @returns false if the context has no instrumented event loop or if one of
+ *          the event loops can't be reached from the caller's thread (see
+ *          run_on_owner()).
+ */
+template<typename TFunc>
+static bool for_each_event_loop(LibFibreCtx* ctx, const TFunc& func) {
+    std::vector<LibFibreCtx*> ctxs = {ctx};
+#if FIBRE_ENABLE_SHARDING
+    if (ctx->shards.size()) {
+        ctxs = ctx->shards;
+    }
+#endif
+
+    bool ok = true;
+    for (LibFibreCtx* c: ctxs) {
+        EventLoop* event_loop = c->event_loop;
+        bool reachable = run_on_owner(c->fibre_ctx, [&]() {
+            if (event_loop->get_stats()) {
+                func(event_loop);
+            } else {
+                ok = false;
+            }
+        });
+        ok = ok && reachable;
+    }
+    return ok;
+}
+
+/**
+ * @brief Combines the instrumentation data of all event loops of the context.
+ */
+static bool get_merged_stats(LibFibreCtx* ctx, EventLoopStats* merged, uint64_t* period_ns) {
+    *period_ns = 0;
+    return for_each_event_loop(ctx, [&](EventLoop* event_loop) {
+        EventLoopStats* stats = event_loop->get_stats();
+        merged->merge(*stats);
+        *period_ns += EventLoopStats::now_ns() - stats->since_ns;
+    });
+}
+#endif
+
+LibFibreStatus libfibre_get_event_loop_stats(LibFibreCtx* ctx, struct LibFibreEventLoopStats* stats) {
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    if (!ctx || !stats) {
+        return LibFibreStatus::kFibreInvalidArgument;
+    }
+
+    EventLoopStats* merged = new EventLoopStats{};
+    uint64_t period_ns;
+    bool ok = get_merged_stats(ctx, merged, &period_ns);
+
+    *stats = {
+        .period_ns = period_ns,
+        .wait_ns = merged->wait_ns,
+        .n_wakeups = merged->n_wakeups,
+        .callback_time = to_c(merged->callback_time),
+        .dispatch_lag = to_c(merged->dispatch_lag),
+        .post_lag = to_c(merged->post_lag),
+        .timer_lateness = to_c(merged->timer_lateness),
+        .events_per_wakeup = to_c(merged->events_per_wakeup),
+    };
+
+    delete merged;
+    return ok ? LibFibreStatus::kFibreOk : LibFibreStatus::kFibreInvalidArgument;
+#else
+    return LibFibreStatus::kFibreInvalidArgument;
+#endif
+}
+
+LibFibreStatus libfibre_get_callback_stats(LibFibreCtx* ctx, struct LibFibreCallbackStats* sites, size_t* n_sites) {
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    if (!ctx || !n_sites || (*n_sites && !sites)) {
+        return LibFibreStatus::kFibreInvalidArgument;
+    }
+
+    EventLoopStats* merged = new EventLoopStats{};
+    uint64_t period_ns;
+    bool ok = get_merged_stats(ctx, merged, &period_ns);
+
+    std::vector<std::pair<uintptr_t, const Histogram*>> sorted;
+    for (auto& it: merged->callback_time_by_site) {
+        sorted.push_back({it.first, &it.second});
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<uintptr_t, const Histogram*>& a, const std::pair<uintptr_t, const Histogram*>& b) {
+        return a.second->sum() > b.second->sum();
+    });
+
+    *n_sites = std::min(*n_sites, sorted.size());
+    for (size_t i = 0; i < *n_sites; ++i) {
+        sites[i] = {.site = sorted[i].first, .module = nullptr, .offset = 0, .run_time = to_c(*sorted[i].second)};
+        EventLoopStats::resolve_site(sites[i].site, &sites[i].module, &sites[i].offset);
+    }
+
+    delete merged;
+    return ok ? LibFibreStatus::kFibreOk : LibFibreStatus::kFibreInvalidArgument;
+#else
+    return LibFibreStatus::kFibreInvalidArgument;
+#endif
+}
+
+LibFibreStatus libfibre_reset_event_loop_stats(LibFibreCtx* ctx) {
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    if (!ctx) {
+        return LibFibreStatus::kFibreInvalidArgument;
+    }
+    bool ok = for_each_event_loop(ctx, [](EventLoop* event_loop) {
+        event_loop->get_stats()->reset(EventLoopStats::now_ns());
+    });
+    return ok ? LibFibreStatus::kFibreOk : LibFibreStatus::kFibreInvalidArgument;
+#else
+    return LibFibreStatus::kFibreInvalidArgument;
+#endif
+}
+
+LibFibreStatus libfibre_set_event_loop_stats_dump_interval(LibFibreCtx* ctx, float interval) {
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    if (!ctx) {
+        return LibFibreStatus::kFibreInvalidArgument;
+    }
+    LibFibreStatus result = LibFibreStatus::kFibreOk;
+    bool ok = for_each_event_loop(ctx, [&](EventLoop* event_loop) {
+        if (event_loop->set_stats_dump_interval(interval).is_error()) {
+            result = LibFibreStatus::kFibreInternalError;
+        }
+    });
+    return ok ? result : LibFibreStatus::kFibreInvalidArgument;
+#else
+    return LibFibreStatus::kFibreInvalidArgument;
+#endif
+}
+
 
 extern "C" {
 #if defined(__has_feature)
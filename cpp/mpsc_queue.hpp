@@ -0,0 +1,126 @@
+#ifndef __FIBRE_MPSC_QUEUE_HPP
+#define __FIBRE_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fibre {
+
+/**
+ * @brief Bounded lock-free multi-producer single-consumer FIFO queue.
+ *
+ * Based on Dmitry Vyukov's bounded MPMC queue: each cell carries a sequence
+ * number that tells producers and the consumer whether the cell is free or
+ * holds an item for the current turn of the ring. Producers claim a cell with
+ * a single CAS and never wait for each other. Since there's only one consumer,
+ * its side needs no atomic read-modify-write operations at all.
+ *
+ * push() can be called from any thread. pop() and empty() must only be
+ * called from the consumer thread.
+ *
+ * @tparam T: Item type. Must be default-constructible and copy-assignable.
+ * @tparam N: Capacity. Must be a power of two.
+ */
+template<typename T, size_t N>
+class MpscQueue {
+    static_assert(N && !(N & (N - 1)), "N must be a power of two");
+
+public:
+    MpscQueue() {
+        for (size_t i = 0; i < N; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Appends an item to the queue.
+     *
+     * @returns false if the queue is full.
+     */
+    bool push(const T& item) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        for (;;) {
+            cell = &cells_[pos & (N - 1)];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                // Cell is free: try to claim it
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // Cell still holds the item from the previous turn
+                return false;
+            } else {
+                // Another producer claimed the cell
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->item = item;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest item from the queue.
+     *
+     * @returns false if the queue is empty or if the oldest item was claimed
+     *          by a producer that didn't finish writing it yet.
+     */
+    bool pop(T* item) {
+        Cell* cell = &cells_[dequeue_pos_ & (N - 1)];
+        if (cell->seq.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+            return false;
+        }
+
+        *item = cell->item;
+        cell->seq.store(dequeue_pos_ + N, std::memory_order_release);
+        dequeue_pos_++;
+        return true;
+    }
+
+    /**
+     * @brief Returns true if no item was pushed or is being pushed.
+     */
+    bool empty() {
+        return enqueue_pos_.load(std::memory_order_acquire) == dequeue_pos_;
+    }
+
+    /**
+     * @brief Returns the position that the next push() would claim.
+     *
+     * Can be used by the consumer to only pop the items that were pushed
+     * before a certain point in time.
+     */
+    size_t push_pos() {
+        return enqueue_pos_.load(std::memory_order_acquire);
+    }
+
+    size_t pop_pos() {
+        return dequeue_pos_;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T item;
+    };
+
+    static const size_t kCacheLine = 64;
+
+    Cell cells_[N];
+    // Producer and consumer positions are on separate cache lines to avoid
+    // false sharing.
+    char pad0_[kCacheLine];
+    std::atomic<size_t> enqueue_pos_{0};
+    char pad1_[kCacheLine - sizeof(std::atomic<size_t>)];
+    size_t dequeue_pos_ = 0;
+};
+
+}
+
+#endif // __FIBRE_MPSC_QUEUE_HPP
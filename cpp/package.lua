@@ -85,19 +85,27 @@ function get_fibre_package(args)
     end
 
     pkg.code_files += 'legacy_protocol.cpp'
+    pkg.code_files += 'stream_adapter.cpp'
     pkg.code_files += 'connection.cpp'
     pkg.code_files += 'endpoint_connection.cpp'
     pkg.code_files += 'multiplexer.cpp'
     pkg.code_files += 'func_utils.cpp'
+    pkg.code_files += 'timer_wheel.cpp'
+    pkg.code_files += 'event_loop_stats.cpp'
+    pkg.code_files += 'sharded_runtime.cpp'
     pkg.code_files += 'platform_support/epoll_event_loop.cpp'
+    pkg.code_files += 'platform_support/io_uring_event_loop.cpp'
     pkg.code_files += 'platform_support/socket_can.cpp'
     pkg.code_files += 'platform_support/can_adapter.cpp'
     pkg.code_files += 'platform_support/posix_tcp_backend.cpp'
+    pkg.code_files += 'platform_support/posix_unix_backend.cpp'
+    pkg.code_files += 'platform_support/shm_channel.cpp'
+    pkg.code_files += 'platform_support/posix_udp_backend.cpp'
     pkg.code_files += 'platform_support/posix_socket.cpp'
     pkg.code_files += 'platform_support/usb_host_adapter.cpp'
     pkg.code_files += 'platform_support/webusb_backend.cpp'
 
-    if args.enable_tcp_client_backend or args.enable_tcp_server_backend then
+    if args.enable_tcp_client_backend or args.enable_tcp_server_backend or args.enable_unix_client_backend or args.enable_unix_server_backend or args.enable_udp_client_backend or args.enable_udp_server_backend then
         -- TODO: chose between windows and posix backend
         pkg.ldflags += '-lanl'
     end
@@ -158,16 +158,6 @@ void CanAdapter::on_heartbeat_sent(bool success) {
     }
 }
 
-void CallContext::reset_at(Domain* domain, uint8_t layer) {
-    if (layer <= 1) {
-        routing_info_offset = 0;
-    }
-    if (layer <= 0) {
-        domain->close_call(handler);
-        handler = nullptr;
-    }
-}
-
 void CanAdapter::on_can_msg(const can_Message_t& msg) {
     // TODO: this discards messages if they come in fast. Need to fetch messages
     // from CAN bus on demand or buffer them in this class.
@@ -235,74 +225,8 @@ void CanAdapter::on_can_msg(const can_Message_t& msg) {
             }
         }
 
-        BufChainStorage<10> buf_chain;
-
-        Chunk chunks[10];
-        BufChainBuilder builder{chunks};
-        write_iterator write_it{builder};
-
-        uint8_t reset_layer = 0;
-        if (!LowLevelProtocol::unpack(ctx->state, {msg.buf, msg.len},
-                                      &reset_layer, write_it)) {
+        if (!ctx->process_packet(domain_, this, node, {msg.buf, msg.len})) {
             F_LOG_E(domain_->ctx->logger, "failed to unpack message");
-            return;
-        }
-
-        BufChain chain = builder;
-
-        if (reset_layer != 0xff) {
-            ctx->reset_at(domain_, reset_layer);
-        }
-
-        while (chain.n_chunks()) {
-            Chunk chunk = chain.front();
-
-            if (chunk.layer() <= 1 && chunk.is_frame_boundary()) {
-                ctx->reset_at(domain_, chunk.layer());
-                chain = chain.skip_chunks(1);
-            } else if (chunk.layer() == 0) {
-                // ignore data on layer0
-                chain = chain.skip_chunks(1);
-            } else if (chunk.layer() == 1) {
-                // data on layer 1
-                size_t n_copy =
-                    std::min(chunk.buf().size(), sizeof(ctx->routing_info) -
-                                                     ctx->routing_info_offset);
-                std::copy_n(chunk.buf().begin(), n_copy,
-                            ctx->routing_info + ctx->routing_info_offset);
-                ctx->routing_info_offset += n_copy;
-
-                if (ctx->routing_info_offset >= 1) {
-                    if (ctx->routing_info[0] == 0x00 ||
-                        ctx->routing_info[0] ==
-                            0x01) {  // call ID for local call stream
-                        if (ctx->routing_info_offset >= 17) {
-                            std::array<uint8_t, 16> call_id;
-                            std::copy_n(ctx->routing_info + 1, 16,
-                                        call_id.begin());
-                            domain_->open_call(
-                                call_id, ctx->routing_info[0], this, node,
-                                &ctx->handler);  // TODO: log error
-                        }
-                    }
-                }
-                chain = chain.skip_chunks(1);
-
-            } else {
-                // Handle data addressed to top level protocol
-                auto payload_end = chain.find_chunk_on_layer(1);
-
-                if (ctx->handler) {
-                    ctx->handler->process_sync(
-                        chain.until(payload_end.chunk).elevate(-2));
-                } else {
-                    // discard data because we don't know what handler to
-                    // send it to
-                    // TODO: log
-                }
-
-                chain = chain.from(payload_end);
-            }
         }
     } else {
         F_LOG_W(domain_->ctx->logger,
@@ -14,22 +14,6 @@ namespace fibre {
 class TimerProvider;
 class Timer;
 
-struct CallContext {
-    uint8_t protocol;
-    bool protocol_known = true;
-    ReceiverState state;
-
-    uint8_t routing_info[17];
-    size_t routing_info_offset;
-
-    uint16_t frame_ids[kMaxLayers];
-    size_t n_layers = 0;
-
-    ConnectionInputSlot* handler = nullptr;
-
-    void reset_at(Domain* domain, uint8_t layer);
-};
-
 /**
  * @brief
  * 
@@ -5,15 +5,29 @@
 
 #include "epoll_event_loop.hpp"
 #include <fibre/rich_status.hpp>
+#include <sched.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/eventfd.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 using namespace fibre;
 
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
 RichStatus EpollEventLoop::start(Logger logger, Callback<void> on_started) {
     F_RET_IF(epoll_fd_ >= 0, "already started");
 
@@ -22,6 +36,24 @@ RichStatus EpollEventLoop::start(Logger logger, Callback<void> on_started) {
     logger_ = logger;
 
     RichStatus status = RichStatus::success();
+    cpu_set_t old_affinity;
+    bool pinned = false;
+
+    if (busy_poll_.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        if (busy_poll_.cpu >= CPU_SETSIZE) {
+            status = F_MAKE_ERR("invalid CPU " << busy_poll_.cpu);
+            goto done0;
+        }
+        CPU_SET(busy_poll_.cpu, &cpus);
+        if (sched_getaffinity(0, sizeof(old_affinity), &old_affinity) != 0
+                || sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            status = F_MAKE_ERR("failed to pin event loop to CPU " << busy_poll_.cpu << ": " << sys_err());
+            goto done0;
+        }
+        pinned = true;
+    }
 
     post_fd_ = eventfd(0, 0);
     
@@ -34,20 +66,48 @@ RichStatus EpollEventLoop::start(Logger logger, Callback<void> on_started) {
         status = F_AMEND_ERR(status, "failed to register event");
         goto done1;
     }
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    contexts_[post_fd_].internal = true;
+#endif
+
+    // Non-blocking because the timer can be re-armed after it expired but
+    // before the expiration was handled.
+    timer_fd_ = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK);
+
+    if (timer_fd_ < 0) {
+        status = F_MAKE_ERR("timerfd_create() failed: " << sys_err{});
+        goto done2;
+    }
+
+    if ((status = register_event(timer_fd_, EPOLLIN, MEMBER_CB(this, on_timer_fd))).is_error()) {
+        status = F_AMEND_ERR(status, "failed to register event");
+        goto done3;
+    }
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    contexts_[timer_fd_].internal = true;
+    stats_.reset(now_ns());
+#endif
+
+    timer_wheel_.advance(now_ns());
     
     if ((status = post(on_started)).is_error()) {
         status = F_AMEND_ERR(status, "post() failed");
-        goto done2;
+        goto done4;
     }
 
-    // Run for as long as there are callbacks pending posted or there's at least
-    // one file descriptor other than post_fd_ registerd.
-    while (pending_callbacks_.size() || (context_map_.size() > 1)) {
+    // Run for as long as there are callbacks pending posted, there's at least
+    // one non-idle file descriptor other than post_fd_ and timer_fd_ registerd
+    // or there's at least one timer open. After stop() only posted callbacks
+    // count.
+    while (!post_queue_.empty() || (!stopping_ && ((n_events_ - n_idle_events_ > 2) || n_timers_))) {
         iterations_++;
 
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t wait_start = now_ns();
+#endif
+
         do {
-            F_LOG_T(logger, "epoll_wait...");
-            n_triggered_events_ = epoll_wait(epoll_fd_, triggered_events_, max_triggered_events_, -1);
+            n_triggered_events_ = wait_for_events();
             F_LOG_T(logger, "epoll_wait unblocked by " << n_triggered_events_ << " events");
             if (errno == EINTR) {
                 F_LOG_D(logger, "interrupted");
@@ -59,21 +119,62 @@ RichStatus EpollEventLoop::start(Logger logger, Callback<void> on_started) {
             break;
         }
 
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t wakeup = now_ns();
+        stats_.record_wakeup(wait_start, wakeup, n_triggered_events_);
+#endif
+
         // Handle events
         for (int i = 0; i < n_triggered_events_; ++i) {
-            EventContext* ctx = (EventContext*)triggered_events_[i].data.ptr;
-            if (ctx) {
-                try { // TODO: not sure if using "try" without throwing exceptions will do unwanted things with the stack
-                    ctx->callback.invoke(triggered_events_[i].events);
-                } catch (...) {
-                    F_LOG_E(logger, "worker callback threw an exception.");
-                }
+            uint64_t data = triggered_events_[i].data.u64;
+            EventContext& ctx = contexts_[(uint32_t)data];
+            if (!ctx.registered || ctx.generation != (uint32_t)(data >> 32)) {
+                continue; // deregistered by an earlier callback of this iteration
+            }
+
+            // The callback may register another fd which can move ctx
+            Callback<void, uint32_t> callback = ctx.callback;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+            bool internal = ctx.internal;
+            uintptr_t site = (uintptr_t)callback.get_ptr();
+            uint64_t start = internal ? 0 : now_ns();
+            if (!internal) {
+                stats_.dispatch_lag.record(start - wakeup);
+            }
+#endif
+            try { // TODO: not sure if using "try" without throwing exceptions will do unwanted things with the stack
+                callback.invoke(triggered_events_[i].events);
+            } catch (...) {
+                F_LOG_E(logger, "worker callback threw an exception.");
             }
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+            if (!internal) {
+                stats_.record_callback(site, start, now_ns());
+            }
+#endif
+        }
+
+        // If the array was full there are probably more events pending
+        if ((size_t)n_triggered_events_ == triggered_events_.size() && triggered_events_.size() < kMaxTriggeredEvents) {
+            triggered_events_.resize(triggered_events_.size() * 2);
+            F_LOG_D(logger, "handling up to " << triggered_events_.size() << " events per iteration");
         }
     }
 
     F_LOG_D(logger, "epoll loop exited");
 
+done4:
+    if (deregister_event(timer_fd_).is_error()) {
+        status = F_MAKE_ERR("deregister_event() failed");
+    }
+
+done3:
+    if (close(timer_fd_) != 0) {
+        status = F_AMEND_ERR(status, "close() failed: " << sys_err());
+    }
+    timer_fd_ = -1;
+    timer_fd_deadline_ = UINT64_MAX;
+
 done2:
     if (deregister_event(post_fd_).is_error()) {
         status = F_MAKE_ERR("deregister_event() failed");
@@ -91,20 +192,61 @@ done0:
     }
     epoll_fd_ = -1;
 
+    if (pinned && sched_setaffinity(0, sizeof(old_affinity), &old_affinity) != 0) {
+        status = F_AMEND_ERR(status, "failed to restore CPU affinity: " << sys_err());
+    }
+
     return status;
 }
 
+RichStatus EpollEventLoop::set_busy_poll(const BusyPollConfig& config) {
+    F_RET_IF(epoll_fd_ >= 0, "must be called before start()");
+    busy_poll_ = config;
+    return RichStatus::success();
+}
+
+int EpollEventLoop::wait_for_events() {
+    if (busy_poll_.spin_us) {
+        // Poll without blocking for a while. Handing the CPU back to the
+        // scheduler and waking up again costs several microseconds, which is
+        // more than low-latency applications can afford.
+        uint64_t spin_until = now_ns() + (uint64_t)busy_poll_.spin_us * 1000ULL;
+        do {
+            int n = epoll_wait(epoll_fd_, triggered_events_.data(), (int)triggered_events_.size(), 0);
+            if (n != 0) {
+                return n;
+            }
+        } while (now_ns() < spin_until);
+    }
+
+    F_LOG_T(logger_, "epoll_wait...");
+    return epoll_wait(epoll_fd_, triggered_events_.data(), (int)triggered_events_.size(), -1);
+}
+
+RichStatus EpollEventLoop::stop() {
+    F_RET_IF(epoll_fd_ < 0, "not started");
+    stopping_ = true;
+    return RichStatus::success();
+}
+
 RichStatus EpollEventLoop::post(Callback<void> callback) {
     F_RET_IF(epoll_fd_ < 0, "not started");
 
-    {
-        std::unique_lock<std::mutex> lock(pending_callbacks_mutex_);
-        pending_callbacks_.push_back(callback);
+    PostedCallback item = {callback};
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    item.posted_ns = now_ns();
+#endif
+    F_RET_IF(!post_queue_.push(item), "post queue full");
+
+    // If the event loop was already woken up it will also see this callback.
+    if (!post_fd_signalled_.exchange(true)) {
+        const uint64_t val = 1;
+        if (write(post_fd_, &val, sizeof(val)) != sizeof(val)) {
+            post_fd_signalled_.store(false);
+            return F_MAKE_ERR("write() failed: " << sys_err());
+        }
     }
 
-    const uint64_t val = 1;
-    F_RET_IF(write(post_fd_, &val, sizeof(val)) != sizeof(val),
-             "write() failed: " << sys_err());
     return RichStatus::success();
 }
 
@@ -112,36 +254,53 @@ RichStatus EpollEventLoop::register_event(int event_fd, uint32_t events, Callbac
     F_RET_IF(epoll_fd_ < 0, "not initialized");
     F_RET_IF(event_fd < 0, "invalid argument");
 
-    EventContext* ctx = new EventContext{callback};
+    if ((size_t)event_fd >= contexts_.size()) {
+        contexts_.resize(event_fd + 1);
+    }
+    EventContext& ctx = contexts_[event_fd];
+    F_RET_IF(ctx.registered, "fd " << event_fd << " already registered");
+
     struct epoll_event ev = {
         .events = events,
-        .data = { .ptr = ctx }
+        .data = { .u64 = make_event_data(event_fd, ctx.generation) }
     };
-    context_map_[event_fd] = ctx;
 
-    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd, &ev) != 0) {
-        delete ctx;
-        return F_MAKE_ERR("epoll_ctl(" << event_fd << "...) failed: " << sys_err());
-    }
+    F_RET_IF(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd, &ev) != 0,
+             "epoll_ctl(" << event_fd << "...) failed: " << sys_err());
+
+    ctx.callback = callback;
+    ctx.events = events;
+    ctx.registered = true;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    ctx.internal = false;
+#endif
+    n_events_++;
+    n_idle_events_ += is_idle(events);
 
     F_LOG_T(logger_, "registered epoll event " << event_fd);
 
     return RichStatus::success();
 }
 
-std::unordered_map<int, EpollEventLoop::EventContext*>::iterator EpollEventLoop::drop_events(int event_fd) {
-    auto it = context_map_.find(event_fd);
-    if (it == context_map_.end()) {
-        return it;
-    }
+RichStatus EpollEventLoop::modify_event(int event_fd, uint32_t events) {
+    F_RET_IF(epoll_fd_ < 0, "not initialized");
+    F_RET_IF(event_fd < 0 || (size_t)event_fd >= contexts_.size() || !contexts_[event_fd].registered,
+             "event context not found");
+    EventContext& ctx = contexts_[event_fd];
 
-    for (int i = 0; i < n_triggered_events_; ++i) {
-        if ((EventContext*)(triggered_events_[i].data.ptr) == it->second) {
-            triggered_events_[i].data.ptr = nullptr;
-        }
-    }
+    struct epoll_event ev = {
+        .events = events,
+        .data = { .u64 = make_event_data(event_fd, ctx.generation) }
+    };
 
-    return it;
+    F_RET_IF(epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, event_fd, &ev) != 0,
+             "epoll_ctl(" << event_fd << "...) failed: " << sys_err());
+
+    n_idle_events_ += is_idle(events);
+    n_idle_events_ -= is_idle(ctx.events);
+    ctx.events = events;
+
+    return RichStatus::success();
 }
 
 RichStatus EpollEventLoop::deregister_event(int event_fd) {
@@ -153,106 +312,169 @@ RichStatus EpollEventLoop::deregister_event(int event_fd) {
         status = F_MAKE_ERR("epoll_ctl() failed: " << sys_err());
     }
 
-    auto it = drop_events(event_fd);
-    F_RET_IF(it == context_map_.end(), "event context not found");
-    context_map_.erase(it);
+    F_RET_IF(event_fd < 0 || (size_t)event_fd >= contexts_.size() || !contexts_[event_fd].registered,
+             "event context not found");
+    EventContext& ctx = contexts_[event_fd];
+
+    // Invalidates events of this fd that were already fetched from epoll
+    ctx.generation++;
+    ctx.registered = false;
+    ctx.callback = {};
+    n_events_--;
+    n_idle_events_ -= is_idle(ctx.events);
     
     return status;
 }
 
 RichStatus EpollEventLoop::open_timer(Timer** p_timer, Callback<void> on_trigger) {
-    if (p_timer) {
-        *p_timer = nullptr;
-    }
-
-    int fd = timerfd_create(CLOCK_BOOTTIME, 0);
-    F_RET_IF(fd < 0, "timerfd_create() failed: " << sys_err{});
+    F_RET_IF(epoll_fd_ < 0, "not initialized");
 
     TimerContext* timer = new TimerContext{}; // deleted in close_timer()
     timer->parent = this;
-    timer->fd = fd;
-    timer->callback = on_trigger;
-
-    RichStatus status;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    timer->on_trigger = on_trigger;
+    timer->entry.callback = MEMBER_CB(timer, on_expired);
+#else
+    timer->entry.callback = on_trigger;
+#endif
+    n_timers_++;
 
-    if ((status = register_event(fd, EPOLLIN, MEMBER_CB(timer, on_timer))).is_error()) {
-        goto fail;
-    }
-    
     if (p_timer) {
         *p_timer = timer;
     }
     return RichStatus::success();
-
-fail:
-    close(fd);
-    delete timer;
-    return status;
 }
 
 RichStatus EpollEventLoop::TimerContext::set(float interval, TimerMode mode) {
-    struct itimerspec timerspec = {};
+    if (mode == TimerMode::kNever) {
+        parent->timer_wheel_.cancel(&entry);
+        return RichStatus::success();
+    }
 
-    if (mode != TimerMode::kNever) {
-        timerspec.it_value = {
-            .tv_sec = (long)interval,
-            .tv_nsec = (long)((interval - (float)(long)interval) * 1e9f)
-        };
-        if (mode == TimerMode::kPeriodic) {
-            timerspec.it_interval = timerspec.it_value;
-        }
+    uint64_t interval_ns = (uint64_t)((double)interval * 1e9);
+    return set_ns(interval_ns, mode == TimerMode::kPeriodic ? interval_ns : 0, false);
+}
+
+RichStatus EpollEventLoop::TimerContext::set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) {
+    // The timer wheel runs on CLOCK_BOOTTIME, which is ahead of
+    // CLOCK_MONOTONIC by the time spent in suspend.
+    uint64_t now = now_ns();
+    deadline_ns += absolute ? now - monotonic_ns() : now;
+    parent->timer_wheel_.arm(&entry, deadline_ns, interval_ns);
+    return parent->update_timer_fd();
+}
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+void EpollEventLoop::TimerContext::on_expired() {
+    // The callback may close the timer
+    EventLoopStats& stats = parent->stats_;
+    Callback<void> callback = on_trigger;
+
+    uint64_t start = now_ns();
+    stats.timer_lateness.record(start - parent->timer_wheel_.firing_deadline_ns());
+    callback.invoke();
+    stats.record_callback((uintptr_t)callback.get_ptr(), start, now_ns());
+}
+#endif
+
+RichStatus EpollEventLoop::update_timer_fd() {
+    uint64_t deadline_ns;
+    if (!timer_wheel_.next_deadline(&deadline_ns) || deadline_ns >= timer_fd_deadline_) {
+        // A timerfd that fires too early or for no reason is harmless so it's
+        // only updated if the deadline moves closer.
+        return RichStatus::success();
     }
 
-    parent->drop_events(fd);
+    struct itimerspec timerspec = {};
+    timerspec.it_value = {
+        .tv_sec = (long)(deadline_ns / 1000000000ULL),
+        .tv_nsec = (long)(deadline_ns % 1000000000ULL)
+    };
 
-    if (timerfd_settime(fd, 0, &timerspec, nullptr) != 0) {
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &timerspec, nullptr) != 0) {
         return F_MAKE_ERR("timerfd_settime() failed: " << sys_err{});
     }
 
+    timer_fd_deadline_ = deadline_ns;
     return RichStatus::success();
 }
 
-void EpollEventLoop::TimerContext::on_timer(uint32_t mask) {
+void EpollEventLoop::on_timer_fd(uint32_t mask) {
     if (mask & EPOLLIN) {
         uint64_t n_triggers;
-        if (read(fd, (uint8_t*)&n_triggers, sizeof(n_triggers)) == -1) {
-            F_LOG_E(parent->logger_, "failed to read timer: " << sys_err{});
-            return;
+        if (read(timer_fd_, (uint8_t*)&n_triggers, sizeof(n_triggers)) == -1) {
+            F_LOG_IF(logger_, errno != EAGAIN, "failed to read timer: " << sys_err{});
         }
 
-        callback.invoke();
+        timer_fd_deadline_ = UINT64_MAX;
+        timer_wheel_.advance(now_ns());
+        F_LOG_IF_ERR(logger_, update_timer_fd(), "failed to update timer");
     }
 
     if (mask & ~(EPOLLIN)) {
-        F_LOG_E(parent->logger_, "unexpected event " << mask);
+        F_LOG_E(logger_, "unexpected event " << mask);
         return;
     }
 }
 
 RichStatus EpollEventLoop::close_timer(Timer* timer) {
     TimerContext* ctx = static_cast<TimerContext*>(timer);
-    deregister_event(ctx->fd);
-    close(ctx->fd);
+    timer_wheel_.cancel(&ctx->entry);
     delete ctx;
+    n_timers_--;
     return RichStatus::success();
 }
 
+uint64_t EpollEventLoop::get_time_ns() {
+    return monotonic_ns();
+}
+
 void EpollEventLoop::run_callbacks(uint32_t) {
     // TODO: warn if read fails
     uint64_t val;
     F_LOG_IF(logger_, read(post_fd_, &val, sizeof(val)) != sizeof(val),
              "failed to read from post file descriptor");
 
-    std::vector<Callback<void>> pending_callbacks;
-
-    {
-        std::unique_lock<std::mutex> lock(pending_callbacks_mutex_);
-        std::swap(pending_callbacks, pending_callbacks_);
+    // Must happen before draining the queue. A post() that comes after this
+    // signals post_fd_ again, one that comes before is seen by the loop below.
+    // acq_rel synchronizes with the producers that set the flag.
+    post_fd_signalled_.exchange(false, std::memory_order_acq_rel);
+
+    // Callbacks that are posted from within the callbacks below (or by other
+    // threads in the meantime) are deferred to the next iteration so that
+    // they can't starve other events.
+    size_t end = post_queue_.push_pos();
+    PostedCallback item;
+    while (post_queue_.pop_pos() != end && post_queue_.pop(&item)) {
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t start = now_ns();
+        stats_.post_lag.record(start - item.posted_ns);
+        item.callback.invoke();
+        stats_.record_callback((uintptr_t)item.callback.get_ptr(), start, now_ns());
+#else
+        item.callback.invoke();
+#endif
     }
+}
 
-    for (auto& cb: pending_callbacks) {
-        cb.invoke();
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+RichStatus EpollEventLoop::set_stats_dump_interval(float interval) {
+    F_RET_IF(epoll_fd_ < 0, "not initialized");
+
+    if (interval <= 0.0f) {
+        timer_wheel_.cancel(&stats_dump_entry_);
+        return RichStatus::success();
     }
+
+    uint64_t interval_ns = (uint64_t)(interval * 1e9f);
+    stats_dump_entry_.callback = MEMBER_CB(this, dump_stats);
+    timer_wheel_.arm(&stats_dump_entry_, now_ns() + interval_ns, interval_ns);
+    return update_timer_fd();
 }
 
+void EpollEventLoop::dump_stats() {
+    stats_.dump(logger_, now_ns());
+}
+#endif
+
 #endif
@@ -3,13 +3,14 @@
 
 //#include <thread>
 #include <sys/epoll.h>
-#include <unordered_map>
+#include <atomic>
 #include <vector>
-#include <mutex>
 //#include <algorithm>
 
 #include <fibre/event_loop.hpp>
 #include <fibre/logging.hpp>
+#include "../timer_wheel.hpp"
+#include "../mpsc_queue.hpp"
 
 namespace fibre {
 
@@ -18,9 +19,10 @@ namespace fibre {
  * 
  * Thread safety: None of the public functions are thread-safe with respect to
  * each other. However they are thread safe with respect to the internal event
- * loop, that means register_event() and deregister_event() can be called from
- * within an event callback (which executes on the event loop thread), provided
- * those calls are properly synchronized with calls from other threads.
+ * loop, that means register_event(), modify_event() and deregister_event() can
+ * be called from within an event callback (which executes on the event loop
+ * thread), provided those calls are properly synchronized with calls from
+ * other threads.
  */
 class EpollEventLoop final : public EventLoop {
 public:
@@ -34,46 +36,111 @@ public:
      */
     RichStatus start(Logger logger, Callback<void> on_started);
 
+    /**
+     * @brief Enables busy polling for lower wakeup latency.
+     *
+     * Must be called before start(). If a CPU is specified, start() pins the
+     * current thread to it and restores the previous CPU affinity before it
+     * returns.
+     */
+    RichStatus set_busy_poll(const BusyPollConfig& config);
+
     RichStatus post(Callback<void> callback) final;
     RichStatus register_event(int fd, uint32_t events, Callback<void, uint32_t> callback) final;
+    RichStatus modify_event(int fd, uint32_t events) final;
     RichStatus deregister_event(int fd) final;
     RichStatus open_timer(Timer** p_timer, Callback<void> on_trigger) final;
     RichStatus close_timer(Timer* timer) final;
+    uint64_t get_time_ns() final;
+    uint32_t socket_busy_poll_us() final { return busy_poll_.socket_busy_poll_us; }
+    RichStatus stop() final;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    EventLoopStats* get_stats() final { return &stats_; }
+    RichStatus set_stats_dump_interval(float interval) final;
+#endif
 
 private:
     struct EventContext {
-        //int fd;
         Callback<void, uint32_t> callback;
+        uint32_t events;
+        uint32_t generation; // incremented on every deregistration
+        bool registered;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        bool internal; // the callback dispatches other callbacks, which are instrumented individually
+#endif
     };
 
     struct TimerContext final : Timer {
         RichStatus set(float interval, TimerMode mode) final;
-        void on_timer(uint32_t);
+        RichStatus set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) final;
+        uint64_t get_missed_periods() final { return entry.missed; }
         EpollEventLoop* parent;
-        int fd;
+        TimerWheel::Entry entry;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        void on_expired();
+        Callback<void> on_trigger;
+#endif
+    };
+
+    struct PostedCallback {
         Callback<void> callback;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t posted_ns;
+#endif
     };
 
-    std::unordered_map<int, EventContext*>::iterator drop_events(int event_fd);
+    static bool is_idle(uint32_t events) { return !(events & ~(EPOLLERR | EPOLLHUP | EPOLLET)); }
+    static uint64_t make_event_data(int fd, uint32_t generation) { return ((uint64_t)generation << 32) | (uint32_t)fd; }
+    int wait_for_events();
     void run_callbacks(uint32_t);
-    void on_timer(TimerContext* ctx);
+    RichStatus update_timer_fd();
+    void on_timer_fd(uint32_t mask);
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    void dump_stats();
+#endif
 
     int epoll_fd_ = -1;
     Logger logger_ = Logger::none();
     int post_fd_ = -1;
     unsigned int iterations_ = 0;
-
-    std::unordered_map<int, EventContext*> context_map_; // required to deregister callbacks
-
-    static const size_t max_triggered_events_ = 16; // max number of events that can be handled per iteration
+    BusyPollConfig busy_poll_;
+
+    // All timers are multiplexed onto a single timerfd through a timer wheel.
+    static const uint64_t kTimerTickNs = 1000000ULL;
+    int timer_fd_ = -1;
+    uint64_t timer_fd_deadline_ = UINT64_MAX; // absolute CLOCK_BOOTTIME deadline to which timer_fd_ is currently set
+    TimerWheel timer_wheel_{kTimerTickNs, 0};
+    size_t n_timers_ = 0; // number of open timers (armed or not)
+
+    // Indexed by fd. The epoll data of a registered fd holds the fd and the
+    // generation of its context so that events which were fetched before the
+    // fd was deregistered (and maybe registered again) can be recognized as
+    // stale without searching the list of triggered events.
+    std::vector<EventContext> contexts_;
+    size_t n_events_ = 0; // number of registered fds
+    size_t n_idle_events_ = 0; // number of registered fds that only listen for errors and hangups
+    bool stopping_ = false; // set by stop()
+
+    // Max number of events that can be handled per iteration. Starts small
+    // and doubles whenever an epoll_wait() fills the whole array, up to
+    // kMaxTriggeredEvents.
+    static const size_t kMinTriggeredEvents = 16;
+    static const size_t kMaxTriggeredEvents = 1024;
     int n_triggered_events_ = 0;
-    struct epoll_event triggered_events_[max_triggered_events_];
+    std::vector<struct epoll_event> triggered_events_ = std::vector<struct epoll_event>(kMinTriggeredEvents);
+
+    // Callbacks that were submitted through post().
+    static const size_t kPostQueueSize = 4096;
+    MpscQueue<PostedCallback, kPostQueueSize> post_queue_;
 
-    // List of callbacks that were submitted through post().
-    std::vector<Callback<void>> pending_callbacks_;
+    // Set by the first post() after run_callbacks() started draining
+    // post_queue_. Only that post() writes to post_fd_.
+    std::atomic<bool> post_fd_signalled_{false};
 
-    // Mutex to protect pending_callbacks_
-    std::mutex pending_callbacks_mutex_;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    EventLoopStats stats_;
+    TimerWheel::Entry stats_dump_entry_; // not counted in n_timers_
+#endif
 };
 
 }
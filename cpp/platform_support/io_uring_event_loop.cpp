@@ -0,0 +1,893 @@
+#include <fibre/config.hpp>
+
+#if FIBRE_ENABLE_EVENT_LOOP && FIBRE_ENABLE_IO_URING
+
+#include "io_uring_event_loop.hpp"
+#include <fibre/rich_status.hpp>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+using namespace fibre;
+
+// liburing is not used to avoid the dependency. These are the only three
+// syscalls of the io_uring interface.
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static const unsigned int kSqEntries = 256;
+static const unsigned int kCqEntries = 4 * kSqEntries; // multishot requests can post many completions per submission
+
+bool IoUringEventLoop::is_supported() {
+    struct io_uring_params params = {};
+    int fd = io_uring_setup(1, &params);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+RichStatus IoUringEventLoop::start(Logger logger, Callback<void> on_started) {
+    F_RET_IF(ring_fd_ >= 0, "already started");
+
+    logger_ = logger;
+    F_RET_IF_ERR(setup_ring(), "failed to set up io_uring");
+
+    RichStatus status = RichStatus::success();
+
+    post_fd_ = eventfd(0, 0);
+
+    if (post_fd_ < 0) {
+        status = F_MAKE_ERR("failed to create an event for posting callbacks onto the event loop");
+        goto done0;
+    }
+
+    if ((status = register_event(post_fd_, EPOLLIN, MEMBER_CB(this, run_callbacks))).is_error()) {
+        status = F_AMEND_ERR(status, "failed to register event");
+        goto done1;
+    }
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    context_map_[post_fd_]->internal = true;
+#endif
+
+    // Non-blocking because a completion can be pending for a timer that was
+    // re-armed in the meantime.
+    timer_fd_ = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK);
+
+    if (timer_fd_ < 0) {
+        status = F_MAKE_ERR("timerfd_create() failed: " << sys_err{});
+        goto done2;
+    }
+
+    if ((status = register_event(timer_fd_, EPOLLIN, MEMBER_CB(this, on_timer_fd))).is_error()) {
+        status = F_AMEND_ERR(status, "failed to register event");
+        goto done3;
+    }
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    context_map_[timer_fd_]->internal = true;
+    stats_.reset(now_ns());
+#endif
+
+    timer_wheel_.advance(now_ns());
+
+    if ((status = post(on_started)).is_error()) {
+        status = F_AMEND_ERR(status, "post() failed");
+        goto done4;
+    }
+
+    // Run for as long as there are callbacks pending posted, there's at least
+    // one non-idle file descriptor other than post_fd_ and timer_fd_ registerd,
+    // there's at least one timer open or there's I/O in progress. After stop()
+    // only posted callbacks count.
+    while (!post_queue_.empty() || (!stopping_ && ((context_map_.size() - n_idle_events_ > 2) || n_timers_ || n_io_ops_))) {
+        iterations_++;
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t wait_start = now_ns();
+#endif
+
+        F_LOG_T(logger, "io_uring_enter...");
+        // EBUSY means that the completion queue overflowed. Reaping
+        // completions resolves that.
+        if (enter(1) < 0 && errno != EBUSY) {
+            status = F_MAKE_ERR("io_uring_enter() failed: " << sys_err() << " - Terminating worker thread.");
+            break;
+        }
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        wakeup_ns_ = now_ns();
+        stats_.record_wakeup(wait_start, wakeup_ns_, __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_);
+#endif
+
+        reap_completions();
+    }
+
+    F_LOG_D(logger, "io_uring loop exited");
+
+done4:
+    if (deregister_event(timer_fd_).is_error()) {
+        status = F_MAKE_ERR("deregister_event() failed");
+    }
+
+done3:
+    timer_fd_deadline_ = UINT64_MAX;
+
+done2:
+    if (deregister_event(post_fd_).is_error()) {
+        status = F_MAKE_ERR("deregister_event() failed");
+    }
+
+    // Cancelled operations are only freed once the kernel hands them back.
+    while (n_orphaned_ops_ && (enter(1) >= 0 || errno == EBUSY)) {
+        reap_completions();
+    }
+
+    // Closed only now so that the kernel is done polling it.
+    if (timer_fd_ >= 0) {
+        if (close(timer_fd_) != 0) {
+            status = F_AMEND_ERR(status, "close() failed: " << sys_err());
+        }
+        timer_fd_ = -1;
+    }
+
+done1:
+    if (close(post_fd_) != 0) {
+        status = F_AMEND_ERR(status, "close() failed: " << sys_err());
+    }
+    post_fd_ = -1;
+
+done0:
+    teardown_ring();
+
+    return status;
+}
+
+RichStatus IoUringEventLoop::setup_ring() {
+    struct io_uring_params params = {};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = kCqEntries;
+    ring_fd_ = io_uring_setup(kSqEntries, &params);
+
+    // IORING_SETUP_SINGLE_ISSUER was introduced in Linux 6.0, along with
+    // multishot receive. Older kernels reject it and we fall back to a ring
+    // without completion-based I/O.
+    bool async_io = true;
+    if (ring_fd_ < 0 && errno == EINVAL) {
+        params = {};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = kCqEntries;
+        ring_fd_ = io_uring_setup(kSqEntries, &params);
+        async_io = false;
+    }
+
+    F_RET_IF(ring_fd_ < 0, "io_uring_setup() failed: " << sys_err());
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        teardown_ring();
+        return F_MAKE_ERR("mmap() failed: " << sys_err());
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+            teardown_ring();
+            return F_MAKE_ERR("mmap() failed: " << sys_err());
+        }
+    }
+
+    sqes_ = (struct io_uring_sqe*)mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        teardown_ring();
+        return F_MAKE_ERR("mmap() failed: " << sys_err());
+    }
+
+    uint8_t* sq = (uint8_t*)sq_ring_;
+    sq_head_ = (unsigned*)(sq + params.sq_off.head);
+    sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+    sq_array_ = (unsigned*)(sq + params.sq_off.array);
+    sq_mask_ = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+
+    uint8_t* cq = (uint8_t*)cq_ring_;
+    cq_head_ = (unsigned*)(cq + params.cq_off.head);
+    cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask_ = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    if (async_io) {
+        F_LOG_IF_ERR(logger_, setup_buf_ring(), "completion-based I/O not available");
+    } else {
+        F_LOG_D(logger_, "kernel too old for completion-based I/O");
+    }
+
+    return RichStatus::success();
+}
+
+void IoUringEventLoop::teardown_ring() {
+    if (sqes_) {
+        munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    cq_ring_ = nullptr;
+    if (sq_ring_) {
+        munmap(sq_ring_, sq_ring_size_);
+        sq_ring_ = nullptr;
+    }
+
+    if (close(ring_fd_) != 0) {
+        F_LOG_E(logger_, "close() failed: " << sys_err());
+    }
+    ring_fd_ = -1;
+
+    // The kernel drops its reference to the buffer ring when the io_uring
+    // instance is closed.
+    teardown_buf_ring();
+}
+
+RichStatus IoUringEventLoop::setup_buf_ring() {
+    size_t ring_size = kNumBufs * sizeof(struct io_uring_buf);
+    void* ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    F_RET_IF(ring == MAP_FAILED, "mmap() failed: " << sys_err());
+
+    void* pool = mmap(nullptr, kNumBufs * kBufSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED) {
+        munmap(ring, ring_size);
+        return F_MAKE_ERR("mmap() failed: " << sys_err());
+    }
+
+    struct io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = kNumBufs;
+    reg.bgid = kBufGroup;
+
+    if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(pool, kNumBufs * kBufSize);
+        munmap(ring, ring_size);
+        return F_MAKE_ERR("failed to register buffer ring: " << sys_err());
+    }
+
+    buf_ring_ = (struct io_uring_buf_ring*)ring;
+    buf_pool_ = (uint8_t*)pool;
+    buf_ring_tail_ = 0;
+
+    for (size_t i = 0; i < kNumBufs; ++i) {
+        release_buffer({buf_pool_ + i * kBufSize, kBufSize});
+    }
+
+    return RichStatus::success();
+}
+
+void IoUringEventLoop::teardown_buf_ring() {
+    if (buf_ring_) {
+        munmap(buf_pool_, kNumBufs * kBufSize);
+        munmap(buf_ring_, kNumBufs * sizeof(struct io_uring_buf));
+        buf_ring_ = nullptr;
+        buf_pool_ = nullptr;
+    }
+}
+
+struct io_uring_sqe* IoUringEventLoop::get_sqe() {
+    unsigned tail = *sq_tail_;
+
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        // Submission queue full. Hand the queued entries to the kernel.
+        if (enter(0) < 0 || tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            F_LOG_E(logger_, "submission queue full: " << sys_err());
+            return nullptr;
+        }
+    }
+
+    // The kernel only looks at the queue during io_uring_enter() so the entry
+    // can be published before it's filled in.
+    struct io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[tail & sq_mask_] = tail & sq_mask_;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+uint32_t IoUringEventLoop::to_poll32(uint32_t events) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (events << 16) | (events >> 16);
+#else
+    return events;
+#endif
+}
+
+int IoUringEventLoop::enter(unsigned int min_complete) {
+    unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int result;
+
+    do {
+        unsigned int to_submit = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (!to_submit && !min_complete) {
+            return 0;
+        }
+        result = io_uring_enter(ring_fd_, to_submit, min_complete, flags);
+    } while (result < 0 && errno == EINTR); // ignore syscall interruptions. This happens for instance during suspend.
+
+    return result;
+}
+
+bool IoUringEventLoop::arm(Operation* op) {
+    struct io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+        return false;
+    }
+
+    sqe->fd = op->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+
+    switch (op->kind) {
+        case OpKind::kPoll:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll32_events = to_poll32(op->events);
+            if (op->events & EPOLLET) {
+                // Multishot polls are edge-triggered
+                sqe->len = IORING_POLL_ADD_MULTI;
+            }
+            break;
+        case OpKind::kSendmsg:
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+            sqe->len = 1;
+            break;
+        case OpKind::kRecvMultishot:
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+            sqe->len = 1;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = kBufGroup;
+            break;
+    }
+
+    op->armed = true;
+    return true;
+}
+
+void IoUringEventLoop::cancel(Operation* op) {
+    op->active = false;
+
+    if (op->armed) {
+        // The operation is freed once its last completion arrives.
+        struct io_uring_sqe* sqe = get_sqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t)(uintptr_t)op;
+        }
+        n_orphaned_ops_++;
+    } else if (op != dispatching_) {
+        starved_ops_.erase(std::remove(starved_ops_.begin(), starved_ops_.end(), op), starved_ops_.end());
+        delete op;
+    }
+}
+
+void IoUringEventLoop::reap_completions() {
+    unsigned head = *cq_head_;
+
+    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        // Copy the entry and hand the slot back before running the callback
+        struct io_uring_cqe cqe = cqes_[head & cq_mask_];
+        __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+
+        Operation* op = (Operation*)(uintptr_t)cqe.user_data;
+        if (op) { // cancellation requests carry no operation
+            on_completion(op, cqe.res, cqe.flags);
+        }
+    }
+}
+
+void IoUringEventLoop::on_completion(Operation* op, int res, uint32_t flags) {
+    if (op->kind == OpKind::kRecvMultishot) {
+        on_recv_completion(op, res, flags);
+        return;
+    }
+
+    op->armed = op->kind == OpKind::kPoll && (flags & IORING_CQE_F_MORE);
+
+    if (!op->active) {
+        if (!op->armed) {
+            // Final completion of a cancelled operation
+            n_orphaned_ops_--;
+            delete op;
+        }
+        return;
+    }
+
+    dispatching_ = op;
+
+    if (op->kind == OpKind::kPoll) {
+        // Drop events that were masked by modify_event() after the kernel
+        // triggered the poll request
+        uint32_t events = res >= 0 ? (uint32_t)res & (op->events | EPOLLERR | EPOLLHUP) : (uint32_t)EPOLLERR;
+        if (events) {
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+            uint64_t start = begin_dispatch(op);
+#endif
+            op->poll_callback.invoke(events);
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+            end_dispatch(op, (uintptr_t)op->poll_callback.get_ptr(), start);
+#endif
+        }
+        if (op->active && !op->armed && (res < 0 || !arm(op))) {
+            // Don't re-arm to prevent a busy spin. The operation stays
+            // registered until deregister_event() is called.
+            F_LOG_E(logger_, "poll on fd " << op->fd << " failed with " << res);
+        }
+    } else {
+        op->active = false;
+        n_io_ops_--;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t start = begin_dispatch(op);
+#endif
+        op->send_callback.invoke(res);
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        end_dispatch(op, (uintptr_t)op->send_callback.get_ptr(), start);
+#endif
+    }
+
+    dispatching_ = nullptr;
+
+    if (!op->active && !op->armed) {
+        delete op;
+    }
+}
+
+void IoUringEventLoop::on_recv_completion(Operation* op, int res, uint32_t flags) {
+    bool more = flags & IORING_CQE_F_MORE;
+    op->armed = more;
+
+    cbufptr_t payload = {};
+    int msg_flags = 0;
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint8_t* buf = buf_pool_ + (flags >> IORING_CQE_BUFFER_SHIFT) * kBufSize;
+        if (res >= (int)sizeof(struct io_uring_recvmsg_out)) {
+            // The buffer starts with a header followed by the source address
+            // and control data, both of which we don't request.
+            struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+            uint8_t* data = buf + sizeof(*out) + out->namelen + out->controllen;
+            payload = {data, std::min((size_t)out->payloadlen, (size_t)(buf + res - data))};
+            msg_flags = (int)out->flags;
+        }
+        if (!op->active || !payload.size()) {
+            release_buffer({buf, kBufSize});
+            payload = {};
+        }
+    }
+
+    if (!op->active) {
+        // Completion of a cancelled operation
+        if (!more) {
+            n_orphaned_ops_--;
+            delete op;
+        }
+        return;
+    }
+
+    if (payload.size()) {
+        dispatching_ = op;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t start = begin_dispatch(op);
+#endif
+        op->recv_callback.invoke((int)payload.size(), payload, msg_flags);
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        end_dispatch(op, (uintptr_t)op->recv_callback.get_ptr(), start);
+#endif
+        dispatching_ = nullptr;
+
+        if (!op->active) {
+            // Cancelled from within the callback
+            if (!op->armed) {
+                delete op;
+            }
+            return;
+        }
+    }
+
+    if (more) {
+        return;
+    }
+
+    if (res == -ENOBUFS) {
+        // All buffers are in use. The request is re-armed once a buffer is
+        // handed back.
+        starved_ops_.push_back(op);
+        return;
+    }
+
+    if (payload.size() && arm(op)) {
+        // The kernel terminated the request for another reason than EOF or
+        // an error (e.g. completion queue overflow).
+        return;
+    }
+
+    op->active = false;
+    n_io_ops_--;
+    op->recv_callback.invoke(res < 0 ? res : 0, {}, 0);
+    delete op;
+}
+
+RichStatus IoUringEventLoop::stop() {
+    F_RET_IF(ring_fd_ < 0, "not started");
+    stopping_ = true;
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::post(Callback<void> callback) {
+    F_RET_IF(ring_fd_ < 0, "not started");
+
+    PostedCallback item = {callback};
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    item.posted_ns = now_ns();
+#endif
+    F_RET_IF(!post_queue_.push(item), "post queue full");
+
+    // If the event loop was already woken up it will also see this callback.
+    if (!post_fd_signalled_.exchange(true)) {
+        const uint64_t val = 1;
+        if (write(post_fd_, &val, sizeof(val)) != sizeof(val)) {
+            post_fd_signalled_.store(false);
+            return F_MAKE_ERR("write() failed: " << sys_err());
+        }
+    }
+
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::register_event(int event_fd, uint32_t events, Callback<void, uint32_t> callback) {
+    F_RET_IF(ring_fd_ < 0, "not initialized");
+    F_RET_IF(event_fd < 0, "invalid argument");
+    F_RET_IF(context_map_.count(event_fd), "fd " << event_fd << " already registered");
+
+    Operation* op = new Operation{}; // deleted in cancel() or on_completion()
+    op->kind = OpKind::kPoll;
+    op->fd = event_fd;
+    op->events = events;
+    op->poll_callback = callback;
+
+    if (!arm(op)) {
+        delete op;
+        return F_MAKE_ERR("failed to submit poll request for " << event_fd);
+    }
+    context_map_[event_fd] = op;
+    n_idle_events_ += is_idle(events);
+
+    F_LOG_T(logger_, "registered event " << event_fd);
+
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::modify_event(int event_fd, uint32_t events) {
+    F_RET_IF(ring_fd_ < 0, "not initialized");
+
+    auto it = context_map_.find(event_fd);
+    F_RET_IF(it == context_map_.end(), "event context not found");
+    Operation* op = it->second;
+    F_RET_IF((op->events ^ events) & EPOLLET, "cannot switch between level- and edge-triggered mode");
+
+    n_idle_events_ += is_idle(events);
+    n_idle_events_ -= is_idle(op->events);
+    op->events = events;
+
+    if (op->armed) {
+        // Update the pending poll request in place. If it completed in the
+        // meantime, on_completion() re-arms it with the new events.
+        struct io_uring_sqe* sqe = get_sqe();
+        F_RET_IF(!sqe, "failed to submit poll update for " << event_fd);
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = (uint64_t)(uintptr_t)op;
+        sqe->len = IORING_POLL_UPDATE_EVENTS | ((events & EPOLLET) ? IORING_POLL_ADD_MULTI : 0);
+        sqe->poll32_events = to_poll32(events);
+    } else if (op != dispatching_) {
+        // The poll request was dropped after an error
+        F_RET_IF(!arm(op), "failed to submit poll request for " << event_fd);
+    }
+
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::deregister_event(int event_fd) {
+    F_RET_IF(ring_fd_ < 0, "not initialized");
+
+    auto it = context_map_.find(event_fd);
+    F_RET_IF(it == context_map_.end(), "event context not found");
+    Operation* op = it->second;
+    context_map_.erase(it);
+    n_idle_events_ -= is_idle(op->events);
+    cancel(op);
+
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::start_sendmsg(int fd, const struct msghdr* msg, IoOperation** p_op, Callback<void, int> on_done) {
+    F_RET_IF(!supports_async_io(), "not supported");
+
+    Operation* op = new Operation{}; // deleted in cancel() or on_completion()
+    op->kind = OpKind::kSendmsg;
+    op->fd = fd;
+    op->msg = *msg;
+    op->send_callback = on_done;
+
+    if (!arm(op)) {
+        delete op;
+        return F_MAKE_ERR("failed to submit sendmsg request for " << fd);
+    }
+    n_io_ops_++;
+
+    if (p_op) {
+        *p_op = op;
+    }
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::start_recv_multishot(int fd, IoOperation** p_op, Callback<void, int, cbufptr_t, int> on_received) {
+    F_RET_IF(!supports_async_io(), "not supported");
+
+    Operation* op = new Operation{}; // deleted in cancel() or on_recv_completion()
+    op->kind = OpKind::kRecvMultishot;
+    op->fd = fd;
+    op->recv_callback = on_received;
+
+    if (!arm(op)) {
+        delete op;
+        return F_MAKE_ERR("failed to submit recvmsg request for " << fd);
+    }
+    n_io_ops_++;
+
+    if (p_op) {
+        *p_op = op;
+    }
+    return RichStatus::success();
+}
+
+void IoUringEventLoop::release_buffer(cbufptr_t buffer) {
+    uint16_t bid = (uint16_t)((buffer.begin() - buf_pool_) / kBufSize);
+
+    // Not using buf_ring_->bufs because in C++ the flexible array member of
+    // io_uring_buf_ring is placed at the wrong offset.
+    struct io_uring_buf* buf = (struct io_uring_buf*)buf_ring_ + (buf_ring_tail_ & (kNumBufs - 1));
+    buf->addr = (uint64_t)(uintptr_t)(buf_pool_ + bid * kBufSize);
+    buf->len = kBufSize;
+    buf->bid = bid;
+    __atomic_store_n(&buf_ring_->tail, ++buf_ring_tail_, __ATOMIC_RELEASE);
+
+    std::vector<Operation*> starved_ops;
+    std::swap(starved_ops, starved_ops_);
+    for (Operation* op: starved_ops) {
+        if (!arm(op)) {
+            starved_ops_.push_back(op); // try again on the next buffer
+        }
+    }
+}
+
+RichStatus IoUringEventLoop::cancel_io(IoOperation* io_op) {
+    Operation* op = static_cast<Operation*>(io_op);
+    F_RET_IF(!op->active, "operation already finished");
+
+    n_io_ops_--;
+    cancel(op);
+
+    // Submit the cancellation right away. For socket operations this
+    // guarantees that the kernel is done with the buffers once we return.
+    F_RET_IF(enter(0) < 0, "io_uring_enter() failed: " << sys_err());
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::open_timer(Timer** p_timer, Callback<void> on_trigger) {
+    F_RET_IF(ring_fd_ < 0, "not initialized");
+
+    TimerContext* timer = new TimerContext{}; // deleted in close_timer()
+    timer->parent = this;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    timer->on_trigger = on_trigger;
+    timer->entry.callback = MEMBER_CB(timer, on_expired);
+#else
+    timer->entry.callback = on_trigger;
+#endif
+    n_timers_++;
+
+    if (p_timer) {
+        *p_timer = timer;
+    }
+    return RichStatus::success();
+}
+
+RichStatus IoUringEventLoop::TimerContext::set(float interval, TimerMode mode) {
+    if (mode == TimerMode::kNever) {
+        parent->timer_wheel_.cancel(&entry);
+        return RichStatus::success();
+    }
+
+    uint64_t interval_ns = (uint64_t)((double)interval * 1e9);
+    return set_ns(interval_ns, mode == TimerMode::kPeriodic ? interval_ns : 0, false);
+}
+
+RichStatus IoUringEventLoop::TimerContext::set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) {
+    // The timer wheel runs on CLOCK_BOOTTIME, which is ahead of
+    // CLOCK_MONOTONIC by the time spent in suspend.
+    uint64_t now = now_ns();
+    deadline_ns += absolute ? now - monotonic_ns() : now;
+    parent->timer_wheel_.arm(&entry, deadline_ns, interval_ns);
+    return parent->update_timer_fd();
+}
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+void IoUringEventLoop::TimerContext::on_expired() {
+    // The callback may close the timer
+    EventLoopStats& stats = parent->stats_;
+    Callback<void> callback = on_trigger;
+
+    uint64_t start = now_ns();
+    stats.timer_lateness.record(start - parent->timer_wheel_.firing_deadline_ns());
+    callback.invoke();
+    stats.record_callback((uintptr_t)callback.get_ptr(), start, now_ns());
+}
+#endif
+
+RichStatus IoUringEventLoop::update_timer_fd() {
+    uint64_t deadline_ns;
+    if (!timer_wheel_.next_deadline(&deadline_ns) || deadline_ns >= timer_fd_deadline_) {
+        // A timerfd that fires too early or for no reason is harmless so it's
+        // only updated if the deadline moves closer.
+        return RichStatus::success();
+    }
+
+    struct itimerspec timerspec = {};
+    timerspec.it_value = {
+        .tv_sec = (long)(deadline_ns / 1000000000ULL),
+        .tv_nsec = (long)(deadline_ns % 1000000000ULL)
+    };
+
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &timerspec, nullptr) != 0) {
+        return F_MAKE_ERR("timerfd_settime() failed: " << sys_err{});
+    }
+
+    timer_fd_deadline_ = deadline_ns;
+    return RichStatus::success();
+}
+
+void IoUringEventLoop::on_timer_fd(uint32_t mask) {
+    if (mask & EPOLLIN) {
+        uint64_t n_triggers;
+        if (read(timer_fd_, (uint8_t*)&n_triggers, sizeof(n_triggers)) == -1) {
+            F_LOG_IF(logger_, errno != EAGAIN, "failed to read timer: " << sys_err{});
+        }
+
+        timer_fd_deadline_ = UINT64_MAX;
+        timer_wheel_.advance(now_ns());
+        F_LOG_IF_ERR(logger_, update_timer_fd(), "failed to update timer");
+    }
+
+    if (mask & ~(EPOLLIN)) {
+        F_LOG_E(logger_, "unexpected event " << mask);
+        return;
+    }
+}
+
+RichStatus IoUringEventLoop::close_timer(Timer* timer) {
+    TimerContext* ctx = static_cast<TimerContext*>(timer);
+    timer_wheel_.cancel(&ctx->entry);
+    delete ctx;
+    n_timers_--;
+    return RichStatus::success();
+}
+
+uint64_t IoUringEventLoop::get_time_ns() {
+    return monotonic_ns();
+}
+
+void IoUringEventLoop::run_callbacks(uint32_t) {
+    uint64_t val;
+    F_LOG_IF(logger_, read(post_fd_, &val, sizeof(val)) != sizeof(val),
+             "failed to read from post file descriptor");
+
+    // Must happen before draining the queue. A post() that comes after this
+    // signals post_fd_ again, one that comes before is seen by the loop below.
+    // acq_rel synchronizes with the producers that set the flag.
+    post_fd_signalled_.exchange(false, std::memory_order_acq_rel);
+
+    // Callbacks that are posted from within the callbacks below (or by other
+    // threads in the meantime) are deferred to the next iteration so that
+    // they can't starve other events.
+    size_t end = post_queue_.push_pos();
+    PostedCallback item;
+    while (post_queue_.pop_pos() != end && post_queue_.pop(&item)) {
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t start = now_ns();
+        stats_.post_lag.record(start - item.posted_ns);
+        item.callback.invoke();
+        stats_.record_callback((uintptr_t)item.callback.get_ptr(), start, now_ns());
+#else
+        item.callback.invoke();
+#endif
+    }
+}
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+uint64_t IoUringEventLoop::begin_dispatch(Operation* op) {
+    if (op->internal) {
+        return 0;
+    }
+    uint64_t start = now_ns();
+    stats_.dispatch_lag.record(start - wakeup_ns_);
+    return start;
+}
+
+void IoUringEventLoop::end_dispatch(Operation* op, uintptr_t site, uint64_t start) {
+    if (!op->internal) {
+        stats_.record_callback(site, start, now_ns());
+    }
+}
+
+RichStatus IoUringEventLoop::set_stats_dump_interval(float interval) {
+    F_RET_IF(ring_fd_ < 0, "not initialized");
+
+    if (interval <= 0.0f) {
+        timer_wheel_.cancel(&stats_dump_entry_);
+        return RichStatus::success();
+    }
+
+    uint64_t interval_ns = (uint64_t)(interval * 1e9f);
+    stats_dump_entry_.callback = MEMBER_CB(this, dump_stats);
+    timer_wheel_.arm(&stats_dump_entry_, now_ns() + interval_ns, interval_ns);
+    return update_timer_fd();
+}
+
+void IoUringEventLoop::dump_stats() {
+    stats_.dump(logger_, now_ns());
+}
+#endif
+
+#endif
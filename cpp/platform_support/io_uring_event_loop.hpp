@@ -0,0 +1,203 @@
+#ifndef __FIBRE_IO_URING_EVENT_LOOP_HPP
+#define __FIBRE_IO_URING_EVENT_LOOP_HPP
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+
+#include <fibre/event_loop.hpp>
+#include <fibre/logging.hpp>
+#include "../timer_wheel.hpp"
+#include "../mpsc_queue.hpp"
+
+namespace fibre {
+
+/**
+ * @brief Event loop based on the Linux-specific `io_uring` infrastructure.
+ *
+ * Besides the readiness-based register_event() (implemented with one-shot
+ * poll requests that are re-armed after each event, which gives the same level
+ * triggered semantics as EpollEventLoop, or with multishot poll requests for
+ * edge-triggered events) this event loop supports
+ * completion-based I/O (see EventLoop::supports_async_io()). Received data is
+ * placed into a ring of buffers that is registered with the kernel so that a
+ * single multishot receive request serves any number of messages.
+ *
+ * Completion-based I/O requires Linux 6.0 or later. On older kernels (5.1 and
+ * later) the event loop still works but supports_async_io() returns false.
+ * Edge-triggered events require Linux 5.13 or later. modify_event() updates
+ * pending poll requests in place on Linux 5.13 or later. On older kernels the
+ * old events stay in effect until the next event fires.
+ *
+ * Thread safety: Same as EpollEventLoop.
+ */
+class IoUringEventLoop final : public EventLoop {
+public:
+    /**
+     * @brief Returns true if the running kernel supports io_uring.
+     *
+     * io_uring can be unavailable on kernels that support it, for instance if
+     * it was disabled through the kernel.io_uring_disabled sysctl.
+     */
+    static bool is_supported();
+
+    /**
+     * @brief Starts the event loop on the current thread and places the
+     * specified start callback on the event queue.
+     *
+     * The function returns when the event loop becomes empty or if a platform
+     * error occurs.
+     */
+    RichStatus start(Logger logger, Callback<void> on_started);
+
+    RichStatus post(Callback<void> callback) final;
+    RichStatus register_event(int fd, uint32_t events, Callback<void, uint32_t> callback) final;
+    RichStatus modify_event(int fd, uint32_t events) final;
+    RichStatus deregister_event(int fd) final;
+    RichStatus open_timer(Timer** p_timer, Callback<void> on_trigger) final;
+    RichStatus close_timer(Timer* timer) final;
+    uint64_t get_time_ns() final;
+
+    bool supports_async_io() final { return buf_ring_ != nullptr; }
+    RichStatus start_sendmsg(int fd, const struct msghdr* msg, IoOperation** op, Callback<void, int> on_done) final;
+    RichStatus start_recv_multishot(int fd, IoOperation** op, Callback<void, int, cbufptr_t, int> on_received) final;
+    void release_buffer(cbufptr_t buffer) final;
+    RichStatus cancel_io(IoOperation* op) final;
+    RichStatus stop() final;
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    EventLoopStats* get_stats() final { return &stats_; }
+    RichStatus set_stats_dump_interval(float interval) final;
+#endif
+
+private:
+    enum class OpKind {
+        kPoll,
+        kSendmsg,
+        kRecvMultishot,
+    };
+
+    struct Operation final : IoOperation {
+        OpKind kind;
+        int fd;
+        bool armed = false; // a request for this operation is owned by the kernel
+        bool active = true; // false once the operation was deregistered or cancelled
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        bool internal = false; // the callback dispatches other callbacks, which are instrumented individually
+#endif
+        uint32_t events = 0; // valid for kPoll
+        struct msghdr msg = {}; // valid for kSendmsg and kRecvMultishot
+        Callback<void, uint32_t> poll_callback;
+        Callback<void, int> send_callback;
+        Callback<void, int, cbufptr_t, int> recv_callback;
+    };
+
+    struct TimerContext final : Timer {
+        RichStatus set(float interval, TimerMode mode) final;
+        RichStatus set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) final;
+        uint64_t get_missed_periods() final { return entry.missed; }
+        IoUringEventLoop* parent;
+        TimerWheel::Entry entry;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        void on_expired();
+        Callback<void> on_trigger;
+#endif
+    };
+
+    struct PostedCallback {
+        Callback<void> callback;
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+        uint64_t posted_ns;
+#endif
+    };
+
+    RichStatus setup_ring();
+    void teardown_ring();
+    RichStatus setup_buf_ring();
+    void teardown_buf_ring();
+
+    struct io_uring_sqe* get_sqe();
+    static uint32_t to_poll32(uint32_t events);
+    static bool is_idle(uint32_t events) { return !(events & ~(EPOLLERR | EPOLLHUP | EPOLLET)); }
+    int enter(unsigned int min_complete);
+    bool arm(Operation* op);
+    void cancel(Operation* op);
+    void reap_completions();
+    void on_completion(Operation* op, int res, uint32_t flags);
+    void on_recv_completion(Operation* op, int res, uint32_t flags);
+    void run_callbacks(uint32_t);
+    RichStatus update_timer_fd();
+    void on_timer_fd(uint32_t mask);
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    uint64_t begin_dispatch(Operation* op);
+    void end_dispatch(Operation* op, uintptr_t site, uint64_t start);
+    void dump_stats();
+#endif
+
+    int ring_fd_ = -1;
+    Logger logger_ = Logger::none();
+    int post_fd_ = -1;
+    unsigned int iterations_ = 0;
+
+    // All timers are multiplexed onto a single timerfd through a timer wheel.
+    static const uint64_t kTimerTickNs = 1000000ULL;
+    int timer_fd_ = -1;
+    uint64_t timer_fd_deadline_ = UINT64_MAX; // absolute CLOCK_BOOTTIME deadline to which timer_fd_ is currently set
+    TimerWheel timer_wheel_{kTimerTickNs, 0};
+    size_t n_timers_ = 0; // number of open timers (armed or not)
+
+    // Shared ring memory
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_array_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe* cqes_;
+
+    // Provided buffers for start_recv_multishot(). Null if async I/O is not
+    // supported by the kernel.
+    static const unsigned kNumBufs = 64; // must be a power of two
+    static const size_t kBufSize = 4096;
+    static const uint16_t kBufGroup = 0;
+    struct io_uring_buf_ring* buf_ring_ = nullptr;
+    uint8_t* buf_pool_ = nullptr;
+    uint16_t buf_ring_tail_ = 0;
+    std::vector<Operation*> starved_ops_; // receive operations that ran out of buffers
+
+    std::unordered_map<int, Operation*> context_map_; // required to deregister callbacks
+    size_t n_idle_events_ = 0; // number of registered fds that only listen for errors and hangups
+    size_t n_io_ops_ = 0; // number of active operations started with start_sendmsg() or start_recv_multishot()
+    size_t n_orphaned_ops_ = 0; // number of inactive operations that are still owned by the kernel
+    Operation* dispatching_ = nullptr; // operation whose callback is currently running
+    bool stopping_ = false; // set by stop()
+
+    // Callbacks that were submitted through post().
+    static const size_t kPostQueueSize = 4096;
+    MpscQueue<PostedCallback, kPostQueueSize> post_queue_;
+
+    // Set by the first post() after run_callbacks() started draining
+    // post_queue_. Only that post() writes to post_fd_.
+    std::atomic<bool> post_fd_signalled_{false};
+
+#if FIBRE_ENABLE_EVENT_LOOP_STATS
+    EventLoopStats stats_;
+    uint64_t wakeup_ns_ = 0; // time at which the current iteration's io_uring_enter() returned
+    TimerWheel::Entry stats_dump_entry_; // not counted in n_timers_
+#endif
+};
+
+}
+
+#endif // __FIBRE_IO_URING_EVENT_LOOP_HPP
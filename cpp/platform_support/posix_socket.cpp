@@ -1,7 +1,7 @@
 
 #include "posix_socket.hpp"
 
-#if FIBRE_ENABLE_TCP_SERVER_BACKEND || FIBRE_ENABLE_TCP_CLIENT_BACKEND
+#if FIBRE_ENABLE_TCP_SERVER_BACKEND || FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_UNIX_SERVER_BACKEND || FIBRE_ENABLE_UNIX_CLIENT_BACKEND || FIBRE_ENABLE_UDP_SERVER_BACKEND || FIBRE_ENABLE_UDP_CLIENT_BACKEND
 
 #include "../print_utils.hpp"
 #include <errno.h>
@@ -9,6 +9,8 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <signal.h>
@@ -19,6 +21,8 @@
 
 using namespace fibre;
 
+constexpr size_t PosixSocket::kMaxIovecs;
+
 namespace fibre {
 /**
  * @brief Tag type to print the last socket error.
@@ -40,6 +44,22 @@ struct sock_err {
 };
 }
 
+/**
+ * @brief Points the iovecs to the specified buffers.
+ *
+ * @returns The total number of bytes in the buffers.
+ */
+template<typename TBuf>
+static size_t fill_iovecs(const TBuf* buffers, size_t n_buffers, struct iovec* iov) {
+    size_t n_total = 0;
+    for (size_t i = 0; i < n_buffers; ++i) {
+        iov[i].iov_base = const_cast<unsigned char*>(buffers[i].begin());
+        iov[i].iov_len = buffers[i].size();
+        n_total += buffers[i].size();
+    }
+    return n_total;
+}
+
 namespace std {
 std::ostream& operator<<(std::ostream& stream, const struct sockaddr_storage& val) {
     char buf[128];
@@ -48,6 +68,9 @@ std::ostream& operator<<(std::ostream& stream, const struct sockaddr_storage& va
         return stream << buf;
     } else if ((val.ss_family == AF_INET6) && (inet_ntop(val.ss_family, ((struct sockaddr*)&val)->sa_data+6, buf, sizeof(buf)))) {
         return stream << buf;
+    } else if (val.ss_family == AF_UNIX) {
+        const char* path = ((const struct sockaddr_un*)&val)->sun_path;
+        return stream << (path[0] ? path : "(unnamed or abstract)");
     } else {
         return stream << "(invalid address)";
     }
@@ -125,19 +148,29 @@ RichStatus fibre::start_resolving_address(EventLoop* event_loop, Logger logger,
         return F_MAKE_ERR("getaddrinfo_a() failed");
     }
 
+    if (handle) {
+        *handle = ctx;
+    }
     return RichStatus::success();
 }
 
 void fibre::cancel_resolving_address(AddressResolutionContext* handle) {
-    gai_cancel(&handle->gaicb);
+    if (gai_cancel(&handle->gaicb) == EAI_CANCELED) {
+        // No completion notification is sent for cancelled requests
+        handle->on_gai_completed(0);
+    }
 }
 
 void AddressResolutionContext::on_gai_completed(uint32_t) {
     F_LOG_IF_ERR(logger, event_loop->deregister_event(cmpl_fd),
                  "failed to deregister event");
+    close(cmpl_fd);
 
-    F_LOG_D(logger, "address resolution complete");
-    if (!F_LOG_IF(logger, gai_error(&gaicb), "failed to resolve " << address_str << ": " << sys_err())) {
+    int err = gai_error(&gaicb);
+    if (err == EAI_CANCELED) {
+        F_LOG_D(logger, "address resolution cancelled");
+    } else if (!F_LOG_IF(logger, err, "failed to resolve " << address_str << ": " << sys_err())) {
+        F_LOG_D(logger, "address resolution complete");
         // this returns multiple addresses
         for (struct addrinfo* addr = gaicb.ar_result; addr; addr = addr->ai_next) {
             F_LOG_D(logger, "resolved IP: " << *(struct sockaddr_storage*)addr->ai_addr);
@@ -176,11 +209,11 @@ RichStatus fibre::start_connecting(EventLoop* event_loop, Logger logger, cbufptr
         goto fail0;
     }
    
-    if (connect(context->socket_id, the_addr, addr.size()) == 0) {
-        if (errno != EINPROGRESS) {
-            status = F_MAKE_ERR("connect() failed: " << sock_err());
-            goto fail1;
-        }
+    // Unix domain sockets usually connect immediately. TCP sockets complete
+    // asynchronously.
+    if (connect(context->socket_id, the_addr, addr.size()) != 0 && errno != EINPROGRESS) {
+        status = F_MAKE_ERR("connect() failed: " << sock_err());
+        goto fail1;
     }
 
     if ((status = event_loop->register_event(context->socket_id, EPOLLOUT, MEMBER_CB(context, on_connection_complete))).is_error()) {
@@ -259,7 +292,7 @@ RichStatus fibre::start_listening(EventLoop* event_loop, Logger logger, cbufptr_
 
     // make this socket a passive socket
     if (listen(context->socket_id, MAX_CONCURRENT_CONNECTIONS) != 0) {
-        status = F_MAKE_ERR("failed to listen on TCP: " << sys_err());
+        status = F_MAKE_ERR("failed to listen: " << sys_err());
         goto fail1;
     }
 
@@ -268,6 +301,10 @@ RichStatus fibre::start_listening(EventLoop* event_loop, Logger logger, cbufptr_
         goto fail1;
     }
 
+    if (ctx) {
+        *ctx = context;
+    }
+
     return RichStatus::success();
 
 fail1:
@@ -285,7 +322,7 @@ void fibre::ConnectionContext::on_accept(uint32_t mask) {
     struct sockaddr_storage remote_addr;
     socklen_t slen = sizeof(remote_addr);
 
-    F_LOG_D(logger, "incoming TCP connection");
+    F_LOG_D(logger, "incoming connection");
     int new_socket_id = accept(socket_id, reinterpret_cast<struct sockaddr *>(&remote_addr), &slen);
     if (IS_INVALID_SOCKET(new_socket_id)) {
         F_LOG_E(logger, "accept() returned invalid socket: " << sock_err());
@@ -303,21 +340,67 @@ RichStatus PosixSocket::init(EventLoop* event_loop, Logger logger, socket_id_t s
     socket_id = dup(socket_id);
     F_RET_IF(IS_INVALID_SOCKET(socket_id), "failed to duplicate socket: " << sock_err());
 
-    //if (!event_loop->register_event(socket_id, 0, MEMBER_CB(this, on_event))) {
-    //    F_LOG_E(logger_, "failed to register socket event");
-    //    close(socket_id);
-    //    return false;
-    //}
+    // Completion-based I/O is only used for stream sockets because the receive
+    // path doesn't report the remote address.
+    int type = 0;
+    socklen_t type_len = sizeof(type);
+    use_async_io_ = event_loop->supports_async_io()
+                 && getsockopt(socket_id, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0
+                 && type == SOCK_STREAM;
+
+#ifdef SO_BUSY_POLL
+    if (int busy_poll_us = (int)event_loop->socket_busy_poll_us()) {
+        // Requires CAP_NET_ADMIN. Without it the socket still works, just
+        // with the usual interrupt-driven latency.
+        if (setsockopt(socket_id, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) != 0) {
+            F_LOG_W(logger, "failed to set SO_BUSY_POLL: " << sock_err());
+        }
+    }
+#endif
+
+    if (!use_async_io_) {
+        // Register once with an empty mask. update_subscription() only
+        // modifies the mask after this.
+        RichStatus status = event_loop->register_event(socket_id, 0, MEMBER_CB(this, on_event));
+        if (status.is_error()) {
+            ::close(socket_id);
+            return F_AMEND_ERR(status, "failed to register socket event");
+        }
+        registered_ = true;
+        mask_ = 0;
+    }
 
     event_loop_ = event_loop;
     logger_ = logger;
     socket_id_ = socket_id;
+    rx_done_ = false;
     return RichStatus::success();
 }
 
 RichStatus PosixSocket::deinit() {
     F_RET_IF(IS_INVALID_SOCKET(socket_id_), "not initialized");
 
+    if (rx_op_) {
+        F_LOG_IF_ERR(logger_, event_loop_->cancel_io(rx_op_), "failed to cancel receive");
+        rx_op_ = nullptr;
+    }
+    for (auto& buf: rx_queue_) {
+        event_loop_->release_buffer(buf);
+    }
+    rx_queue_.clear();
+    rx_queue_offset_ = 0;
+
+    if (tx_op_) {
+        F_LOG_IF_ERR(logger_, event_loop_->cancel_io(tx_op_), "failed to cancel send");
+        tx_op_ = nullptr;
+    }
+
+    if (registered_) {
+        F_LOG_IF_ERR(logger_, event_loop_->deregister_event(socket_id_), "failed to deregister event");
+        registered_ = false;
+        mask_ = 0;
+    }
+
     if (::close(socket_id_)) {
         F_LOG_E(logger_, "close() failed: " << sock_err());
     }
@@ -327,7 +410,7 @@ RichStatus PosixSocket::deinit() {
 }
 
 void PosixSocket::start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) {
-    if (rx_callback_.has_value()) {
+    if (rx_callback_.has_value() || rxv_callback_.has_value()) {
         F_LOG_E(logger_, "RX request already pending");
         completer.invoke({kStreamError});
         return;
@@ -337,6 +420,13 @@ void PosixSocket::start_read(bufptr_t buffer, TransferHandle* handle, Callback<v
         *handle = reinterpret_cast<TransferHandle>(this);
     }
 
+    if (use_async_io_) {
+        rx_buf_ = buffer;
+        rx_callback_ = completer;
+        start_read_async();
+        return;
+    }
+
     auto result = read_sync(buffer);
     if (result.has_value()) {
         completer.invoke(*result);
@@ -347,18 +437,64 @@ void PosixSocket::start_read(bufptr_t buffer, TransferHandle* handle, Callback<v
     }
 }
 
+void PosixSocket::start_readv(const bufptr_t* buffers, size_t n_buffers, TransferHandle* handle, Callback<void, ReadvResult> completer) {
+    if (rx_callback_.has_value() || rxv_callback_.has_value()) {
+        F_LOG_E(logger_, "RX request already pending");
+        completer.invoke({kStreamError, 0});
+        return;
+    }
+
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+
+    if (use_async_io_) {
+        rx_bufs_ = buffers;
+        n_rx_bufs_ = n_buffers;
+        rxv_callback_ = completer;
+        start_read_async();
+        return;
+    }
+
+    auto result = readv_sync(buffers, n_buffers);
+    if (result.has_value()) {
+        completer.invoke(*result);
+    } else {
+        rx_bufs_ = buffers;
+        n_rx_bufs_ = n_buffers;
+        rxv_callback_ = completer;
+        update_subscription();
+    }
+}
+
 void PosixSocket::cancel_read(TransferHandle transfer_handle) {
     if (transfer_handle != reinterpret_cast<TransferHandle>(this)) {
         F_LOG_E(logger_, "invalid handle");
-    } else if (!rx_callback_.has_value()) {
+    } else if (!rx_callback_.has_value() && !rxv_callback_.has_value()) {
         F_LOG_E(logger_, "no RX pending");
     } else {
-        rx_callback_.invoke_and_clear({kStreamCancelled, rx_buf_.begin()});
+        complete_read(kStreamCancelled, 0);
+    }
+}
+
+/**
+ * @brief Completes the pending RX request, regardless of whether it was
+ * started with start_read() or start_readv().
+ */
+void PosixSocket::complete_read(StreamStatus status, size_t n_bytes) {
+    if (rx_callback_.has_value()) {
+        bufptr_t buf = rx_buf_;
+        rx_buf_ = {};
+        rx_callback_.invoke_and_clear({status, buf.begin() + std::min(n_bytes, buf.size())});
+    } else if (rxv_callback_.has_value()) {
+        rx_bufs_ = nullptr;
+        n_rx_bufs_ = 0;
+        rxv_callback_.invoke_and_clear({status, n_bytes});
     }
 }
 
 void PosixSocket::start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult0> completer) {
-    if (tx_callback_.has_value()) {
+    if (tx_callback_.has_value() || txv_callback_.has_value()) {
         F_LOG_E(logger_, "TX request already pending");
         completer.invoke({kStreamError});
         return;
@@ -368,6 +504,13 @@ void PosixSocket::start_write(cbufptr_t buffer, TransferHandle* handle, Callback
         *handle = reinterpret_cast<TransferHandle>(this);
     }
 
+    if (use_async_io_) {
+        tx_buf_ = buffer;
+        tx_callback_ = completer;
+        start_writev_async(&tx_buf_, 1);
+        return;
+    }
+
     auto result = write_sync(buffer);
     if (result.has_value()) {
         completer.invoke(*result);
@@ -378,97 +521,182 @@ void PosixSocket::start_write(cbufptr_t buffer, TransferHandle* handle, Callback
     }
 }
 
+void PosixSocket::start_writev(const cbufptr_t* buffers, size_t n_buffers, TransferHandle* handle, Callback<void, WritevResult> completer) {
+    if (tx_callback_.has_value() || txv_callback_.has_value()) {
+        F_LOG_E(logger_, "TX request already pending");
+        completer.invoke({kStreamError, 0});
+        return;
+    }
+
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+
+    if (use_async_io_) {
+        txv_callback_ = completer;
+        start_writev_async(buffers, n_buffers);
+        return;
+    }
+
+    auto result = writev_sync(buffers, n_buffers);
+    if (result.has_value()) {
+        completer.invoke(*result);
+    } else {
+        tx_bufs_ = buffers;
+        n_tx_bufs_ = n_buffers;
+        txv_callback_ = completer;
+        update_subscription();
+    }
+}
+
 void PosixSocket::cancel_write(TransferHandle transfer_handle) {
     if (transfer_handle != reinterpret_cast<TransferHandle>(this)) {
         F_LOG_E(logger_, "invalid handle");
-    } else if (!tx_callback_.has_value()) {
-        F_LOG_E(logger_, "no TX pending");
-    } else {
+        return;
+    }
+
+    if (tx_op_) {
+        F_LOG_IF_ERR(logger_, event_loop_->cancel_io(tx_op_), "failed to cancel send");
+        tx_op_ = nullptr;
+    }
+
+    if (tx_callback_.has_value()) {
         tx_callback_.invoke_and_clear({kStreamCancelled, tx_buf_.begin()});
+    } else if (txv_callback_.has_value()) {
+        txv_callback_.invoke_and_clear({kStreamCancelled, 0});
+    } else {
+        F_LOG_E(logger_, "no TX pending");
     }
 }
 
 std::optional<ReadResult> PosixSocket::read_sync(bufptr_t buffer) {
-    if (buffer.size() == 0) {
+    auto result = readv_sync(&buffer, 1);
+    if (!result.has_value()) {
+        return std::nullopt;
+    }
+    return {{result->status, buffer.begin() + std::min(result->n_bytes, buffer.size())}};
+}
+
+std::optional<ReadvResult> PosixSocket::readv_sync(const bufptr_t* buffers, size_t n_buffers) {
+    struct iovec iov[kMaxIovecs];
+    size_t n_iov = std::min(n_buffers, kMaxIovecs);
+    size_t n_total = fill_iovecs(buffers, n_iov, iov);
+
+    if (n_total == 0) {
         // Empty buffers mess with our socket-close detection
         F_LOG_E(logger_, "empty buffer not permitted");
     }
 
-    socklen_t slen = sizeof(remote_addr_);
-    ssize_t n_received = recvfrom(socket_id_, buffer.begin(), buffer.size(),
-            MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&remote_addr_), &slen);
-    
+    struct msghdr msg = {};
+    msg.msg_name = &remote_addr_;
+    msg.msg_namelen = sizeof(remote_addr_);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n_iov;
+
+    ssize_t n_received = recvmsg(socket_id_, &msg, MSG_DONTWAIT);
+
     if (n_received < 0) {
-        // If recvfrom returns -1 an errno is set to indicate the error.
+        // If recvmsg returns -1 an errno is set to indicate the error.
         auto err = sock_err{};
         if (err.error_number == EAGAIN || err.error_number == EWOULDBLOCK) {
             return std::nullopt;
         } else {
             F_LOG_E(logger_, "Socket read failed: " << err);
-            return {{kStreamError, buffer.end()}}; // the function might have written to the buffer
+            return {{kStreamError, n_total}}; // the function might have written to the buffers
         }
 
-    } else if ((size_t)n_received > buffer.size()) {
+    } else if ((size_t)n_received > n_total) {
         F_LOG_E(logger_, "received too many bytes");
-        return {{kStreamError, buffer.end()}};
+        return {{kStreamError, n_total}};
 
     } else if (n_received == 0) {
         F_LOG_D(logger_, "socket closed (RX half)");
-        return {{kStreamClosed, buffer.begin()}};
+        return {{kStreamClosed, 0}};
 
     } else {
         F_LOG_D(logger_, "Received " << n_received << " bytes from " << remote_addr_);
-        return {{kStreamOk, buffer.begin() + n_received}};
+        return {{kStreamOk, (size_t)n_received}};
     }
 }
 
 std::optional<WriteResult0> PosixSocket::write_sync(cbufptr_t buffer) {
-    if (buffer.size() == 0) {
+    auto result = writev_sync(&buffer, 1);
+    if (!result.has_value()) {
+        return std::nullopt;
+    }
+    return {{result->status, buffer.begin() + std::min(result->n_bytes, buffer.size())}};
+}
+
+std::optional<WritevResult> PosixSocket::writev_sync(const cbufptr_t* buffers, size_t n_buffers) {
+    struct iovec iov[kMaxIovecs];
+    size_t n_iov = std::min(n_buffers, kMaxIovecs);
+    size_t n_total = fill_iovecs(buffers, n_iov, iov);
+
+    if (n_total == 0) {
         // Empty buffers mess with our socket-close detection
         F_LOG_E(logger_, "empty buffer not permitted");
     }
 
-    int n_sent = sendto(socket_id_, buffer.begin(), buffer.size(), MSG_DONTWAIT,
-            reinterpret_cast<struct sockaddr*>(&remote_addr_), sizeof(remote_addr_));
+    struct msghdr msg = {};
+    msg.msg_name = &remote_addr_;
+    msg.msg_namelen = sizeof(remote_addr_);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n_iov;
+
+    ssize_t n_sent = sendmsg(socket_id_, &msg, MSG_DONTWAIT);
     if (n_sent < 0) {
-        // If sendto returns -1 an errno is set to indicate the error.
+        // If sendmsg returns -1 an errno is set to indicate the error.
         auto err = sock_err{};
         if (err.error_number == EAGAIN || err.error_number == EWOULDBLOCK) {
             return std::nullopt;
-        } else {
-            F_LOG_E(logger_, "Socket write failed: " << err);
-            return {{kStreamError, buffer.end()}}; // the function might have written to the buffer
         }
+        return make_writev_result(n_sent, err.error_number, n_total);
+    }
+
+    return make_writev_result(n_sent, 0, n_total);
+}
 
-    } else if ((size_t)n_sent > buffer.size()) {
+WritevResult PosixSocket::make_writev_result(ssize_t n_sent, int error_number, size_t n_total) {
+    if (n_sent < 0) {
+        F_LOG_E(logger_, "Socket write failed: " << sock_err{error_number});
+        return {kStreamError, n_total}; // the function might have written to the buffer
+
+    } else if ((size_t)n_sent > n_total) {
         F_LOG_E(logger_, "sent too many bytes");
-        return {{kStreamError, buffer.end()}};
+        return {kStreamError, n_total};
 
     } else if (n_sent == 0) {
         F_LOG_D(logger_, "socket closed (TX half)");
-        return {{kStreamClosed, buffer.begin()}};
+        return {kStreamClosed, 0};
 
     } else {
         F_LOG_D(logger_, "Sent " << n_sent << " bytes to " << remote_addr_);
-        return {{kStreamOk, buffer.begin() + n_sent}};
+        return {kStreamOk, (size_t)n_sent};
     }
 }
 
 void PosixSocket::update_subscription() {
-    uint32_t new_mask = (tx_callback_.has_value() ? EPOLLOUT : 0)
-                      | (rx_callback_.has_value() ? EPOLLIN : 0);
-    if (new_mask != mask_) {
-        if (mask_) {
-            event_loop_->deregister_event(socket_id_);
-        }
-        mask_ = new_mask;
-        if (new_mask) {
-            event_loop_->register_event(socket_id_, new_mask, MEMBER_CB(this, on_event));
-        }
+    uint32_t new_mask = (tx_callback_.has_value() || txv_callback_.has_value() ? EPOLLOUT : 0)
+                      | (rx_callback_.has_value() || rxv_callback_.has_value() ? EPOLLIN : 0);
+    if (new_mask == mask_) {
+        return;
+    }
+
+    mask_ = new_mask;
+    if (registered_) {
+        F_LOG_IF_ERR(logger_, event_loop_->modify_event(socket_id_, mask_), "failed to modify event");
+    } else if (mask_) {
+        // The socket was deregistered after a hangup (see on_event())
+        registered_ = !F_LOG_IF_ERR(logger_, event_loop_->register_event(socket_id_, mask_, MEMBER_CB(this, on_event)),
+                                    "failed to register event");
     }
 }
 
 void PosixSocket::on_event(uint32_t mask) {
+    // On errors and hangups pending requests complete with the socket's error
+    if (mask & (EPOLLERR | EPOLLHUP)) {
+        mask |= mask_;
+    }
 
     if (mask & EPOLLIN) {
         // The socket is ready for RX. If an RX request is pending, handle it
@@ -476,10 +704,17 @@ void PosixSocket::on_event(uint32_t mask) {
 
         if (rx_callback_.has_value()) {
             auto result = read_sync(rx_buf_);
-            rx_buf_ = {};
             if (result.has_value()) {
+                rx_buf_ = {};
                 rx_callback_.invoke_and_clear(*result);
             }
+        } else if (rxv_callback_.has_value()) {
+            auto result = readv_sync(rx_bufs_, n_rx_bufs_);
+            if (result.has_value()) {
+                rx_bufs_ = nullptr;
+                n_rx_bufs_ = 0;
+                rxv_callback_.invoke_and_clear(*result);
+            }
         }
     }
 
@@ -489,18 +724,146 @@ void PosixSocket::on_event(uint32_t mask) {
 
         if (tx_callback_.has_value()) {
             auto result = write_sync(tx_buf_);
-            tx_buf_ = {};
             if (result.has_value()) {
+                tx_buf_ = {};
                 tx_callback_.invoke_and_clear(*result);
             }
+        } else if (txv_callback_.has_value()) {
+            auto result = writev_sync(tx_bufs_, n_tx_bufs_);
+            if (result.has_value()) {
+                tx_bufs_ = nullptr;
+                n_tx_bufs_ = 0;
+                txv_callback_.invoke_and_clear(*result);
+            }
         }
     }
 
-    if (mask & ~(EPOLLIN | EPOLLOUT)) {
+    if (mask & ~(EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP)) {
         F_LOG_E(logger_, "unknown event mask: " << as_hex(mask));
     }
 
+    if ((mask & (EPOLLERR | EPOLLHUP)) && !rx_callback_.has_value() && !rxv_callback_.has_value()
+            && !tx_callback_.has_value() && !txv_callback_.has_value()) {
+        // Errors and hangups are reported regardless of the mask so they would
+        // fire continuously. Further requests fail immediately anyway.
+        F_LOG_IF_ERR(logger_, event_loop_->deregister_event(socket_id_), "failed to deregister event");
+        registered_ = false;
+        mask_ = 0;
+        return;
+    }
+
     update_subscription();
 }
 
+void PosixSocket::start_read_async() {
+    if (!rx_op_ && !rx_done_) {
+        RichStatus status = event_loop_->start_recv_multishot(socket_id_, &rx_op_, MEMBER_CB(this, on_received));
+        if (F_LOG_IF_ERR(logger_, status, "failed to start receiving")) {
+            complete_read(kStreamError, 0);
+            return;
+        }
+    }
+    complete_read_async();
+}
+
+void PosixSocket::complete_read_async() {
+    const bufptr_t* buffers;
+    size_t n_buffers;
+    if (rx_callback_.has_value()) {
+        buffers = &rx_buf_;
+        n_buffers = 1;
+    } else if (rxv_callback_.has_value()) {
+        buffers = rx_bufs_;
+        n_buffers = n_rx_bufs_;
+    } else {
+        return;
+    }
+
+    // Fill the read buffers with as much queued data as possible
+    size_t n_received = 0;
+    for (size_t i = 0; i < n_buffers && rx_queue_.size(); ++i) {
+        n_received += dequeue(buffers[i]);
+    }
+
+    if (n_received) {
+        F_LOG_D(logger_, "Received " << n_received << " bytes");
+        complete_read(kStreamOk, n_received);
+    } else if (rx_done_) {
+        complete_read(rx_result_ == 0 ? kStreamClosed : kStreamError, 0);
+    }
+}
+
+/**
+ * @brief Moves as much queued data as fits into the buffer.
+ *
+ * @returns The number of bytes moved.
+ */
+size_t PosixSocket::dequeue(bufptr_t buffer) {
+    bufptr_t buf = buffer;
+    while (rx_queue_.size() && buf.size()) {
+        cbufptr_t chunk = rx_queue_.front().skip(rx_queue_offset_);
+        size_t n_copy = std::min(chunk.size(), buf.size());
+        std::copy_n(chunk.begin(), n_copy, buf.begin());
+        buf = buf.skip(n_copy);
+        rx_queue_offset_ += n_copy;
+
+        if (n_copy == chunk.size()) {
+            event_loop_->release_buffer(rx_queue_.front());
+            rx_queue_.pop_front();
+            rx_queue_offset_ = 0;
+        }
+    }
+    return buf.begin() - buffer.begin();
+}
+
+void PosixSocket::on_received(int result, cbufptr_t data, int msg_flags) {
+    if (result > 0) {
+        rx_queue_.push_back(data);
+    } else if (result == 0) {
+        F_LOG_D(logger_, "socket closed (RX half)");
+        rx_op_ = nullptr;
+        rx_done_ = true;
+        rx_result_ = result;
+    } else {
+        F_LOG_E(logger_, "Socket read failed: " << sock_err{-result});
+        rx_op_ = nullptr;
+        rx_done_ = true;
+        rx_result_ = result;
+    }
+
+    complete_read_async();
+}
+
+void PosixSocket::start_writev_async(const cbufptr_t* buffers, size_t n_buffers) {
+    size_t n_iov = std::min(n_buffers, kMaxIovecs);
+    tx_total_ = fill_iovecs(buffers, n_iov, tx_iov_);
+
+    if (tx_total_ == 0) {
+        // Empty buffers mess with our socket-close detection
+        F_LOG_E(logger_, "empty buffer not permitted");
+    }
+
+    tx_msg_ = {};
+    tx_msg_.msg_iov = tx_iov_;
+    tx_msg_.msg_iovlen = n_iov;
+
+    if (F_LOG_IF_ERR(logger_, event_loop_->start_sendmsg(socket_id_, &tx_msg_, &tx_op_, MEMBER_CB(this, on_sent)),
+                     "failed to start sending")) {
+        on_sent(-EIO);
+    }
+}
+
+void PosixSocket::on_sent(int result) {
+    tx_op_ = nullptr;
+    WritevResult txv_result = make_writev_result(result, -result, tx_total_);
+
+    if (tx_callback_.has_value()) {
+        cbufptr_t buf = tx_buf_;
+        tx_buf_ = {};
+        tx_callback_.invoke_and_clear({txv_result.status, buf.begin() + std::min(txv_result.n_bytes, buf.size())});
+    } else if (txv_callback_.has_value()) {
+        txv_callback_.invoke_and_clear(txv_result);
+    }
+}
+
 #endif
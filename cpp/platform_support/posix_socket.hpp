@@ -3,7 +3,7 @@
 
 #include <fibre/config.hpp>
 
-#if FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_TCP_SERVER_BACKEND
+#if FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_TCP_SERVER_BACKEND || FIBRE_ENABLE_UNIX_CLIENT_BACKEND || FIBRE_ENABLE_UNIX_SERVER_BACKEND || FIBRE_ENABLE_UDP_CLIENT_BACKEND || FIBRE_ENABLE_UDP_SERVER_BACKEND
 
 #include <fibre/async_stream.hpp>
 #include <fibre/bufptr.hpp>
@@ -12,9 +12,12 @@
 #include <fibre/logging.hpp>
 #include <fibre/rich_status.hpp>
 #include <string>
+#include <deque>
 
 #if defined(__linux__)
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #elif defined(_WIN32) || defined(_WIN64)
 #error "WinSock not supported yet"
 #else
@@ -117,6 +120,16 @@ void stop_listening(ConnectionContext* ctx);
  * @brief AsyncStreamSource and AsyncStreamSink based on a Posix or WinSock
  * socket ID.
  * 
+ * If the event loop supports completion-based I/O (see
+ * EventLoop::supports_async_io()) stream sockets use it instead of readiness
+ * notifications: A multishot receive is started with the first read and stays
+ * active for the lifetime of the socket. Data that arrives while no read is
+ * pending is queued in buffers owned by the event loop.
+ * 
+ * Otherwise the socket is registered on the event loop once in init() and the
+ * set of events it listens for is changed with EventLoop::modify_event()
+ * whenever a read or write request starts waiting or completes.
+ * 
  * Note: To make this work on Windows, a "poll"-based worker must be implemented.
  */
 class PosixSocket final : public AsyncStreamSource, public AsyncStreamSink {
@@ -142,9 +155,13 @@ public:
     RichStatus deinit();
 
     void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final;
+    bool supports_readv() const final { return true; }
+    void start_readv(const bufptr_t* buffers, size_t n_buffers, TransferHandle* handle, Callback<void, ReadvResult> completer) final;
     void cancel_read(TransferHandle transfer_handle) final;
 
     void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult0> completer) final;
+    bool supports_writev() const final { return true; }
+    void start_writev(const cbufptr_t* buffers, size_t n_buffers, TransferHandle* handle, Callback<void, WritevResult> completer) final;
     void cancel_write(TransferHandle transfer_handle) final;
 
     /**
@@ -159,20 +176,54 @@ public:
     struct sockaddr_storage get_remote_address() const { return remote_addr_; }
 
 private:
+    // Buffers beyond this limit are not filled or sent in one transfer. This
+    // is indistinguishable from a partial transfer for the caller.
+    static constexpr size_t kMaxIovecs = 16;
+
     std::optional<ReadResult> read_sync(bufptr_t buffer);
+    std::optional<ReadvResult> readv_sync(const bufptr_t* buffers, size_t n_buffers);
+    void complete_read(StreamStatus status, size_t n_bytes);
     std::optional<WriteResult0> write_sync(cbufptr_t buffer);
+    std::optional<WritevResult> writev_sync(const cbufptr_t* buffers, size_t n_buffers);
+    WritevResult make_writev_result(ssize_t n_sent, int error_number, size_t n_total);
     void update_subscription();
     void on_event(uint32_t mask);
 
+    void start_read_async();
+    void complete_read_async();
+    size_t dequeue(bufptr_t buffer);
+    void start_writev_async(const cbufptr_t* buffers, size_t n_buffers);
+    void on_received(int result, cbufptr_t data, int msg_flags);
+    void on_sent(int result);
+
     int socket_id_ = INVALID_SOCKET;
     EventLoop* event_loop_ = nullptr;
     Logger logger_ = Logger::none();
     struct sockaddr_storage remote_addr_ = {0}; // updated after each RX event
+    bool registered_ = false; // true while the socket is registered on the event loop
     uint32_t mask_ = 0; // current event subscription mask
     bufptr_t rx_buf_{}; // valid while there is an RX request pending
+    const bufptr_t* rx_bufs_ = nullptr; // valid while there is a vectored RX request pending
+    size_t n_rx_bufs_ = 0; // valid while there is a vectored RX request pending
     cbufptr_t tx_buf_{}; // valid while there is a TX request pending
+    const cbufptr_t* tx_bufs_ = nullptr; // valid while there is a vectored TX request pending
+    size_t n_tx_bufs_ = 0; // valid while there is a vectored TX request pending
     Callback<void, ReadResult> rx_callback_; // valid while there is an RX request pending
+    Callback<void, ReadvResult> rxv_callback_; // valid while there is a vectored RX request pending
     Callback<void, WriteResult0> tx_callback_; // valid while there is a TX request pending
+    Callback<void, WritevResult> txv_callback_; // valid while there is a vectored TX request pending
+
+    // Completion-based I/O
+    bool use_async_io_ = false;
+    IoOperation* rx_op_ = nullptr; // valid while the multishot receive is active
+    std::deque<cbufptr_t> rx_queue_; // received data that was not yet read, in event loop owned buffers
+    size_t rx_queue_offset_ = 0; // number of bytes already read from the front of rx_queue_
+    bool rx_done_ = false; // true once the multishot receive finished
+    int rx_result_ = 0; // final result of the multishot receive (0 for EOF or a negative errno)
+    IoOperation* tx_op_ = nullptr; // valid while there is a TX request pending
+    struct msghdr tx_msg_ = {};
+    struct iovec tx_iov_[kMaxIovecs];
+    size_t tx_total_ = 0; // number of bytes in the pending TX request
 };
 
 }
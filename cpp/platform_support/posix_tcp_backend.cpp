@@ -5,6 +5,7 @@
 
 #include "posix_socket.hpp"
 #include <fibre/fibre.hpp>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <unistd.h>
 #include <algorithm>
@@ -12,6 +13,10 @@
 
 using namespace fibre;
 
+// Bounds for the exponential backoff between reconnect attempts
+static const float kMinReconnectDelay = 0.1f;
+static const float kMaxReconnectDelay = 30.0f;
+
 RichStatus PosixTcpBackend::init(EventLoop* event_loop, Logger logger) {
     F_RET_IF(event_loop_, "already initialized");
     F_RET_IF(!event_loop, "invalid argument");
@@ -51,27 +56,72 @@ void PosixTcpBackend::start_channel_discovery(Domain* domain, const char* specs,
         return; // TODO: error reporting
     }
 
-    n_discoveries_++;
+    // The legacy protocol stays the default until all peers speak the native
+    // protocol.
+    std::string protocol = "legacy";
+    try_parse_key(specs, specs + specs_len, "protocol", &protocol);
+#if FIBRE_ENABLE_STREAM_ADAPTER
+    if (protocol != "legacy" && protocol != "native") {
+#else
+    if (protocol != "legacy") {
+#endif
+        F_LOG_E(logger_, "unsupported protocol: " << protocol);
+        return; // TODO: error reporting
+    }
 
-    TcpChannelDiscoveryContext* ctx = new TcpChannelDiscoveryContext(); // TODO: free
+    TcpChannelDiscoveryContext* ctx = new TcpChannelDiscoveryContext(); // deleted in stop_channel_discovery() or on_found_address()
     
     if (F_LOG_IF_ERR(logger_, event_loop_->open_timer(&ctx->timer, MEMBER_CB(ctx, resolve_address)), "failed to open timer")) {
         delete ctx;
         return;
     }
 
+    n_discoveries_++;
+    if (handle) {
+        *handle = ctx;
+    }
+
     ctx->parent = this;
     ctx->address = {{address_begin, address_end}, port};
     ctx->display_name = "TCP (" + ctx->address.first + ":" + std::to_string(port) + ")";
     ctx->domain = domain;
+    ctx->native_protocol = protocol == "native";
     ctx->addr_resolution_ctx = nullptr;
     ctx->resolve_address();
 }
 
 RichStatus PosixTcpBackend::stop_channel_discovery(ChannelDiscoveryContext* handle) {
-    // TODO
+    TcpChannelDiscoveryContext* ctx = static_cast<TcpChannelDiscoveryContext*>(handle);
+    F_RET_IF(!ctx, "invalid handle");
+
     n_discoveries_--;
-    return RichStatus::success();
+    ctx->stopping = true;
+
+    RichStatus status = event_loop_->close_timer(ctx->timer);
+    ctx->timer = nullptr;
+
+    for (auto addr_ctx: ctx->known_addresses) {
+        if (addr_ctx->connection_ctx) {
+            cancel_opening_connections(addr_ctx->connection_ctx); // completes synchronously
+        }
+        if (addr_ctx->reconnect_timer) {
+            F_LOG_IF_ERR(logger_, event_loop_->close_timer(addr_ctx->reconnect_timer), "failed to close timer");
+        }
+        for (auto conn: addr_ctx->connections) {
+            conn->addr_ctx = nullptr; // connections stay open until the domain releases them
+        }
+        delete addr_ctx;
+    }
+    ctx->known_addresses.clear();
+
+    if (ctx->addr_resolution_ctx) {
+        // ctx is deleted once the cancellation completes
+        cancel_resolving_address(ctx->addr_resolution_ctx);
+    } else {
+        delete ctx;
+    }
+
+    return status;
 }
 
 void PosixTcpBackend::TcpChannelDiscoveryContext::resolve_address() {
@@ -85,24 +135,28 @@ void PosixTcpBackend::TcpChannelDiscoveryContext::resolve_address() {
 }
 
 void PosixTcpBackend::TcpChannelDiscoveryContext::on_found_address(std::optional<cbufptr_t> addr) {
+    // The backend might already be deinitialized so we must not access it.
+    if (stopping) {
+        if (!addr.has_value()) {
+            delete this; // stop_channel_discovery() is waiting for this
+        }
+        return;
+    }
+
     F_LOG_D(parent->logger_, "found address");
 
     if (addr.has_value()) {
         // Resolved an address. If it wasn't already known, try to connect to it.
         std::vector<uint8_t> vec{addr->begin(), addr->end()};
         bool is_known = std::find_if(known_addresses.begin(), known_addresses.end(),
-            [&](AddrContext& val){ return val.addr == vec; }) != known_addresses.end();
+            [&](AddrContext* val){ return val->addr == vec; }) != known_addresses.end();
 
         if (!is_known) {
-            AddrContext ctx = {.addr = vec};
-            if (!F_LOG_IF_ERR(parent->logger_,
-                    parent->start_opening_connections(parent->event_loop_,
-                        parent->logger_, *addr, SOCK_STREAM, IPPROTO_TCP,
-                        &ctx.connection_ctx, MEMBER_CB(this, on_connected)),
-                    "failed to connect")) {
+            AddrContext* ctx = new AddrContext{this, vec, nullptr, nullptr, kMinReconnectDelay, {}}; // deleted in stop_channel_discovery()
+            if (!F_LOG_IF_ERR(parent->logger_, ctx->connect(), "failed to connect")) {
                 known_addresses.push_back(ctx);
             } else {
-                // TODO
+                delete ctx; // TODO
             }
         }
     } else {
@@ -124,27 +178,108 @@ void PosixTcpBackend::TcpChannelDiscoveryContext::on_found_address(std::optional
     }
 }
 
-void PosixTcpBackend::TcpChannelDiscoveryContext::on_connected(RichStatus status, socket_id_t socket_id) {
-    if (!status.is_error()) {
-        auto socket = new PosixSocket{}; // TODO: free
-        status = socket->init(parent->event_loop_, parent->logger_, socket_id);
+RichStatus PosixTcpBackend::TcpChannelDiscoveryContext::AddrContext::connect() {
+    PosixTcpBackend* backend = parent->parent;
+    return backend->start_opening_connections(backend->event_loop_,
+            backend->logger_, {addr.data(), addr.size()}, SOCK_STREAM,
+            IPPROTO_TCP, &connection_ctx, MEMBER_CB(this, on_connected));
+}
+
+void PosixTcpBackend::TcpChannelDiscoveryContext::AddrContext::schedule_reconnect() {
+    PosixTcpBackend* backend = parent->parent;
+
+    if (!reconnect_timer && F_LOG_IF_ERR(backend->logger_,
+            backend->event_loop_->open_timer(&reconnect_timer, MEMBER_CB(this, on_reconnect_timer)),
+            "failed to open timer")) {
+        return;
+    }
+
+    // Wait between half and all of the backoff delay so that many clients
+    // that lost their connection at the same time don't all come back at the
+    // same time.
+    float delay = reconnect_delay * (0.5f + 0.5f * (float)parent->domain->rng.next() / 255.0f);
+    reconnect_delay = std::min(reconnect_delay * 2.0f, kMaxReconnectDelay);
+
+    F_LOG_D(backend->logger_, "reconnecting in " << delay << "s");
+    F_LOG_IF_ERR(backend->logger_, reconnect_timer->set(delay, TimerMode::kOnce),
+                 "failed to set timer");
+}
+
+void PosixTcpBackend::TcpChannelDiscoveryContext::AddrContext::on_reconnect_timer() {
+    if (F_LOG_IF_ERR(parent->parent->logger_, connect(), "failed to connect")) {
+        schedule_reconnect();
+    }
+}
+
+void PosixTcpBackend::TcpChannelDiscoveryContext::AddrContext::on_connected(RichStatus status, socket_id_t socket_id) {
+    if (!parent->parent->is_persistent() || IS_INVALID_SOCKET(socket_id)) {
+        connection_ctx = nullptr;
+    }
+    if (!parent->stopping) {
         if (!status.is_error()) {
-            domain->add_legacy_channels({kFibreOk, socket, socket, SIZE_MAX, false}, display_name.data());
-            return;
+            reconnect_delay = kMinReconnectDelay; // reset exponential backoff
+        }
+        parent->on_connected(this, status, socket_id);
+    }
+}
+
+void PosixTcpBackend::TcpChannelDiscoveryContext::on_connected(AddrContext* addr_ctx, RichStatus status, socket_id_t socket_id) {
+    if (!status.is_error()) {
+        // Both protocols send each packet with a single write (see
+        // PacketWrapper) so Nagle's algorithm has nothing to coalesce. It would
+        // only hold back small calls until the previous one is acknowledged.
+        int flag = 1;
+        if (setsockopt(socket_id, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) != 0) {
+            F_LOG_W(parent->logger_, "failed to set TCP_NODELAY: " << sys_err());
+        }
+
+#if FIBRE_ENABLE_STREAM_ADAPTER
+        if (native_protocol) {
+            auto conn = new TcpConnection{addr_ctx, parent->logger_}; // deleted in on_closed()
+            status = conn->socket.init(parent->event_loop_, parent->logger_, socket_id);
+            if (!status.is_error()) {
+                addr_ctx->connections.push_back(conn);
+                domain->add_channels({kFibreOk, &conn->socket, &conn->socket, SIZE_MAX, false},
+                                     display_name.data(), MEMBER_CB(conn, on_closed));
+                return;
+            }
+            delete conn;
+        } else
+#endif
+        {
+            auto socket = new PosixSocket{}; // TODO: free
+            status = socket->init(parent->event_loop_, parent->logger_, socket_id);
+            if (!status.is_error()) {
+                domain->add_legacy_channels({kFibreOk, socket, socket, SIZE_MAX, false}, display_name.data());
+                return;
+            }
+            delete socket;
         }
-        delete socket;
     }
 
     F_LOG_IF_ERR(parent->logger_, status, "failed to connect - will retry");
 
-    // Try to reconnect soon
-    lookup_period = 1.0f;
-    resolve_address();
+    if (!addr_ctx->connection_ctx) {
+        addr_ctx->schedule_reconnect();
+    }
 }
 
-void PosixTcpBackend::TcpChannelDiscoveryContext::on_disconnected() {
-    lookup_period = 1.0f; // reset exponential backoff
-    resolve_address();
+void PosixTcpBackend::TcpChannelDiscoveryContext::TcpConnection::on_closed(StreamStatus status) {
+    F_LOG_D(logger, "connection closed");
+    F_LOG_IF_ERR(logger, socket.deinit(), "failed to deinit socket");
+
+    if (addr_ctx) {
+        auto& conns = addr_ctx->connections;
+        conns.erase(std::find(conns.begin(), conns.end(), this));
+
+        // A client reconnects. The connections of a server come back by
+        // themselves through the listening socket.
+        if (!addr_ctx->parent->parent->is_persistent()) {
+            addr_ctx->schedule_reconnect();
+        }
+    }
+
+    delete this;
 }
 
 #endif
@@ -29,30 +29,52 @@ public:
     RichStatus stop_channel_discovery(ChannelDiscoveryContext* handle) final;
 
 private:
-    struct TcpChannelDiscoveryContext {
+    struct TcpChannelDiscoveryContext : ChannelDiscoveryContext {
         PosixTcpBackend* parent;
         Timer* timer;
         std::pair<std::string, int> address;
         std::string display_name;
         Domain* domain;
+        bool native_protocol; // run the native protocol rather than the legacy protocol
         AddressResolutionContext* addr_resolution_ctx;
-        ConnectionContext* connection_ctx;
         float lookup_period = 1.0f; // wait 1s for next address resolution
+        bool stopping = false; // set by stop_channel_discovery()
+
+        struct AddrContext;
+
+        // Connection that runs the native protocol (see
+        // Domain::add_channels()). Deleted once the domain releases it.
+        struct TcpConnection {
+            AddrContext* addr_ctx; // null once the discovery is stopped
+            Logger logger;
+            PosixSocket socket;
+            void on_closed(StreamStatus status);
+        };
 
         struct AddrContext {
+            TcpChannelDiscoveryContext* parent;
             std::vector<uint8_t> addr;
-            ConnectionContext* connection_ctx;
+            ConnectionContext* connection_ctx; // null if no attempt is ongoing
+            Timer* reconnect_timer; // opened on first use
+            float reconnect_delay; // upper bound of the next reconnect delay
+            std::vector<TcpConnection*> connections;
+            RichStatus connect();
+            void schedule_reconnect();
+            void on_reconnect_timer();
+            void on_connected(RichStatus status, socket_id_t socket_id);
         };
 
-        std::vector<AddrContext> known_addresses;
+        std::vector<AddrContext*> known_addresses;
         void resolve_address();
         void on_found_address(std::optional<cbufptr_t> addr);
-        void on_connected(RichStatus status, socket_id_t socket_id);
-        void on_disconnected();
+        void on_connected(AddrContext* addr_ctx, RichStatus status, socket_id_t socket_id);
     };
 
     virtual RichStatus start_opening_connections(EventLoop* event_loop, Logger logger, cbufptr_t addr, int type, int protocol, ConnectionContext** ctx, Callback<void, RichStatus, socket_id_t> on_connected) = 0;
     virtual void cancel_opening_connections(ConnectionContext* ctx) = 0;
+    // True if a connection context keeps opening connections after the first
+    // one (server) or false if it's done after the first callback (client).
+    virtual bool is_persistent() = 0;
 
     EventLoop* event_loop_ = nullptr;
     Logger logger_ = Logger::none();
@@ -67,6 +89,7 @@ public:
     void cancel_opening_connections(ConnectionContext* ctx) final {
         stop_connecting(ctx);
     }
+    bool is_persistent() final { return false; }
 };
 
 class PosixTcpServerBackend : public PosixTcpBackend {
@@ -77,6 +100,7 @@ public:
     void cancel_opening_connections(ConnectionContext* ctx) final {
         stop_listening(ctx);
     }
+    bool is_persistent() final { return true; }
 };
 
 }
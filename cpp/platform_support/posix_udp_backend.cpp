@@ -0,0 +1,644 @@
+#include "posix_udp_backend.hpp"
+
+#if FIBRE_ENABLE_UDP_CLIENT_BACKEND || FIBRE_ENABLE_UDP_SERVER_BACKEND
+
+#include <fibre/domain.hpp>
+#include <fibre/fibre.hpp>
+#include <fibre/simple_serdes.hpp>
+#include <algorithm>
+#include <bitset>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace fibre;
+
+RichStatus UdpAdapter::start(EventLoop* event_loop, Logger logger, Domain* domain, socket_id_t socket_id, const char* intf_name) {
+    F_RET_IF(event_loop_, "already started");
+    F_RET_IF(!event_loop || !domain, "invalid argument");
+
+    socket_id_ = dup(socket_id);
+    F_RET_IF(IS_INVALID_SOCKET(socket_id_), "failed to duplicate socket: " << sys_err());
+
+    RichStatus status = event_loop->open_timer(&timer_, MEMBER_CB(this, on_timer));
+    if (!status.is_error()) {
+        status = event_loop->register_event(socket_id_, EPOLLIN, MEMBER_CB(this, on_socket_event));
+        if (!status.is_error()) {
+            event_loop_ = event_loop;
+            logger_ = logger;
+            domain_ = domain;
+            intf_name_ = intf_name;
+            mask_ = EPOLLIN;
+            stopping_ = false;
+            F_LOG_IF_ERR(logger, timer_->set(kHeartbeatInterval, TimerMode::kPeriodic),
+                         "failed to set timer");
+            return RichStatus::success();
+        }
+        F_LOG_IF_ERR(logger, event_loop->close_timer(timer_), "failed to close timer");
+        timer_ = nullptr;
+    }
+
+    ::close(socket_id_);
+    socket_id_ = INVALID_SOCKET;
+    return status;
+}
+
+RichStatus UdpAdapter::stop() {
+    F_RET_IF(!event_loop_, "not started");
+
+    stopping_ = true;
+
+    for (auto peer: peers_) {
+        if (peer->node) {
+            forget_node(peer);
+        }
+        delete peer;
+    }
+    peers_.clear();
+    tx_peer_ = nullptr;
+
+    RichStatus status = event_loop_->close_timer(timer_);
+    timer_ = nullptr;
+    F_LOG_IF_ERR(logger_, event_loop_->deregister_event(socket_id_), "failed to deregister socket");
+    ::close(socket_id_);
+    socket_id_ = INVALID_SOCKET;
+
+    F_LOG_D(logger_, "stopped UDP adapter");
+    event_loop_ = nullptr;
+    return status;
+}
+
+RichStatus UdpAdapter::add_peer(cbufptr_t addr) {
+    F_RET_IF(!event_loop_, "not started");
+    F_RET_IF(addr.size() > sizeof(struct sockaddr_storage), "invalid address");
+
+    struct sockaddr_storage storage = {};
+    std::copy(addr.begin(), addr.end(), reinterpret_cast<uint8_t*>(&storage));
+
+    Peer* peer = new_peer(storage, addr.size(), true);
+    F_RET_IF(!peer, "out of memory");
+    send_heartbeat(peer);
+    return RichStatus::success();
+}
+
+UdpAdapter::Peer* UdpAdapter::find_peer(const struct sockaddr_storage& addr, socklen_t addr_len) {
+    auto it = std::find_if(peers_.begin(), peers_.end(), [&](Peer* peer) {
+        return peer->addr_len == addr_len && memcmp(&peer->addr, &addr, addr_len) == 0;
+    });
+    return it == peers_.end() ? nullptr : *it;
+}
+
+UdpAdapter::Peer* UdpAdapter::new_peer(const struct sockaddr_storage& addr, socklen_t addr_len, bool permanent) {
+    Peer* peer = new Peer(); // deleted in on_timer() or stop()
+    peer->parent = this;
+    peer->addr = addr;
+    peer->addr_len = addr_len;
+    peer->permanent = permanent;
+    // A random initial epoch keeps the peer from mistaking the stream of a
+    // restarted adapter for the continuation of an old one.
+    peer->tx_epoch = domain_->rng.next();
+    peers_.push_back(peer);
+    F_LOG_D(logger_, "new UDP peer " << addr);
+    return peer;
+}
+
+void UdpAdapter::forget_node(Peer* peer) {
+    reset_input_slots(peer);
+    peer->rx_state = kRxIdle;
+
+    // Closes all output slots to the peer
+    peer->tx_paused = true;
+    domain_->on_lost_node(peer->node, peer);
+    peer->tx_paused = false;
+    peer->node = nullptr;
+
+    // Whatever the peer receives from now on belongs to a new stream
+    peer->tx_epoch++;
+    peer->tx_seq = 0;
+}
+
+void UdpAdapter::reset_input_slots(Peer* peer) {
+    for (auto& slot: peer->rx_slots) {
+        slot.second.reset_at(domain_, 0);
+    }
+    while (peer->rx_slots.begin() != peer->rx_slots.end()) {
+        peer->rx_slots.erase(peer->rx_slots.begin());
+    }
+}
+
+void UdpAdapter::on_timer() {
+    for (size_t i = 0; i < peers_.size();) {
+        Peer* peer = peers_[i];
+
+        if (++peer->silent_ticks >= kPeerTimeoutTicks) {
+            if (peer->node) {
+                F_LOG_D(logger_, "UDP peer " << peer->addr << " timed out");
+                forget_node(peer);
+            }
+            if (!peer->permanent) {
+                if (tx_peer_ == peer) {
+                    tx_peer_ = nullptr;
+                }
+                peers_.erase(peers_.begin() + i);
+                delete peer;
+                continue;
+            }
+        }
+
+        send_heartbeat(peer);
+        if (peer->rx_state == kRxLost) {
+            send_resync(peer); // the previous request might have been lost
+        }
+        ++i;
+    }
+
+    update_subscription();
+}
+
+void UdpAdapter::on_socket_event(uint32_t mask) {
+    if (mask & EPOLLOUT) {
+        if (tx_peer_) {
+            flush();
+        }
+        send_loop();
+    }
+
+    if (mask & EPOLLIN) {
+        // Read until the socket is drained
+        while (!stopping_) {
+            struct sockaddr_storage addr;
+            socklen_t addr_len = sizeof(addr);
+            ssize_t n_received = recvfrom(socket_id_, rx_buf_, sizeof(rx_buf_),
+                    MSG_DONTWAIT | MSG_TRUNC, reinterpret_cast<struct sockaddr*>(&addr), &addr_len);
+
+            if (n_received < 0) {
+                F_LOG_IF(logger_, errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR,
+                         "recvfrom failed: " << sys_err());
+                break;
+            } else if ((size_t)n_received > sizeof(rx_buf_)) {
+                F_LOG_W(logger_, "dropping oversized datagram (" << n_received << " bytes)");
+            } else {
+                handle_packet(addr, addr_len, {rx_buf_, (size_t)n_received});
+            }
+        }
+    }
+
+    update_subscription();
+}
+
+void UdpAdapter::handle_packet(const struct sockaddr_storage& addr, socklen_t addr_len, cbufptr_t packet) {
+    if (packet.size() < 1) {
+        F_LOG_W(logger_, "empty packet");
+        return;
+    }
+
+    Peer* peer = find_peer(addr, addr_len);
+
+    if (packet[0] == kHeartbeat) {
+        if (packet.size() < kHeartbeatSize || packet[1] != kVersion) {
+            F_LOG_W(logger_, "incompatible peer (heartbeat length " << packet.size() << ", version " << (int)packet[1] << ")");
+            return;
+        }
+        if (!peer) {
+            peer = new_peer(addr, addr_len, false);
+            send_heartbeat(peer); // so that the peer doesn't need to wait for the next tick
+        }
+        handle_heartbeat(peer, packet);
+
+    } else if (!peer || !peer->node) {
+        // If this was data it is noticed as lost once the heartbeat arrives
+        F_LOG_D(logger_, "ignoring packet from unknown peer " << addr);
+
+    } else if (packet[0] == kData) {
+        handle_data(peer, packet);
+
+    } else if (packet[0] == kResync) {
+        handle_resync(peer, packet);
+
+    } else {
+        F_LOG_W(logger_, "unknown packet type " << (int)packet[0]);
+    }
+}
+
+void UdpAdapter::handle_heartbeat(Peer* peer, cbufptr_t packet) {
+    peer->silent_ticks = 0;
+
+    NodeId node_id;
+    std::copy_n(packet.begin() + 2, 16, node_id.begin());
+    uint8_t epoch = packet[18];
+    uint16_t seq = read_le<uint16_t>(&packet[19]);
+
+    if (peer->node && peer->node->id != node_id) {
+        // The peer restarted with a different identity. Its old calls are
+        // gone.
+        F_LOG_D(logger_, "peer changed its node ID");
+        forget_node(peer);
+    }
+
+    bool same_stream = peer->rx_state != kRxIdle && epoch == peer->rx_epoch;
+    if (peer->rx_state == kRxLost && same_stream) {
+        // already waiting for a new stream
+    } else if (same_stream ? seq != peer->rx_seq : seq != 0) {
+        on_lost_data(peer, epoch);
+    }
+
+    if (!peer->node) {
+        domain_->on_found_node(node_id, peer, intf_name_, &peer->node);
+    }
+}
+
+void UdpAdapter::handle_data(Peer* peer, cbufptr_t packet) {
+    if (packet.size() < kDataHeaderSize) {
+        F_LOG_W(logger_, "packet too short");
+        return;
+    }
+
+    peer->silent_ticks = 0;
+
+    uint8_t epoch = packet[1];
+    uint16_t seq = read_le<uint16_t>(&packet[2]);
+
+    if (peer->rx_state == kRxLost && epoch == peer->rx_epoch) {
+        return; // remainder of the stream that lost data
+    }
+
+    if (peer->rx_state != kRxSynced || epoch != peer->rx_epoch) {
+        // The peer started a new stream
+        reset_input_slots(peer);
+        peer->rx_state = kRxSynced;
+        peer->rx_epoch = epoch;
+        peer->rx_seq = 0;
+    }
+
+    if (seq != peer->rx_seq) {
+        on_lost_data(peer, epoch);
+        return;
+    }
+    peer->rx_seq++;
+
+    uint8_t slot_id = packet[4];
+    CallContext* ctx = peer->rx_slots.get(slot_id);
+    if (!ctx) {
+        // this slot is unknown - alloc new slot
+        ctx = peer->rx_slots.alloc(slot_id);
+        if (!ctx) {
+            F_LOG_W(logger_, "too many input slots");
+            return;
+        }
+    }
+
+    if (!ctx->process_packet(domain_, peer, peer->node, packet.skip(kDataHeaderSize))) {
+        F_LOG_E(logger_, "failed to unpack message");
+    }
+}
+
+void UdpAdapter::handle_resync(Peer* peer, cbufptr_t packet) {
+    if (packet.size() < kResyncSize) {
+        F_LOG_W(logger_, "packet too short");
+        return;
+    }
+
+    peer->silent_ticks = 0;
+
+    if (packet[1] != peer->tx_epoch) {
+        return; // already started over
+    }
+
+    F_LOG_D(logger_, "UDP peer " << peer->addr << " lost data - starting over");
+
+    peer->tx_epoch++;
+    peer->tx_seq = 0;
+    peer->tx_paused = true;
+    domain_->resync_node(peer->node, peer);
+    peer->tx_paused = false;
+    send_loop();
+}
+
+void UdpAdapter::on_lost_data(Peer* peer, uint8_t epoch) {
+    F_LOG_D(logger_, "lost data from UDP peer " << peer->addr);
+    reset_input_slots(peer);
+    peer->rx_state = kRxLost;
+    peer->rx_epoch = epoch;
+    send_resync(peer);
+}
+
+void UdpAdapter::send_heartbeat(Peer* peer) {
+    uint8_t buf[kHeartbeatSize];
+    buf[0] = kHeartbeat;
+    buf[1] = kVersion;
+    std::copy_n(domain_->node_id.begin(), 16, buf + 2);
+    buf[18] = peer->tx_epoch;
+    write_le<uint16_t>(peer->tx_seq, &buf[19]);
+    send_control(peer, buf);
+}
+
+void UdpAdapter::send_resync(Peer* peer) {
+    uint8_t buf[kResyncSize] = {kResync, peer->rx_epoch};
+    send_control(peer, buf);
+}
+
+/**
+ * @brief Sends a packet that is not part of the data stream. If the socket is
+ * not writable the packet is dropped. Both kinds of control packets are
+ * repeated anyway.
+ */
+void UdpAdapter::send_control(Peer* peer, cbufptr_t packet) {
+    ssize_t n_sent = sendto(socket_id_, packet.begin(), packet.size(), MSG_DONTWAIT,
+            reinterpret_cast<const struct sockaddr*>(&peer->addr), peer->addr_len);
+    if (n_sent < 0) {
+        F_LOG_D(logger_, "failed to send control packet: " << sys_err());
+    }
+}
+
+/**
+ * @brief Sends the pending data packets of all peers for as long as the socket
+ * is writable.
+ *
+ * This runs as a loop rather than through recursion so that synchronously
+ * completing writes don't grow the stack.
+ */
+void UdpAdapter::send_loop() {
+    if (in_send_loop_) {
+        return;
+    }
+    in_send_loop_ = true;
+
+    bool progress = true;
+    while (progress && !tx_peer_ && !stopping_) {
+        progress = false;
+        for (size_t i = 0; i < peers_.size() && !tx_peer_; ++i) {
+            Peer* peer = peers_[i];
+            if (peer->has_pending_task && !peer->tx_paused) {
+                send_data(peer);
+                progress = true;
+            }
+        }
+    }
+
+    in_send_loop_ = false;
+}
+
+void UdpAdapter::send_data(Peer* peer) {
+    TxTask task = peer->pending_task;
+    peer->has_pending_task = false;
+
+    TxContext* tx_slot = reinterpret_cast<TxContext*>(task.slot_id);
+    tx_buf_[0] = kData;
+    tx_buf_[1] = peer->tx_epoch;
+    write_le<uint16_t>(peer->tx_seq, &tx_buf_[2]);
+    tx_buf_[4] = tx_slot->slot_id;
+
+    bufptr_t packet{tx_buf_ + kDataHeaderSize, tx_buf_ + kMaxPacketSize};
+    CBufIt task_end = LowLevelProtocol::pack(tx_slot->state, task.chain(), &packet);
+
+    if (packet.begin() == tx_buf_ + kDataHeaderSize) {
+        // The task can't be sent now or later. Dropping the link to the peer
+        // takes it back from the multiplexer through on_lost_node() so that
+        // the calls to the peer fail instead of stalling.
+        F_LOG_E(logger_, "failed to pack message for UDP peer " << peer->addr);
+        forget_node(peer);
+        return;
+    }
+
+    tx_len_ = packet.begin() - tx_buf_;
+    tx_peer_ = peer;
+    sending_task_ = task;
+    sending_end_ = task_end;
+    flush();
+}
+
+/**
+ * @brief Sends the packet in tx_buf_ unless the socket is not writable.
+ *
+ * Errors other than a full send buffer count as loss on the wire: The packet
+ * is reported as sent and the receiver notices the gap.
+ */
+void UdpAdapter::flush() {
+    Peer* peer = tx_peer_;
+    ssize_t n_sent = sendto(socket_id_, tx_buf_, tx_len_, MSG_DONTWAIT,
+            reinterpret_cast<const struct sockaddr*>(&peer->addr), peer->addr_len);
+
+    if (n_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return; // retried once the socket is writable
+    }
+    F_LOG_IF(logger_, n_sent < 0, "sendto failed: " << sys_err());
+
+    tx_peer_ = nullptr;
+    peer->tx_seq++;
+    // This can call start_write() synchronously
+    peer->multiplexer_.on_sent(sending_task_.pipe, sending_end_);
+}
+
+void UdpAdapter::update_subscription() {
+    if (!event_loop_) {
+        return;
+    }
+    uint32_t mask = EPOLLIN | (tx_peer_ ? EPOLLOUT : 0);
+    if (mask != mask_) {
+        mask_ = mask;
+        F_LOG_IF_ERR(logger_, event_loop_->modify_event(socket_id_, mask), "failed to modify event");
+    }
+}
+
+bool UdpAdapter::Peer::open_output_slot(uintptr_t* p_slot_id, Node* dest) {
+    std::bitset<kMaxOutputSlots> slots_in_use;
+
+    for (auto& active_slot : tx_slots) {
+        slots_in_use[active_slot.slot_id] = true;
+    }
+
+    uint8_t output_slot_id = find_first(slots_in_use.flip());
+    if (output_slot_id >= kMaxOutputSlots) {
+        return false;  // cannot allocate more output slots
+    }
+
+    TxContext* slot = tx_slots.alloc();  // freed in close_output_slot()
+    if (!slot) {
+        return false;  // out of memory
+    }
+
+    slot->slot_id = output_slot_id;
+
+    if (p_slot_id) {
+        *p_slot_id = reinterpret_cast<uintptr_t>(slot);
+    }
+
+    return true;
+}
+
+bool UdpAdapter::Peer::close_output_slot(uintptr_t slot_id) {
+    TxContext* slot = reinterpret_cast<TxContext*>(slot_id);
+    tx_slots.free(slot);
+    return true;
+}
+
+bool UdpAdapter::Peer::start_write(TxTaskChain tasks) {
+    if (parent->stopping_ || has_pending_task || !tasks.size()) {
+        return false;  // busy
+    }
+
+    pending_task = tasks[0];
+    has_pending_task = true;
+    parent->send_loop();
+    parent->update_subscription();
+    return true;
+}
+
+void UdpAdapter::Peer::cancel_write() {
+    has_pending_task = false;
+    if (parent->tx_peer_ == this) {
+        // The packet is dropped. It didn't get a number yet so the peer won't
+        // miss it.
+        parent->tx_peer_ = nullptr;
+    }
+}
+
+RichStatus PosixUdpBackend::init(EventLoop* event_loop, Logger logger) {
+    F_RET_IF(event_loop_, "already initialized");
+    F_RET_IF(!event_loop, "invalid argument");
+    event_loop_ = event_loop;
+    logger_ = logger;
+    return RichStatus::success();
+}
+
+RichStatus PosixUdpBackend::deinit() {
+    F_RET_IF(!event_loop_, "not initialized");
+    F_LOG_IF(logger_, n_discoveries_, "some discoveries still ongoing");
+    event_loop_ = nullptr;
+    logger_ = Logger::none();
+    return RichStatus::success();
+}
+
+void PosixUdpBackend::start_channel_discovery(Domain* domain, const char* specs, size_t specs_len, ChannelDiscoveryContext** handle) {
+    const char* address_begin;
+    const char* address_end;
+    int port;
+
+    if (!event_loop_) {
+        F_LOG_E(logger_, "not initialized");
+        return; // TODO: error reporting
+    }
+
+    if (!try_parse_key(specs, specs + specs_len, "address", &address_begin, &address_end)) {
+        F_LOG_E(logger_, "no address specified");
+        return; // TODO: error reporting
+    }
+
+    if (!try_parse_key(specs, specs + specs_len, "port", &port)) {
+        F_LOG_E(logger_, "no port specified");
+        return; // TODO: error reporting
+    }
+
+    UdpChannelDiscoveryContext* ctx = new UdpChannelDiscoveryContext(); // deleted in stop_channel_discovery() or on_found_address()
+
+    if (F_LOG_IF_ERR(logger_, event_loop_->open_timer(&ctx->timer, MEMBER_CB(ctx, resolve_address)), "failed to open timer")) {
+        delete ctx;
+        return;
+    }
+
+    n_discoveries_++;
+    if (handle) {
+        *handle = ctx;
+    }
+
+    ctx->parent = this;
+    ctx->domain = domain;
+    ctx->address = {{address_begin, address_end}, port};
+    ctx->display_name = "UDP (" + ctx->address.first + ":" + std::to_string(port) + ")";
+    ctx->resolve_address();
+}
+
+RichStatus PosixUdpBackend::stop_channel_discovery(ChannelDiscoveryContext* handle) {
+    UdpChannelDiscoveryContext* ctx = static_cast<UdpChannelDiscoveryContext*>(handle);
+    F_RET_IF(!ctx, "invalid handle");
+
+    n_discoveries_--;
+    ctx->stopping = true;
+
+    RichStatus status = event_loop_->close_timer(ctx->timer);
+    ctx->timer = nullptr;
+
+    if (ctx->adapter) {
+        F_LOG_IF_ERR(logger_, ctx->adapter->stop(), "failed to stop UDP adapter");
+        delete ctx->adapter;
+        ctx->adapter = nullptr;
+    }
+
+    if (ctx->addr_resolution_ctx) {
+        // ctx is deleted once the cancellation completes
+        cancel_resolving_address(ctx->addr_resolution_ctx);
+    } else {
+        delete ctx;
+    }
+
+    return status;
+}
+
+void PosixUdpBackend::UdpChannelDiscoveryContext::resolve_address() {
+    if (F_LOG_IF(parent->logger_, addr_resolution_ctx, "already resolving")) {
+        return;
+    }
+    F_LOG_IF_ERR(parent->logger_,
+            start_resolving_address(parent->event_loop_, parent->logger_,
+            address, parent->is_persistent(), &addr_resolution_ctx, MEMBER_CB(this, on_found_address)),
+            "cannot start address resolution");
+}
+
+void PosixUdpBackend::UdpChannelDiscoveryContext::on_found_address(std::optional<cbufptr_t> addr) {
+    // The backend might already be deinitialized so we must not access it.
+    if (stopping) {
+        if (!addr.has_value()) {
+            delete this; // stop_channel_discovery() is waiting for this
+        }
+        return;
+    }
+
+    if (addr.has_value()) {
+        // Only the first address that works is used
+        if (!adapter) {
+            F_LOG_IF_ERR(parent->logger_, open_adapter(*addr), "failed to open UDP socket");
+        }
+    } else {
+        addr_resolution_ctx = nullptr;
+        if (!adapter) {
+            // Try again using exponential backoff.
+            F_LOG_IF_ERR(parent->logger_, timer->set(lookup_period, TimerMode::kOnce),
+                         "failed to set timer");
+            lookup_period = std::min(lookup_period * 3.0f, 3600.0f); // exponential backoff with at most 1h period
+        }
+    }
+}
+
+RichStatus PosixUdpBackend::UdpChannelDiscoveryContext::open_adapter(cbufptr_t addr) {
+    const struct sockaddr* sa = reinterpret_cast<const struct sockaddr*>(addr.begin());
+    F_RET_IF(addr.size() < sizeof(sa->sa_family), "invalid address");
+
+    socket_id_t socket_id = socket(sa->sa_family, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+    F_RET_IF(IS_INVALID_SOCKET(socket_id), "failed to open socket: " << sys_err());
+
+    RichStatus status = RichStatus::success();
+    if (parent->is_persistent() && bind(socket_id, sa, addr.size()) != 0) {
+        status = F_MAKE_ERR("failed to bind socket: " << sys_err());
+    }
+
+    if (!status.is_error()) {
+        adapter = new UdpAdapter(); // deleted in stop_channel_discovery()
+        status = adapter->start(parent->event_loop_, parent->logger_, domain, socket_id, display_name.data());
+        if (!status.is_error() && !parent->is_persistent()) {
+            status = adapter->add_peer(addr);
+            if (status.is_error()) {
+                F_LOG_IF_ERR(parent->logger_, adapter->stop(), "failed to stop UDP adapter");
+            }
+        }
+        if (status.is_error()) {
+            delete adapter;
+            adapter = nullptr;
+        }
+    }
+
+    ::close(socket_id);
+    return status;
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef __FIBRE_POSIX_UDP_BACKEND_HPP
+#define __FIBRE_POSIX_UDP_BACKEND_HPP
+
+#include <fibre/config.hpp>
+
+#if FIBRE_ENABLE_UDP_CLIENT_BACKEND || FIBRE_ENABLE_UDP_SERVER_BACKEND
+
+#include "posix_socket.hpp"
+#include <fibre/channel_discoverer.hpp>
+#include <fibre/connection.hpp>
+#include <fibre/event_loop.hpp>
+#include <fibre/logging.hpp>
+#include <fibre/low_level_protocol.hpp>
+#include <fibre/node.hpp>
+#include <fibre/pool.hpp>
+#include <string>
+#include <vector>
+
+namespace fibre {
+
+/**
+ * @brief Runs the native Fibre protocol over a UDP socket with any number of
+ * peers.
+ *
+ * Each datagram holds one packet that starts with a type byte:
+ *  - kHeartbeat: [type, version, 16-byte node ID, epoch, 2-byte seq]. Sent
+ *    to every known peer once per kHeartbeatInterval. Like on CanAdapter, a
+ *    peer is announced to the domain as a node once its heartbeat arrives and
+ *    it is considered lost when it stays silent for kPeerTimeoutTicks
+ *    intervals. A peer that was not known before becomes known through its
+ *    first heartbeat. A client knows its server from the start.
+ *  - kData: [type, epoch, 2-byte seq, slot ID, LowLevelProtocol packet]
+ *  - kResync: [type, epoch]
+ *
+ * The data packets to a peer are numbered consecutively (seq). Neither
+ * LowLevelProtocol nor the connections can tell where data is missing, so
+ * as soon as the receiver sees a gap it drops its input slots for the peer and
+ * asks the peer with kResync to start over. The peer then reopens all output
+ * slots towards the receiver under a new epoch (see Domain::resync_node()),
+ * which resends everything that the receiver didn't acknowledge yet. The
+ * heartbeat carries the number of the next data packet so that lost packets
+ * at the end of a burst are noticed too. A kResync that gets lost is repeated
+ * with the next heartbeat.
+ *
+ * Reordered datagrams look like lost ones to the receiver. This costs a
+ * resync but does not corrupt any data.
+ */
+class UdpAdapter {
+public:
+    // Same limit as on StreamAdapter. It is far below the minimum path MTU
+    // of IPv4 (576 bytes) and IPv6 (1280 bytes), so datagrams are never
+    // fragmented on the way.
+    static constexpr size_t kMaxPayloadSize = 128;
+
+    /**
+     * @brief Starts running the protocol on the specified socket.
+     *
+     * @param socket_id: A UDP socket in non-blocking mode. It is duplicated so
+     *        the caller can close it after this call.
+     */
+    RichStatus start(EventLoop* event_loop, Logger logger, Domain* domain, socket_id_t socket_id, const char* intf_name);
+
+    /**
+     * @brief Stops the adapter. All nodes that were reachable through it are
+     * reported as lost.
+     */
+    RichStatus stop();
+
+    /**
+     * @brief Adds a peer that receives heartbeats before it was heard from.
+     * This peer is never forgotten.
+     *
+     * @param addr: A buffer that holds a `struct sockaddr`.
+     */
+    RichStatus add_peer(cbufptr_t addr);
+
+private:
+    enum PacketType : uint8_t {
+        kHeartbeat = 0x00,
+        kData = 0x01,
+        kResync = 0x02,
+    };
+
+    static constexpr uint8_t kVersion = 1;
+    static constexpr size_t kHeartbeatSize = 2 + 16 + 3;
+    static constexpr size_t kDataHeaderSize = 5;
+    static constexpr size_t kResyncSize = 2;
+    static constexpr size_t kMaxPacketSize = kDataHeaderSize + kMaxPayloadSize;
+    static constexpr float kHeartbeatInterval = 0.1f;
+    static constexpr unsigned kPeerTimeoutTicks = 30;
+
+    // If this is too large, thrashing can occur at the destination
+    static constexpr size_t kMaxOutputSlots = 8;
+    static constexpr size_t kMaxInputSlots = 8;
+
+    struct TxContext {
+        uint8_t slot_id;
+        SenderState state{};
+    };
+
+    enum RxState {
+        kRxIdle, // nothing received yet on the current stream
+        kRxSynced, // receiving the stream rx_epoch
+        kRxLost, // lost data of the stream rx_epoch and waiting for a new one
+    };
+
+    struct Peer final : FrameStreamSink {
+        UdpAdapter* parent;
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+        bool permanent; // see add_peer()
+        Node* node = nullptr; // set once the peer's heartbeat arrived
+        unsigned silent_ticks = 0;
+
+        uint8_t tx_epoch;
+        uint16_t tx_seq = 0; // number of the next data packet
+        bool tx_paused = false; // set while the output slots are replaced
+        TxTask pending_task; // received through start_write() and not yet packed
+        bool has_pending_task = false;
+        Pool<TxContext, kMaxOutputSlots> tx_slots;
+
+        RxState rx_state = kRxIdle;
+        uint8_t rx_epoch = 0;
+        uint16_t rx_seq = 0; // number of the next expected data packet
+        Map<uint8_t, CallContext, kMaxInputSlots> rx_slots;
+
+        // FrameStreamSink implementation
+        bool open_output_slot(uintptr_t* p_slot_id, Node* dest) final;
+        bool close_output_slot(uintptr_t slot_id) final;
+        bool start_write(TxTaskChain tasks) final;
+        void cancel_write() final;
+    };
+
+    Peer* find_peer(const struct sockaddr_storage& addr, socklen_t addr_len);
+    Peer* new_peer(const struct sockaddr_storage& addr, socklen_t addr_len, bool permanent);
+    void forget_node(Peer* peer);
+    void reset_input_slots(Peer* peer);
+
+    void on_timer();
+    void on_socket_event(uint32_t mask);
+    void handle_packet(const struct sockaddr_storage& addr, socklen_t addr_len, cbufptr_t packet);
+    void handle_heartbeat(Peer* peer, cbufptr_t packet);
+    void handle_data(Peer* peer, cbufptr_t packet);
+    void handle_resync(Peer* peer, cbufptr_t packet);
+    void on_lost_data(Peer* peer, uint8_t epoch);
+
+    void send_heartbeat(Peer* peer);
+    void send_resync(Peer* peer);
+    void send_control(Peer* peer, cbufptr_t packet);
+    void send_loop();
+    void send_data(Peer* peer);
+    void flush();
+    void update_subscription();
+
+    EventLoop* event_loop_ = nullptr;
+    Logger logger_ = Logger::none();
+    Domain* domain_ = nullptr;
+    const char* intf_name_ = nullptr;
+    socket_id_t socket_id_ = INVALID_SOCKET;
+    uint32_t mask_ = 0; // current event subscription mask
+    Timer* timer_ = nullptr;
+    bool stopping_ = false;
+    std::vector<Peer*> peers_;
+
+    uint8_t tx_buf_[kMaxPacketSize];
+    size_t tx_len_ = 0;
+    // Peer for which tx_buf_ holds a data packet that is not sent yet because
+    // the socket is not writable.
+    Peer* tx_peer_ = nullptr;
+    TxTask sending_task_; // packed into tx_buf_
+    CBufIt sending_end_ = CBufIt::null();
+    bool in_send_loop_ = false;
+
+    uint8_t rx_buf_[kMaxPacketSize];
+};
+
+/**
+ * @brief Backend that runs the native protocol over UDP (see UdpAdapter).
+ *
+ * The address is specified with the `address` and `port` keys. The server
+ * binds its socket to the address and serves any client that sends it
+ * heartbeats. The client sends from an ephemeral port to the address.
+ */
+class PosixUdpBackend : public Backend {
+public:
+    RichStatus init(EventLoop* event_loop, Logger logger) final;
+    RichStatus deinit() final;
+
+    void start_channel_discovery(Domain* domain, const char* specs, size_t specs_len, ChannelDiscoveryContext** handle) final;
+    RichStatus stop_channel_discovery(ChannelDiscoveryContext* handle) final;
+
+protected:
+    struct UdpChannelDiscoveryContext : ChannelDiscoveryContext {
+        PosixUdpBackend* parent;
+        Domain* domain;
+        Timer* timer;
+        std::pair<std::string, int> address;
+        std::string display_name;
+        AddressResolutionContext* addr_resolution_ctx = nullptr;
+        float lookup_period = 1.0f; // wait 1s for next address resolution
+        UdpAdapter* adapter = nullptr; // set once the socket is open
+        bool stopping = false; // set by stop_channel_discovery()
+
+        void resolve_address();
+        void on_found_address(std::optional<cbufptr_t> addr);
+        RichStatus open_adapter(cbufptr_t addr);
+    };
+
+    // True for the server, which binds to the address rather than sending
+    // to it.
+    virtual bool is_persistent() = 0;
+
+    EventLoop* event_loop_ = nullptr;
+    Logger logger_ = Logger::none();
+    size_t n_discoveries_ = 0;
+};
+
+class PosixUdpClientBackend : public PosixUdpBackend {
+private:
+    bool is_persistent() final { return false; }
+};
+
+class PosixUdpServerBackend : public PosixUdpBackend {
+private:
+    bool is_persistent() final { return true; }
+};
+
+}
+
+#endif
+
+#endif // __FIBRE_POSIX_UDP_BACKEND_HPP
@@ -0,0 +1,256 @@
+#include "posix_unix_backend.hpp"
+
+#if FIBRE_ENABLE_UNIX_CLIENT_BACKEND || FIBRE_ENABLE_UNIX_SERVER_BACKEND
+
+#include <fibre/fibre.hpp>
+#include <algorithm>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace fibre;
+
+// Bounds for the exponential backoff between reconnect attempts
+static const float kMinReconnectDelay = 0.1f;
+static const float kMaxReconnectDelay = 30.0f;
+
+RichStatus PosixUnixBackend::init(EventLoop* event_loop, Logger logger) {
+    F_RET_IF(event_loop_, "already initialized");
+    F_RET_IF(!event_loop, "invalid argument");
+    event_loop_ = event_loop;
+    logger_ = logger;
+    return RichStatus::success();
+}
+
+RichStatus PosixUnixBackend::deinit() {
+    F_RET_IF(!event_loop_, "not initialized");
+    F_LOG_IF(logger_, n_discoveries_, "some discoveries still ongoing");
+    event_loop_ = nullptr;
+    logger_ = Logger::none();
+    return RichStatus::success();
+}
+
+void PosixUnixBackend::start_channel_discovery(Domain* domain, const char* specs, size_t specs_len, ChannelDiscoveryContext** handle) {
+    std::string path;
+    int spin_us = 0;
+
+    if (!event_loop_) {
+        F_LOG_E(logger_, "not initialized");
+        return; // TODO: error reporting
+    }
+
+    if (!try_parse_key(specs, specs + specs_len, "path", &path) || path.empty()) {
+        F_LOG_E(logger_, "no path specified");
+        return; // TODO: error reporting
+    }
+
+    if (use_shm_) {
+        try_parse_key(specs, specs + specs_len, "spin_us", &spin_us);
+    }
+
+    UnixChannelDiscoveryContext* ctx = new UnixChannelDiscoveryContext(); // deleted in stop_channel_discovery()
+
+    if (path.size() >= sizeof(ctx->addr.sun_path)) {
+        F_LOG_E(logger_, "path too long: " << path);
+        delete ctx;
+        return; // TODO: error reporting
+    }
+
+    ctx->parent = this;
+    ctx->domain = domain;
+    ctx->addr.sun_family = AF_UNIX;
+    if (path[0] == '@') {
+        // Abstract socket address: starts with a null byte and is not null
+        // terminated
+        ctx->addr.sun_path[0] = '\0';
+        std::copy(path.begin() + 1, path.end(), ctx->addr.sun_path + 1);
+        ctx->addr_len = offsetof(struct sockaddr_un, sun_path) + path.size();
+    } else {
+        std::copy(path.begin(), path.end(), ctx->addr.sun_path);
+        ctx->addr.sun_path[path.size()] = '\0';
+        ctx->addr_len = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+    }
+    ctx->display_name = (use_shm_ ? "Shared memory (" : "Unix socket (") + path + ")";
+    ctx->spin_us = (uint32_t)std::max(spin_us, 0);
+    ctx->reconnect_delay = kMinReconnectDelay;
+
+    n_discoveries_++;
+    if (handle) {
+        *handle = ctx;
+    }
+
+    if (F_LOG_IF_ERR(logger_, ctx->connect(), "failed to connect")) {
+        ctx->schedule_reconnect();
+    }
+}
+
+RichStatus PosixUnixBackend::stop_channel_discovery(ChannelDiscoveryContext* handle) {
+    UnixChannelDiscoveryContext* ctx = static_cast<UnixChannelDiscoveryContext*>(handle);
+    F_RET_IF(!ctx, "invalid handle");
+
+    n_discoveries_--;
+    ctx->stopping = true;
+
+    if (ctx->connection_ctx) {
+        cancel_opening_connections(ctx); // completes synchronously
+    }
+
+    RichStatus status = RichStatus::success();
+    if (ctx->reconnect_timer) {
+        status = event_loop_->close_timer(ctx->reconnect_timer);
+    }
+
+    for (auto conn: ctx->connections) {
+        conn->parent = nullptr; // connections stay open until the domain releases them
+    }
+
+    delete ctx;
+    return status;
+}
+
+RichStatus PosixUnixBackend::UnixChannelDiscoveryContext::connect() {
+    return parent->start_opening_connections(this);
+}
+
+void PosixUnixBackend::UnixChannelDiscoveryContext::schedule_reconnect() {
+    if (!reconnect_timer && F_LOG_IF_ERR(parent->logger_,
+            parent->event_loop_->open_timer(&reconnect_timer, MEMBER_CB(this, on_reconnect_timer)),
+            "failed to open timer")) {
+        return;
+    }
+
+    // Jitter as in PosixTcpBackend
+    float delay = reconnect_delay * (0.5f + 0.5f * (float)domain->rng.next() / 255.0f);
+    reconnect_delay = std::min(reconnect_delay * 2.0f, kMaxReconnectDelay);
+
+    F_LOG_D(parent->logger_, "reconnecting in " << delay << "s");
+    F_LOG_IF_ERR(parent->logger_, reconnect_timer->set(delay, TimerMode::kOnce),
+                 "failed to set timer");
+}
+
+void PosixUnixBackend::UnixChannelDiscoveryContext::on_reconnect_timer() {
+    if (F_LOG_IF_ERR(parent->logger_, connect(), "failed to connect")) {
+        schedule_reconnect();
+    }
+}
+
+void PosixUnixBackend::UnixChannelDiscoveryContext::on_connected(RichStatus status, socket_id_t socket_id) {
+    if (!parent->is_persistent() || IS_INVALID_SOCKET(socket_id)) {
+        connection_ctx = nullptr;
+    }
+    if (stopping) {
+        return;
+    }
+
+    if (!status.is_error()) {
+        reconnect_delay = kMinReconnectDelay; // reset exponential backoff
+
+        auto conn = new UnixConnection{this, parent->logger_, parent->use_shm_}; // deleted in on_closed()
+#if FIBRE_ENABLE_SHM_TRANSPORT
+        if (parent->use_shm_) {
+            status = conn->shm.init(parent->event_loop_, parent->logger_, socket_id, parent->is_persistent(), spin_us);
+            if (!status.is_error()) {
+                connections.push_back(conn);
+                domain->add_channels({kFibreOk, &conn->shm, &conn->shm, ShmChannel::kMaxPacketSize, true},
+                                     display_name.data(), MEMBER_CB(conn, on_closed));
+                return;
+            }
+        } else
+#endif
+        {
+            status = conn->socket.init(parent->event_loop_, parent->logger_, socket_id);
+            if (!status.is_error()) {
+                connections.push_back(conn);
+                // SOCK_SEQPACKET preserves packet boundaries so no framing is
+                // needed. The adapter limits the packet size by itself.
+                domain->add_channels({kFibreOk, &conn->socket, &conn->socket, SIZE_MAX, true},
+                                     display_name.data(), MEMBER_CB(conn, on_closed));
+                return;
+            }
+        }
+        delete conn;
+    }
+
+    F_LOG_IF_ERR(parent->logger_, status, "failed to connect - will retry");
+
+    if (!connection_ctx) {
+        schedule_reconnect();
+    }
+}
+
+void PosixUnixBackend::UnixConnection::on_closed(StreamStatus status) {
+    F_LOG_D(logger, "connection closed");
+#if FIBRE_ENABLE_SHM_TRANSPORT
+    if (use_shm) {
+        F_LOG_IF_ERR(logger, shm.deinit(), "failed to deinit shared memory channel");
+    } else
+#endif
+    {
+        F_LOG_IF_ERR(logger, socket.deinit(), "failed to deinit socket");
+    }
+
+    if (parent) {
+        auto& conns = parent->connections;
+        conns.erase(std::find(conns.begin(), conns.end(), this));
+
+        if (!parent->parent->is_persistent()) {
+            parent->schedule_reconnect();
+        }
+    }
+
+    delete this;
+}
+
+RichStatus PosixUnixClientBackend::start_opening_connections(UnixChannelDiscoveryContext* ctx) {
+    return start_connecting(event_loop_, logger_,
+            {reinterpret_cast<const uint8_t*>(&ctx->addr), ctx->addr_len},
+            SOCK_SEQPACKET, 0, &ctx->connection_ctx, MEMBER_CB(ctx, on_connected));
+}
+
+void PosixUnixClientBackend::cancel_opening_connections(UnixChannelDiscoveryContext* ctx) {
+    stop_connecting(ctx->connection_ctx);
+}
+
+/**
+ * @brief Removes the socket file at the specified address if no server is
+ * listening on it.
+ *
+ * A server that exited without stopping its discovery leaves the file behind,
+ * which would make bind() fail.
+ */
+static void remove_stale_socket(Logger logger, const struct sockaddr_un& addr, socklen_t addr_len) {
+    struct stat st;
+    if (!addr.sun_path[0] || stat(addr.sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        return; // abstract address or no socket file
+    }
+
+    int socket_id = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+    if (IS_INVALID_SOCKET(socket_id)) {
+        return;
+    }
+
+    if (connect(socket_id, reinterpret_cast<const struct sockaddr*>(&addr), addr_len) != 0 && errno == ECONNREFUSED) {
+        F_LOG_D(logger, "removing stale socket " << addr.sun_path);
+        F_LOG_IF(logger, unlink(addr.sun_path) != 0, "failed to remove stale socket: " << sys_err());
+    }
+
+    close(socket_id);
+}
+
+RichStatus PosixUnixServerBackend::start_opening_connections(UnixChannelDiscoveryContext* ctx) {
+    remove_stale_socket(logger_, ctx->addr, ctx->addr_len);
+    return start_listening(event_loop_, logger_,
+            {reinterpret_cast<const uint8_t*>(&ctx->addr), ctx->addr_len},
+            SOCK_SEQPACKET, 0, &ctx->connection_ctx, MEMBER_CB(ctx, on_connected));
+}
+
+void PosixUnixServerBackend::cancel_opening_connections(UnixChannelDiscoveryContext* ctx) {
+    stop_listening(ctx->connection_ctx);
+    if (ctx->addr.sun_path[0]) {
+        F_LOG_IF(logger_, unlink(ctx->addr.sun_path) != 0, "failed to remove socket: " << sys_err());
+    }
+}
+
+#endif
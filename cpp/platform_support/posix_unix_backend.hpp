@@ -0,0 +1,114 @@
+#ifndef __FIBRE_POSIX_UNIX_BACKEND_HPP
+#define __FIBRE_POSIX_UNIX_BACKEND_HPP
+
+#include <fibre/config.hpp>
+
+#if FIBRE_ENABLE_UNIX_CLIENT_BACKEND || FIBRE_ENABLE_UNIX_SERVER_BACKEND
+
+#include "posix_socket.hpp"
+#include "shm_channel.hpp"
+#include <fibre/channel_discoverer.hpp>
+#include <fibre/event_loop.hpp>
+#include <fibre/logging.hpp>
+#include <string>
+#include <vector>
+#include <sys/un.h>
+
+namespace fibre {
+
+/**
+ * @brief Backend for processes on the same host that talk through a Unix
+ * domain socket.
+ *
+ * The sockets are of type SOCK_SEQPACKET, which preserves packet boundaries,
+ * so the native protocol runs over them without stream framing. The socket is
+ * specified with the `path` key. A path that starts with '@' denotes a socket
+ * in the Linux abstract namespace, which has no file system entry.
+ *
+ * Like the TCP backend, client and server only differ in how they obtain
+ * connected sockets. A client reconnects with exponential backoff whenever its
+ * connection closes or the server is not running yet.
+ *
+ * If constructed with use_shm = true, the socket only sets up a ShmChannel and
+ * the data goes through shared memory.
+ */
+class PosixUnixBackend : public Backend {
+public:
+    explicit PosixUnixBackend(bool use_shm) : use_shm_(use_shm) {}
+
+    RichStatus init(EventLoop* event_loop, Logger logger) final;
+    RichStatus deinit() final;
+
+    void start_channel_discovery(Domain* domain, const char* specs, size_t specs_len, ChannelDiscoveryContext** handle) final;
+    RichStatus stop_channel_discovery(ChannelDiscoveryContext* handle) final;
+
+protected:
+    struct UnixChannelDiscoveryContext;
+
+    // Deleted once the domain releases it.
+    struct UnixConnection {
+        UnixChannelDiscoveryContext* parent; // null once the discovery is stopped
+        Logger logger;
+        bool use_shm;
+        PosixSocket socket;
+#if FIBRE_ENABLE_SHM_TRANSPORT
+        ShmChannel shm; // used instead of socket if use_shm_ is set
+#endif
+        void on_closed(StreamStatus status);
+    };
+
+    struct UnixChannelDiscoveryContext : ChannelDiscoveryContext {
+        PosixUnixBackend* parent;
+        Domain* domain;
+        struct sockaddr_un addr;
+        socklen_t addr_len;
+        std::string display_name;
+        uint32_t spin_us; // see ShmChannel::init()
+        ConnectionContext* connection_ctx = nullptr; // null if no attempt is ongoing
+        Timer* reconnect_timer = nullptr; // opened on first use
+        float reconnect_delay; // upper bound of the next reconnect delay
+        std::vector<UnixConnection*> connections;
+        bool stopping = false; // set by stop_channel_discovery()
+
+        RichStatus connect();
+        void schedule_reconnect();
+        void on_reconnect_timer();
+        void on_connected(RichStatus status, socket_id_t socket_id);
+    };
+
+    virtual RichStatus start_opening_connections(UnixChannelDiscoveryContext* ctx) = 0;
+    virtual void cancel_opening_connections(UnixChannelDiscoveryContext* ctx) = 0;
+    // True for a server, see PosixTcpBackend::is_persistent().
+    virtual bool is_persistent() = 0;
+
+    bool use_shm_;
+    EventLoop* event_loop_ = nullptr;
+    Logger logger_ = Logger::none();
+    size_t n_discoveries_ = 0;
+};
+
+class PosixUnixClientBackend : public PosixUnixBackend {
+public:
+    explicit PosixUnixClientBackend(bool use_shm = false) : PosixUnixBackend(use_shm) {}
+
+private:
+    RichStatus start_opening_connections(UnixChannelDiscoveryContext* ctx) final;
+    void cancel_opening_connections(UnixChannelDiscoveryContext* ctx) final;
+    bool is_persistent() final { return false; }
+};
+
+class PosixUnixServerBackend : public PosixUnixBackend {
+public:
+    explicit PosixUnixServerBackend(bool use_shm = false) : PosixUnixBackend(use_shm) {}
+
+private:
+    RichStatus start_opening_connections(UnixChannelDiscoveryContext* ctx) final;
+    void cancel_opening_connections(UnixChannelDiscoveryContext* ctx) final;
+    bool is_persistent() final { return true; }
+};
+
+}
+
+#endif
+
+#endif // __FIBRE_POSIX_UNIX_BACKEND_HPP
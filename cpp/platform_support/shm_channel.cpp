@@ -0,0 +1,567 @@
+#include "shm_channel.hpp"
+
+#if FIBRE_ENABLE_SHM_TRANSPORT
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace fibre;
+
+constexpr size_t ShmChannel::kMaxPacketSize;
+
+static const uint32_t kShmMagic = 0x4d485346; // "FSHM"
+static const uint32_t kShmVersion = 1;
+static const uint32_t kRingSize = 65536; // must be a power of two
+
+// The peer process maps the same atomics
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared memory requires lock-free atomics");
+
+/**
+ * @brief Single producer single consumer ring in the shared memory segment.
+ *
+ * Each packet is stored as a 32-bit length followed by the data, padded to a
+ * multiple of 4 bytes. Packets wrap around the end of the ring. head and tail
+ * count the bytes since the ring was created and overflow at 2^32.
+ *
+ * The waiting flags implement the doorbell handshake: A side that is about to
+ * wait sets its flag and then checks the ring again. A side that changed the
+ * ring checks the peer's flag afterwards. Both use sequentially consistent
+ * fences in between so at least one of them sees the other's write.
+ */
+struct ShmChannel::Ring {
+    alignas(64) std::atomic<uint32_t> head; // written by the producer
+    std::atomic<uint32_t> writer_waiting; // set by the producer, cleared by the consumer
+    alignas(64) std::atomic<uint32_t> tail; // written by the consumer
+    std::atomic<uint32_t> reader_waiting; // set by the consumer, cleared by the producer
+    alignas(64) uint8_t data[kRingSize];
+
+    void write(uint32_t pos, const void* src, size_t len) {
+        size_t offset = pos & (kRingSize - 1);
+        size_t n_first = std::min(len, kRingSize - offset);
+        memcpy(data + offset, src, n_first);
+        memcpy(data, (const uint8_t*)src + n_first, len - n_first);
+    }
+
+    void read(uint32_t pos, void* dst, size_t len) const {
+        size_t offset = pos & (kRingSize - 1);
+        size_t n_first = std::min(len, kRingSize - offset);
+        memcpy(dst, data + offset, n_first);
+        memcpy((uint8_t*)dst + n_first, data, len - n_first);
+    }
+};
+
+struct ShmChannel::Segment {
+    uint32_t magic;
+    uint32_t version;
+    Ring rings[2]; // [0]: server to client, [1]: client to server
+};
+
+// Sent by the server over the control socket along with the file descriptors
+// of the segment and the two doorbells.
+struct ShmHandshake {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+};
+
+static uint32_t record_size(size_t packet_size) {
+    return (uint32_t)(4 + ((packet_size + 3) & ~(size_t)3));
+}
+
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+RichStatus ShmChannel::init(EventLoop* event_loop, Logger logger, int socket_id, bool is_server, uint32_t spin_us) {
+    F_RET_IF(control_socket_ >= 0, "already initialized");
+
+    control_socket_ = dup(socket_id);
+    F_RET_IF(control_socket_ < 0, "failed to duplicate socket: " << sys_err());
+
+    event_loop_ = event_loop;
+    logger_ = logger;
+    is_server_ = is_server;
+    spin_ns_ = (uint64_t)spin_us * 1000ULL;
+    status_ = kStreamOk;
+
+    RichStatus status = is_server ? create_segment() : RichStatus::success();
+
+    if (status.is_success()) {
+        // The client receives the segment through this event. Afterwards it
+        // only reports the hangup of the peer.
+        status = event_loop_->register_event(control_socket_, EPOLLIN, MEMBER_CB(this, on_control_event));
+        control_registered_ = status.is_success();
+    }
+
+    if (status.is_error()) {
+        F_LOG_IF_ERR(logger_, deinit(), "failed to deinit");
+    }
+    return status;
+}
+
+RichStatus ShmChannel::deinit() {
+    F_RET_IF(control_socket_ < 0, "not initialized");
+
+    if (control_registered_) {
+        F_LOG_IF_ERR(logger_, event_loop_->deregister_event(control_socket_), "failed to deregister event");
+        control_registered_ = false;
+    }
+    if (rx_doorbell_ >= 0) {
+        F_LOG_IF_ERR(logger_, event_loop_->deregister_event(rx_doorbell_), "failed to deregister event");
+        ::close(rx_doorbell_);
+        rx_doorbell_ = -1;
+    }
+    if (tx_doorbell_ >= 0) {
+        ::close(tx_doorbell_);
+        tx_doorbell_ = -1;
+    }
+    if (segment_) {
+        F_LOG_IF(logger_, munmap(segment_, sizeof(Segment)) != 0, "munmap() failed: " << sys_err());
+        segment_ = nullptr;
+        rx_ring_ = nullptr;
+        tx_ring_ = nullptr;
+    }
+
+    ::close(control_socket_);
+    control_socket_ = -1;
+    return RichStatus::success();
+}
+
+RichStatus ShmChannel::create_segment() {
+    int fd = memfd_create("fibre-shm", MFD_CLOEXEC);
+    F_RET_IF(fd < 0, "memfd_create() failed: " << sys_err());
+
+    if (ftruncate(fd, sizeof(Segment)) != 0) {
+        ::close(fd);
+        return F_MAKE_ERR("ftruncate() failed: " << sys_err());
+    }
+
+    // [0] is rung by the client, [1] by the server
+    int doorbells[2] = {
+        eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+        eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)
+    };
+    if (doorbells[0] < 0 || doorbells[1] < 0) {
+        RichStatus status = F_MAKE_ERR("eventfd() failed: " << sys_err());
+        for (int doorbell: doorbells) {
+            if (doorbell >= 0) {
+                ::close(doorbell);
+            }
+        }
+        ::close(fd);
+        return status;
+    }
+
+    // Takes ownership of the doorbells
+    RichStatus status = map_segment(fd, doorbells[0], doorbells[1]);
+    if (status.is_error()) {
+        ::close(fd);
+        return status;
+    }
+
+    // A new memfd is zero-filled, which is a valid initial state for the
+    // rings.
+    segment_->magic = kShmMagic;
+    segment_->version = kShmVersion;
+
+    ShmHandshake handshake = {kShmMagic, kShmVersion, sizeof(Segment)};
+    int fds[3] = {fd, doorbells[0], doorbells[1]};
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = {&handshake, sizeof(handshake)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    // The socket was just connected so its buffer is empty
+    ssize_t n_sent = sendmsg(control_socket_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    ::close(fd); // the mapping and the peer keep the segment alive
+    F_RET_IF(n_sent != (ssize_t)sizeof(handshake), "failed to send segment: " << sys_err());
+
+    return RichStatus::success();
+}
+
+void ShmChannel::receive_segment() {
+    ShmHandshake handshake;
+    int fds[3];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = {&handshake, sizeof(handshake)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n_received = recvmsg(control_socket_, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    } else if (n_received < 0) {
+        F_LOG_E(logger_, "failed to receive segment: " << sys_err());
+        close(kStreamError);
+        return;
+    } else if (n_received == 0) {
+        F_LOG_D(logger_, "control socket closed");
+        close(kStreamClosed);
+        return;
+    }
+
+    size_t n_fds = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), std::min(n_fds, (size_t)3) * sizeof(int));
+        }
+    }
+
+    if (n_received != sizeof(handshake) || n_fds != 3 || (msg.msg_flags & MSG_CTRUNC)
+            || handshake.magic != kShmMagic || handshake.version != kShmVersion
+            || handshake.size != sizeof(Segment)) {
+        F_LOG_E(logger_, "incompatible peer");
+        for (size_t i = 0; i < std::min(n_fds, (size_t)3); ++i) {
+            ::close(fds[i]);
+        }
+        close(kStreamError);
+        return;
+    }
+
+    // Takes ownership of the doorbells
+    RichStatus status = map_segment(fds[0], fds[2], fds[1]);
+    ::close(fds[0]);
+    if (F_LOG_IF_ERR(logger_, status, "failed to map segment")) {
+        close(kStreamError);
+        return;
+    }
+
+    F_LOG_D(logger_, "received shared memory segment");
+
+    // Transfers that were started in the meantime
+    if (!continue_read(true)) {
+        continue_write(false);
+    }
+}
+
+RichStatus ShmChannel::map_segment(int fd, int rx_doorbell, int tx_doorbell) {
+    void* mem = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        ::close(rx_doorbell);
+        ::close(tx_doorbell);
+        return F_MAKE_ERR("mmap() failed: " << sys_err());
+    }
+
+    segment_ = reinterpret_cast<Segment*>(mem);
+    rx_ring_ = &segment_->rings[is_server_ ? 1 : 0];
+    tx_ring_ = &segment_->rings[is_server_ ? 0 : 1];
+    tx_doorbell_ = tx_doorbell;
+
+    RichStatus status = event_loop_->register_event(rx_doorbell, EPOLLIN, MEMBER_CB(this, on_doorbell));
+    if (status.is_error()) {
+        ::close(rx_doorbell);
+        return F_AMEND_ERR(status, "failed to register doorbell");
+    }
+    rx_doorbell_ = rx_doorbell;
+
+    return RichStatus::success();
+}
+
+void ShmChannel::start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) {
+    if (rx_callback_.has_value()) {
+        F_LOG_E(logger_, "RX request already pending");
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    } else if (status_ != kStreamOk) {
+        completer.invoke({status_, buffer.begin()});
+        return;
+    }
+
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+
+    rx_buf_ = buffer;
+    rx_callback_ = completer;
+
+    if (!segment_) {
+        return; // completes once the segment arrived
+    }
+
+    if (spin_ns_) {
+        uint64_t deadline = now_ns() + spin_ns_;
+        do {
+            if (try_read(false)) {
+                return;
+            }
+        } while (now_ns() < deadline);
+    }
+
+    continue_read(false);
+}
+
+void ShmChannel::cancel_read(TransferHandle transfer_handle) {
+    if (transfer_handle != reinterpret_cast<TransferHandle>(this)) {
+        F_LOG_E(logger_, "invalid handle");
+    } else if (rx_callback_.has_value()) {
+        bufptr_t buf = rx_buf_;
+        rx_buf_ = {};
+        rx_callback_.invoke_and_clear({kStreamCancelled, buf.begin()});
+    } else if (status_ == kStreamOk) {
+        F_LOG_E(logger_, "no RX pending");
+    }
+}
+
+void ShmChannel::start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult0> completer) {
+    if (tx_callback_.has_value()) {
+        F_LOG_E(logger_, "TX request already pending");
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    } else if (!buffer.size() || buffer.size() > kMaxPacketSize) {
+        F_LOG_E(logger_, "invalid packet size " << buffer.size());
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    } else if (status_ != kStreamOk) {
+        completer.invoke({status_, buffer.begin()});
+        return;
+    }
+
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+
+    tx_buf_ = buffer;
+    tx_callback_ = completer;
+
+    if (segment_) {
+        continue_write(false);
+    }
+}
+
+void ShmChannel::cancel_write(TransferHandle transfer_handle) {
+    if (transfer_handle != reinterpret_cast<TransferHandle>(this)) {
+        F_LOG_E(logger_, "invalid handle");
+    } else if (tx_callback_.has_value()) {
+        cbufptr_t buf = tx_buf_;
+        tx_buf_ = {};
+        tx_callback_.invoke_and_clear({kStreamCancelled, buf.begin()});
+    } else if (status_ == kStreamOk) {
+        F_LOG_E(logger_, "no TX pending");
+    }
+}
+
+/**
+ * @brief Completes the pending read if the ring holds a packet and otherwise
+ * tells the peer to ring the doorbell once it wrote one.
+ *
+ * @param defer_write: See try_read().
+ * @returns true if the read completed or the channel closed. The completion
+ * handler can delete the channel so the caller must not touch it anymore.
+ */
+bool ShmChannel::continue_read(bool defer_write) {
+    if (!rx_callback_.has_value()) {
+        return false;
+    } else if (try_read(defer_write)) {
+        return true;
+    }
+    rx_ring_->reader_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return try_read(defer_write); // the peer might have written before it saw the flag
+}
+
+/**
+ * @brief Same as continue_read() for the pending write.
+ */
+bool ShmChannel::continue_write(bool defer_read) {
+    if (!tx_callback_.has_value()) {
+        return false;
+    } else if (try_write(defer_read)) {
+        return true;
+    }
+    tx_ring_->writer_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return try_write(defer_read); // the peer might have made space before it saw the flag
+}
+
+/**
+ * @brief Completes the pending read with the next packet in the ring.
+ *
+ * @param defer_write: Set by callers that would continue a pending write
+ *        after this. The completion handler can delete the channel so
+ *        instead of that, this rings our own doorbell to bring the event loop
+ *        back for the write. Deiniting the channel deregisters the doorbell.
+ * @returns false if the ring is empty.
+ */
+bool ShmChannel::try_read(bool defer_write) {
+    uint32_t tail = rx_ring_->tail.load(std::memory_order_relaxed);
+    uint32_t head = rx_ring_->head.load(std::memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+
+    uint32_t len;
+    rx_ring_->read(tail, &len, sizeof(len));
+    if (len > kMaxPacketSize || record_size(len) > head - tail) {
+        F_LOG_E(logger_, "corrupt ring");
+        close(kStreamError);
+        return true;
+    }
+
+    size_t n_copy = std::min((size_t)len, rx_buf_.size());
+    F_LOG_IF(logger_, n_copy < len, "truncated packet of " << len << " bytes");
+    rx_ring_->read(tail + 4, rx_buf_.begin(), n_copy);
+    rx_ring_->tail.store(tail + record_size(len), std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (rx_ring_->writer_waiting.load(std::memory_order_relaxed)
+            && rx_ring_->writer_waiting.exchange(0)) {
+        ring(tx_doorbell_);
+    }
+
+    if (defer_write && tx_callback_.has_value()) {
+        ring(rx_doorbell_);
+    }
+
+    bufptr_t buf = rx_buf_;
+    rx_buf_ = {};
+    rx_callback_.invoke_and_clear({kStreamOk, buf.begin() + n_copy});
+    return true;
+}
+
+/**
+ * @brief Completes the pending write by putting the packet into the ring.
+ *
+ * @param defer_read: Same as `defer_write` in try_read().
+ * @returns false if the ring has no space for the packet.
+ */
+bool ShmChannel::try_write(bool defer_read) {
+    uint32_t record = record_size(tx_buf_.size());
+    uint32_t head = tx_ring_->head.load(std::memory_order_relaxed);
+    uint32_t tail = tx_ring_->tail.load(std::memory_order_acquire);
+    if (record > kRingSize - (head - tail)) {
+        return false;
+    }
+
+    uint32_t len = (uint32_t)tx_buf_.size();
+    tx_ring_->write(head, &len, sizeof(len));
+    tx_ring_->write(head + 4, tx_buf_.begin(), tx_buf_.size());
+    tx_ring_->head.store(head + record, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (tx_ring_->reader_waiting.load(std::memory_order_relaxed)
+            && tx_ring_->reader_waiting.exchange(0)) {
+        ring(tx_doorbell_);
+    }
+
+    if (defer_read && rx_callback_.has_value()) {
+        ring(rx_doorbell_);
+    }
+
+    cbufptr_t buf = tx_buf_;
+    tx_buf_ = {};
+    tx_callback_.invoke_and_clear({kStreamOk, buf.end()});
+    return true;
+}
+
+void ShmChannel::ring(int doorbell) {
+    uint64_t val = 1;
+    if (write(doorbell, &val, sizeof(val)) != sizeof(val)) {
+        F_LOG_E(logger_, "failed to ring doorbell: " << sys_err());
+    }
+}
+
+void ShmChannel::on_doorbell(uint32_t mask) {
+    uint64_t val;
+    if (read(rx_doorbell_, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+        F_LOG_E(logger_, "failed to read doorbell: " << sys_err());
+    }
+
+    // At most one transfer completes per event (see try_read()). The two
+    // directions take turns going first so that a busy one can't starve the
+    // other one.
+    read_first_ = !read_first_;
+    if (read_first_) {
+        if (!continue_read(true)) {
+            continue_write(false);
+        }
+    } else {
+        if (!continue_write(true)) {
+            continue_read(false);
+        }
+    }
+}
+
+void ShmChannel::on_control_event(uint32_t mask) {
+    if (!segment_ && status_ == kStreamOk) {
+        receive_segment();
+        return;
+    }
+
+    // Nothing is sent on the control socket after the segment so this is
+    // either a hangup or a misbehaving peer.
+    uint8_t dummy;
+    ssize_t n_received = recv(control_socket_, &dummy, sizeof(dummy), MSG_DONTWAIT);
+    if (n_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    F_LOG_D(logger_, "control socket closed");
+    close(n_received == 0 ? kStreamClosed : kStreamError);
+}
+
+/**
+ * @brief Completes all pending transfers with the specified status. Must be
+ * the last thing that the caller does because the completion handlers can
+ * deinit and delete the channel.
+ */
+void ShmChannel::close(StreamStatus status) {
+    if (status_ != kStreamOk) {
+        return;
+    }
+    status_ = status;
+
+    if (control_registered_) {
+        // A hung up socket would report the hangup continuously
+        F_LOG_IF_ERR(logger_, event_loop_->deregister_event(control_socket_), "failed to deregister event");
+        control_registered_ = false;
+    }
+
+    bufptr_t rx_buf = rx_buf_;
+    cbufptr_t tx_buf = tx_buf_;
+    Callback<void, ReadResult> rx_callback = rx_callback_;
+    Callback<void, WriteResult0> tx_callback = tx_callback_;
+    rx_buf_ = {};
+    tx_buf_ = {};
+    rx_callback_ = {};
+    tx_callback_ = {};
+
+    if (rx_callback.has_value()) {
+        rx_callback.invoke({status, rx_buf.begin()});
+    }
+    if (tx_callback.has_value()) {
+        tx_callback.invoke({status, tx_buf.begin()});
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef __FIBRE_SHM_CHANNEL_HPP
+#define __FIBRE_SHM_CHANNEL_HPP
+
+#include <fibre/config.hpp>
+
+#if FIBRE_ENABLE_SHM_TRANSPORT
+
+#include <fibre/async_stream.hpp>
+#include <fibre/event_loop.hpp>
+#include <fibre/logging.hpp>
+#include <fibre/rich_status.hpp>
+#include <stdint.h>
+
+namespace fibre {
+
+/**
+ * @brief Packet based AsyncStreamSource and AsyncStreamSink between two
+ * processes on the same host.
+ *
+ * The data goes through a shared memory segment (memfd) that holds one single
+ * producer single consumer ring per direction. Each write is one packet. Reads
+ * return one packet at a time and truncate packets that don't fit the buffer.
+ *
+ * The two sides set up the channel through a connected Unix domain socket (the
+ * control socket): The server creates the segment and two eventfds and passes
+ * them to the client in one message. After that the socket only serves to
+ * detect when the peer goes away.
+ *
+ * The eventfds are doorbells. A side only rings the peer's doorbell if the
+ * peer announced in the shared memory that it waits for data (or for space in
+ * the ring), so while both sides are busy, packets are exchanged without
+ * system calls. Optionally a read spins for a while before it waits for the
+ * doorbell.
+ *
+ * Reads and writes that are started before the client received the segment
+ * stay pending until it arrives.
+ */
+class ShmChannel final : public AsyncStreamSource, public AsyncStreamSink {
+public:
+    // Largest packet that can be written
+    static constexpr size_t kMaxPacketSize = 4096;
+
+    /**
+     * @brief Initializes the channel on a connected control socket.
+     *
+     * @param socket_id: The control socket. It is duplicated so the caller can
+     *        close it after this call.
+     * @param is_server: The server creates and sends the segment, the client
+     *        receives it.
+     * @param spin_us: Time for which a read polls the ring before it waits
+     *        for the peer's doorbell. This blocks the event loop meanwhile.
+     */
+    RichStatus init(EventLoop* event_loop, Logger logger, int socket_id, bool is_server, uint32_t spin_us);
+
+    /**
+     * @brief Deinits a channel that was initialized with init(). Must not be
+     * called while a transfer is pending.
+     *
+     * Once the channel closed, cancelling a transfer has no effect because
+     * its completion is already under way.
+     */
+    RichStatus deinit();
+
+    void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final;
+    void cancel_read(TransferHandle transfer_handle) final;
+
+    void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult0> completer) final;
+    void cancel_write(TransferHandle transfer_handle) final;
+
+private:
+    struct Ring;
+    struct Segment;
+
+    RichStatus create_segment();
+    void receive_segment();
+    RichStatus map_segment(int fd, int rx_doorbell, int tx_doorbell);
+    void on_control_event(uint32_t mask);
+    void on_doorbell(uint32_t mask);
+    void close(StreamStatus status);
+    void ring(int doorbell);
+    bool continue_read(bool defer_write);
+    bool continue_write(bool defer_read);
+    bool try_read(bool defer_write);
+    bool try_write(bool defer_read);
+
+    EventLoop* event_loop_ = nullptr;
+    Logger logger_ = Logger::none();
+    int control_socket_ = -1;
+    bool control_registered_ = false;
+    int rx_doorbell_ = -1; // rung by the peer
+    int tx_doorbell_ = -1; // rung by this side
+    bool is_server_ = false;
+    uint64_t spin_ns_ = 0;
+    bool read_first_ = false; // alternates on each doorbell event
+
+    Segment* segment_ = nullptr; // null until the client received the segment
+    Ring* rx_ring_ = nullptr;
+    Ring* tx_ring_ = nullptr;
+    StreamStatus status_ = kStreamOk; // set once the channel closed
+
+    bufptr_t rx_buf_{}; // valid while there is an RX request pending
+    cbufptr_t tx_buf_{}; // valid while there is a TX request pending
+    Callback<void, ReadResult> rx_callback_; // valid while there is an RX request pending
+    Callback<void, WriteResult0> tx_callback_; // valid while there is a TX request pending
+};
+
+}
+
+#endif
+
+#endif // __FIBRE_SHM_CHANNEL_HPP
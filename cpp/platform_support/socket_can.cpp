@@ -144,7 +144,12 @@ RichStatus SocketCan::init(EventLoop* event_loop, Logger logger, std::string nam
         }
         
         event_loop_ = event_loop;
-        if ((status = event_loop_->register_event(socket_id_, EPOLLIN, MEMBER_CB(this, on_event))).is_error()) {
+        if (event_loop_->supports_async_io()) {
+            status = event_loop_->start_recv_multishot(socket_id_, &rx_op_, MEMBER_CB(this, on_received));
+        } else {
+            status = event_loop_->register_event(socket_id_, EPOLLIN, MEMBER_CB(this, on_event));
+        }
+        if (status.is_error()) {
             goto fail;
         }
     }
@@ -183,7 +188,19 @@ bool SocketCan::read_sync() {
             F_LOG_E(logger_, "Socket read failed: " << sys_err());
         }
 
-    } else if (message.msg_flags & MSG_CONFIRM) {
+    } else {
+        handle_message({(const uint8_t*)&frame, (size_t)n_received}, message.msg_flags);
+    }
+
+    return true;
+}
+
+void SocketCan::handle_message(cbufptr_t data, int msg_flags) {
+    struct canfd_frame frame = {};
+    size_t n_received = data.size();
+    std::copy_n(data.begin(), std::min(n_received, sizeof(frame)), (uint8_t*)&frame);
+
+    if (msg_flags & MSG_CONFIRM) {
         // TODO: this check doesn't work for arbitrary message sizes
         auto it = std::find_if(tx_slots_.begin(), tx_slots_.end(), [&](TxSlot& slot) {
             return slot.busy && memcmp(&frame, &slot.frame, sizeof(frame)) == 0;
@@ -198,7 +215,6 @@ bool SocketCan::read_sync() {
 
     } else if (n_received != sizeof(struct can_frame) && n_received != sizeof(struct canfd_frame)) {
         F_LOG_W(logger_, "invalid message length " << n_received);
-        return true;
 
     } else {
         // Trigger all matching subscriptions
@@ -214,8 +230,6 @@ bool SocketCan::read_sync() {
             s.invoke(msg);
         }
     }
-
-    return true;
 }
 
 bool SocketCan::is_valid_baud_rate(uint32_t nominal_baud_rate, uint32_t data_baud_rate) {
@@ -227,6 +241,11 @@ bool SocketCan::start(uint32_t nominal_baud_rate, uint32_t data_baud_rate, on_ev
 }
 
 bool SocketCan::stop() {
+    if (rx_op_) {
+        F_LOG_IF_ERR(logger_, event_loop_->cancel_io(rx_op_), "failed to cancel receive");
+        rx_op_ = nullptr;
+    }
+
     for (auto& slot: tx_slots_) {
         F_LOG_IF_ERR(logger_, event_loop_->close_timer(slot.timer), "failed to cancel timer");
         if (slot.busy) {
@@ -372,6 +391,18 @@ void SocketCan::on_event(uint32_t mask) {
     }
 }
 
+void SocketCan::on_received(int result, cbufptr_t data, int msg_flags) {
+    if (result > 0) {
+        handle_message(data, msg_flags);
+        event_loop_->release_buffer(data);
+    } else {
+        // This happens when the interface disappears
+        rx_op_ = nullptr;
+        F_LOG_W(logger_, "interface disappeared (" << result << ")");
+        on_error_.invoke_and_clear(this); // this will delete the "this" instance
+    }
+}
+
 void SocketCan::on_timeout(TxSlot* slot) {
     // The timeout can trigger simultaneously with the send confirmation but
     // execute earlier (especially after pausing during debugging). In this case
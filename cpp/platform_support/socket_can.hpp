@@ -50,12 +50,15 @@ private:
     void on_sent(TxSlot* slot, bool success);
     void update_filters();
     bool read_sync();
+    void handle_message(cbufptr_t data, int msg_flags);
     void on_event(uint32_t mask);
+    void on_received(int result, cbufptr_t data, int msg_flags);
     void on_timeout(TxSlot* tx_slot);
 
     EventLoop* event_loop_ = nullptr;
     Logger logger_ = Logger::none();
     int socket_id_ = -1;
+    IoOperation* rx_op_ = nullptr; // valid while a multishot receive is active
     Callback<void, SocketCan*> on_error_;
     std::vector<Subscription*> subscriptions_;
 
@@ -0,0 +1,167 @@
+#include <fibre/sharded_runtime.hpp>
+
+#if FIBRE_ENABLE_SHARDING
+
+#include <fibre/fibre.hpp>
+#include <fibre/event_loop.hpp>
+#include <algorithm>
+
+using namespace fibre;
+
+RichStatus ShardedRuntime::start(size_t n_shards, Logger logger) {
+    F_RET_IF(shards_.size(), "already started");
+
+    if (!n_shards) {
+        n_shards = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+
+    F_LOG_D(logger, "starting " << n_shards << " shards");
+
+    for (size_t i = 0; i < n_shards; ++i) {
+        Shard* shard = new Shard{}; // deleted in stop()
+        shard->runtime = this;
+        shard->id = i;
+        shard->logger = logger;
+        shards_.push_back(shard);
+        shard->thread = std::thread(&Shard::thread_main, shard);
+    }
+
+    RichStatus status = RichStatus::success();
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (Shard* shard: shards_) {
+            cv_.wait(lock, [&]() { return shard->ready; });
+            if (shard->status.is_error() && status.is_success()) {
+                status = F_AMEND_ERR(shard->status, "shard " << shard->id << " failed to start");
+            }
+        }
+    }
+
+    if (status.is_error()) {
+        F_LOG_IF_ERR(logger, stop(), "failed to stop shards");
+    }
+
+    return status;
+}
+
+RichStatus ShardedRuntime::stop() {
+    F_RET_IF(current_shard() != n_shards(), "must not be called from a shard");
+
+    RichStatus status = RichStatus::success();
+
+    for (Shard* shard: shards_) {
+        if (shard->fibre) {
+            RichStatus s = post(shard->id, MEMBER_CB(shard, shutdown));
+            if (s.is_error() && status.is_success()) {
+                status = s;
+            }
+        }
+    }
+
+    for (Shard* shard: shards_) {
+        shard->thread.join();
+        if (shard->status.is_error() && status.is_success()) {
+            status = F_AMEND_ERR(shard->status, "shard " << shard->id << " failed");
+        }
+        delete shard;
+    }
+
+    shards_.clear();
+    return status;
+}
+
+size_t ShardedRuntime::current_shard() {
+    std::thread::id this_id = std::this_thread::get_id();
+    for (Shard* shard: shards_) {
+        if (shard->thread_id == this_id) {
+            return shard->id;
+        }
+    }
+    return shards_.size();
+}
+
+size_t ShardedRuntime::next_shard() {
+    return next_shard_++ % shards_.size();
+}
+
+RichStatus ShardedRuntime::post(size_t shard, Callback<void> callback) {
+    F_RET_IF(shard >= shards_.size(), "invalid shard " << shard);
+    return shards_[shard]->event_loop->post(callback);
+}
+
+RichStatus ShardedRuntime::run_sync(size_t shard, Callback<void> callback) {
+    F_RET_IF(shard >= shards_.size(), "invalid shard " << shard);
+
+    size_t current = current_shard();
+    if (current == shard) {
+        callback.invoke();
+        return RichStatus::success();
+    }
+    F_RET_IF(current != shards_.size(), "synchronous call from shard " << current << " to shard " << shard);
+
+    SyncCall call;
+    call.callback = callback;
+    F_RET_IF_ERR(post(shard, MEMBER_CB(&call, run)), "post() failed");
+
+    std::unique_lock<std::mutex> lock(call.mutex);
+    call.cv.wait(lock, [&]() { return call.done; });
+    return RichStatus::success();
+}
+
+void ShardedRuntime::SyncCall::run() {
+    callback.invoke();
+    std::unique_lock<std::mutex> lock(mutex);
+    done = true;
+    cv.notify_all();
+}
+
+void ShardedRuntime::Shard::thread_main() {
+    // The event loop returns once shutdown() closed everything on it
+    RichStatus loop_status = launch_event_loop(logger, MEMBER_CB(this, on_started));
+
+    std::unique_lock<std::mutex> lock(runtime->mutex_);
+    if (loop_status.is_error() && status.is_success()) {
+        status = loop_status;
+    }
+    ready = true; // in case the event loop didn't start
+    runtime->cv_.notify_all();
+}
+
+void ShardedRuntime::Shard::on_started(EventLoop* loop) {
+    RichStatus s = fibre::open(loop, logger, &fibre);
+    if (s.is_success()) {
+        s = loop->open_timer(&keepalive, MEMBER_CB(this, on_keepalive));
+        if (s.is_error()) {
+            F_LOG_IF_ERR(logger, fibre->deinit_backends(), "failed to deinit backends");
+            fibre::close(fibre);
+            fibre = nullptr;
+        }
+    }
+
+    if (fibre) {
+        fibre->runtime = runtime;
+        fibre->shard_id = id;
+    }
+
+    std::unique_lock<std::mutex> lock(runtime->mutex_);
+    thread_id = std::this_thread::get_id();
+    event_loop = loop;
+    status = s;
+    ready = true;
+    runtime->cv_.notify_all();
+}
+
+void ShardedRuntime::Shard::shutdown() {
+    F_LOG_IF_ERR(logger, fibre->deinit_backends(), "failed to deinit backends");
+    fibre::close(fibre);
+    fibre = nullptr;
+    F_LOG_IF_ERR(logger, event_loop->close_timer(keepalive), "failed to close timer");
+    keepalive = nullptr;
+
+    // Closing a domain doesn't close the connections that were opened with the
+    // legacy protocol so these would keep the event loop running forever.
+    F_LOG_IF_ERR(logger, event_loop->stop(), "failed to stop event loop");
+}
+
+#endif
@@ -0,0 +1,321 @@
+#include "stream_adapter.hpp"
+
+#if FIBRE_ENABLE_STREAM_ADAPTER
+
+#include <fibre/domain.hpp>
+#include <fibre/fibre.hpp>
+#include <fibre/logging.hpp>
+#include <algorithm>
+#include <bitset>
+
+using namespace fibre;
+
+StreamAdapter::StreamAdapter(Domain* domain, AsyncStreamSource* rx_channel, AsyncStreamSink* tx_channel, bool packetized, size_t mtu, const char* intf_name)
+    : domain_(domain),
+      rx_channel_(packetized ? rx_channel : &packet_unwrapper_),
+      tx_channel_(packetized ? tx_channel : &packet_wrapper_),
+      packet_size_(std::min(mtu, kMaxPacketSize)),
+      intf_name_(intf_name),
+      packet_wrapper_(tx_channel),
+      packet_unwrapper_(rx_channel) {}
+
+void StreamAdapter::start(Callback<void, StreamAdapter*, StreamStatus> on_stopped) {
+    enter();
+    on_stopped_ = on_stopped;
+    send_loop(); // sends the handshake
+    receive_loop();
+    leave();
+}
+
+void StreamAdapter::stop() {
+    enter();
+    close(kStreamCancelled);
+    leave();
+}
+
+void StreamAdapter::close(StreamStatus status) {
+    if (stopping_) {
+        return;
+    }
+    stopping_ = true;
+    status_ = status;
+
+    if (rx_busy_) {
+        rx_channel_->cancel_read(rx_handle_);
+    }
+    if (tx_busy_) {
+        tx_channel_->cancel_write(tx_handle_);
+    }
+}
+
+/**
+ * @brief Must be the last thing that an entry point into the adapter does
+ * because it can delete the adapter.
+ */
+void StreamAdapter::leave() {
+    if (!--depth_ && stopping_) {
+        maybe_finish_stop();
+    }
+}
+
+void StreamAdapter::maybe_finish_stop() {
+    if (rx_busy_ || tx_busy_ || stopped_) {
+        return;
+    }
+    stopped_ = true;
+
+    reset_input_slots();
+
+    if (node_) {
+        // Closes all output slots on this adapter
+        domain_->on_lost_node(node_, this);
+        node_ = nullptr;
+    }
+
+    F_LOG_D(domain_->ctx->logger, "stopped stream adapter");
+    on_stopped_.invoke_and_clear(this, status_);
+}
+
+void StreamAdapter::reset_input_slots() {
+    for (auto& slot: rx_slots_) {
+        slot.second.reset_at(domain_, 0);
+    }
+    while (rx_slots_.begin() != rx_slots_.end()) {
+        rx_slots_.erase(rx_slots_.begin());
+    }
+}
+
+bool StreamAdapter::open_output_slot(uintptr_t* p_slot_id, Node* dest) {
+    std::bitset<kMaxOutputSlots> slots_in_use;
+
+    for (auto& active_slot : tx_slots_) {
+        slots_in_use[active_slot.slot_id] = true;
+    }
+
+    uint8_t output_slot_id = find_first(slots_in_use.flip());
+    if (output_slot_id >= kMaxOutputSlots) {
+        return false;  // cannot allocate more output slots
+    }
+
+    TxContext* slot = tx_slots_.alloc();  // freed in close_output_slot()
+    if (!slot) {
+        return false;  // out of memory
+    }
+
+    slot->slot_id = output_slot_id;
+
+    if (p_slot_id) {
+        *p_slot_id = reinterpret_cast<uintptr_t>(slot);
+    }
+
+    return true;
+}
+
+bool StreamAdapter::close_output_slot(uintptr_t slot_id) {
+    TxContext* slot = reinterpret_cast<TxContext*>(slot_id);
+    tx_slots_.free(slot);
+    return true;
+}
+
+bool StreamAdapter::start_write(TxTaskChain tasks) {
+    if (stopping_ || has_pending_task_ || !tasks.size()) {
+        return false;  // busy
+    }
+
+    enter();
+    pending_task_ = tasks[0];
+    has_pending_task_ = true;
+    send_loop();
+    leave();
+    return true;
+}
+
+void StreamAdapter::cancel_write() {
+    if (has_pending_task_) {
+        has_pending_task_ = false;
+    } else {
+        // The packet was already copied to tx_buf_ so it is still sent in
+        // full to keep the framing intact but it's not reported back to the
+        // multiplexer.
+        has_sending_task_ = false;
+    }
+}
+
+/**
+ * @brief Sends packets for as long as there is something to send and the
+ * channel completes writes immediately.
+ *
+ * This runs as a loop rather than through recursion so that synchronously
+ * completing writes don't grow the stack.
+ */
+void StreamAdapter::send_loop() {
+    if (in_send_loop_) {
+        return;
+    }
+    in_send_loop_ = true;
+
+    while (!tx_busy_ && !stopping_ && (!handshake_sent_ || has_pending_task_)) {
+        send_next_packet();
+    }
+
+    in_send_loop_ = false;
+}
+
+void StreamAdapter::send_next_packet() {
+    uint8_t* end;
+
+    if (!handshake_sent_) {
+        tx_buf_[0] = kHandshake;
+        tx_buf_[1] = kVersion;
+        std::copy_n(domain_->node_id.begin(), 16, tx_buf_ + 2);
+        end = tx_buf_ + kHandshakeSize;
+        handshake_sent_ = true;
+
+    } else {
+        TxTask task = pending_task_;
+        has_pending_task_ = false;
+
+        TxContext* tx_slot = reinterpret_cast<TxContext*>(task.slot_id);
+        tx_buf_[0] = kData;
+        tx_buf_[1] = tx_slot->slot_id;
+
+        bufptr_t packet{tx_buf_ + kDataHeaderSize, tx_buf_ + packet_size_};
+        CBufIt task_end = LowLevelProtocol::pack(tx_slot->state, task.chain(), &packet);
+
+        if (packet.begin() == tx_buf_ + kDataHeaderSize) {
+            // The task can't be sent now or later. Closing the adapter takes
+            // it back from the multiplexer through on_lost_node() so that the
+            // calls on this link fail instead of stalling.
+            F_LOG_E(domain_->ctx->logger, "failed to pack message");
+            close(kStreamError);
+            return;
+        }
+
+        sending_task_ = task;
+        sending_end_ = task_end;
+        has_sending_task_ = true;
+        end = packet.begin();
+    }
+
+    tx_busy_ = true;
+    tx_channel_->start_write({tx_buf_, end}, &tx_handle_, MEMBER_CB(this, on_write_done));
+}
+
+void StreamAdapter::on_write_done(WriteResult0 result) {
+    enter();
+    tx_busy_ = false;
+
+    if (stopping_) {
+        // nothing to do
+    } else if (result.status != kStreamOk) {
+        F_LOG_D(domain_->ctx->logger, "TX channel closed: " << result.status);
+        close(result.status);
+    } else {
+        if (has_sending_task_) {
+            has_sending_task_ = false;
+            // This can call start_write() synchronously
+            multiplexer_.on_sent(sending_task_.pipe, sending_end_);
+        }
+        send_loop();
+    }
+
+    leave();
+}
+
+/**
+ * @brief Keeps a read pending for as long as the adapter runs. Reads that
+ * complete immediately are handled in a loop rather than through recursion.
+ */
+void StreamAdapter::receive_loop() {
+    if (in_receive_loop_) {
+        return;
+    }
+    in_receive_loop_ = true;
+
+    while (!rx_busy_ && !stopping_) {
+        rx_busy_ = true;
+        rx_channel_->start_read({rx_buf_, rx_buf_ + packet_size_}, &rx_handle_, MEMBER_CB(this, on_read_done));
+    }
+
+    in_receive_loop_ = false;
+}
+
+void StreamAdapter::on_read_done(ReadResult result) {
+    enter();
+    rx_busy_ = false;
+
+    if (stopping_) {
+        // nothing to do
+    } else if (result.status != kStreamOk) {
+        F_LOG_D(domain_->ctx->logger, "RX channel closed: " << result.status);
+        close(result.status);
+    } else {
+        handle_packet({rx_buf_, result.end});
+        receive_loop();
+    }
+
+    leave();
+}
+
+void StreamAdapter::handle_packet(cbufptr_t packet) {
+    if (packet.size() < 1) {
+        F_LOG_W(domain_->ctx->logger, "empty packet");
+        return;
+    }
+
+    if (packet[0] == kHandshake) {
+        if (packet.size() < kHandshakeSize || packet[1] != kVersion) {
+            F_LOG_E(domain_->ctx->logger, "incompatible peer (handshake length " << packet.size() << ", version " << (int)packet[1] << ")");
+            close(kStreamError);
+            return;
+        }
+
+        NodeId node_id;
+        std::copy_n(packet.begin() + 2, 16, node_id.begin());
+
+        if (node_ && node_->id == node_id) {
+            return; // node already known
+        }
+
+        if (node_) {
+            // The peer restarted with a different identity. Its old calls are
+            // gone.
+            F_LOG_D(domain_->ctx->logger, "peer changed its node ID");
+            reset_input_slots();
+            domain_->on_lost_node(node_, this);
+            node_ = nullptr;
+        }
+
+        domain_->on_found_node(node_id, this, intf_name_, &node_);
+
+    } else if (packet[0] == kData) {
+        if (!node_) {
+            F_LOG_W(domain_->ctx->logger, "data before handshake");
+            return;
+        }
+        if (packet.size() < kDataHeaderSize) {
+            F_LOG_W(domain_->ctx->logger, "packet too short");
+            return;
+        }
+
+        uint8_t slot_id = packet[1];
+        CallContext* ctx = rx_slots_.get(slot_id);
+        if (!ctx) {
+            // this slot is unknown - alloc new slot
+            ctx = rx_slots_.alloc(slot_id);
+            if (!ctx) {
+                F_LOG_W(domain_->ctx->logger, "too many input slots");
+                return;
+            }
+        }
+
+        if (!ctx->process_packet(domain_, this, node_, packet.skip(kDataHeaderSize))) {
+            F_LOG_E(domain_->ctx->logger, "failed to unpack message");
+        }
+
+    } else {
+        F_LOG_W(domain_->ctx->logger, "unknown packet type " << (int)packet[0]);
+    }
+}
+
+#endif
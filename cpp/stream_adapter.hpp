@@ -0,0 +1,144 @@
+#ifndef __FIBRE_STREAM_ADAPTER_HPP
+#define __FIBRE_STREAM_ADAPTER_HPP
+
+#include <fibre/config.hpp>
+
+#if FIBRE_ENABLE_STREAM_ADAPTER
+
+#include "legacy_protocol.hpp"
+#include <fibre/async_stream.hpp>
+#include <fibre/callback.hpp>
+#include <fibre/channel_discoverer.hpp>
+#include <fibre/connection.hpp>
+#include <fibre/low_level_protocol.hpp>
+#include <fibre/node.hpp>
+#include <fibre/pool.hpp>
+
+namespace fibre {
+
+/**
+ * @brief Runs the native Fibre protocol over a pair of point-to-point channels
+ * such as a TCP connection or a UART.
+ *
+ * On stream based channels the packets are framed the same way as by the
+ * legacy protocol (prefix, length, CRC8 header, CRC16 trailer, see
+ * PacketWrapper) so that the receiver can resynchronize after corrupted or
+ * lost bytes. Packet based channels carry one packet per transfer.
+ *
+ * Each packet starts with a type byte:
+ *  - kHandshake: [type, version, 16-byte node ID]. Each side sends one as soon
+ *    as the adapter is started. Once the peer's handshake arrives, the peer is
+ *    announced to the domain as a node that is reachable through this adapter.
+ *  - kData: [type, slot ID, LowLevelProtocol packet]. The slot ID lets several
+ *    calls share the link, each with its own LowLevelProtocol state. There is
+ *    no addressing since the link only has two ends.
+ */
+class StreamAdapter final : public FrameStreamSink {
+public:
+    StreamAdapter(Domain* domain, AsyncStreamSource* rx_channel, AsyncStreamSink* tx_channel, bool packetized, size_t mtu, const char* intf_name);
+
+    /**
+     * @brief Sends the handshake and starts receiving.
+     *
+     * @param on_stopped: Invoked once the adapter stopped, either because
+     *        either of the channels failed or closed or because stop() was
+     *        called. The adapter can be deleted from within this callback.
+     */
+    void start(Callback<void, StreamAdapter*, StreamStatus> on_stopped);
+
+    /**
+     * @brief Cancels all ongoing transfers. The on_stopped callback is invoked
+     * once they completed (possibly before this function returns).
+     */
+    void stop();
+
+    // Not used by the adapter. Lets Domain::add_channels() tell the owner of
+    // the channels when they are released.
+    Callback<void, StreamStatus> on_closed;
+
+private:
+    enum PacketType : uint8_t {
+        kHandshake = 0x00,
+        kData = 0x01,
+    };
+
+    static constexpr uint8_t kVersion = 1;
+    static constexpr size_t kHandshakeSize = 2 + 16;
+    static constexpr size_t kDataHeaderSize = 2;
+
+    // LowLevelProtocol can't express chunks that extend past 255 bytes of a
+    // packet and small packets let the multiplexer interleave calls.
+    static constexpr size_t kMaxPacketSize = kDataHeaderSize + 128;
+
+    // If this is too large, thrashing can occur at the destination
+    static constexpr size_t kMaxOutputSlots = 8;
+    static constexpr size_t kMaxInputSlots = 8;
+
+    struct TxContext {
+        uint8_t slot_id;
+        SenderState state{};
+    };
+
+    // FrameStreamSink implementation
+    bool open_output_slot(uintptr_t* p_slot_id, Node* dest) final;
+    bool close_output_slot(uintptr_t slot_id) final;
+    bool start_write(TxTaskChain tasks) final;
+    void cancel_write() final;
+
+    void send_loop();
+    void send_next_packet();
+    void on_write_done(WriteResult0 result);
+    void receive_loop();
+    void on_read_done(ReadResult result);
+    void handle_packet(cbufptr_t packet);
+    void reset_input_slots();
+    void close(StreamStatus status);
+    void enter() { depth_++; }
+    void leave();
+    void maybe_finish_stop();
+
+    Domain* domain_;
+    AsyncStreamSource* rx_channel_;
+    AsyncStreamSink* tx_channel_;
+    size_t packet_size_;
+    const char* intf_name_;
+
+    // Only used on stream based channels
+    PacketWrapper packet_wrapper_;
+    PacketUnwrapper packet_unwrapper_;
+
+    Callback<void, StreamAdapter*, StreamStatus> on_stopped_;
+    StreamStatus status_ = kStreamOk;
+    Node* node_ = nullptr; // set once the peer's handshake arrived
+
+    uint8_t tx_buf_[kMaxPacketSize];
+    TransferHandle tx_handle_;
+    bool tx_busy_ = false;
+    bool in_send_loop_ = false;
+    bool handshake_sent_ = false;
+    TxTask pending_task_; // received through start_write() and not yet packed
+    bool has_pending_task_ = false;
+    TxTask sending_task_; // packed into tx_buf_
+    CBufIt sending_end_ = CBufIt::null();
+    bool has_sending_task_ = false;
+
+    uint8_t rx_buf_[kMaxPacketSize];
+    TransferHandle rx_handle_;
+    bool rx_busy_ = false;
+    bool in_receive_loop_ = false;
+
+    bool stopping_ = false;
+    bool stopped_ = false;
+    // Number of calls into this adapter that are on the stack. The stop is
+    // only finished (which can delete the adapter) once this drops to zero.
+    unsigned depth_ = 0;
+
+    Pool<TxContext, kMaxOutputSlots> tx_slots_;
+    Map<uint8_t, CallContext, kMaxInputSlots> rx_slots_;
+};
+
+}
+
+#endif
+
+#endif // __FIBRE_STREAM_ADAPTER_HPP
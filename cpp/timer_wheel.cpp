@@ -0,0 +1,193 @@
+#include "timer_wheel.hpp"
+
+using namespace fibre;
+
+TimerWheel::TimerWheel(uint64_t tick_ns, uint64_t now_ns)
+    : tick_ns_(tick_ns), now_(now_ns / tick_ns) {
+    for (unsigned l = 0; l < kLevels; ++l) {
+        for (unsigned s = 0; s < kSlots; ++s) {
+            slots_[l][s].prev = slots_[l][s].next = &slots_[l][s];
+        }
+    }
+}
+
+void TimerWheel::arm(Entry* entry, uint64_t deadline_ns, uint64_t interval_ns) {
+    if (entry->is_armed()) {
+        unlink(entry);
+    }
+
+    // Round up so that timers never fire early
+    entry->expiry = (deadline_ns + tick_ns_ - 1) / tick_ns_;
+    if (entry->expiry <= now_) {
+        entry->expiry = now_ + 1;
+    }
+    entry->deadline_ns = deadline_ns;
+    entry->interval_ns = interval_ns;
+    entry->missed = 0;
+    insert(entry);
+}
+
+void TimerWheel::cancel(Entry* entry) {
+    if (entry->is_armed()) {
+        unlink(entry);
+    }
+}
+
+void TimerWheel::advance(uint64_t now_ns) {
+    uint64_t target = now_ns / tick_ns_;
+    target_ = target;
+
+    while (now_ < target) {
+        if (!n_armed_) {
+            now_ = target;
+            break;
+        }
+
+        // Skip to the next occupied level 0 slot or the next cascade point,
+        // whichever comes first.
+        unsigned cur = now_ & (kSlots - 1);
+        uint64_t ahead = cur == kSlots - 1 ? 0 : occupied_[0] & (~0ULL << (cur + 1));
+        uint64_t next = ahead ? (now_ & ~(uint64_t)(kSlots - 1)) + __builtin_ctzll(ahead)
+                              : (now_ | (kSlots - 1)) + 1;
+        if (next > target) {
+            now_ = target;
+            break;
+        }
+        now_ = next;
+
+        // Cascade from top to bottom so that timers can move down several
+        // levels at once.
+        for (unsigned l = kLevels - 1; l > 0; --l) {
+            if (!(now_ & ((1ULL << (kSlotBits * l)) - 1))) {
+                cascade(l);
+            }
+        }
+
+        expire(now_ & (kSlots - 1));
+    }
+}
+
+bool TimerWheel::next_deadline(uint64_t* deadline_ns) {
+    if (!n_armed_) {
+        return false;
+    }
+
+    uint64_t earliest = UINT64_MAX;
+
+    for (unsigned l = 0; l < kLevels; ++l) {
+        uint64_t bits = occupied_[l];
+        if (!bits) {
+            continue;
+        }
+
+        // Find the first occupied slot after the current one. Slots that are
+        // behind the current slot are reached in the next turn of the level.
+        uint64_t block = now_ >> (kSlotBits * l);
+        unsigned shift = (block + 1) & (kSlots - 1);
+        uint64_t rotated = shift ? ((bits >> shift) | (bits << (kSlots - shift))) : bits;
+        uint64_t tick = (block + __builtin_ctzll(rotated) + 1) << (kSlotBits * l);
+
+        if (tick < earliest) {
+            earliest = tick;
+        }
+    }
+
+    if (deadline_ns) {
+        *deadline_ns = earliest * tick_ns_;
+    }
+    return true;
+}
+
+void TimerWheel::insert(Entry* entry) {
+    uint64_t expiry = entry->expiry;
+    uint64_t delta = expiry - now_;
+
+    unsigned level = 0;
+    while (level < kLevels - 1 && delta >= (1ULL << (kSlotBits * (level + 1)))) {
+        level++;
+    }
+
+    if (delta >= (1ULL << (kSlotBits * kLevels))) {
+        // Out of range: park the timer in the furthest slot of the top level.
+        // It gets re-inserted (with the real expiry) when that slot is reached.
+        expiry = now_ + (1ULL << (kSlotBits * kLevels)) - 1;
+    }
+
+    entry->level = level;
+    entry->slot = (expiry >> (kSlotBits * level)) & (kSlots - 1);
+
+    Entry* head = &slots_[level][entry->slot];
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+
+    occupied_[level] |= 1ULL << entry->slot;
+    n_armed_++;
+}
+
+void TimerWheel::unlink(Entry* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = entry->next = nullptr;
+
+    Entry* head = &slots_[entry->level][entry->slot];
+    if (head->next == head) {
+        occupied_[entry->level] &= ~(1ULL << entry->slot);
+    }
+    n_armed_--;
+}
+
+void TimerWheel::cascade(unsigned level) {
+    unsigned slot = (now_ >> (kSlotBits * level)) & (kSlots - 1);
+    Entry* head = &slots_[level][slot];
+
+    while (head->next != head) {
+        Entry* entry = head->next;
+        unlink(entry);
+        insert(entry);
+    }
+}
+
+void TimerWheel::expire(unsigned slot) {
+    Entry* head = &slots_[0][slot];
+
+    // Move the due timers to a local list first. Callbacks can arm or cancel
+    // any timer, including the ones on this list.
+    Entry due;
+    if (head->next == head) {
+        return;
+    }
+    due.next = head->next;
+    due.prev = head->prev;
+    due.next->prev = &due;
+    due.prev->next = &due;
+    head->next = head->prev = head;
+    occupied_[0] &= ~(1ULL << slot);
+
+    while (due.next != &due) {
+        Entry* entry = due.next;
+        unlink(entry);
+        uint64_t expiry = entry->expiry;
+
+        if (entry->interval_ns) {
+            // The next deadline is derived from the exact previous deadline so
+            // that the timer doesn't drift. Triggers that would still be due
+            // within this advance() are skipped.
+            uint64_t limit_ns = target_ * tick_ns_;
+            entry->deadline_ns += entry->interval_ns;
+            entry->missed = 0;
+            if (entry->deadline_ns <= limit_ns) {
+                entry->missed = (limit_ns - entry->deadline_ns) / entry->interval_ns + 1;
+                entry->deadline_ns += entry->missed * entry->interval_ns;
+            }
+            entry->expiry = (entry->deadline_ns + tick_ns_ - 1) / tick_ns_;
+            insert(entry);
+        }
+
+        // The callback may close the timer so we must not touch the entry
+        // afterwards.
+        firing_ = expiry;
+        entry->callback.invoke();
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef __FIBRE_TIMER_WHEEL_HPP
+#define __FIBRE_TIMER_WHEEL_HPP
+
+#include <fibre/callback.hpp>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace fibre {
+
+/**
+ * @brief Hierarchical timer wheel that multiplexes any number of timers onto a
+ * single platform timer.
+ *
+ * Time is measured in ticks of a fixed duration. Level 0 has one slot per tick,
+ * each higher level has slots that are kSlots times coarser. Timers are stored
+ * in an intrusive list in the slot of their expiry time on the lowest level
+ * that can hold them and are moved down one level when the wheel reaches the
+ * slot they're in ("cascading"). Timers that expire beyond the range of the
+ * highest level are parked there and re-inserted when the wheel gets closer.
+ *
+ * Arming and cancelling a timer is O(1). advance() is O(number of expired or
+ * cascaded timers) plus O(1) per kSlots ticks of elapsed time.
+ *
+ * The owner is responsible for reading the clock and for calling advance()
+ * when the time returned by next_deadline() is reached. Timer callbacks are
+ * invoked from within advance() and may arm, cancel or destroy any timer,
+ * including the one that is currently firing.
+ *
+ * Not thread-safe.
+ */
+class TimerWheel {
+public:
+    struct Entry {
+        // Intrusive list pointers. Both null if the timer is not armed.
+        Entry* prev = nullptr;
+        Entry* next = nullptr;
+        uint64_t expiry = 0; // in ticks
+        uint64_t deadline_ns = 0; // exact deadline of the next trigger
+        uint64_t interval_ns = 0; // 0 for one-shot timers
+        uint64_t missed = 0; // number of triggers that were skipped before the current one
+        uint8_t level = 0;
+        uint8_t slot = 0;
+        Callback<void> callback;
+
+        bool is_armed() const { return next; }
+    };
+
+    /**
+     * @param tick_ns: The resolution of the wheel. Timers fire no earlier than
+     *        requested and up to one tick (plus the owner's wakeup latency)
+     *        later.
+     * @param now_ns: The current time as per the owner's clock.
+     */
+    TimerWheel(uint64_t tick_ns, uint64_t now_ns);
+
+    /**
+     * @brief Arms (or re-arms) the specified timer.
+     *
+     * @param deadline_ns: Absolute time at which the timer shall fire first.
+     *        Deadlines in the past fire on the next call to advance() that
+     *        moves time forward by at least one tick.
+     * @param interval_ns: Interval for periodic timers or 0 for one-shot
+     *        timers. Periodic timers are due at exactly
+     *        `deadline_ns + k * interval_ns`. If advance() is called so late
+     *        that several of these deadlines have passed, the timer fires
+     *        only once and the skipped triggers are counted in Entry::missed.
+     */
+    void arm(Entry* entry, uint64_t deadline_ns, uint64_t interval_ns);
+
+    /**
+     * @brief Disarms the specified timer. Has no effect if the timer is not
+     * armed.
+     */
+    void cancel(Entry* entry);
+
+    /**
+     * @brief Fires all timers that are due at the specified time.
+     */
+    void advance(uint64_t now_ns);
+
+    /**
+     * @brief Returns the absolute time at which advance() must be called next
+     * or false if no timer is armed.
+     *
+     * This can be earlier than the expiry of the earliest timer because timers
+     * on higher levels must be cascaded before they can fire. Calling
+     * advance() early is harmless.
+     */
+    bool next_deadline(uint64_t* deadline_ns);
+
+    size_t n_armed() { return n_armed_; }
+
+    /**
+     * @brief Returns the time at which the timer whose callback is currently
+     * running was due, rounded up to the tick.
+     *
+     * Only valid during a timer callback.
+     */
+    uint64_t firing_deadline_ns() { return firing_ * tick_ns_; }
+
+private:
+    static const unsigned kSlotBits = 6;
+    static const unsigned kSlots = 1 << kSlotBits;
+    static const unsigned kLevels = 4;
+
+    void insert(Entry* entry);
+    void unlink(Entry* entry);
+    void cascade(unsigned level);
+    void expire(unsigned slot);
+
+    // Each slot is the sentinel of a circular list.
+    Entry slots_[kLevels][kSlots];
+    uint64_t occupied_[kLevels] = {}; // bit i set if slot i is non-empty
+    uint64_t tick_ns_;
+    uint64_t now_; // in ticks
+    uint64_t target_ = 0; // the time up to which advance() is currently advancing, in ticks
+    size_t n_armed_ = 0;
+    uint64_t firing_ = 0; // expiry of the timer whose callback is running, in ticks
+};
+
+}
+
+#endif // __FIBRE_TIMER_WHEEL_HPP
@@ -87,6 +87,7 @@ LogSignature = CFUNCTYPE(None, c_void_p, c_char_p, c_uint, c_int, c_size_t, c_si
 OnFoundObjectSignature = CFUNCTYPE(None, c_void_p, c_void_p, c_void_p, c_char_p, c_size_t)
 OnLostObjectSignature = CFUNCTYPE(None, c_void_p, c_void_p)
 OnStoppedSignature = CFUNCTYPE(None, c_void_p, c_int)
+OnBulkReadDoneSignature = CFUNCTYPE(None, c_void_p, c_int, c_void_p)
 
 OnTxCompletedSignature = CFUNCTYPE(None, c_void_p, c_void_p, c_int, c_void_p)
 OnRxCompletedSignature = CFUNCTYPE(None, c_void_p, c_void_p, c_int, c_void_p)
@@ -221,6 +222,10 @@ libfibre_close = lib.libfibre_close
 libfibre_close.argtypes = [c_void_p]
 libfibre_close.restype = None
 
+libfibre_set_cache_dir = lib.libfibre_set_cache_dir
+libfibre_set_cache_dir.argtypes = [c_void_p, c_char_p]
+libfibre_set_cache_dir.restype = None
+
 libfibre_open_domain = lib.libfibre_open_domain
 libfibre_open_domain.argtypes = [c_void_p, c_char_p, c_size_t]
 libfibre_open_domain.restype = c_void_p
@@ -257,6 +262,10 @@ libfibre_get_attribute = lib.libfibre_get_attribute
 libfibre_get_attribute.argtypes = [c_void_p, c_void_p, c_size_t, POINTER(c_void_p)]
 libfibre_get_attribute.restype = c_int
 
+libfibre_start_bulk_read = lib.libfibre_start_bulk_read
+libfibre_start_bulk_read.argtypes = [POINTER(c_void_p), c_size_t, c_void_p, c_size_t, OnBulkReadDoneSignature, c_void_p]
+libfibre_start_bulk_read.restype = c_int
+
 libfibre_run_tasks = lib.libfibre_run_tasks
 libfibre_run_tasks.argtypes = [c_void_p, POINTER(LibFibreTask), c_size_t, POINTER(POINTER(LibFibreTask)), POINTER(c_size_t)]
 libfibre_run_tasks.restype = None
@@ -688,6 +697,35 @@ class RemoteObject(object):
 
         return object.__getattribute__(self, key)
 
+    def _read_properties(self, *names):
+        """
+        Reads several properties of this object or its subobjects with as few
+        round trips as the device supports. Names can be paths relative to this
+        object, such as "axis0.encoder.pos_estimate".
+        Returns a tuple with the values in the order of `names`.
+        If this function is called from the Fibre thread then it is nonblocking
+        and returns an asyncio.Future. If it is called from another thread then
+        it blocks until all values are read.
+        """
+        if threading.current_thread() != libfibre_thread:
+            return run_coroutine_threadsafe(self._libfibre.loop, lambda: self._read_properties(*names))
+
+        props = []
+        for name in names:
+            obj = self
+            for key in name.split('.'):
+                obj = obj._get_without_magic(key)
+                if obj is None:
+                    raise AttributeError("Attribute {} not found".format(name))
+            if not obj.__class__._magic_getter:
+                raise TypeError("{} is not a property".format(name))
+            codec = obj.__class__._functions[obj.__class__._magic_getter]._outputs[0][2]
+            if isinstance(codec, ObjectPtrCodec):
+                raise TypeError("{} is an object reference which cannot be read in bulk".format(name))
+            props.append((obj, codec))
+
+        return asyncio.ensure_future(self._libfibre._bulk_read(props), loop=self._libfibre.loop)
+
     def __dir__(self):
         props = ["_" + k + "_property" for k, (idx, intf) in self._attributes.items() if intf._name.startswith("fibre.Property<") and intf._name.endswith(">")]
         return sorted(set(super(object, self).__dir__()
@@ -765,6 +803,7 @@ class LibFibre():
         self.c_on_found_object = OnFoundObjectSignature(self._on_found_object)
         self.c_on_lost_object = OnLostObjectSignature(self._on_lost_object)
         self.c_on_discovery_stopped = OnStoppedSignature(self._on_discovery_stopped)
+        self.c_on_bulk_read_done = OnBulkReadDoneSignature(self._on_bulk_read_done)
         
         self.timer_map = {}
         self.eventfd_map = {}
@@ -773,6 +812,7 @@ class LibFibre():
         self._objects = {} # key: libfibre handle, value: python class
         self._functions = {} # key: libfibre handle, value: python class
         self._calls = {} # key: libfibre handle, value: Call object
+        self._bulk_reads = {} # key: ID, value: (future, rx buffer)
 
         self.clear_tasks()
         self._autostart_dispatcher = True
@@ -794,6 +834,16 @@ class LibFibre():
         self.ctx = c_void_p(libfibre_open(event_loop, self.c_on_run_tasks, logger))
         assert(self.ctx)
 
+        # Cache interface descriptors on disk so that known devices connect
+        # faster. Like in libfibre this is off unless a directory is given.
+        cache_dir = os.environ.get('FIBRE_CACHE_DIR')
+        if cache_dir:
+            try:
+                os.makedirs(cache_dir, exist_ok=True)
+                libfibre_set_cache_dir(self.ctx, cache_dir.encode('utf-8'))
+            except OSError:
+                pass # fall back to in-memory cache
+
     def _log(self, ctx, file, line, level, info0, info1, text):
         file = string_at(file).decode('utf-8')
         text = string_at(text).decode('utf-8')
@@ -1021,6 +1071,34 @@ class LibFibre():
     def _on_discovery_stopped(self, ctx, result):
         print("discovery stopped")
 
+    async def _bulk_read(self, props):
+        handles = (c_void_p * len(props))(*(obj._obj_handle for obj, codec in props))
+        rx_buf = (c_uint8 * (9 * len(props)))() # 1 length byte + up to 8 value bytes per property
+        future = self.loop.create_future()
+        ctx = insert_with_new_id(self._bulk_reads, (future, rx_buf))
+
+        status = libfibre_start_bulk_read(handles, len(props), rx_buf, len(rx_buf), self.c_on_bulk_read_done, ctx)
+        if status != kFibreOk:
+            self._bulk_reads.pop(ctx)
+            raise _get_exception(status)
+
+        status, rx_len = await future
+        if status != kFibreOk:
+            raise _get_exception(status)
+
+        buf = bytes(rx_buf[:rx_len])
+        values = []
+        for obj, codec in props:
+            if len(buf) < 1 or buf[0] != codec.get_length() or len(buf) < 1 + buf[0]:
+                raise _get_exception(kFibreProtocolError)
+            values.append(codec.deserialize(self, buf[1:1 + buf[0]]))
+            buf = buf[1 + buf[0]:]
+        return tuple(values)
+
+    def _on_bulk_read_done(self, ctx, status, rx_end):
+        future, rx_buf = self._bulk_reads.pop(ctx)
+        future.set_result((status, (rx_end or 0) - addressof(rx_buf)))
+
     def _on_call_completed(self, ctx, status, tx_end, rx_end, tx_buf, tx_len, rx_buf, rx_len):
         call = self._calls.pop(ctx)
 
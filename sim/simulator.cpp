@@ -8,13 +8,11 @@ using namespace fibre::simulator;
 
 class SimulatorTimer final : public Timer {
     RichStatus set(float interval, TimerMode mode) final;
-    void on_trigger();
+    RichStatus set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) final;
+    uint64_t get_missed_periods() final { return entry_.missed; }
 public:
     Simulator* sim_;
-    Callback<void> callback;
-    Simulator::Event* evt_;
-    bool periodic_;
-    float interval_;
+    TimerWheel::Entry entry_;
 };
 
 RichStatus Simulator::post(Callback<void> callback) {
@@ -24,6 +22,9 @@ RichStatus Simulator::register_event(int fd, uint32_t events,
                                      Callback<void, uint32_t> callback) {
     return F_MAKE_ERR("not implemented");
 }
+RichStatus Simulator::modify_event(int fd, uint32_t events) {
+    return F_MAKE_ERR("not implemented");
+}
 RichStatus Simulator::deregister_event(int fd) {
     return F_MAKE_ERR("not implemented");
 }
@@ -31,7 +32,7 @@ RichStatus Simulator::deregister_event(int fd) {
 RichStatus Simulator::open_timer(Timer** p_timer, Callback<void> on_trigger) {
     SimulatorTimer* t = new SimulatorTimer{}; // deleted in close_timer()
     t->sim_ = this;
-    t->callback = on_trigger;
+    t->entry_.callback = on_trigger;
     if (p_timer) {
         *p_timer = t;
     }
@@ -39,39 +40,58 @@ RichStatus Simulator::open_timer(Timer** p_timer, Callback<void> on_trigger) {
 }
 
 RichStatus SimulatorTimer::set(float interval, TimerMode mode) {
-    if (evt_) {
-        sim_->cancel(evt_);
-    }
-
-    periodic_ = mode == TimerMode::kPeriodic;
-    interval_ = interval;
-
-    if (mode != TimerMode::kNever) {
-        uint64_t delay_ns = interval_ * (float)1e9;
-        evt_ = sim_->add_event({sim_->t_ns + delay_ns, MEMBER_CB(this, on_trigger), nullptr, {}});
+    if (mode == TimerMode::kNever) {
+        sim_->cancel_timer(&entry_);
+    } else {
+        uint64_t delay_ns = interval * (float)1e9;
+        sim_->arm_timer(&entry_, delay_ns, mode == TimerMode::kPeriodic ? delay_ns : 0);
     }
-
     return RichStatus::success();
 }
 
-void SimulatorTimer::on_trigger() {
-    evt_ = nullptr;
-
-    if (periodic_) {
-        uint64_t delay_ns = interval_ * (float)1e9;
-        evt_ = sim_->add_event({sim_->t_ns + delay_ns, MEMBER_CB(this, on_trigger), nullptr, {}});
+RichStatus SimulatorTimer::set_ns(uint64_t deadline_ns, uint64_t interval_ns, bool absolute) {
+    if (absolute) {
+        deadline_ns = deadline_ns > sim_->t_ns ? deadline_ns - sim_->t_ns : 0;
     }
-
-    callback.invoke();
+    sim_->arm_timer(&entry_, deadline_ns, interval_ns);
+    return RichStatus::success();
 }
 
 RichStatus Simulator::close_timer(Timer* timer) {
     SimulatorTimer* t = static_cast<SimulatorTimer*>(timer);
-    cancel(t->evt_);
+    cancel_timer(&t->entry_);
     delete t;
     return RichStatus::success();
 }
 
+void Simulator::arm_timer(TimerWheel::Entry* entry, uint64_t delay_ns, uint64_t interval_ns) {
+    timer_wheel_.arm(entry, t_ns + delay_ns, interval_ns);
+    update_timer_event();
+}
+
+void Simulator::cancel_timer(TimerWheel::Entry* entry) {
+    // The timer event is left in place. If it's no longer needed it just
+    // fires without effect.
+    timer_wheel_.cancel(entry);
+}
+
+void Simulator::update_timer_event() {
+    uint64_t deadline_ns;
+    if (!timer_wheel_.next_deadline(&deadline_ns) || (timer_evt_ && timer_evt_->t_ns <= deadline_ns)) {
+        return;
+    }
+    if (timer_evt_) {
+        cancel(timer_evt_);
+    }
+    timer_evt_ = add_event({deadline_ns, MEMBER_CB(this, on_timer_event), nullptr, {}});
+}
+
+void Simulator::on_timer_event() {
+    timer_evt_ = nullptr;
+    timer_wheel_.advance(t_ns);
+    update_timer_event();
+}
+
 Simulator::Event* Simulator::send(Port* from, std::vector<Port*> to,
                                   float duration, Callback<void> on_delivery) {
     uint64_t duration_ns = duration * (float)1e9;
@@ -89,6 +109,7 @@ Simulator::Event* Simulator::add_event(Event new_evt) {
 
 void Simulator::cancel(Event* evt) {
     backlog.erase(std::find(backlog.begin(), backlog.end(), evt));
+    delete evt;
 }
 
 void Simulator::run(size_t n_events, float dt) {
@@ -2,6 +2,7 @@
 #define __FIBRE_SIMULATOR_HPP
 
 #include <fibre/../../mini_rng.hpp>
+#include <fibre/../../timer_wheel.hpp>
 #include <fibre/callback.hpp>
 #include <fibre/event_loop.hpp>
 #include <fibre/logging.hpp>
@@ -57,19 +58,32 @@ public:
 
     void run(size_t n_events, float dt);
 
+    // Used by the timers returned by open_timer()
+    void arm_timer(TimerWheel::Entry* entry, uint64_t delay_ns, uint64_t interval_ns);
+    void cancel_timer(TimerWheel::Entry* entry);
+
     RichStatus post(Callback<void> callback) final;
     RichStatus register_event(int fd, uint32_t events,
                               Callback<void, uint32_t> callback) final;
+    RichStatus modify_event(int fd, uint32_t events) final;
     RichStatus deregister_event(int fd) final;
     RichStatus open_timer(Timer** p_timer, Callback<void> on_trigger) final;
     RichStatus close_timer(Timer* timer) final;
+    uint64_t get_time_ns() final { return t_ns; }
 
     uint64_t t_ns = 0;
     MiniRng rng;
 
 private:
+    void update_timer_event();
+    void on_timer_event();
 
     std::vector<Event*> backlog;
+
+    // All timers are multiplexed onto a single event in the backlog.
+    static const uint64_t kTimerTickNs = 1000ULL;
+    TimerWheel timer_wheel_{kTimerTickNs, 0};
+    Event* timer_evt_ = nullptr;
 };
 
 }  // namespace simulator
@@ -17,6 +17,10 @@ fibre_pkg = get_fibre_package({
     enable_libusb_backend=false,
     enable_tcp_client_backend=true,
     enable_tcp_server_backend=true,
+    enable_unix_client_backend=true,
+    enable_unix_server_backend=true,
+    enable_udp_client_backend=true,
+    enable_udp_server_backend=true,
     enable_socket_can_backend=true,
 })
 
@@ -42,10 +46,47 @@ for _, src in pairs(autogen_pkg.code_files) do
 end
 
 
-compile_outname='build/test_node.elf'
+function link(inputs, outname, extra_ldflags)
+    tup.frule{
+        inputs=inputs,
+        command='^c^ '..LINKER..' %f '..tostring(CFLAGS)..' '..tostring(LDFLAGS)..' '..(extra_ldflags or '')..' -o %o',
+        outputs={outname}
+    }
+end
+
+link(object_files, 'build/test_node.elf')
+
+-- Standalone benchmarks and regression checks
+function bench(name, fibre_objects, extra_ldflags)
+    inputs = {compile(name..'.cpp')}
+    inputs += fibre_objects or {}
+    link(inputs, 'build/'..name..'.elf', extra_ldflags)
+end
 
-tup.frule{
-    inputs=object_files,
-    command='^c^ '..LINKER..' %f '..tostring(CFLAGS)..' '..tostring(LDFLAGS)..' -o %o',
-    outputs={compile_outname}
+-- Subset of the Fibre objects for programs that only need the event loops
+-- and sockets
+event_loop_objects = {
+    'build/epoll_event_loop.cpp.o',
+    'build/io_uring_event_loop.cpp.o',
+    'build/posix_socket.cpp.o',
+    'build/timer_wheel.cpp.o',
 }
+
+bench('crc_bench')
+bench('json_bench')
+bench('event_loop_bench', event_loop_objects)
+bench('mpsc_stress', event_loop_objects, '-lpthread')
+bench('latency_bench', event_loop_objects, '-lpthread')
+bench('ipc_latency_bench', event_loop_objects)
+bench('shm_bad_handshake', {
+    'build/epoll_event_loop.cpp.o',
+    'build/io_uring_event_loop.cpp.o',
+    'build/shm_channel.cpp.o',
+    'build/timer_wheel.cpp.o',
+})
+
+-- Links against the library that ../cpp/Tupfile.lua builds
+if string.find(fibre_run_now(CXX..' -dumpmachine'), "x86_64.*%-linux%-.*") then
+    bench('libfibre_shard_test', {fibre_cpp_dir..'/build/libfibre-linux-amd64.so'},
+          "-lpthread -Wl,-rpath,'$ORIGIN/../"..fibre_cpp_dir.."/build'")
+end
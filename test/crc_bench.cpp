@@ -0,0 +1,130 @@
+/**
+ * Checks the table-driven and slice-by-N CRC implementations against the
+ * bitwise reference and compares their throughput.
+ *
+ * Usage: crc_bench.elf [size in bytes]
+ *
+ * Exits with a non-zero status if any implementation disagrees with the
+ * bitwise reference.
+ */
+
+#include <fibre/../../crc.hpp>
+#include <fibre/../../legacy_protocol.hpp>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#if FIBRE_CRC_TABLE_SLICES != 8
+#error "this benchmark needs FIBRE_CRC_TABLE_SLICES = 8"
+#endif
+
+using namespace fibre;
+
+constexpr unsigned kCrc8Poly = CANONICAL_CRC8_POLYNOMIAL;
+constexpr unsigned kCrc16Poly = CANONICAL_CRC16_POLYNOMIAL;
+
+template<typename T, unsigned POLYNOMIAL>
+static T crc_bitwise(T remainder, const uint8_t* buffer, size_t length) {
+    while (length--)
+        remainder = calc_crc_bitwise<T, POLYNOMIAL>(remainder, *(buffer++));
+    return remainder;
+}
+
+template<typename T, unsigned POLYNOMIAL>
+static T crc_table(T remainder, const uint8_t* buffer, size_t length) {
+    const T* table = CrcTable<T, POLYNOMIAL, 1>::table();
+    while (length--)
+        remainder = calc_crc_table<T, POLYNOMIAL>(table, remainder, *(buffer++));
+    return remainder;
+}
+
+template<size_t N_SLICES>
+static uint16_t crc16_sliced(uint16_t remainder, const uint8_t* buffer, size_t length) {
+    return calc_crc16_sliced<kCrc16Poly, N_SLICES>(remainder, buffer, length);
+}
+
+static bool check_equivalence(std::mt19937& rng) {
+    std::vector<uint8_t> buf(4096);
+    size_t n_errors = 0;
+
+    for (size_t i = 0; i < 20000; ++i) {
+        // Random offsets exercise unaligned heads and tails of the sliced loops
+        size_t offset = rng() % 16;
+        size_t length = rng() % (buf.size() - offset);
+        for (size_t j = 0; j < offset + length; ++j) {
+            buf[j] = (uint8_t)rng();
+        }
+        const uint8_t* data = buf.data() + offset;
+        uint16_t init = (uint16_t)rng();
+
+        uint8_t ref8 = crc_bitwise<uint8_t, kCrc8Poly>((uint8_t)init, data, length);
+        uint16_t ref16 = crc_bitwise<uint16_t, kCrc16Poly>(init, data, length);
+
+        n_errors += crc_table<uint8_t, kCrc8Poly>((uint8_t)init, data, length) != ref8;
+        n_errors += calc_crc8<kCrc8Poly>((uint8_t)init, data, length) != ref8;
+        n_errors += crc_table<uint16_t, kCrc16Poly>(init, data, length) != ref16;
+        n_errors += crc16_sliced<4>(init, data, length) != ref16;
+        n_errors += crc16_sliced<8>(init, data, length) != ref16;
+        n_errors += calc_crc16<kCrc16Poly>(init, data, length) != ref16;
+    }
+
+    // The canonical CRC16 of a message followed by its big endian CRC is zero
+    uint8_t msg[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9', 0, 0};
+    uint16_t crc = crc_bitwise<uint16_t, kCrc16Poly>(CANONICAL_CRC16_INIT, msg, 9);
+    msg[9] = (uint8_t)(crc >> 8);
+    msg[10] = (uint8_t)crc;
+    n_errors += calc_crc16<kCrc16Poly>(CANONICAL_CRC16_INIT, msg, sizeof(msg)) != 0;
+
+    if (n_errors) {
+        printf("%zu mismatches against the bitwise reference\n", n_errors);
+    }
+    return !n_errors;
+}
+
+// Keeps the compiler from dropping the calculations
+static volatile unsigned sink;
+
+template<typename T>
+static void bench(const char* name, T (*fn)(T, const uint8_t*, size_t), const std::vector<uint8_t>& buf) {
+    T remainder = 0;
+    size_t n_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed;
+
+    // Runs for at least 200ms to get past frequency scaling and cache warmup
+    do {
+        remainder = fn(remainder, buf.data(), buf.size());
+        n_bytes += buf.size();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < 0.2);
+
+    sink = remainder;
+    printf("%-16s %8.1f MB/s\n", name, n_bytes / elapsed / 1e6);
+}
+
+int main(int argc, const char** argv) {
+    size_t size = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1 << 20;
+
+    std::mt19937 rng(1);
+    if (!check_equivalence(rng)) {
+        return 1;
+    }
+    printf("all implementations match the bitwise reference\n");
+
+    std::vector<uint8_t> buf(size);
+    for (auto& b: buf) {
+        b = (uint8_t)rng();
+    }
+
+    printf("%zu bytes:\n", size);
+    bench<uint8_t>("crc8 bitwise", crc_bitwise<uint8_t, kCrc8Poly>, buf);
+    bench<uint8_t>("crc8 table", crc_table<uint8_t, kCrc8Poly>, buf);
+    bench<uint16_t>("crc16 bitwise", crc_bitwise<uint16_t, kCrc16Poly>, buf);
+    bench<uint16_t>("crc16 table", crc_table<uint16_t, kCrc16Poly>, buf);
+    bench<uint16_t>("crc16 slice-by-4", crc16_sliced<4>, buf);
+    bench<uint16_t>("crc16 slice-by-8", crc16_sliced<8>, buf);
+
+    return 0;
+}
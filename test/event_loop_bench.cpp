@@ -0,0 +1,207 @@
+/**
+ * Compares the message throughput of EpollEventLoop and IoUringEventLoop on
+ * loopback TCP.
+ *
+ * Usage: event_loop_bench.elf [round trips per connection]
+ *
+ * Each connection is a loopback TCP pair with both ends driven by PosixSocket
+ * on the same event loop. One end sends 64-byte messages and waits for each
+ * to be echoed back by the other end. All connections run concurrently and the
+ * result is the total number of messages (requests and responses) per second.
+ */
+
+#include <fibre/../../platform_support/epoll_event_loop.hpp>
+#include <fibre/../../platform_support/io_uring_event_loop.hpp>
+#include <fibre/../../platform_support/posix_socket.hpp>
+#include <arpa/inet.h>
+#include <chrono>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace fibre;
+
+static constexpr size_t kMessageSize = 64;
+
+/**
+ * @brief One connection. The client sends a message, the server echoes it
+ * and the client checks it before it sends the next one.
+ */
+struct Connection {
+    PosixSocket client;
+    PosixSocket server;
+    uint8_t tx_msg[kMessageSize];
+    uint8_t client_buf[kMessageSize];
+    uint8_t server_buf[kMessageSize];
+    size_t client_received = 0;
+    size_t server_received = 0;
+    size_t n_round_trips = 0;
+    size_t n_round_trips_total = 0;
+    bool failed = false;
+
+    void start(size_t round_trips) {
+        n_round_trips_total = round_trips;
+        memset(tx_msg, 0x55, sizeof(tx_msg));
+        server.start_read({server_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_server_read));
+        send_request();
+    }
+
+    void finish(bool ok) {
+        ok = client.deinit().is_success() && ok;
+        ok = server.deinit().is_success() && ok;
+        failed = !ok;
+    }
+
+    void send_request() {
+        client_received = 0;
+        client.start_write({tx_msg, kMessageSize}, nullptr, MEMBER_CB(this, on_client_written));
+    }
+
+    void on_client_written(WriteResult0 result) {
+        if (result.status != kStreamOk || result.end != tx_msg + kMessageSize) {
+            return finish(false); // writes of this size never complete partially on loopback
+        }
+        client.start_read({client_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_client_read));
+    }
+
+    void on_client_read(ReadResult result) {
+        if (result.status != kStreamOk) {
+            return finish(false);
+        }
+        client_received = result.end - client_buf;
+        if (client_received < kMessageSize) {
+            client.start_read({result.end, client_buf + kMessageSize}, nullptr, MEMBER_CB(this, on_client_read));
+            return;
+        }
+        if (memcmp(client_buf, tx_msg, kMessageSize)) {
+            return finish(false);
+        }
+        if (++n_round_trips == n_round_trips_total) {
+            return finish(true);
+        }
+        send_request();
+    }
+
+    void on_server_read(ReadResult result) {
+        if (result.status != kStreamOk) {
+            return; // the client deinited the connection
+        }
+        server_received = result.end - server_buf;
+        if (server_received < kMessageSize) {
+            server.start_read({result.end, server_buf + kMessageSize}, nullptr, MEMBER_CB(this, on_server_read));
+            return;
+        }
+        server.start_write({server_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_server_written));
+    }
+
+    void on_server_written(WriteResult0 result) {
+        if (result.status != kStreamOk) {
+            return;
+        }
+        server.start_read({server_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_server_read));
+    }
+};
+
+static bool open_tcp_pair(int* client_fd, int* server_fd) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    bool ok = listen_fd >= 0
+           && !bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))
+           && !getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len)
+           && !listen(listen_fd, 1)
+           && (*client_fd = socket(AF_INET, SOCK_STREAM, 0)) >= 0
+           && !connect(*client_fd, (struct sockaddr*)&addr, sizeof(addr))
+           && (*server_fd = accept(listen_fd, nullptr, nullptr)) >= 0;
+    ::close(listen_fd);
+
+    if (ok) {
+        for (int fd: {*client_fd, *server_fd}) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Runs n_connections connections concurrently on a fresh event loop
+ * of type TLoop.
+ *
+ * @returns messages per second or 0 on failure.
+ */
+template<typename TLoop>
+static double run(size_t n_connections, size_t n_round_trips) {
+    TLoop loop;
+    std::vector<Connection> connections(n_connections);
+    std::chrono::steady_clock::time_point start;
+    bool setup_ok = true;
+
+    RichStatus status = loop.start(Logger::none(), [&]() {
+        for (auto& conn: connections) {
+            int client_fd, server_fd;
+            if (!open_tcp_pair(&client_fd, &server_fd)) {
+                setup_ok = false;
+                return;
+            }
+            setup_ok = setup_ok
+                    && conn.client.init(&loop, Logger::none(), client_fd).is_success()
+                    && conn.server.init(&loop, Logger::none(), server_fd).is_success();
+            ::close(client_fd);
+            ::close(server_fd);
+        }
+        if (!setup_ok) {
+            for (auto& conn: connections) {
+                conn.finish(false);
+            }
+            return;
+        }
+        start = std::chrono::steady_clock::now();
+        for (auto& conn: connections) {
+            conn.start(n_round_trips);
+        }
+    });
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = setup_ok && status.is_success();
+    for (auto& conn: connections) {
+        ok = ok && !conn.failed && conn.n_round_trips == n_round_trips;
+    }
+    return ok ? 2.0 * n_round_trips * n_connections / elapsed : 0;
+}
+
+int main(int argc, const char** argv) {
+    size_t n_round_trips = argc > 1 ? strtoul(argv[1], nullptr, 0) : 10000;
+
+    // Checks if io_uring is usable here (it can be disabled by sysctl or
+    // seccomp)
+    IoUringEventLoop probe;
+    if (probe.start(Logger::none(), nullptr).is_error()) {
+        printf("io_uring is not available\n");
+        return 1;
+    }
+
+    printf("connections     epoll [msg/s]  io_uring [msg/s]\n");
+    for (size_t n_connections: {1, 16, 64}) {
+        for (size_t rep = 0; rep < 3; ++rep) {
+            double epoll = run<EpollEventLoop>(n_connections, n_round_trips);
+            double io_uring = run<IoUringEventLoop>(n_connections, n_round_trips);
+            if (!epoll || !io_uring) {
+                printf("benchmark failed\n");
+                return 1;
+            }
+            printf("%11zu  %15.0f  %16.0f\n", n_connections, epoll, io_uring);
+        }
+    }
+
+    return 0;
+}
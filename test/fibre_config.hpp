@@ -4,11 +4,24 @@
 #define FIBRE_ENABLE_EVENT_LOOP 1
 
 #if defined(__linux__)
+#define FIBRE_ENABLE_IO_URING 1
 #define FIBRE_ENABLE_TCP_CLIENT_BACKEND 1
 #define FIBRE_ENABLE_TCP_SERVER_BACKEND 1
+#define FIBRE_ENABLE_UNIX_CLIENT_BACKEND 1
+#define FIBRE_ENABLE_UNIX_SERVER_BACKEND 1
+#define FIBRE_ENABLE_SHM_TRANSPORT 1
+#define FIBRE_ENABLE_UDP_CLIENT_BACKEND 1
+#define FIBRE_ENABLE_UDP_SERVER_BACKEND 1
 #define FIBRE_ENABLE_SOCKET_CAN_BACKEND 1
 #endif
 
 #if FIBRE_ENABLE_SOCKET_CAN_BACKEND
 #define FIBRE_ENABLE_CAN_ADAPTER 1
 #endif
+
+#if FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_TCP_SERVER_BACKEND || FIBRE_ENABLE_UNIX_CLIENT_BACKEND || FIBRE_ENABLE_UNIX_SERVER_BACKEND
+#define FIBRE_ENABLE_STREAM_ADAPTER 1
+#endif
+
+#define FIBRE_CRC_TABLE_SLICES 8
+#define FIBRE_LEGACY_PROTOCOL_BUF_SIZE 4096
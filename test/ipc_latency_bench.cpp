@@ -0,0 +1,212 @@
+/**
+ * Compares the round trip latency of Unix domain sockets (as used by the
+ * unix-client and unix-server backends) with loopback TCP (as used by the
+ * tcp-client and tcp-server backends).
+ *
+ * Usage: ipc_latency_bench.elf [round trips]
+ *
+ * Both ends of each connection are driven by PosixSocket on the same event
+ * loop. One end sends a 64-byte message and waits for the other end to echo
+ * it back before it sends the next one. The Unix pair is an AF_UNIX
+ * SOCK_SEQPACKET socket pair like the one the Unix backend opens. Each
+ * transport is measured on EpollEventLoop and, if available, on
+ * IoUringEventLoop. The program reports the mean, the 50th and 99th
+ * percentile and the maximum of the round trip times.
+ */
+
+#include <fibre/../../platform_support/epoll_event_loop.hpp>
+#include <fibre/../../platform_support/io_uring_event_loop.hpp>
+#include <fibre/../../platform_support/posix_socket.hpp>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace fibre;
+
+static constexpr size_t kMessageSize = 64;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief One connection. The client sends a message, the server echoes it
+ * and the client checks it before it sends the next one.
+ */
+struct Connection {
+    PosixSocket client;
+    PosixSocket server;
+    uint8_t tx_msg[kMessageSize];
+    uint8_t client_buf[kMessageSize];
+    uint8_t server_buf[kMessageSize];
+    size_t n_round_trips = 0;
+    uint64_t sent_ns = 0;
+    std::vector<uint64_t> rtts_ns;
+    bool failed = false;
+
+    void start(size_t round_trips) {
+        n_round_trips = round_trips;
+        rtts_ns.reserve(round_trips);
+        memset(tx_msg, 0x55, sizeof(tx_msg));
+        server.start_read({server_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_server_read));
+        send_request();
+    }
+
+    void finish(bool ok) {
+        ok = client.deinit().is_success() && ok;
+        ok = server.deinit().is_success() && ok;
+        failed = !ok;
+    }
+
+    void send_request() {
+        sent_ns = now_ns();
+        client.start_write({tx_msg, kMessageSize}, nullptr, MEMBER_CB(this, on_client_written));
+    }
+
+    void on_client_written(WriteResult0 result) {
+        if (result.status != kStreamOk || result.end != tx_msg + kMessageSize) {
+            return finish(false); // writes of this size never complete partially locally
+        }
+        client.start_read({client_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_client_read));
+    }
+
+    void on_client_read(ReadResult result) {
+        if (result.status != kStreamOk) {
+            return finish(false);
+        }
+        if (result.end < client_buf + kMessageSize) {
+            client.start_read({result.end, client_buf + kMessageSize}, nullptr, MEMBER_CB(this, on_client_read));
+            return;
+        }
+        rtts_ns.push_back(now_ns() - sent_ns);
+        if (memcmp(client_buf, tx_msg, kMessageSize)) {
+            return finish(false);
+        }
+        if (rtts_ns.size() == n_round_trips) {
+            return finish(true);
+        }
+        send_request();
+    }
+
+    void on_server_read(ReadResult result) {
+        if (result.status != kStreamOk) {
+            return; // the client deinited the connection
+        }
+        if (result.end < server_buf + kMessageSize) {
+            server.start_read({result.end, server_buf + kMessageSize}, nullptr, MEMBER_CB(this, on_server_read));
+            return;
+        }
+        server.start_write({server_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_server_written));
+    }
+
+    void on_server_written(WriteResult0 result) {
+        if (result.status != kStreamOk) {
+            return;
+        }
+        server.start_read({server_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_server_read));
+    }
+};
+
+static bool open_tcp_pair(int* client_fd, int* server_fd) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    bool ok = listen_fd >= 0
+           && !bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))
+           && !getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len)
+           && !listen(listen_fd, 1)
+           && (*client_fd = socket(AF_INET, SOCK_STREAM, 0)) >= 0
+           && !connect(*client_fd, (struct sockaddr*)&addr, sizeof(addr))
+           && (*server_fd = accept(listen_fd, nullptr, nullptr)) >= 0;
+    ::close(listen_fd);
+
+    if (ok) {
+        for (int fd: {*client_fd, *server_fd}) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+        }
+    }
+    return ok;
+}
+
+static bool open_unix_pair(int* client_fd, int* server_fd) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds)) {
+        return false;
+    }
+    *client_fd = fds[0];
+    *server_fd = fds[1];
+    return true;
+}
+
+template<typename TLoop>
+static bool run(const char* name, bool (*open_pair)(int*, int*), size_t n_round_trips) {
+    TLoop loop;
+    Connection conn;
+    bool setup_ok = true;
+
+    RichStatus status = loop.start(Logger::none(), [&]() {
+        int client_fd, server_fd;
+        if (!open_pair(&client_fd, &server_fd)) {
+            setup_ok = false;
+            return;
+        }
+        setup_ok = conn.client.init(&loop, Logger::none(), client_fd).is_success()
+                && conn.server.init(&loop, Logger::none(), server_fd).is_success();
+        ::close(client_fd);
+        ::close(server_fd);
+        if (!setup_ok) {
+            return conn.finish(false);
+        }
+        conn.start(n_round_trips);
+    });
+
+    std::vector<uint64_t>& rtts = conn.rtts_ns;
+    if (!setup_ok || status.is_error() || conn.failed || rtts.size() != n_round_trips) {
+        printf("%-24s failed\n", name);
+        return false;
+    }
+
+    uint64_t sum = 0;
+    for (uint64_t rtt: rtts) {
+        sum += rtt;
+    }
+    std::sort(rtts.begin(), rtts.end());
+    auto percentile = [&](double p) {
+        return rtts[std::min(rtts.size() - 1, (size_t)(p * rtts.size()))] / 1e3;
+    };
+    printf("%-24s %8.1f %8.1f %8.1f %8.1f\n", name, sum / 1e3 / rtts.size(),
+           percentile(0.5), percentile(0.99), rtts.back() / 1e3);
+    return true;
+}
+
+int main(int argc, const char** argv) {
+    size_t n_round_trips = argc > 1 ? strtoul(argv[1], nullptr, 0) : 50000;
+
+    // Checks if io_uring is usable here (it can be disabled by sysctl or
+    // seccomp)
+    IoUringEventLoop probe;
+    bool have_io_uring = probe.start(Logger::none(), nullptr).is_success();
+
+    printf("round trip [us]              mean      p50      p99      max\n");
+    bool ok = run<EpollEventLoop>("TCP loopback, epoll", open_tcp_pair, n_round_trips);
+    ok = run<EpollEventLoop>("Unix seqpacket, epoll", open_unix_pair, n_round_trips) && ok;
+    if (have_io_uring) {
+        ok = run<IoUringEventLoop>("TCP loopback, io_uring", open_tcp_pair, n_round_trips) && ok;
+        ok = run<IoUringEventLoop>("Unix seqpacket, io_uring", open_unix_pair, n_round_trips) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/**
+ * Measures how fast the legacy client parses and walks a large interface
+ * descriptor.
+ *
+ * Usage: json_bench.elf [size in bytes] [output file]
+ *
+ * The descriptor is generated with the same structure as the JSON that
+ * LegacyObjectServer serves on endpoint 0: nested objects with properties
+ * and functions. If an output file is given, the generated JSON is written
+ * to it as well.
+ */
+
+#include <fibre/../../json.hpp>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+static void gen_object(std::string& json, size_t depth, int& id) {
+    json += "[";
+    for (size_t i = 0; i < 12; ++i) {
+        if (i) {
+            json += ",";
+        }
+        std::string idx = std::to_string(i);
+        if (depth && i < 3) {
+            json += "{\"name\":\"obj" + idx + "\",\"type\":\"object\",\"members\":";
+            gen_object(json, depth - 1, id);
+            json += "}";
+        } else if (i % 4 == 1) {
+            std::string ids[4];
+            for (auto& str: ids) {
+                str = std::to_string(id++);
+            }
+            json += "{\"name\":\"func" + idx + "\",\"id\":" + ids[0]
+                  + ",\"type\":\"function\",\"inputs\":[{\"name\":\"obj\",\"id\":" + ids[1]
+                  + ",\"type\":\"object_ref\"},{\"name\":\"arg\",\"id\":" + ids[2]
+                  + ",\"type\":\"float\"}],\"outputs\":[{\"name\":\"result\",\"id\":" + ids[3]
+                  + ",\"type\":\"uint32\"}]}";
+        } else {
+            json += "{\"name\":\"prop" + idx + "\",\"id\":" + std::to_string(id++)
+                  + ",\"type\":\"uint32\",\"access\":\"rw\"}";
+        }
+    }
+    json += "]";
+}
+
+/**
+ * @brief Generates a descriptor of at least `size` bytes by adding top level
+ * subtrees until the size is reached.
+ */
+static std::string gen_descriptor(size_t size) {
+    std::string json = "[";
+    int id = 1;
+    for (size_t i = 0; json.size() < size; ++i) {
+        if (i) {
+            json += ",";
+        }
+        json += "{\"name\":\"axis" + std::to_string(i) + "\",\"type\":\"object\",\"members\":";
+        gen_object(json, 4, id);
+        json += "}";
+    }
+    return json + "]";
+}
+
+// Visits the document the same way LegacyObjectClient::load_object() does.
+static size_t walk(const json_value* list_val) {
+    size_t n_members = 0;
+    for (const json_value* item = json_first(list_val); item; item = item->next) {
+        std::string name = json_as_str(json_dict_find(item, "name"));
+        const json_value* type = json_dict_find(item, "type");
+        n_members++;
+
+        if (json_str_equals(type, "object")) {
+            n_members += walk(json_dict_find(item, "members"));
+        } else if (json_str_equals(type, "function")) {
+            for (const char* key: {"inputs", "outputs"}) {
+                for (const json_value* arg = json_first(json_dict_find(item, key)); arg; arg = arg->next) {
+                    std::string arg_name = json_as_str(json_dict_find(arg, "name"));
+                    n_members += json_is_int(json_dict_find(arg, "id"))
+                              && json_is_str(json_dict_find(arg, "type"));
+                }
+            }
+        } else {
+            n_members += json_is_int(json_dict_find(item, "id"))
+                      && json_is_str(json_dict_find(item, "access"));
+        }
+    }
+    return n_members;
+}
+
+int main(int argc, const char** argv) {
+    size_t size = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000000;
+    std::string json = gen_descriptor(size);
+
+    if (argc > 2) {
+        FILE* file = fopen(argv[2], "wb");
+        if (!file || fwrite(json.data(), 1, json.size(), file) != json.size()) {
+            printf("failed to write %s\n", argv[2]);
+            return 1;
+        }
+        fclose(file);
+    }
+
+    double parse_s = 0, walk_s = 0;
+    size_t n_runs = 0, n_nodes = 0, n_members = 0;
+
+    while (parse_s + walk_s < 1.0 || n_runs < 5) {
+        const char* begin = json.data();
+        json_arena arena;
+        json_error error;
+
+        auto t0 = std::chrono::steady_clock::now();
+        const json_value* root = json_parse(&begin, json.data() + json.size(), &arena, &error);
+        auto t1 = std::chrono::steady_clock::now();
+
+        if (!root) {
+            printf("parse error at offset %zu: %s\n", (size_t)(error.ptr - json.data()), error.str);
+            return 1;
+        }
+
+        n_members = walk(root);
+        auto t2 = std::chrono::steady_clock::now();
+
+        parse_s += std::chrono::duration<double>(t1 - t0).count();
+        walk_s += std::chrono::duration<double>(t2 - t1).count();
+        n_nodes = arena.size();
+        n_runs++;
+    }
+
+    printf("descriptor: %zu bytes, %zu nodes, %zu members\n", json.size(), n_nodes, n_members);
+    printf("parse: %7.2f ms (%.0f MB/s)\n", parse_s / n_runs * 1e3, json.size() * n_runs / parse_s / 1e6);
+    printf("walk:  %7.2f ms\n", walk_s / n_runs * 1e3);
+    return 0;
+}
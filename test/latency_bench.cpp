@@ -0,0 +1,186 @@
+/**
+ * Ping-pong latency benchmark for the event loop with and without busy
+ * polling.
+ *
+ * Usage: latency_bench.elf [round trips] [spin_us] [cpu]
+ *
+ * A PosixSocket on the event loop sends 64-byte messages over loopback TCP to
+ * an echo thread that uses blocking reads and writes, and waits for each echo
+ * before it sends the next message. The program reports the 50th, 99th and
+ * 99.9th percentile and the maximum of the round trip times once with a
+ * blocking event loop and once with BusyPollConfig::spin_us set to `spin_us`
+ * (default 50). If `cpu` is given, the busy polling event loop is pinned to
+ * that CPU.
+ *
+ * Spinning only pays off if the event loop thread doesn't compete with the
+ * echo thread for the same CPU.
+ */
+
+#include <fibre/../../platform_support/epoll_event_loop.hpp>
+#include <fibre/../../platform_support/posix_socket.hpp>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace fibre;
+
+static constexpr size_t kMessageSize = 64;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Event loop side of the ping-pong.
+ */
+struct Pinger {
+    PosixSocket socket;
+    uint8_t tx_msg[kMessageSize];
+    uint8_t rx_buf[kMessageSize];
+    size_t n_round_trips = 0;
+    uint64_t sent_ns = 0;
+    std::vector<uint64_t> rtts_ns;
+    bool failed = false;
+
+    void start(EventLoop* event_loop, int fd, size_t round_trips) {
+        n_round_trips = round_trips;
+        rtts_ns.reserve(round_trips);
+        memset(tx_msg, 0x55, sizeof(tx_msg));
+        if (socket.init(event_loop, Logger::none(), fd).is_error()) {
+            failed = true;
+            return;
+        }
+        send();
+    }
+
+    void finish(bool ok) {
+        failed = socket.deinit().is_error() || !ok;
+    }
+
+    void send() {
+        sent_ns = now_ns();
+        socket.start_read({rx_buf, kMessageSize}, nullptr, MEMBER_CB(this, on_read));
+        socket.start_write({tx_msg, kMessageSize}, nullptr, MEMBER_CB(this, on_written));
+    }
+
+    void on_written(WriteResult0 result) {
+        if (result.status != kStreamOk || result.end != tx_msg + kMessageSize) {
+            finish(false); // writes of this size never complete partially on loopback
+        }
+    }
+
+    void on_read(ReadResult result) {
+        if (result.status != kStreamOk) {
+            return finish(false);
+        }
+        if (result.end < rx_buf + kMessageSize) {
+            socket.start_read({result.end, rx_buf + kMessageSize}, nullptr, MEMBER_CB(this, on_read));
+            return;
+        }
+        rtts_ns.push_back(now_ns() - sent_ns);
+        if (memcmp(rx_buf, tx_msg, kMessageSize)) {
+            return finish(false);
+        }
+        if (rtts_ns.size() == n_round_trips) {
+            return finish(true);
+        }
+        send();
+    }
+};
+
+static bool open_tcp_pair(int* client_fd, int* server_fd) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    bool ok = listen_fd >= 0
+           && !bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))
+           && !getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len)
+           && !listen(listen_fd, 1)
+           && (*client_fd = socket(AF_INET, SOCK_STREAM, 0)) >= 0
+           && !connect(*client_fd, (struct sockaddr*)&addr, sizeof(addr))
+           && (*server_fd = accept(listen_fd, nullptr, nullptr)) >= 0;
+    ::close(listen_fd);
+
+    if (ok) {
+        for (int fd: {*client_fd, *server_fd}) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        fcntl(*client_fd, F_SETFL, O_NONBLOCK);
+    }
+    return ok;
+}
+
+static void echo(int fd) {
+    uint8_t buf[kMessageSize];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (write(fd, buf, n) != n) {
+            break;
+        }
+    }
+}
+
+static bool run(const char* name, const BusyPollConfig& busy_poll, size_t n_round_trips) {
+    int client_fd, server_fd;
+    if (!open_tcp_pair(&client_fd, &server_fd)) {
+        printf("%-16s failed to open sockets\n", name);
+        return false;
+    }
+
+    std::thread echo_thread(echo, server_fd);
+    Pinger pinger;
+    EpollEventLoop loop;
+
+    RichStatus status = loop.set_busy_poll(busy_poll);
+    if (status.is_success()) {
+        status = loop.start(Logger::none(), [&]() {
+            pinger.start(&loop, client_fd, n_round_trips);
+        });
+    }
+
+    ::close(client_fd);
+    shutdown(server_fd, SHUT_RDWR); // ends the echo thread
+    echo_thread.join();
+    ::close(server_fd);
+
+    std::vector<uint64_t>& rtts = pinger.rtts_ns;
+    if (status.is_error() || pinger.failed || rtts.size() != n_round_trips) {
+        printf("%-16s failed\n", name);
+        return false;
+    }
+
+    std::sort(rtts.begin(), rtts.end());
+    auto percentile = [&](double p) {
+        return rtts[std::min(rtts.size() - 1, (size_t)(p * rtts.size()))] / 1e3;
+    };
+    printf("%-16s %8.1f %8.1f %8.1f %8.1f\n", name,
+           percentile(0.5), percentile(0.99), percentile(0.999), rtts.back() / 1e3);
+    return true;
+}
+
+int main(int argc, const char** argv) {
+    size_t n_round_trips = argc > 1 ? strtoul(argv[1], nullptr, 0) : 50000;
+
+    BusyPollConfig busy_poll;
+    busy_poll.spin_us = argc > 2 ? strtoul(argv[2], nullptr, 0) : 50;
+    busy_poll.cpu = argc > 3 ? atoi(argv[3]) : -1;
+
+    printf("round trip [us]       p50      p99    p99.9      max\n");
+    bool ok = run("blocking", BusyPollConfig{}, n_round_trips);
+    ok = run("busy-poll", busy_poll, n_round_trips) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+/**
+ * Checks libfibre calls that a callback on one shard makes for another shard
+ * of a context that was opened with libfibre_open_sharded().
+ *
+ * Usage: libfibre_shard_test.elf [test node] [port]
+ *
+ * Build with -fsanitize=address to check for invalid memory accesses. Run it
+ * with ASAN_OPTIONS=detect_leaks=0 because the connections of the legacy
+ * protocol are never freed.
+ *
+ * The program starts the test node (default: test_node.elf next to this
+ * program) as a TCP server and opens a context with two shards. Domain A goes
+ * to shard 0 and domain B to shard 1 and both discover the test node. From the
+ * discovery callback of domain A (on shard 0) the program stops the discovery
+ * of domain B (owned by shard 1) and opens and closes another domain, which
+ * must land on shard 0.
+ *
+ * Exits with a non-zero status if any of this fails.
+ */
+
+#include <fibre/libfibre.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+struct Test {
+    LibFibreCtx* ctx = nullptr;
+    std::string client_specs;
+    LibFibreDomain* domain_a = nullptr;
+    LibFibreDomain* domain_b = nullptr;
+    LibFibreDiscoveryCtx* discovery_a = nullptr;
+    LibFibreDiscoveryCtx* discovery_b = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    bool opened_domain = false;
+};
+
+static void on_found_a(void* ctx, LibFibreObject* obj, LibFibreInterface* intf, const char* path, size_t path_length) {
+    Test* test = static_cast<Test*>(ctx);
+    std::unique_lock<std::mutex> lock(test->mutex);
+    if (test->done) {
+        return;
+    }
+
+    // Owned by shard 1 so this is processed asynchronously
+    libfibre_stop_discovery(test->discovery_b);
+    test->discovery_b = nullptr;
+
+    // Must open the domain on this shard rather than fail
+    LibFibreDomain* domain = libfibre_open_domain(test->ctx, test->client_specs.data(), test->client_specs.size());
+    test->opened_domain = domain;
+    if (domain) {
+        libfibre_close_domain(domain);
+    }
+
+    test->done = true;
+    test->cv.notify_all();
+}
+
+static void on_found_b(void* ctx, LibFibreObject* obj, LibFibreInterface* intf, const char* path, size_t path_length) {}
+static void on_lost(void* ctx, LibFibreObject* obj) {}
+static void on_stopped(void* ctx, LibFibreStatus status) {}
+
+static void run_tasks(LibFibreCtx* ctx, LibFibreTask* tasks, size_t n_tasks, LibFibreTask** out_tasks, size_t* n_out_tasks) {
+    // The test starts no calls
+    *out_tasks = nullptr;
+    *n_out_tasks = 0;
+}
+
+static pid_t start_server(const std::string& node, const std::string& specs) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(node.c_str(), node.c_str(), "--server", "--domain", specs.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+int main(int argc, const char** argv) {
+    std::string argv0 = argv[0];
+    std::string node = argc > 1 ? argv[1] : argv0.substr(0, argv0.rfind('/') + 1) + "test_node.elf";
+    std::string port = argc > 2 ? argv[2] : "14240";
+
+    pid_t server = start_server(node, "tcp-server:address=127.0.0.1,port=" + port);
+    if (server < 0) {
+        printf("failed to start %s\n", node.c_str());
+        return 1;
+    }
+
+    Test test;
+    test.client_specs = "tcp-client:address=127.0.0.1,port=" + port;
+
+    bool ok = false;
+    test.ctx = libfibre_open_sharded(2, run_tasks, {0, nullptr, nullptr});
+    if (test.ctx) {
+        // Domains are distributed round-robin
+        test.domain_a = libfibre_open_domain(test.ctx, test.client_specs.data(), test.client_specs.size());
+        test.domain_b = libfibre_open_domain(test.ctx, test.client_specs.data(), test.client_specs.size());
+    }
+
+    if (test.domain_a && test.domain_b) {
+        libfibre_start_discovery(test.domain_b, &test.discovery_b, on_found_b, on_lost, on_stopped, &test);
+        libfibre_start_discovery(test.domain_a, &test.discovery_a, on_found_a, on_lost, on_stopped, &test);
+
+        LibFibreDiscoveryCtx* discovery_b;
+        {
+            std::unique_lock<std::mutex> lock(test.mutex);
+            test.cv.wait_for(lock, std::chrono::seconds(10), [&]() { return test.done; });
+            ok = test.done && test.opened_domain;
+            test.done = true; // in case of a timeout
+            discovery_b = test.discovery_b;
+        }
+
+        libfibre_stop_discovery(test.discovery_a);
+        if (discovery_b) {
+            libfibre_stop_discovery(discovery_b);
+        }
+    }
+
+    if (test.domain_a) {
+        libfibre_close_domain(test.domain_a);
+    }
+    if (test.domain_b) {
+        libfibre_close_domain(test.domain_b);
+    }
+    if (test.ctx) {
+        libfibre_close(test.ctx);
+    }
+
+    kill(server, SIGINT);
+    waitpid(server, nullptr, 0);
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+/**
+ * Multi-threaded stress test and benchmark for MpscQueue and for
+ * EventLoop::post(), which is built on it.
+ *
+ * Usage: mpsc_stress.elf [items per producer]
+ *
+ * For 1, 2, 4 and 8 producer threads, each producer pushes (or posts) a
+ * numbered sequence of items while a single consumer checks that all items
+ * arrive exactly once and in per-producer FIFO order. Pushes that find the
+ * queue full are retried.
+ *
+ * Exits with a non-zero status if any item is lost, duplicated or reordered.
+ */
+
+#include <fibre/../../mpsc_queue.hpp>
+#include <fibre/../../platform_support/epoll_event_loop.hpp>
+#include <fibre/../../platform_support/io_uring_event_loop.hpp>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace fibre;
+
+static constexpr size_t kMaxProducers = 8;
+
+// Items carry the producer index in the upper bits and the sequence number
+// in the lower bits.
+static constexpr unsigned kSeqBits = 48;
+
+static uintptr_t make_item(size_t producer, uint64_t seq) {
+    return ((uintptr_t)producer << kSeqBits) | (uintptr_t)seq;
+}
+
+/**
+ * @brief Consumer side bookkeeping shared by both tests.
+ */
+struct OrderChecker {
+    uint64_t next_seq[kMaxProducers] = {};
+    size_t n_received = 0;
+    size_t n_errors = 0;
+
+    void on_item(uintptr_t item) {
+        size_t producer = item >> kSeqBits;
+        uint64_t seq = item & (((uintptr_t)1 << kSeqBits) - 1);
+        if (producer >= kMaxProducers || seq != next_seq[producer]) {
+            n_errors++;
+        } else {
+            next_seq[producer]++;
+        }
+        n_received++;
+    }
+};
+
+struct Result {
+    double items_per_s;
+    size_t n_full; // number of pushes that found the queue full
+    bool ok;
+};
+
+static Result run_queue(size_t n_producers, size_t n_items) {
+    MpscQueue<uintptr_t, 4096>* queue = new MpscQueue<uintptr_t, 4096>();
+    std::atomic<size_t> n_full{0};
+    std::vector<std::thread> producers;
+    OrderChecker checker;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t p = 0; p < n_producers; ++p) {
+        producers.emplace_back([&, p]() {
+            size_t full = 0;
+            for (uint64_t seq = 0; seq < n_items; ++seq) {
+                while (!queue->push(make_item(p, seq))) {
+                    full++;
+                    std::this_thread::yield();
+                }
+            }
+            n_full += full;
+        });
+    }
+
+    size_t n_total = n_producers * n_items;
+    while (checker.n_received < n_total) {
+        uintptr_t item;
+        if (queue->pop(&item)) {
+            checker.on_item(item);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto& thread: producers) {
+        thread.join();
+    }
+
+    bool ok = !checker.n_errors && queue->empty();
+    delete queue;
+    return {n_total / elapsed, n_full, ok};
+}
+
+/**
+ * @brief Posts callbacks from producer threads to an event loop that runs on
+ * the calling thread.
+ */
+template<typename TLoop>
+struct PostTest {
+    TLoop loop;
+    Timer* keepalive = nullptr;
+    OrderChecker checker;
+    std::vector<std::thread> producers;
+    std::atomic<size_t> n_full{0};
+    size_t n_producers;
+    size_t n_items;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+
+    // The callback context is the item itself so that posting allocates
+    // nothing. The test instance is found through a static pointer instead.
+    static void on_item(void* ctx);
+    static PostTest* instance;
+
+    void on_keepalive() {}
+
+    void on_started() {
+        // The loop returns once nothing is registered on it anymore, so the
+        // timer keeps it running until all items arrived.
+        if (loop.open_timer(&keepalive, MEMBER_CB(this, on_keepalive)).is_error()) {
+            return;
+        }
+        start = std::chrono::steady_clock::now();
+        for (size_t p = 0; p < n_producers; ++p) {
+            producers.emplace_back([this, p]() {
+                size_t full = 0;
+                for (uint64_t seq = 0; seq < n_items; ++seq) {
+                    while (loop.post({on_item, reinterpret_cast<void*>(make_item(p, seq))}).is_error()) {
+                        full++;
+                        std::this_thread::yield();
+                    }
+                }
+                n_full += full;
+            });
+        }
+    }
+
+    Result run() {
+        instance = this;
+        RichStatus status = loop.start(Logger::none(), MEMBER_CB(this, on_started));
+        for (auto& thread: producers) {
+            thread.join();
+        }
+        double elapsed = std::chrono::duration<double>(end - start).count();
+        bool ok = status.is_success() && !checker.n_errors
+               && checker.n_received == n_producers * n_items;
+        return {n_producers * n_items / elapsed, n_full, ok};
+    }
+};
+
+template<typename TLoop>
+PostTest<TLoop>* PostTest<TLoop>::instance = nullptr;
+
+template<typename TLoop>
+void PostTest<TLoop>::on_item(void* ctx) {
+    PostTest* self = instance;
+    self->checker.on_item(reinterpret_cast<uintptr_t>(ctx));
+    if (self->checker.n_received == self->n_producers * self->n_items) {
+        self->end = std::chrono::steady_clock::now();
+        if (self->loop.close_timer(self->keepalive).is_error()) {
+            self->checker.n_errors++;
+        }
+    }
+}
+
+template<typename TLoop>
+static Result run_post(size_t n_producers, size_t n_items) {
+    PostTest<TLoop>* test = new PostTest<TLoop>();
+    test->n_producers = n_producers;
+    test->n_items = n_items;
+    Result result = test->run();
+    delete test;
+    return result;
+}
+
+static bool report(const char* name, size_t n_producers, Result result) {
+    printf("%-18s %7zu  %10.2f M/s  %10zu  %s\n", name, n_producers,
+           result.items_per_s / 1e6, result.n_full, result.ok ? "ok" : "FAILED");
+    return result.ok;
+}
+
+int main(int argc, const char** argv) {
+    size_t n_items = argc > 1 ? strtoul(argv[1], nullptr, 0) : 500000;
+    bool ok = true;
+
+    IoUringEventLoop probe;
+    bool have_io_uring = probe.start(Logger::none(), nullptr).is_success();
+
+    printf("test               threads  throughput      queue full  result\n");
+    for (size_t n_producers: {1, 2, 4, 8}) {
+        ok = report("MpscQueue", n_producers, run_queue(n_producers, n_items)) && ok;
+        ok = report("epoll post()", n_producers, run_post<EpollEventLoop>(n_producers, n_items)) && ok;
+        if (have_io_uring) {
+            ok = report("io_uring post()", n_producers, run_post<IoUringEventLoop>(n_producers, n_items)) && ok;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+/**
+ * Regression check for a use-after-free in ShmChannel when the owner of the
+ * channel deletes it from a read completion.
+ *
+ * Usage: shm_bad_handshake.elf
+ *
+ * Build with -fsanitize=address to check for invalid memory accesses.
+ *
+ * The server side mimics a UnixConnection with a StreamAdapter on a shared
+ * memory channel: It keeps a read pending and writes packets for as long as
+ * the ring has space. Once it reads a handshake with the wrong version it
+ * cancels its write, deinits the channel and deletes itself, which is what
+ * happens when the StreamAdapter rejects an incompatible peer. The client
+ * plays the peer: It sends a valid handshake, reads a number of packets and
+ * then sends a handshake with the wrong version.
+ *
+ * The test runs on EpollEventLoop and, if available, on IoUringEventLoop.
+ * Exits with a non-zero status if the exchange doesn't go as expected.
+ */
+
+#include <fibre/../../platform_support/epoll_event_loop.hpp>
+#include <fibre/../../platform_support/io_uring_event_loop.hpp>
+#include <fibre/../../platform_support/shm_channel.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace fibre;
+
+// Same layout as StreamAdapter's handshake
+static constexpr uint8_t kHandshake = 0x00;
+static constexpr uint8_t kVersion = 1;
+static constexpr size_t kHandshakeSize = 2 + 16;
+
+// More than fit into the ring so the server's write is pending most of the
+// time
+static constexpr size_t kPacketsBeforeBadHandshake = 64;
+
+struct Results {
+    size_t n_good_handshakes = 0;
+    bool server_deleted = false;
+    bool client_closed = false;
+    bool failed = false;
+};
+
+/**
+ * @brief Server side that deletes itself once it read an incompatible
+ * handshake.
+ */
+struct Server {
+    ShmChannel shm;
+    Results* results;
+    uint8_t rx_buf[ShmChannel::kMaxPacketSize];
+    uint8_t tx_buf[ShmChannel::kMaxPacketSize] = {};
+    TransferHandle tx_handle;
+    bool tx_busy = false;
+    bool in_send_loop = false;
+
+    void start() {
+        shm.start_read({rx_buf, sizeof(rx_buf)}, nullptr, MEMBER_CB(this, on_read));
+        send_loop();
+    }
+
+    void send_loop() {
+        in_send_loop = true;
+        while (!tx_busy) {
+            tx_busy = true;
+            shm.start_write({tx_buf, sizeof(tx_buf)}, &tx_handle, MEMBER_CB(this, on_written));
+        }
+        in_send_loop = false;
+    }
+
+    void on_written(WriteResult0 result) {
+        tx_busy = false;
+        if (result.status != kStreamOk) {
+            return; // cancelled by close()
+        }
+        if (!in_send_loop) {
+            send_loop();
+        }
+    }
+
+    void on_read(ReadResult result) {
+        if (result.status != kStreamOk) {
+            results->failed = true; // the client never closes first
+            return;
+        }
+        size_t length = result.end - rx_buf;
+        if (length < kHandshakeSize || rx_buf[0] != kHandshake) {
+            results->failed = true;
+        } else if (rx_buf[1] != kVersion) {
+            return close();
+        } else {
+            results->n_good_handshakes++;
+        }
+        shm.start_read({rx_buf, sizeof(rx_buf)}, nullptr, MEMBER_CB(this, on_read));
+    }
+
+    void close() {
+        if (tx_busy) {
+            shm.cancel_write(tx_handle);
+        }
+        if (shm.deinit().is_error()) {
+            results->failed = true;
+        }
+        results->server_deleted = true;
+        delete this;
+    }
+};
+
+/**
+ * @brief Client side that reads the server's packets and eventually sends a
+ * bad handshake.
+ */
+struct Client {
+    ShmChannel shm;
+    Results* results;
+    uint8_t rx_buf[ShmChannel::kMaxPacketSize];
+    uint8_t good_handshake[kHandshakeSize] = {kHandshake, kVersion};
+    uint8_t bad_handshake[kHandshakeSize] = {kHandshake, kVersion + 1};
+    size_t n_received = 0;
+
+    void start() {
+        shm.start_write({good_handshake, sizeof(good_handshake)}, nullptr, MEMBER_CB(this, on_written));
+        shm.start_read({rx_buf, sizeof(rx_buf)}, nullptr, MEMBER_CB(this, on_read));
+    }
+
+    void on_written(WriteResult0 result) {
+        if (result.status != kStreamOk) {
+            results->failed = true;
+        }
+    }
+
+    void on_read(ReadResult result) {
+        if (result.status != kStreamOk) {
+            // The server closed the control socket
+            results->client_closed = true;
+            if (shm.deinit().is_error()) {
+                results->failed = true;
+            }
+            return;
+        }
+        if (++n_received == kPacketsBeforeBadHandshake) {
+            shm.start_write({bad_handshake, sizeof(bad_handshake)}, nullptr, MEMBER_CB(this, on_written));
+        }
+        shm.start_read({rx_buf, sizeof(rx_buf)}, nullptr, MEMBER_CB(this, on_read));
+    }
+};
+
+template<typename TLoop>
+static bool run(const char* name) {
+    TLoop loop;
+    Results results;
+    Client client;
+    client.results = &results;
+
+    RichStatus status = loop.start(Logger::none(), [&]() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds)) {
+            results.failed = true;
+            return;
+        }
+
+        Server* server = new Server(); // deletes itself
+        server->results = &results;
+        bool ok = server->shm.init(&loop, Logger::none(), fds[0], true, 0).is_success();
+        ok = ok && client.shm.init(&loop, Logger::none(), fds[1], false, 0).is_success();
+        ::close(fds[0]);
+        ::close(fds[1]);
+
+        if (!ok) {
+            results.failed = true;
+            return; // the loop keeps running if one of them registered, which shows as a hang
+        }
+
+        server->start();
+        client.start();
+    });
+
+    bool ok = status.is_success() && !results.failed && results.n_good_handshakes == 1
+           && results.server_deleted && results.client_closed;
+    printf("%-10s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, const char** argv) {
+    // Checks if io_uring is usable here (it can be disabled by sysctl or
+    // seccomp)
+    IoUringEventLoop probe;
+    bool have_io_uring = probe.start(Logger::none(), nullptr).is_success();
+
+    bool ok = run<EpollEventLoop>("epoll");
+    if (have_io_uring) {
+        ok = run<IoUringEventLoop>("io_uring") && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""
+Measures how long the test node takes to discover the root object over the
+UDP backend when datagrams get lost.
+
+Usage: udp_loss_bench.py [--node build/test_node.elf] [--loss 0,0.01,...]
+                         [--seeds 6] [--port 14230]
+
+For each loss rate and seed, this starts a test node with udp-server and a
+test node with udp-client. The client talks to the server through a proxy
+that drops each datagram in either direction with the given probability.
+The script reports the time from the client's start until it discovered the
+root object, and the number of resyncs on both sides (see UdpAdapter).
+
+Exits with a non-zero status if any run fails to discover the object or
+reports corrupted data.
+"""
+
+import argparse, os, random, select, socket, subprocess, sys, threading, time
+
+script_dir = os.path.dirname(os.path.realpath(__file__))
+
+
+class LossyProxy(threading.Thread):
+    """
+    Forwards datagrams between one client (talking to listen_port) and the
+    server on target_port and drops each one with probability `loss`.
+    """
+    def __init__(self, listen_port, target_port, loss, seed):
+        super().__init__(daemon=True)
+        self.front = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.front.bind(('127.0.0.1', listen_port))
+        self.back = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.back.bind(('127.0.0.1', 0))
+        self.target = ('127.0.0.1', target_port)
+        self.loss = loss
+        self.rng = random.Random(seed)
+        self.stopping = False
+
+    def run(self):
+        client = None
+        while not self.stopping:
+            readable, _, _ = select.select([self.front, self.back], [], [], 0.1)
+            for sock in readable:
+                data, addr = sock.recvfrom(65536)
+                if self.rng.random() < self.loss:
+                    continue
+                if sock is self.front:
+                    client = addr
+                    self.back.sendto(data, self.target)
+                elif client:
+                    self.front.sendto(data, client)
+
+    def stop(self):
+        self.stopping = True
+        self.join()
+        self.front.close()
+        self.back.close()
+
+
+class NodeOutput(threading.Thread):
+    """
+    Reads the log of a test node and watches for the lines of interest.
+    """
+    def __init__(self, process):
+        super().__init__(daemon=True)
+        self.process = process
+        self.discovered = threading.Event()
+        self.n_resyncs = 0
+        self.corrupt = False
+
+    def run(self):
+        for line in self.process.stdout:
+            if 'discovered Object' in line:
+                self.discovered.set()
+            elif 'lost data from' in line:
+                self.n_resyncs += 1
+            elif 'JSON parsing error' in line:
+                self.corrupt = True
+
+
+def start_node(node, args):
+    env = dict(os.environ, FIBRE_LOG='5')
+    process = subprocess.Popen([node] + args, env=env, stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT, text=True, errors='replace')
+    output = NodeOutput(process)
+    output.start()
+    return process, output
+
+
+def stop_node(process, output):
+    process.terminate()
+    try:
+        process.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        process.kill()
+        process.wait()
+    output.join()
+
+
+def run(node, port, loss, seed, timeout):
+    """
+    Returns the time to discovery in seconds (or None on failure) and the
+    number of resyncs on the client and on the server.
+    """
+    server = start_node(node, ['--server', '--domain', 'udp-server:address=127.0.0.1,port={}'.format(port)])
+    proxy = LossyProxy(port + 1, port, loss, seed)
+    proxy.start()
+    time.sleep(0.5) # gives the server time to open its socket
+
+    start = time.monotonic()
+    client = start_node(node, ['--client', '--domain', 'udp-client:address=127.0.0.1,port={}'.format(port + 1)])
+    discovered = client[1].discovered.wait(timeout)
+    elapsed = time.monotonic() - start
+
+    stop_node(*client)
+    stop_node(*server)
+    proxy.stop()
+
+    ok = discovered and not client[1].corrupt and not server[1].corrupt
+    return (elapsed if ok else None), client[1].n_resyncs, server[1].n_resyncs
+
+
+def main():
+    parser = argparse.ArgumentParser(description='UDP backend loss benchmark')
+    parser.add_argument('--node', default=os.path.join(script_dir, 'build', 'test_node.elf'),
+                        help='test node executable')
+    parser.add_argument('--loss', default='0,0.01,0.05,0.1,0.2',
+                        help='comma separated loss rates')
+    parser.add_argument('--seeds', type=int, default=6, help='runs per loss rate')
+    parser.add_argument('--port', type=int, default=14230,
+                        help='server port (the proxy listens on the next one)')
+    parser.add_argument('--timeout', type=float, default=20, help='timeout per run in seconds')
+    args = parser.parse_args()
+
+    ok = True
+    print('loss    discovery [ms] min / median / max    resyncs (client, server)')
+    for loss in [float(l) for l in args.loss.split(',')]:
+        times = []
+        n_resyncs = [0, 0]
+        for seed in range(1, args.seeds + 1):
+            elapsed, client_resyncs, server_resyncs = run(args.node, args.port, loss, seed, args.timeout)
+            if elapsed is None:
+                print('{:4.0f}%  seed {} failed'.format(loss * 100, seed))
+                ok = False
+                continue
+            times.append(elapsed * 1000)
+            n_resyncs[0] += client_resyncs
+            n_resyncs[1] += server_resyncs
+        if times:
+            times.sort()
+            print('{:4.0f}%  {:8.0f} / {:6.0f} / {:6.0f}            {}, {}'.format(
+                loss * 100, times[0], times[len(times) // 2], times[-1], *n_resyncs))
+
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
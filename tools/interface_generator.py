@@ -795,8 +795,16 @@ def export_obj(obj, intf_stack):
                 'inputs': [],
                 'outputs': []
             }
+            # The trigger endpoint carries the precomputed span of the function
+            # (all of its input and output endpoints) so that the server can
+            # dispatch any endpoint of the function in constant time.
+            in_sizes = [legacy_sizes[map_to_fibre01_type(arg.type)] for arg in list(func['in'].values())[1:]]
+            out_sizes = [legacy_sizes[map_to_fibre01_type(arg.type)] for arg in func['out'].values()]
+            trigger_id = len(endpoint_table)
             endpoint_table.append(
-                '{.type = EndpointType::kFunctionTrigger, .function_trigger = {.function_id = ' + str(func['id']) + ', .object_id = ' + str(obj['id']) + '}}'
+                '{.type = EndpointType::kFunctionTrigger, .function_trigger = {.function_id = ' + str(func['id']) + ', .object_id = ' + str(obj['id'])
+                + ', .n_inputs = ' + str(len(in_sizes)) + ', .n_outputs = ' + str(len(out_sizes))
+                + ', .input_size = ' + str(sum(in_sizes)) + ', .output_size = ' + str(sum(out_sizes)) + '}}'
             )
             for i, (k_arg, arg) in enumerate(list(func['in'].items())[1:]):
                 fn_desc['inputs'].append({
@@ -806,7 +814,8 @@ def export_obj(obj, intf_stack):
                     'access': 'rw',
                 })
                 endpoint_table.append(
-                    '{.type = EndpointType::kFunctionInput, .function_input = {.size = ' + str(legacy_sizes[map_to_fibre01_type(arg.type)]) + '}}'
+                    '{.type = EndpointType::kFunctionInput, .function_input = {.size = ' + str(in_sizes[i])
+                    + ', .trigger_offset = ' + str(len(endpoint_table) - trigger_id) + ', .offset = ' + str(sum(in_sizes[:i])) + '}}'
                 )
             for i, (k_arg, arg) in enumerate(func['out'].items()):
                 fn_desc['outputs'].append({
@@ -816,7 +825,8 @@ def export_obj(obj, intf_stack):
                     'access': 'r',
                 })
                 endpoint_table.append(
-                    '{.type = EndpointType::kFunctionOutput, .function_output = {.size = ' + str(legacy_sizes[map_to_fibre01_type(arg.type)]) + '}}'
+                    '{.type = EndpointType::kFunctionOutput, .function_output = {.size = ' + str(out_sizes[i])
+                    + ', .trigger_offset = ' + str(len(endpoint_table) - trigger_id) + ', .offset = ' + str(sum(out_sizes[:i])) + '}}'
                 )
             endpoint_descr['members'].append(fn_desc)
 